@@ -1,6 +1,5 @@
 #include "source/common/matcher/solo_matcher.h"
 
-#include "source/common/common/logger.h"
 #include "source/common/common/regex.h"
 #include "source/common/router/config_impl.h"
 
@@ -14,42 +13,43 @@ namespace Matcher {
 namespace {
 
 /**
- * Perform a match against any HTTP header or pseudo-header.
+ * Perform a match against any HTTP header or pseudo-header. The constraints
+ * a rule doesn't have are compiled out.
  */
-class BaseMatcherImpl : public Matcher,
-                        public Logger::Loggable<Logger::Id::filter> {
+template <bool HasHeaders, bool HasQueryParameters>
+class BaseMatcherImpl : public Matcher {
 public:
   BaseMatcherImpl(const RouteMatch &match)
-      : case_sensitive_(
-            PROTOBUF_GET_WRAPPED_OR_DEFAULT(match, case_sensitive, true)),
-        config_headers_(
+      : config_headers_(
             Http::HeaderUtility::buildHeaderDataVector(match.headers())) {
     for (const auto &query_parameter : match.query_parameters()) {
       config_query_parameters_.push_back(
           std::make_unique<Router::ConfigUtility::QueryParameterMatcher>(
               query_parameter));
     }
+    ASSERT(HasHeaders == !config_headers_.empty());
+    ASSERT(HasQueryParameters == !config_query_parameters_.empty());
   }
 
   // Check match for HeaderMatcher and QueryParameterMatcher
   bool matchRoute(const Http::RequestHeaderMap &headers) const {
-    bool matches = true;
     // TODO(potatop): matching on RouteMatch runtime is not implemented.
-
-    matches &= Http::HeaderUtility::matchHeaders(headers, config_headers_);
-    if (!config_query_parameters_.empty()) {
+    if constexpr (HasHeaders) {
+      if (!Http::HeaderUtility::matchHeaders(headers, config_headers_)) {
+        return false;
+      }
+    }
+    if constexpr (HasQueryParameters) {
       Http::Utility::QueryParams query_parameters =
-          Http::Utility::parseQueryString(
-              headers.Path()->value().getStringView());
-      matches &= ConfigUtility::matchQueryParams(query_parameters,
-                                                 config_query_parameters_);
+          Http::Utility::parseQueryString(headers.getPathValue());
+      if (!ConfigUtility::matchQueryParams(query_parameters,
+                                          config_query_parameters_)) {
+        return false;
+      }
     }
-    return matches;
+    return true;
   }
 
-protected:
-  const bool case_sensitive_;
-
 private:
   std::vector<Http::HeaderUtility::HeaderDataPtr> config_headers_;
   std::vector<Router::ConfigUtility::QueryParameterMatcherPtr>
@@ -59,22 +59,24 @@ private:
 /**
  * Perform a match against any path with prefix rule.
  */
-class PrefixMatcherImpl : public BaseMatcherImpl {
+template <bool CaseSensitive, bool HasHeaders, bool HasQueryParameters>
+class PrefixMatcherImpl
+    : public BaseMatcherImpl<HasHeaders, HasQueryParameters> {
 public:
   PrefixMatcherImpl(const ::RouteMatch &match)
-      : BaseMatcherImpl(match), prefix_(match.prefix()) {}
+      : BaseMatcherImpl<HasHeaders, HasQueryParameters>(match),
+        prefix_(match.prefix()) {}
 
   bool matches(const Http::RequestHeaderMap &headers) const override {
-    if (BaseMatcherImpl::matchRoute(headers) &&
-        (case_sensitive_
-             ? absl::StartsWith(headers.Path()->value().getStringView(),
-                                prefix_)
-             : absl::StartsWithIgnoreCase(
-                   headers.Path()->value().getStringView(), prefix_))) {
-      ENVOY_LOG(debug, "Prefix requirement '{}' matched.", prefix_);
-      return true;
+    const absl::string_view path = headers.getPathValue();
+    bool match;
+    if constexpr (CaseSensitive) {
+      match = absl::StartsWith(path, prefix_);
+    } else {
+      match = absl::StartsWithIgnoreCase(path, prefix_);
     }
-    return false;
+    // the path is checked first, as it is the cheaper check.
+    return match && this->matchRoute(headers);
   }
 
 private:
@@ -85,26 +87,23 @@ private:
 /**
  * Perform a match against any path with a specific path rule.
  */
-class PathMatcherImpl : public BaseMatcherImpl {
+template <bool CaseSensitive, bool HasHeaders, bool HasQueryParameters>
+class PathMatcherImpl : public BaseMatcherImpl<HasHeaders, HasQueryParameters> {
 public:
   PathMatcherImpl(const ::RouteMatch &match)
-      : BaseMatcherImpl(match), path_(match.path()) {}
+      : BaseMatcherImpl<HasHeaders, HasQueryParameters>(match),
+        path_(match.path()) {}
 
   bool matches(const Http::RequestHeaderMap &headers) const override {
-    if (BaseMatcherImpl::matchRoute(headers)) {
-      const Http::HeaderString &path = headers.Path()->value();
-      const size_t compare_length =
-          path.getStringView().length() -
-          Http::Utility::findQueryStringStart(path).length();
-      auto real_path = path.getStringView().substr(0, compare_length);
-      bool match = case_sensitive_ ? real_path == path_
-                                   : absl::EqualsIgnoreCase(real_path, path_);
-      if (match) {
-        ENVOY_LOG(debug, "Path requirement '{}' matched.", path_);
-        return true;
-      }
+    const absl::string_view path = headers.getPathValue();
+    const absl::string_view real_path = path.substr(0, path.find('?'));
+    bool match;
+    if constexpr (CaseSensitive) {
+      match = real_path == path_;
+    } else {
+      match = absl::EqualsIgnoreCase(real_path, path_);
     }
-    return false;
+    return match && this->matchRoute(headers);
   }
 
 private:
@@ -113,30 +112,24 @@ private:
 };
 
 /**
- * Perform a match against any path with a regex rule.
+ * Perform a match against any path with a regex rule. Case sensitivity is
+ * up to the regex.
  * TODO(mattklein123): This code needs dedup with RegexRouteEntryImpl.
  */
-class RegexMatcherImpl : public BaseMatcherImpl {
+template <bool, bool HasHeaders, bool HasQueryParameters>
+class RegexMatcherImpl
+    : public BaseMatcherImpl<HasHeaders, HasQueryParameters> {
 public:
-  RegexMatcherImpl(const RouteMatch &match) : BaseMatcherImpl(match) {
+  RegexMatcherImpl(const RouteMatch &match)
+      : BaseMatcherImpl<HasHeaders, HasQueryParameters>(match) {
     ASSERT(match.path_specifier_case() == RouteMatch::kSafeRegex);
     regex_ = Regex::Utility::parseRegex(match.safe_regex());
-    regex_str_ = match.safe_regex().regex();
   }
 
   bool matches(const Http::RequestHeaderMap &headers) const override {
-    if (BaseMatcherImpl::matchRoute(headers)) {
-      const Http::HeaderString &path = headers.Path()->value();
-      const absl::string_view query_string =
-          Http::Utility::findQueryStringStart(path);
-      absl::string_view path_view = path.getStringView();
-      path_view.remove_suffix(query_string.length());
-      if (regex_->match(path_view)) {
-        ENVOY_LOG(debug, "Regex requirement '{}' matched.", regex_str_);
-        return true;
-      }
-    }
-    return false;
+    const absl::string_view path = headers.getPathValue();
+    return this->matchRoute(headers) &&
+           regex_->match(path.substr(0, path.find('?')));
   }
 
 private:
@@ -144,8 +137,6 @@ private:
 static Regex::CompiledMatcherPtr parseStdRegexAsCompiledMatcher(const std::string& regex,
                                  std::regex::flag_type flags = std::regex::optimize);
   Regex::CompiledMatcherPtr regex_;
-  // raw regex string, for logging.
-  std::string regex_str_;
 };
 
 class CompiledStdMatcher : public Regex::CompiledMatcher {
@@ -174,16 +165,42 @@ private:
   const std::regex regex_;
 };
 
+// Picks the MatcherImpl specialized for the constraints of match.
+template <template <bool, bool, bool> class MatcherImpl, bool CaseSensitive>
+MatcherConstPtr createSpecialized(const RouteMatch &match) {
+  const bool has_headers = match.headers_size() > 0;
+  const bool has_query_parameters = match.query_parameters_size() > 0;
+  if (has_headers && has_query_parameters) {
+    return std::make_shared<MatcherImpl<CaseSensitive, true, true>>(match);
+  }
+  if (has_headers) {
+    return std::make_shared<MatcherImpl<CaseSensitive, true, false>>(match);
+  }
+  if (has_query_parameters) {
+    return std::make_shared<MatcherImpl<CaseSensitive, false, true>>(match);
+  }
+  return std::make_shared<MatcherImpl<CaseSensitive, false, false>>(match);
+}
+
+template <template <bool, bool, bool> class MatcherImpl>
+MatcherConstPtr createSpecialized(const RouteMatch &match) {
+  if (PROTOBUF_GET_WRAPPED_OR_DEFAULT(match, case_sensitive, true)) {
+    return createSpecialized<MatcherImpl, true>(match);
+  }
+  return createSpecialized<MatcherImpl, false>(match);
+}
+
 } // namespace
 
 MatcherConstPtr Matcher::create(const RouteMatch &match) {
   switch (match.path_specifier_case()) {
   case RouteMatch::PathSpecifierCase::kPrefix:
-    return std::make_shared<PrefixMatcherImpl>(match);
+    return createSpecialized<PrefixMatcherImpl>(match);
   case RouteMatch::PathSpecifierCase::kPath:
-    return std::make_shared<PathMatcherImpl>(match);
+    return createSpecialized<PathMatcherImpl>(match);
   case RouteMatch::PathSpecifierCase::kSafeRegex:
-    return std::make_shared<RegexMatcherImpl>(match);
+    // the regex decides case sensitivity.
+    return createSpecialized<RegexMatcherImpl, true>(match);
   // path specifier is required.
   case RouteMatch::PathSpecifierCase::PATH_SPECIFIER_NOT_SET:
   default:
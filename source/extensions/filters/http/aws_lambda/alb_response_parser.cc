@@ -0,0 +1,489 @@
+#include "source/extensions/filters/http/aws_lambda/alb_response_parser.h"
+
+#include <array>
+
+#include "absl/strings/numbers.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+namespace {
+
+constexpr uint8_t INVALID_SEXTET = 0xff;
+// numbers and the true, false and null literals are short.
+constexpr size_t MAX_LITERAL_SIZE = 64;
+
+const std::array<uint8_t, 256> &base64Table() {
+  static const std::array<uint8_t, 256> table = [] {
+    std::array<uint8_t, 256> table;
+    table.fill(INVALID_SEXTET);
+    const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (uint8_t i = 0; i < 64; i++) {
+      table[static_cast<uint8_t>(alphabet[i])] = i;
+    }
+    return table;
+  }();
+  return table;
+}
+
+bool isWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool isLiteralChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' ||
+         c == '+' || c == '.' || c == 'E';
+}
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+} // namespace
+
+void Base64StreamDecoder::decode(const char *data, size_t length,
+                                 Buffer::Instance &output) {
+  const std::array<uint8_t, 256> &table = base64Table();
+  // decoded in batches, so the buffer isn't appended to byte by byte.
+  char decoded[3 * 1024];
+  size_t decoded_length = 0;
+  for (size_t i = 0; i < length && valid_; i++) {
+    uint32_t sextet = 0;
+    if (ended_) {
+      // nothing can follow the padding.
+      valid_ = false;
+    } else if (data[i] == '=') {
+      valid_ = count_ >= 2;
+      padding_++;
+    } else {
+      sextet = table[static_cast<uint8_t>(data[i])];
+      valid_ = sextet != INVALID_SEXTET && padding_ == 0;
+    }
+    group_ = group_ << 6 | sextet;
+    if (++count_ < 4) {
+      continue;
+    }
+    decoded[decoded_length++] = static_cast<char>(group_ >> 16);
+    if (padding_ < 2) {
+      decoded[decoded_length++] = static_cast<char>(group_ >> 8);
+    }
+    if (padding_ < 1) {
+      decoded[decoded_length++] = static_cast<char>(group_);
+    }
+    ended_ = padding_ > 0;
+    group_ = 0;
+    count_ = 0;
+    if (decoded_length == sizeof(decoded)) {
+      output.add(decoded, decoded_length);
+      decoded_length = 0;
+    }
+  }
+  if (valid_ && decoded_length != 0) {
+    output.add(decoded, decoded_length);
+  }
+}
+
+void AlbResponseParser::parse(const Buffer::Instance &data) {
+  for (const Buffer::RawSlice &slice : data.getRawSlices()) {
+    parseSlice(static_cast<const char *>(slice.mem_), slice.len_);
+  }
+}
+
+bool AlbResponseParser::finish() {
+  valid_ = valid_ && started_ && stack_.empty() && lexer_ == Lexer::Token;
+  if (!valid_) {
+    return false;
+  }
+  if (body_seen_ && base64_) {
+    if (body_raw_) {
+      // isBase64Encoded came after the body.
+      Buffer::OwnedImpl raw;
+      raw.move(body_);
+      for (const Buffer::RawSlice &slice : raw.getRawSlices()) {
+        base64_decoder_.decode(static_cast<const char *>(slice.mem_),
+                               slice.len_, body_);
+      }
+    }
+    // as with Base64::decode, a body that isn't base64 is empty.
+    if (!base64_decoder_.finish()) {
+      body_.drain(body_.length());
+    }
+  }
+  return true;
+}
+
+void AlbResponseParser::parseSlice(const char *data, size_t length) {
+  size_t i = 0;
+  while (i < length && valid_) {
+    const char c = data[i];
+    switch (lexer_) {
+    case Lexer::String:
+      i += parseString(data + i, length - i);
+      break;
+    case Lexer::Escape: {
+      i++;
+      lexer_ = Lexer::String;
+      char unescaped = c;
+      switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        break;
+      case 'b':
+        unescaped = '\b';
+        break;
+      case 'f':
+        unescaped = '\f';
+        break;
+      case 'n':
+        unescaped = '\n';
+        break;
+      case 'r':
+        unescaped = '\r';
+        break;
+      case 't':
+        unescaped = '\t';
+        break;
+      case 'u':
+        lexer_ = Lexer::Unicode;
+        unicode_ = 0;
+        unicode_digits_ = 0;
+        continue;
+      default:
+        valid_ = false;
+        continue;
+      }
+      appendString(&unescaped, 1);
+      break;
+    }
+    case Lexer::Unicode: {
+      i++;
+      const int digit = hexValue(c);
+      if (digit < 0) {
+        valid_ = false;
+        break;
+      }
+      unicode_ = unicode_ << 4 | digit;
+      if (++unicode_digits_ < 4) {
+        break;
+      }
+      lexer_ = Lexer::String;
+      if (high_surrogate_ != 0) {
+        if (unicode_ < 0xdc00 || unicode_ > 0xdfff) {
+          valid_ = false;
+          break;
+        }
+        const uint32_t code_point =
+            0x10000 + ((high_surrogate_ - 0xd800) << 10) + (unicode_ - 0xdc00);
+        high_surrogate_ = 0;
+        appendCodePoint(code_point);
+      } else if (unicode_ >= 0xd800 && unicode_ <= 0xdbff) {
+        high_surrogate_ = unicode_;
+      } else if (unicode_ >= 0xdc00 && unicode_ <= 0xdfff) {
+        valid_ = false;
+      } else {
+        appendCodePoint(unicode_);
+      }
+      break;
+    }
+    case Lexer::Literal:
+      if (isLiteralChar(c)) {
+        literal_ += c;
+        valid_ = literal_.size() <= MAX_LITERAL_SIZE;
+        i++;
+      } else {
+        // c is parsed again, as the token after the literal.
+        endLiteral();
+      }
+      break;
+    case Lexer::Token:
+      i++;
+      parseToken(c);
+      break;
+    }
+  }
+}
+
+size_t AlbResponseParser::parseString(const char *data, size_t length) {
+  // most of a string is plain chars, append them at once.
+  size_t i = 0;
+  while (i < length && data[i] != '"' && data[i] != '\\' &&
+         static_cast<uint8_t>(data[i]) >= 0x20) {
+    i++;
+  }
+  appendString(data, i);
+  if (i == length) {
+    return i;
+  }
+  if (data[i] == '"') {
+    endString();
+  } else if (data[i] == '\\') {
+    lexer_ = Lexer::Escape;
+  } else {
+    // control chars must be escaped.
+    valid_ = false;
+  }
+  return i + 1;
+}
+
+void AlbResponseParser::parseToken(char c) {
+  if (isWhitespace(c)) {
+    return;
+  }
+  if (!started_) {
+    started_ = true;
+    value_role_ = Role::Root;
+    startValue(c);
+    return;
+  }
+  if (stack_.empty()) {
+    // nothing can follow the response.
+    valid_ = false;
+    return;
+  }
+
+  Frame &frame = stack_.back();
+  switch (frame.expect) {
+  case Expect::KeyOrEnd:
+    if (c == '}') {
+      stack_.pop_back();
+    } else if (c == '"') {
+      lexer_ = Lexer::String;
+      string_target_ = StringTarget::Key;
+      string_.clear();
+    } else {
+      valid_ = false;
+    }
+    break;
+  case Expect::Colon:
+    valid_ = c == ':';
+    frame.expect = Expect::Value;
+    break;
+  case Expect::ValueOrEnd:
+    if (c == ']') {
+      stack_.pop_back();
+      break;
+    }
+    value_role_ =
+        frame.role == Role::MultiValueHeaderList ? Role::HeaderValue
+                                                 : Role::Skip;
+    frame.expect = Expect::CommaOrEnd;
+    startValue(c);
+    break;
+  case Expect::Value:
+    frame.expect = Expect::CommaOrEnd;
+    startValue(c);
+    break;
+  case Expect::CommaOrEnd:
+    // trailing commas are accepted, as the protobuf json parser does.
+    if (c == ',') {
+      frame.expect = frame.object ? Expect::KeyOrEnd : Expect::ValueOrEnd;
+    } else if (c == (frame.object ? '}' : ']')) {
+      stack_.pop_back();
+    } else {
+      valid_ = false;
+    }
+    break;
+  }
+}
+
+void AlbResponseParser::startValue(char c) {
+  const Role role = value_role_;
+  const bool scalar = role == Role::StatusCode || role == Role::Base64Flag;
+  switch (c) {
+  case '{':
+    valid_ = !scalar;
+    if (role == Role::HeaderValue) {
+      headers_.emplace_back(header_name_, "");
+    }
+    stack_.push_back({true,
+                      role == Role::Root || role == Role::Headers ||
+                              role == Role::MultiValueHeaders
+                          ? role
+                          : Role::Skip,
+                      Expect::KeyOrEnd});
+    break;
+  case '[':
+    valid_ = !scalar && role != Role::Root;
+    if (role == Role::HeaderValue) {
+      headers_.emplace_back(header_name_, "");
+    }
+    stack_.push_back(
+        {false, role == Role::MultiValueHeaderList ? role : Role::Skip,
+         Expect::ValueOrEnd});
+    break;
+  case '"':
+    valid_ = !scalar && role != Role::Root;
+    lexer_ = Lexer::String;
+    string_target_ = StringTarget::Discard;
+    if (role == Role::HeaderValue) {
+      string_target_ = StringTarget::Value;
+      string_.clear();
+    } else if (role == Role::Body) {
+      string_target_ = StringTarget::Body;
+      // the last body wins, as it would in a json document.
+      body_.drain(body_.length());
+      base64_decoder_ = Base64StreamDecoder();
+      body_raw_ = !base64_;
+      body_seen_ = true;
+    }
+    break;
+  default:
+    valid_ = role != Role::Root && isLiteralChar(c);
+    lexer_ = Lexer::Literal;
+    literal_.assign(1, c);
+    break;
+  }
+}
+
+void AlbResponseParser::endString() {
+  lexer_ = Lexer::Token;
+  if (high_surrogate_ != 0) {
+    valid_ = false;
+    return;
+  }
+  switch (string_target_) {
+  case StringTarget::Key: {
+    Frame &frame = stack_.back();
+    frame.expect = Expect::Colon;
+    switch (frame.role) {
+    case Role::Root:
+      if (string_ == "body") {
+        value_role_ = Role::Body;
+      } else if (string_ == "isBase64Encoded") {
+        value_role_ = Role::Base64Flag;
+      } else if (string_ == "statusCode") {
+        value_role_ = Role::StatusCode;
+      } else if (string_ == "headers") {
+        value_role_ = Role::Headers;
+      } else if (string_ == "multiValueHeaders") {
+        value_role_ = Role::MultiValueHeaders;
+      } else {
+        value_role_ = Role::Skip;
+      }
+      break;
+    case Role::Headers:
+      value_role_ = Role::HeaderValue;
+      header_name_ = std::move(string_);
+      break;
+    case Role::MultiValueHeaders:
+      value_role_ = Role::MultiValueHeaderList;
+      header_name_ = std::move(string_);
+      break;
+    default:
+      value_role_ = Role::Skip;
+      break;
+    }
+    break;
+  }
+  case StringTarget::Value:
+    headers_.emplace_back(header_name_, std::move(string_));
+    break;
+  case StringTarget::Body:
+  case StringTarget::Discard:
+    break;
+  }
+  string_.clear();
+}
+
+void AlbResponseParser::endLiteral() {
+  lexer_ = Lexer::Token;
+  const bool is_true = literal_ == "true";
+  const bool is_false = literal_ == "false";
+  double number = 0;
+  const bool is_number =
+      (literal_[0] == '-' || (literal_[0] >= '0' && literal_[0] <= '9')) &&
+      absl::SimpleAtod(literal_, &number);
+  if (!is_true && !is_false && !is_number && literal_ != "null") {
+    valid_ = false;
+    return;
+  }
+  switch (value_role_) {
+  case Role::StatusCode:
+    // range check before the cast, a double out of range doesn't convert.
+    valid_ = is_number && number >= 100 && number <= 599 &&
+             number == static_cast<uint64_t>(number);
+    if (valid_) {
+      status_code_ = static_cast<uint64_t>(number);
+    }
+    break;
+  case Role::Base64Flag:
+    valid_ = is_true || is_false;
+    base64_ = is_true;
+    break;
+  case Role::HeaderValue:
+    // headers that aren't strings are empty.
+    headers_.emplace_back(header_name_, "");
+    break;
+  default:
+    break;
+  }
+}
+
+void AlbResponseParser::appendString(const char *data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  if (high_surrogate_ != 0) {
+    // a high surrogate must be followed by a low one.
+    valid_ = false;
+    return;
+  }
+  switch (string_target_) {
+  case StringTarget::Key:
+  case StringTarget::Value:
+    string_.append(data, length);
+    break;
+  case StringTarget::Body:
+    if (base64_) {
+      base64_decoder_.decode(data, length, body_);
+    } else {
+      body_.add(data, length);
+    }
+    break;
+  case StringTarget::Discard:
+    break;
+  }
+}
+
+void AlbResponseParser::appendCodePoint(uint32_t code_point) {
+  char utf8[4];
+  size_t length;
+  if (code_point < 0x80) {
+    utf8[0] = static_cast<char>(code_point);
+    length = 1;
+  } else if (code_point < 0x800) {
+    utf8[0] = static_cast<char>(0xc0 | code_point >> 6);
+    utf8[1] = static_cast<char>(0x80 | (code_point & 0x3f));
+    length = 2;
+  } else if (code_point < 0x10000) {
+    utf8[0] = static_cast<char>(0xe0 | code_point >> 12);
+    utf8[1] = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+    utf8[2] = static_cast<char>(0x80 | (code_point & 0x3f));
+    length = 3;
+  } else {
+    utf8[0] = static_cast<char>(0xf0 | code_point >> 18);
+    utf8[1] = static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+    utf8[2] = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+    utf8[3] = static_cast<char>(0x80 | (code_point & 0x3f));
+    length = 4;
+  }
+  appendString(utf8, length);
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "envoy/buffer/buffer.h"
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+/**
+ * Decodes base64 as it arrives, so that encoded bodies don't have to be
+ * decoded in one piece. Like Base64::decode, it expects padded input.
+ */
+class Base64StreamDecoder {
+public:
+  void decode(const char *data, size_t length, Buffer::Instance &output);
+  // whether all the input was valid and complete base64.
+  bool finish() const { return valid_ && count_ == 0; }
+
+private:
+  uint32_t group_{};
+  uint32_t count_{};
+  uint32_t padding_{};
+  bool ended_{};
+  bool valid_{true};
+};
+
+/**
+ * Parses a Lambda response in the ALB format as it is received, without
+ * building a json document of it. The body field is unescaped, and base64
+ * decoded if needed, straight into body(), which is the only copy of it.
+ *
+ * see:
+ * https://docs.aws.amazon.com/elasticloadbalancing/latest/application/lambda-functions.html#respond-to-load-balancer
+ */
+class AlbResponseParser {
+public:
+  AlbResponseParser() { stack_.reserve(8); }
+
+  // parses the next part of the response.
+  void parse(const Buffer::Instance &data);
+  // whether the response was complete, valid json with the expected types.
+  bool finish();
+  // the fields of the response, once finish() succeeded.
+  const absl::optional<uint64_t> &statusCode() const { return status_code_; }
+  const std::vector<std::pair<std::string, std::string>> &headers() const {
+    return headers_;
+  }
+  Buffer::Instance &body() { return body_; }
+
+private:
+  // what a json value is to the response.
+  enum class Role : uint8_t {
+    Root,
+    Skip,
+    Body,
+    Base64Flag,
+    StatusCode,
+    Headers,
+    HeaderValue,
+    MultiValueHeaders,
+    MultiValueHeaderList,
+  };
+  enum class Expect : uint8_t { KeyOrEnd, Colon, Value, ValueOrEnd, CommaOrEnd };
+  struct Frame {
+    bool object;
+    Role role;
+    Expect expect;
+  };
+  enum class Lexer : uint8_t { Token, String, Escape, Unicode, Literal };
+  enum class StringTarget : uint8_t { Key, Value, Body, Discard };
+
+  void parseSlice(const char *data, size_t length);
+  // returns how many chars of the string it consumed.
+  size_t parseString(const char *data, size_t length);
+  void parseToken(char c);
+  void startValue(char c);
+  void endString();
+  void endLiteral();
+  void appendString(const char *data, size_t length);
+  void appendCodePoint(uint32_t code_point);
+
+  std::vector<Frame> stack_;
+  Lexer lexer_{Lexer::Token};
+  StringTarget string_target_{};
+  Role value_role_{Role::Root};
+  bool started_{};
+  bool valid_{true};
+
+  std::string string_;
+  std::string header_name_;
+  std::string literal_;
+  uint32_t unicode_{};
+  uint32_t unicode_digits_{};
+  uint32_t high_surrogate_{};
+
+  bool base64_{};
+  // whether the body was stored before knowing it's base64.
+  bool body_raw_{};
+  bool body_seen_{};
+  Base64StreamDecoder base64_decoder_;
+
+  absl::optional<uint64_t> status_code_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  Buffer::OwnedImpl body_;
+};
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,19 +1,19 @@
 #include "source/extensions/filters/http/aws_lambda/aws_authenticator.h"
 
 #include <algorithm>
-#include <list>
 #include <string>
 
 #include "envoy/http/header_map.h"
 
 #include "source/common/common/assert.h"
 #include "source/common/common/empty_string.h"
-#include "source/common/common/hex.h"
 #include "source/common/common/utility.h"
 #include "source/common/http/headers.h"
 #include "source/common/http/utility.h"
 #include "source/common/singleton/const_singleton.h"
 
+#include "absl/strings/str_cat.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace HttpFilters {
@@ -37,96 +37,83 @@ AwsAuthenticator::AwsAuthenticator(TimeSource &time_source,
 
 void AwsAuthenticator::init(const std::string *access_key,
                             const std::string *secret_key,
-                            const std::string *session_token) {
+                            const std::string *session_token,
+                            SigningCaches *caches) {
   access_key_ = access_key;
   session_token_ = session_token;
-  const std::string &secret_key_ref = *secret_key;
-  first_key_ = "AWS4" + secret_key_ref;
+  secret_key_ = secret_key;
+  caches_ = caches;
 }
 
 AwsAuthenticator::~AwsAuthenticator() {}
 
+HeaderList::HeaderList(std::vector<Http::LowerCaseString> headers)
+    : headers_(std::move(headers)) {
+  // sorted, as required by AWS signature algorithm.
+  std::sort(headers_.begin(), headers_.end(),
+            [](const Http::LowerCaseString &i, const Http::LowerCaseString &j) {
+              return i.get() < j.get();
+            });
+  headers_.erase(std::unique(headers_.begin(), headers_.end()),
+                 headers_.end());
+  for (const auto &header : headers_) {
+    if (!signed_headers_.empty()) {
+      signed_headers_ += ';';
+    }
+    signed_headers_ += header.get();
+  }
+}
+
 HeaderList AwsAuthenticator::createHeaderToSign(
     std::initializer_list<Http::LowerCaseString> headers) {
-  // A C++ set is sorted. which is required by AWS signature algorithm.
-  HeaderList ret(AwsAuthenticator::lowercasecompare);
-  ret.insert(headers);
-  ret.insert(AwsAuthenticatorConsts::get().DateHeader);
-  return ret;
+  std::vector<Http::LowerCaseString> all(headers);
+  all.push_back(AwsAuthenticatorConsts::get().DateHeader);
+  return HeaderList(std::move(all));
 }
 
 void AwsAuthenticator::updatePayloadHash(const Buffer::Instance &data) {
   body_sha_.update(data);
 }
 
-bool AwsAuthenticator::lowercasecompare(const Http::LowerCaseString &i,
-                                        const Http::LowerCaseString &j) {
-  return (i.get() < j.get());
-}
-
-std::string AwsAuthenticator::addDate(
-    std::chrono::time_point<std::chrono::system_clock> now) {
-  // TODO(yuval-k): This can be cached or optimized if needed
-  std::string request_date_time = DateFormatter("%Y%m%dT%H%M%SZ").fromTime(now);
+void AwsAuthenticator::addDate(const std::string &request_date_time) {
   request_headers_->addReferenceKey(AwsAuthenticatorConsts::get().DateHeader,
                                     request_date_time);
-  return request_date_time;
 }
 
-std::pair<std::string, std::string>
-AwsAuthenticator::prepareHeaders(const HeaderList &headers_to_sign) {
-  std::stringstream canonical_headers_stream;
-  std::stringstream signed_headers_stream;
-
-  for (auto header = headers_to_sign.begin(), end = headers_to_sign.end();
-       header != end; header++) {
-
+bool AwsAuthenticator::findHeaders(const HeaderList &headers_to_sign,
+                                   HeaderEntries &entries) {
+  bool found_all = true;
+  for (const auto &header : headers_to_sign.headers()) {
     const Http::HeaderEntry *headerEntry{};
-    if (*header == AwsAuthenticatorConsts::get().Host) {
+    if (header == AwsAuthenticatorConsts::get().Host) {
       headerEntry = request_headers_->Host();
     } else {
-      const auto getter = request_headers_->get(*header);
+      const auto getter = request_headers_->get(header);
       if (!getter.empty()) {
         headerEntry = getter[0];
       }
-      
-    }
-
-    // Should not happen, need to check now that envoy does not default header entries
-    if (headerEntry == nullptr) {
-      continue;
     }
 
-    auto headerName = header->get();
-    canonical_headers_stream << headerName;
-    signed_headers_stream << headerName;
-
-    canonical_headers_stream << ':';
-    if (headerEntry != nullptr) {
-      canonical_headers_stream << headerEntry->value().getStringView();
-      // TODO: add warning if null
-    }
-    canonical_headers_stream << '\n';
-    HeaderList::const_iterator next = header;
-    next++;
-    if (next != end) {
-      signed_headers_stream << ";";
-    }
+    // Should not happen, need to check now that envoy does not default header
+    // entries
+    found_all = found_all && headerEntry != nullptr;
+    entries.push_back(headerEntry);
   }
-  std::string canonical_headers = canonical_headers_stream.str();
-  std::string signed_headers = signed_headers_stream.str();
-
-  std::pair<std::string, std::string> pair =
-      std::make_pair(std::move(canonical_headers), std::move(signed_headers));
-  return pair;
+  return found_all;
 }
 
-std::string AwsAuthenticator::getBodyHexSha() {
+void AwsAuthenticator::hexEncode(const uint8_t *bytes, HexSha256 &out) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+    out[2 * i] = hex[bytes[i] >> 4];
+    out[2 * i + 1] = hex[bytes[i] & 0xf];
+  }
+}
 
+void AwsAuthenticator::getBodyHexSha(HexSha256 &out) {
   uint8_t payload_out[SHA256_DIGEST_LENGTH];
   body_sha_.finalize(payload_out);
-  std::string hexpayload = Hex::encode(payload_out, SHA256_DIGEST_LENGTH);
-  return hexpayload;
+  hexEncode(payload_out, out);
 }
 
 void AwsAuthenticator::fetchUrl() {
@@ -140,9 +127,10 @@ void AwsAuthenticator::fetchUrl() {
   }
 }
 
-std::string AwsAuthenticator::computeCanonicalRequestHash(
-    const std::string &request_method, const std::string &canonical_headers,
-    const std::string &signed_headers, const std::string &hexpayload) {
+void AwsAuthenticator::computeCanonicalRequestHash(
+    const std::string &request_method, const HeaderList &headers_to_sign,
+    const HeaderEntries &entries, absl::string_view signed_headers,
+    absl::string_view hexpayload, HexSha256 &out) {
 
   // Do iternal classes for sha and hmac.
   Sha256 canonicalRequestHash;
@@ -155,7 +143,15 @@ std::string AwsAuthenticator::computeCanonicalRequestHash(
     canonicalRequestHash.update(query_string_);
   }
   canonicalRequestHash.update('\n');
-  canonicalRequestHash.update(canonical_headers);
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i] == nullptr) {
+      continue;
+    }
+    canonicalRequestHash.update(headers_to_sign.headers()[i].get());
+    canonicalRequestHash.update(':');
+    canonicalRequestHash.update(entries[i]->value().getStringView());
+    canonicalRequestHash.update('\n');
+  }
   canonicalRequestHash.update('\n');
   canonicalRequestHash.update(signed_headers);
   canonicalRequestHash.update('\n');
@@ -164,108 +160,167 @@ std::string AwsAuthenticator::computeCanonicalRequestHash(
   uint8_t cononicalRequestHashOut[SHA256_DIGEST_LENGTH];
 
   canonicalRequestHash.finalize(cononicalRequestHashOut);
-  return Hex::encode(cononicalRequestHashOut, SHA256_DIGEST_LENGTH);
+  hexEncode(cononicalRequestHashOut, out);
 }
 
-std::string AwsAuthenticator::getCredntialScopeDate(
-    std::chrono::time_point<std::chrono::system_clock> now) {
+void AwsAuthenticator::deriveSigningKey(
+    const std::string &region, const std::string &credentials_scope_date,
+    SigningKeyCache::SigningKey &signing_key) {
+  static const std::string aws_request = "aws4_request";
 
-  std::string credentials_scope_date = DateFormatter("%Y%m%d").fromTime(now);
-  return credentials_scope_date;
-}
+  HMACSha256 sighmac;
+  unsigned int out_len = sighmac.length();
+  ASSERT(out_len == signing_key.size());
+  uint8_t *out = signing_key.data();
 
-std::string
-AwsAuthenticator::getCredntialScope(const std::string &region,
-                                    const std::string &credentials_scope_date) {
+  // only built when there is no cached key to use.
+  sighmac.init(absl::StrCat("AWS4", *secret_key_));
+  sighmac.update(credentials_scope_date);
+  sighmac.finalize(out, &out_len);
 
-  std::stringstream credential_scope_stream;
-  credential_scope_stream << credentials_scope_date << "/" << region << "/"
-                          << (*service_) << "/aws4_request";
-  return credential_scope_stream.str();
+  recusiveHmacHelper(sighmac, out, out_len, region);
+  recusiveHmacHelper(sighmac, out, out_len, *service_);
+  recusiveHmacHelper(sighmac, out, out_len, aws_request);
 }
 
-std::string AwsAuthenticator::computeSignature(
+void AwsAuthenticator::computeSignature(
     const std::string &region, const std::string &credentials_scope_date,
     const std::string &credential_scope, const std::string &request_date_time,
-    const std::string &hashed_canonical_request) {
-  static const std::string aws_request = "aws4_request";
+    const HexSha256 &hashed_canonical_request, HexSha256 &out) {
+  // the signing key only changes daily, or when the credentials do.
+  const SigningKeyCache::SigningKey *signing_key = nullptr;
+  if (caches_ != nullptr) {
+    signing_key = caches_->keys_.find(*access_key_, *secret_key_,
+                                      credentials_scope_date, region,
+                                      *service_);
+  }
+  SigningKeyCache::SigningKey derived_key;
+  if (signing_key == nullptr) {
+    deriveSigningKey(region, credentials_scope_date, derived_key);
+    if (caches_ != nullptr) {
+      caches_->keys_.insert(*access_key_, *secret_key_, credentials_scope_date,
+                            region, *service_, derived_key);
+    }
+    signing_key = &derived_key;
+  }
 
   HMACSha256 sighmac;
   unsigned int out_len = sighmac.length();
-  absl::FixedArray<uint8_t> out(out_len);
-
-  sighmac.init(first_key_);
-  sighmac.update(credentials_scope_date);
-  sighmac.finalize(out.begin(), &out_len);
-
-  recusiveHmacHelper(sighmac, out.begin(), out_len, region);
-  recusiveHmacHelper(sighmac, out.begin(), out_len, *service_);
-  recusiveHmacHelper(sighmac, out.begin(), out_len, aws_request);
+  std::array<uint8_t, SHA256_DIGEST_LENGTH> signature;
+  ASSERT(out_len == signature.size());
   const auto &nl = AwsAuthenticatorConsts::get().Newline;
 
-  recusiveHmacHelper<std::initializer_list<const std::string *>>(
-      sighmac, out.begin(), out_len,
-      {&AwsAuthenticatorConsts::get().Algorithm, &nl, &request_date_time, &nl,
-       &credential_scope, &nl, &hashed_canonical_request});
+  sighmac.init(signing_key->data(), signing_key->size());
+  sighmac.update({AwsAuthenticatorConsts::get().Algorithm, nl,
+                  request_date_time, nl, credential_scope, nl,
+                  view(hashed_canonical_request)});
+  sighmac.finalize(signature.data(), &out_len);
 
-  return Hex::encode(out.begin(), out_len);
+  hexEncode(signature.data(), out);
 }
 
 void AwsAuthenticator::sign(Http::RequestHeaderMap *request_headers,
                             const HeaderList &headers_to_sign,
                             const std::string &region) {
 
-  // we can't use the date provider interface as this is not the date header,
-  // plus the date format is different. use slow method now, optimize in the
-  // future.
+  // the date header and its format differ from those of the date provider,
+  // so the dates are cached in caches_ instead.
   auto now = time_source_.systemTime();
 
   std::string sig = signWithTime(request_headers, headers_to_sign, region, now);
   request_headers->setInline(authorization_handle.handle(), sig);
 }
 
+void AwsAuthenticator::signUnsignedPayload(
+    Http::RequestHeaderMap *request_headers, const HeaderList &headers_to_sign,
+    const std::string &region) {
+  auto now = time_source_.systemTime();
+
+  std::string sig =
+      signWithTime(request_headers, headers_to_sign, region, now, true);
+  request_headers->setInline(authorization_handle.handle(), sig);
+}
+
 std::string AwsAuthenticator::signWithTime(
     Http::RequestHeaderMap *request_headers, const HeaderList &headers_to_sign,
     const std::string &region,
-    std::chrono::time_point<std::chrono::system_clock> now) {
+    std::chrono::time_point<std::chrono::system_clock> now,
+    bool unsigned_payload) {
   request_headers_ = request_headers;
 
-  std::string request_date_time = addDate(now);
+  SigningDateCache local_dates;
+  SigningDateCache &dates =
+      caches_ != nullptr ? caches_->dates_ : local_dates;
+  dates.update(now);
+  const std::string &request_date_time = dates.requestDateTime();
+  addDate(request_date_time);
 
   // Add session token header if present
   if (session_token_ != nullptr) {
     request_headers->addCopy(AwsAuthenticatorConsts::get().SecurityTokenHeader,
                              (*session_token_));
   }
+  if (unsigned_payload) {
+    request_headers->setReference(
+        AwsAuthenticatorConsts::get().ContentSha256Header,
+        AwsAuthenticatorConsts::get().UnsignedPayload);
+  }
 
-  auto &&preparedHeaders = prepareHeaders(headers_to_sign);
-  std::string canonical_headers = std::move(preparedHeaders.first);
-  std::string signed_headers = std::move(preparedHeaders.second);
+  // the canonical request is hashed as it is written, so it's never built.
+  HeaderEntries entries;
+  std::string missing_signed_headers;
+  absl::string_view signed_headers = headers_to_sign.signedHeaders();
+  if (!findHeaders(headers_to_sign, entries)) {
+    // only the headers the request has are signed.
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i] != nullptr) {
+        if (!missing_signed_headers.empty()) {
+          missing_signed_headers += ';';
+        }
+        missing_signed_headers += headers_to_sign.headers()[i].get();
+      }
+    }
+    signed_headers = missing_signed_headers;
+  }
 
-  std::string hexpayload = getBodyHexSha();
+  HexSha256 body_sha;
+  absl::string_view hexpayload = AwsAuthenticatorConsts::get().UnsignedPayload;
+  if (!unsigned_payload) {
+    getBodyHexSha(body_sha);
+    hexpayload = view(body_sha);
+  }
 
   fetchUrl();
 
-  std::string hashed_canonical_request = computeCanonicalRequestHash(
-      *method_, canonical_headers, signed_headers, hexpayload);
-  std::string credentials_scope_date = getCredntialScopeDate(now);
-  std::string CredentialScope =
-      getCredntialScope(region, credentials_scope_date);
-
-  std::string signature =
-      computeSignature(region, credentials_scope_date, CredentialScope,
-                       request_date_time, hashed_canonical_request);
-
-  std::stringstream authorizationvalue;
+  HexSha256 hashed_canonical_request;
+  computeCanonicalRequestHash(*method_, headers_to_sign, entries,
+                              signed_headers, hexpayload,
+                              hashed_canonical_request);
+  const std::string &credentials_scope_date = dates.scopeDate();
+  const std::string &CredentialScope =
+      dates.credentialScope(region, *service_);
 
   // TODO(talnordan): Provide `DETAILS`.
   RELEASE_ASSERT(access_key_, "");
 
-  authorizationvalue << AwsAuthenticatorConsts::get().Algorithm
-                     << " Credential=" << (*access_key_) << "/"
-                     << CredentialScope << ", SignedHeaders=" << signed_headers
-                     << ", Signature=" << signature;
-  return authorizationvalue.str();
+  HexSha256 signature;
+  computeSignature(region, credentials_scope_date, CredentialScope,
+                   request_date_time, hashed_canonical_request, signature);
+
+  static const absl::string_view credential = " Credential=";
+  static const absl::string_view signed_headers_key = ", SignedHeaders=";
+  static const absl::string_view signature_key = ", Signature=";
+  const std::string &algorithm = AwsAuthenticatorConsts::get().Algorithm;
+
+  std::string authorizationvalue;
+  authorizationvalue.reserve(
+      algorithm.size() + credential.size() + access_key_->size() + 1 +
+      CredentialScope.size() + signed_headers_key.size() +
+      signed_headers.size() + signature_key.size() + signature.size());
+  absl::StrAppend(&authorizationvalue, algorithm, credential, *access_key_,
+                  "/", CredentialScope, signed_headers_key, signed_headers,
+                  signature_key, view(signature));
+  return authorizationvalue;
 }
 
 AwsAuthenticator::Sha256::Sha256() { SHA256_Init(&context_); }
@@ -317,14 +372,14 @@ void AwsAuthenticator::HMACSha256::init(const uint8_t *bytes, size_t size) {
   firstinit = false;
 }
 
-void AwsAuthenticator::HMACSha256::update(const std::string &data) {
-  update(reinterpret_cast<const uint8_t *>(data.c_str()), data.size());
+void AwsAuthenticator::HMACSha256::update(absl::string_view data) {
+  update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
 }
 
 void AwsAuthenticator::HMACSha256::update(
-    std::initializer_list<const std::string *> strings) {
-  for (auto &&str : strings) {
-    update(*str);
+    std::initializer_list<absl::string_view> strings) {
+  for (absl::string_view str : strings) {
+    update(str);
   }
 }
 
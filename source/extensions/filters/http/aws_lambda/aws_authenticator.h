@@ -1,13 +1,19 @@
 #pragma once
-#include <set>
+#include <array>
 #include <string>
+#include <vector>
 
 #include "envoy/buffer/buffer.h"
 #include "envoy/common/time.h"
 #include "envoy/http/header_map.h"
+#include "envoy/thread_local/thread_local.h"
 
 #include "source/common/singleton/const_singleton.h"
+#include "source/extensions/filters/http/aws_lambda/signing_date_cache.h"
+#include "source/extensions/filters/http/aws_lambda/signing_key_cache.h"
 
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
 #include "openssl/digest.h"
 #include "openssl/hmac.h"
 #include "openssl/sha.h"
@@ -23,16 +29,41 @@ public:
   const std::string Service{"lambda"};
   const std::string Newline{"\n"};
   const Http::LowerCaseString DateHeader{"x-amz-date"};
+  const Http::LowerCaseString ContentSha256Header{"x-amz-content-sha256"};
+  const std::string UnsignedPayload{"UNSIGNED-PAYLOAD"};
   const Http::LowerCaseString SecurityTokenHeader{"x-amz-security-token"};
   const Http::LowerCaseString Host{"host"};
 };
 
 typedef ConstSingleton<AwsAuthenticatorValues> AwsAuthenticatorConsts;
 
-typedef bool (*LowerCaseStringCompareFunc)(const Http::LowerCaseString &,
-                                           const Http::LowerCaseString &);
+/**
+ * The headers to sign, sorted as the AWS signature algorithm requires. The
+ * signed headers value is computed once, for the requests that have all the
+ * headers.
+ */
+class HeaderList {
+public:
+  explicit HeaderList(std::vector<Http::LowerCaseString> headers);
+
+  const std::vector<Http::LowerCaseString> &headers() const {
+    return headers_;
+  }
+  // the header names joined by ';'.
+  const std::string &signedHeaders() const { return signed_headers_; }
 
-typedef std::set<Http::LowerCaseString, LowerCaseStringCompareFunc> HeaderList;
+private:
+  std::vector<Http::LowerCaseString> headers_;
+  std::string signed_headers_;
+};
+
+/**
+ * What signatures reuse from one another. There is one per worker.
+ */
+struct SigningCaches : public ThreadLocal::ThreadLocalObject {
+  SigningKeyCache keys_;
+  SigningDateCache dates_;
+};
 
 class AwsAuthenticator {
 public:
@@ -41,14 +72,25 @@ public:
 
   ~AwsAuthenticator();
 
+  // caches, if set, keeps the signing keys and the formatted dates from one
+  // signature to the next.
   void init(const std::string *access_key, const std::string *secret_key,
-            const std::string *session_token);
+            const std::string *session_token,
+            SigningCaches *caches = nullptr);
 
   void updatePayloadHash(const Buffer::Instance &data);
 
   void sign(Http::RequestHeaderMap *request_headers,
             const HeaderList &headers_to_sign, const std::string &region);
 
+  /**
+   * Signs the request without its body, which can then be sent as it comes.
+   * headers_to_sign should include the x-amz-content-sha256 header.
+   */
+  void signUnsignedPayload(Http::RequestHeaderMap *request_headers,
+                           const HeaderList &headers_to_sign,
+                           const std::string &region);
+
   /**
    * This creates a a list of headers to sign to be used by sign.
    */
@@ -61,31 +103,41 @@ private:
 
   std::string signWithTime(Http::RequestHeaderMap *request_headers,
                            const HeaderList &headers_to_sign,
-                           const std::string &region, SystemTime now);
+                           const std::string &region, SystemTime now,
+                           bool unsigned_payload = false);
 
-  std::string addDate(SystemTime now);
+  // a hex encoded sha256, kept on the stack.
+  using HexSha256 = std::array<char, 2 * SHA256_DIGEST_LENGTH>;
+  static absl::string_view view(const HexSha256 &hex) {
+    return {hex.data(), hex.size()};
+  }
+  static void hexEncode(const uint8_t *bytes, HexSha256 &out);
+
+  void addDate(const std::string &request_date_time);
 
-  std::pair<std::string, std::string>
-  prepareHeaders(const HeaderList &headers_to_sign);
+  // the values of the headers to sign, nullptr for the ones the request
+  // doesn't have. returns whether the request has all of them.
+  using HeaderEntries = absl::InlinedVector<const Http::HeaderEntry *, 8>;
+  bool findHeaders(const HeaderList &headers_to_sign, HeaderEntries &entries);
 
-  std::string getBodyHexSha();
+  void getBodyHexSha(HexSha256 &out);
   void fetchUrl();
-  std::string computeCanonicalRequestHash(const std::string &request_method,
-                                          const std::string &canonical_Headers,
-                                          const std::string &signed_headers,
-                                          const std::string &hexpayload);
-  std::string getCredntialScopeDate(SystemTime now);
-  std::string getCredntialScope(const std::string &region,
-                                const std::string &datenow);
-
-  std::string computeSignature(const std::string &region,
-                               const std::string &credential_scope_date,
-                               const std::string &credential_scope,
-                               const std::string &request_date_time,
-                               const std::string &hashed_canonical_request);
-
-  static bool lowercasecompare(const Http::LowerCaseString &i,
-                               const Http::LowerCaseString &j);
+  // hashes the canonical request as it is written, without building it.
+  void computeCanonicalRequestHash(const std::string &request_method,
+                                   const HeaderList &headers_to_sign,
+                                   const HeaderEntries &entries,
+                                   absl::string_view signed_headers,
+                                   absl::string_view hexpayload,
+                                   HexSha256 &out);
+  void deriveSigningKey(const std::string &region,
+                        const std::string &credential_scope_date,
+                        SigningKeyCache::SigningKey &signing_key);
+  void computeSignature(const std::string &region,
+                        const std::string &credential_scope_date,
+                        const std::string &credential_scope,
+                        const std::string &request_date_time,
+                        const HexSha256 &hashed_canonical_request,
+                        HexSha256 &out);
 
   class Sha256 {
   public:
@@ -111,8 +163,8 @@ private:
     size_t length() const;
     void init(const std::string &data);
     void init(const uint8_t *bytes, size_t size);
-    void update(const std::string &data);
-    void update(std::initializer_list<const std::string *> strings);
+    void update(absl::string_view data);
+    void update(std::initializer_list<absl::string_view> strings);
     void update(const uint8_t *bytes, size_t size);
     void finalize(uint8_t *out, unsigned int *out_len);
 
@@ -134,8 +186,9 @@ private:
 
   TimeSource &time_source_;
   const std::string *access_key_{};
+  const std::string *secret_key_{};
   const std::string *session_token_{};
-  std::string first_key_;
+  SigningCaches *caches_{};
   const std::string *service_{};
   const std::string *method_{};
   absl::string_view query_string_{};
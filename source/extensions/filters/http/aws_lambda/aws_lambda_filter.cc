@@ -6,7 +6,6 @@
 #include <vector>
 
 #include "envoy/http/header_map.h"
-#include "source/common/common/base64.h"
 
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/empty_string.h"
@@ -32,6 +31,7 @@ struct RcDetailsValues {
   const std::string CredentialsNotFound = "aws_lambda_credentials_not_found";
   const std::string CredentialsNotFoundBody =
       "no credentials present for AWS upstream";
+  const std::string AlbResponseTooLarge = "aws_lambda_alb_response_too_large";
 };
 typedef ConstSingleton<RcDetailsValues> RcDetails;
 } // namespace
@@ -55,6 +55,13 @@ const HeaderList AWSLambdaFilter::HeadersToSign =
          AWSLambdaHeaderNames::get().LogType, Http::Headers::get().HostLegacy,
          Http::Headers::get().ContentType});
 
+const HeaderList AWSLambdaFilter::UnsignedPayloadHeadersToSign =
+    AwsAuthenticator::createHeaderToSign(
+        {AWSLambdaHeaderNames::get().InvocationType,
+         AWSLambdaHeaderNames::get().LogType, Http::Headers::get().HostLegacy,
+         Http::Headers::get().ContentType,
+         AwsAuthenticatorConsts::get().ContentSha256Header});
+
 AWSLambdaFilter::AWSLambdaFilter(Upstream::ClusterManager &cluster_manager,
                                  Api::Api &api,
                                  AWSLambdaConfigConstSharedPtr filter_config)
@@ -92,6 +99,12 @@ AWSLambdaFilter::decodeHeaders(Http::RequestHeaderMap &headers,
     return Http::FilterHeadersStatus::StopIteration;
   }
 
+  // An unsigned body is only protected by TLS, and a body that may have to be
+  // replaced by the default body has to be buffered anyway.
+  streaming_ = protocol_options_->unsignedPayload() &&
+               !function_on_route_->defaultBody().has_value() &&
+               secureTransport();
+
   // If the state is still the initial, attempt to get credentials
   ASSERT(state_ == State::Init);
   state_ = State::Calling;
@@ -114,7 +127,7 @@ AWSLambdaFilter::decodeHeaders(Http::RequestHeaderMap &headers,
     }
   }
 
-  if (end_stream) {
+  if (end_stream || streaming()) {
     lambdafy();
     return Http::FilterHeadersStatus::Continue;
   }
@@ -124,13 +137,29 @@ AWSLambdaFilter::decodeHeaders(Http::RequestHeaderMap &headers,
 
 
 Http::FilterHeadersStatus 
-AWSLambdaFilter::encodeHeaders(Http::ResponseHeaderMap &headers, bool) {
+AWSLambdaFilter::encodeHeaders(Http::ResponseHeaderMap &headers,
+                               bool end_stream) {
 
   if (!headers.get(AWSLambdaHeaderNames::get().FunctionError).empty()){
     // We treat upstream function errors as if it was any other upstream error
     headers.setStatus(504);
   }
   response_headers_ = &headers;
+  if (state_ == State::Responded) {
+    // our own local replies are sent as they are.
+    return Http::FilterHeadersStatus::Continue;
+  }
+  if (functionOnRoute() != nullptr && functionOnRoute()->responseStreaming() &&
+      !end_stream && Http::Utility::getResponseStatus(headers) ==
+                         enumToInt(Http::Code::OK)) {
+    // lambda errors are plain json, only a successful invocation is an event
+    // stream. its payload is sent on as it is decoded.
+    event_stream_decoder_ = std::make_unique<EventStreamDecoder>();
+    headers.removeContentLength();
+    // the content-type is the event stream's, not the payload's.
+    headers.removeContentType();
+    return Http::FilterHeadersStatus::Continue;
+  }
   if (functionOnRoute() != nullptr && functionOnRoute()->unwrapAsAlb()){
     // Stop iteration so that encodedata can mutate headers from alb json
     return Http::FilterHeadersStatus::StopIteration;
@@ -148,105 +177,108 @@ Http::FilterDataStatus AWSLambdaFilter::encodeData(
     return Http::FilterDataStatus::StopIterationNoBuffer;
   }
 
-  if (functionOnRoute() == nullptr || !functionOnRoute()->unwrapAsAlb()){
+  if (event_stream_decoder_ != nullptr) {
+    return decodeEventStream(data, end_stream);
+  }
+
+  if (state_ == State::Responded || functionOnRoute() == nullptr ||
+      !functionOnRoute()->unwrapAsAlb()) {
     // return response as is if not configured for alb mode
     return Http::FilterDataStatus::Continue;
   }
 
+  // the response is parsed as it arrives, only the body is kept. what the
+  // parser holds on to (headers, strings, nesting) is bounded by its input,
+  // so the whole response counts against the limit, not just the body.
+  alb_response_length_ += data.length();
+  const uint32_t limit = encoder_callbacks_->encoderBufferLimit();
+  if (limit > 0 && alb_response_length_ > limit) {
+    state_ = State::Responded;
+    encoder_callbacks_->sendLocalReply(
+        Http::Code::InternalServerError, RcDetails::get().AlbResponseTooLarge,
+        nullptr, absl::nullopt, RcDetails::get().AlbResponseTooLarge);
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  }
+  alb_parser_.parse(data);
+  data.drain(data.length());
   if (!end_stream) {
-    // we need the entire response prior to parsing and unwrapping the json
-    return Http::FilterDataStatus::StopIterationAndBuffer;
+    // we need the entire response prior to setting the headers
+    return Http::FilterDataStatus::StopIterationNoBuffer;
   }
-  encoder_callbacks_->addEncodedData(data, false);
-  finalizeResponse();
-  
- 
+  finalizeResponse(data);
   return Http::FilterDataStatus::Continue;
 }
 
 Http::FilterTrailersStatus 
 AWSLambdaFilter::encodeTrailers(Http::ResponseTrailerMap &) {
 
-  if (functionOnRoute() == nullptr || !functionOnRoute()->unwrapAsAlb()){
+  if (event_stream_decoder_ != nullptr) {
+    // the stream ends here, it is only complete if the invocation was.
+    Buffer::OwnedImpl payload;
+    if (decodeEventStream(payload, true) != Http::FilterDataStatus::Continue) {
+      return Http::FilterTrailersStatus::StopIteration;
+    }
+    if (payload.length() != 0) {
+      encoder_callbacks_->addEncodedData(payload, false);
+    }
+    return Http::FilterTrailersStatus::Continue;
+  }
+
+  if (state_ == State::Responded || functionOnRoute() == nullptr ||
+      !functionOnRoute()->unwrapAsAlb()) {
    return Http::FilterTrailersStatus::Continue;
   }
   // Future proof against alb http2 support and finalize the data transform
-  finalizeResponse();
+  Buffer::OwnedImpl body;
+  finalizeResponse(body);
+  if (body.length() != 0) {
+    encoder_callbacks_->addEncodedData(body, false);
+  }
   
   return Http::FilterTrailersStatus::Continue;
 }
 
-void AWSLambdaFilter::finalizeResponse(){
-  // Now that the response is finished we know that the following is safe
-  // as the following options will only make the resulting buffer smaller.
-  const Buffer::Instance&  buff = *encoder_callbacks_->encodingBuffer();
-  encoder_callbacks_->modifyEncodingBuffer([this](Buffer::Instance& enc_buf) {
-    Buffer::OwnedImpl body;
-    if (parseResponseAsALB(*response_headers_, enc_buf, body)){
-      response_headers_->setStatus(static_cast<int>(Http::Code::InternalServerError));
-      body.drain(body.length());
-    }
-    enc_buf.drain(enc_buf.length());
-    enc_buf.move(body);
-  });
-  response_headers_->setContentLength(buff.length());
-}
+Http::FilterDataStatus
+AWSLambdaFilter::decodeEventStream(Buffer::Instance &data, bool end_stream) {
+  Buffer::OwnedImpl payload;
+  const EventStreamDecoder::Status status =
+      event_stream_decoder_->decode(data, end_stream, payload);
+  data.move(payload);
+  if (status == EventStreamDecoder::Status::Ok) {
+    return Http::FilterDataStatus::Continue;
+  }
 
-bool AWSLambdaFilter::parseResponseAsALB(Http::ResponseHeaderMap& headers, 
-                const Buffer::Instance& json_buf, Buffer::Instance& body) {
+  // the response already started, resetting the stream is the only way to
+  // tell the client it is not complete.
+  ENVOY_LOG(debug, "{}: streamed invocation of {} failed: {} {}", __func__,
+            functionOnRoute()->path(), event_stream_decoder_->errorCode(),
+            event_stream_decoder_->errorDetails());
+  event_stream_decoder_.reset();
+  encoder_callbacks_->resetStream();
+  return Http::FilterDataStatus::StopIterationNoBuffer;
+}
 
-  ProtobufWkt::Struct alb_response;                
-  try {
-    MessageUtil::loadFromJson(json_buf.toString(), alb_response);
-  } catch (EnvoyException& ex) {
-    ENVOY_LOG(debug, "{}: alb_unwrap set but did not recieve a json payload", 
-                                                   functionOnRoute()->path());
-    headers.setStatus(static_cast<int>(Http::Code::InternalServerError));
-    return true;
-  }
-  
-  const auto& flds = alb_response.fields();
-  if (flds.contains("body")) {
-    auto rawBody = flds.at("body").string_value();
-    if (flds.contains("isBase64Encoded")){
-      if (!flds.at("isBase64Encoded").has_bool_value()){
-        return true;
-      }
-      if (flds.at("isBase64Encoded").bool_value()){
-        rawBody = Base64::decode(rawBody);
-      }
-    }
-    body.add(rawBody);
+void AWSLambdaFilter::finalizeResponse(Buffer::Instance &body) {
+  if (!alb_parser_.finish()) {
+    ENVOY_LOG(debug, "{}: alb_unwrap set but did not recieve a json payload",
+              functionOnRoute()->path());
+    response_headers_->setStatus(
+        static_cast<int>(Http::Code::InternalServerError));
+    response_headers_->setContentLength(0);
+    return;
   }
 
-  if (flds.contains("statusCode")){
-    headers.setStatus(flds.at("statusCode").number_value());
-    if (!flds.at("statusCode").has_number_value()){
-      return true;
-    }
-  }
-  if (flds.contains("headers")){
-    const auto& hds = flds.at("headers").struct_value();
-    const auto& hdsFields = hds.fields();
-    for (auto const& hdrEntry : hdsFields) { 
-      headers.addCopy(Http::LowerCaseString(hdrEntry.first),
-                             hdrEntry.second.string_value());
-    }
+  if (alb_parser_.statusCode().has_value()) {
+    response_headers_->setStatus(alb_parser_.statusCode().value());
   }
   // While ALB would refuse to parse something with headers + multivalue
   // Being more permissive in this case was determined to be better.
-  if (flds.contains("multiValueHeaders")){
-    const auto& hds = flds.at("multiValueHeaders").struct_value();
-    const auto& hdsFields = hds.fields();
-    for (auto const& hdrEntry : hdsFields) { 
-      const auto& list = hdrEntry.second.list_value();
-      for (auto const& val : list.values()){
-        headers.addCopy(Http::LowerCaseString(hdrEntry.first),
-                                                            val.string_value());
-      }
-    }
+  for (const auto &header : alb_parser_.headers()) {
+    response_headers_->addCopy(Http::LowerCaseString(header.first),
+                               header.second);
   }
-  return false;
+  body.move(alb_parser_.body());
+  response_headers_->setContentLength(body.length());
 }
 
 void AWSLambdaFilter::onSuccess(
@@ -280,7 +312,8 @@ void AWSLambdaFilter::onSuccess(
                                        RcDetails::get().CredentialsNotFound);
     return;
   }
-  aws_authenticator_.init(access_key, secret_key, session_token);
+  aws_authenticator_.init(access_key, secret_key, session_token,
+                          &filter_config_->signingCaches());
 
   if (filter_config_->propagateOriginalRouting()){
     request_headers_->setEnvoyOriginalPath(request_headers_->getPathValue());
@@ -293,9 +326,9 @@ void AWSLambdaFilter::onSuccess(
   request_headers_->setReferencePath(function_on_route_->path());
 
   if (stopped_) {
-    if (end_stream_) {
+    if (end_stream_ || streaming()) {
       // edge case where header only request was stopped, but now needs to be
-      // lambdafied.
+      // lambdafied. streamed requests are signed before their body arrives.
       lambdafy();
     }
     stopped_ = false;
@@ -315,7 +348,7 @@ void AWSLambdaFilter::onFailure(CredentialsFailureStatus) {
 
 Http::FilterDataStatus AWSLambdaFilter::decodeData(Buffer::Instance &data,
                                                    bool end_stream) {
-  if (!function_on_route_) {
+  if (!function_on_route_ || signed_) {
     return Http::FilterDataStatus::Continue;
   }
   end_stream_ = end_stream;
@@ -324,7 +357,9 @@ Http::FilterDataStatus AWSLambdaFilter::decodeData(Buffer::Instance &data,
     has_body_ = true;
   }
 
-  aws_authenticator_.updatePayloadHash(data);
+  if (!streaming()) {
+    aws_authenticator_.updatePayloadHash(data);
+  }
 
   if (state_ == Calling) {
     return Http::FilterDataStatus::StopIterationAndBuffer;
@@ -343,6 +378,9 @@ Http::FilterDataStatus AWSLambdaFilter::decodeData(Buffer::Instance &data,
 Http::FilterTrailersStatus
 AWSLambdaFilter::decodeTrailers(Http::RequestTrailerMap &) {
   end_stream_ = true;
+  if (signed_) {
+    return Http::FilterTrailersStatus::Continue;
+  }
   if (state_ == State::Calling) {
     return Http::FilterTrailersStatus::StopIteration;
   } else if (state_ == Responded) {
@@ -357,6 +395,7 @@ AWSLambdaFilter::decodeTrailers(Http::RequestTrailerMap &) {
 }
 
 void AWSLambdaFilter::lambdafy() {
+  signed_ = true;
   handleDefaultBody();
 
   const std::string &invocation_type =
@@ -369,8 +408,42 @@ void AWSLambdaFilter::lambdafy() {
                                  AWSLambdaHeaderNames::get().LogNone);
   request_headers_->setReferenceHost(protocol_options_->host());
 
-  aws_authenticator_.sign(request_headers_, HeadersToSign,
-                          protocol_options_->region());
+  if (streaming()) {
+    aws_authenticator_.signUnsignedPayload(request_headers_,
+                                           UnsignedPayloadHeadersToSign,
+                                           protocol_options_->region());
+  } else {
+    aws_authenticator_.sign(request_headers_, HeadersToSign,
+                            protocol_options_->region());
+  }
+}
+
+bool AWSLambdaFilter::secureTransport() const {
+  const std::string *cluster_name =
+      Http::SoloFilterUtility::resolveClusterName(decoder_callbacks_);
+  if (cluster_name == nullptr) {
+    return false;
+  }
+  Upstream::ThreadLocalCluster *cluster =
+      cluster_manager_.getThreadLocalCluster(*cluster_name);
+  if (cluster == nullptr) {
+    return false;
+  }
+  // the upstream host isn't picked yet, so every host the request may go to
+  // has to use TLS. lambda clusters only have a few hosts.
+  for (const auto &host_set : cluster->prioritySet().hostSetsPerPriority()) {
+    for (const Upstream::HostSharedPtr &host : host_set->hosts()) {
+      if (!host->transportSocketFactory().implementsSecureTransport()) {
+        return false;
+      }
+    }
+  }
+  // as do hosts added in the meantime, which match no transport socket match
+  // if they have no metadata and use the default socket.
+  return cluster->info()
+      ->transportSocketMatcher()
+      .resolve(nullptr)
+      .factory_.implementsSecureTransport();
 }
 
 void AWSLambdaFilter::handleDefaultBody() {
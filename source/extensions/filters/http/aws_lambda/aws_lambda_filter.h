@@ -8,8 +8,10 @@
 #include "envoy/upstream/cluster_manager.h"
 #include "source/common/common/base64.h"
 
+#include "source/extensions/filters/http/aws_lambda/alb_response_parser.h"
 #include "source/extensions/filters/http/aws_lambda/aws_authenticator.h"
 #include "source/extensions/filters/http/aws_lambda/config.h"
+#include "source/extensions/filters/http/aws_lambda/event_stream_decoder.h"
 #include "source/extensions/filters/http/aws_lambda/sts_credentials_provider.h"
 
 #include "api/envoy/config/filter/http/aws_lambda/v2/aws_lambda.pb.validate.h"
@@ -82,16 +84,29 @@ public:
 
 private:
   static const HeaderList HeadersToSign;
+  static const HeaderList UnsignedPayloadHeadersToSign;
+
+  // whether the request is signed without its body, so that the body
+  // doesn't have to be buffered.
+  bool streaming() const { return streaming_; }
+  // whether the upstream cluster protects the body with TLS.
+  bool secureTransport() const;
 
   void handleDefaultBody();
 
   void lambdafy();
-  void finalizeResponse();
-  bool parseResponseAsALB(Http::ResponseHeaderMap&, 
-                          const Buffer::Instance&, Buffer::Instance&);
+  void finalizeResponse(Buffer::Instance &body);
+  Http::FilterDataStatus decodeEventStream(Buffer::Instance &data,
+                                           bool end_stream);
 
   Http::RequestHeaderMap *request_headers_{};
   Http::ResponseHeaderMap *response_headers_{};
+  // decodes the response of a streamed invocation.
+  std::unique_ptr<EventStreamDecoder> event_stream_decoder_;
+  // parses the response of routes that unwrap it as alb.
+  AlbResponseParser alb_parser_;
+  // the bytes of the response fed to alb_parser_ so far.
+  uint64_t alb_response_length_{};
   AwsAuthenticator aws_authenticator_;
 
   Http::StreamDecoderFilterCallbacks *decoder_callbacks_{};
@@ -103,6 +118,9 @@ private:
   Router::RouteConstSharedPtr route_;
   const AWSLambdaRouteConfig *function_on_route_{};
   bool has_body_{};
+  // whether the request headers are signed.
+  bool signed_{};
+  bool streaming_{};
 
   AWSLambdaConfigConstSharedPtr filter_config_;
 
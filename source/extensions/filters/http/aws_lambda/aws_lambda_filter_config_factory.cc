@@ -24,8 +24,8 @@ AWSLambdaFilterConfigFactory::createFilterFactoryFromProtoTyped(
           context.api(), Extensions::Common::Aws::Utility::metadataFetcher),
       StsCredentialsProviderFactory::create(context.api(),
                                             context.clusterManager()),
-      context.mainThreadDispatcher(), context.api(), context.threadLocal(), stats_prefix,
-      context.scope(), proto_config);
+      context.mainThreadDispatcher(), context.api(), context.clusterManager(),
+      context.threadLocal(), stats_prefix, context.scope(), proto_config);
   return
       [&context, config]
       (Http::FilterChainFactoryCallbacks &callbacks) -> void {
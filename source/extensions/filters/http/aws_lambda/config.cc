@@ -4,6 +4,8 @@
 
 #include "source/common/common/regex.h"
 
+#include "source/extensions/filters/http/solo_well_known_names.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace HttpFilters {
@@ -42,11 +44,14 @@ AWSLambdaConfigImpl::AWSLambdaConfigImpl(
         &protoconfig)
     : stats_(generateStats(stats_prefix, scope)), api_(api),
       file_watcher_(dispatcher.createFilesystemWatcher()), tls_(tls),
+      signing_caches_(tls),
       credential_refresh_delay_(std::chrono::milliseconds(
         DurationUtil::durationToMilliseconds(
           protoconfig.credential_refresh_delay()))),
           propagate_original_routing_(protoconfig.propagate_original_routing()){
-
+  signing_caches_.set([](Event::Dispatcher &) {
+    return std::make_shared<SigningCaches>();
+  });
 
   // Initialize Credential fetcher, if none exists do nothing. Filter will
   // implicitly use protocol options data
@@ -73,18 +78,12 @@ AWSLambdaConfigImpl::AWSLambdaConfigImpl(
 
     // Load all of the env data for STS credentials
     loadSTSData();
-    // use service account credentials provider
-    // transfer ptr ownership to sts_factor isn't cleaned up before we get into
-    // tls set
-    sts_factory_ = std::move(sts_factory);
-    auto service_account_creds = protoconfig.service_account_credentials();
-    tls_.set([this, web_token = web_token_, role_arn = role_arn_,
-                    service_account_creds](Event::Dispatcher &dispatcher) {
-      StsCredentialsProviderPtr sts_cred_provider = sts_factory_->build(
-          service_account_creds, dispatcher, web_token, role_arn);
-      return std::make_shared<ThreadLocalCredentials>(
-          std::move(sts_cred_provider));
-    });
+    // use a single service account credentials provider on the main thread,
+    // whose credentials are shared with the workers.
+    sts_credentials_ = SharedStsCredentialsProvider::create(
+        sts_factory->build(protoconfig.service_account_credentials(),
+                           dispatcher, web_token_, role_arn_),
+        dispatcher, tls, api_.timeSource(), role_arn_);
     sts_enabled_ = true;
     break;
   }
@@ -123,21 +122,37 @@ void AWSLambdaConfigImpl::loadSTSData() {
   }
 }
 
-void AWSLambdaConfigImpl::init(Event::Dispatcher &dispatcher) {
+void AWSLambdaConfigImpl::init(Event::Dispatcher &dispatcher,
+                               Upstream::ClusterManager &cluster_manager) {
   if (sts_enabled_) {
-    // Set up a filewatch and timer for sts token upating.
-    auto shared_this = shared_from_this();
+    // Fetch the credentials of the roles of the known clusters now, and of
+    // the clusters added later as they are, rather than on their first
+    // requests. The default role goes first as chained roles need it.
+    sts_credentials_->warm(absl::nullopt);
+    const auto clusters = cluster_manager.clusters();
+    for (const auto &cluster : clusters.active_clusters_) {
+      warmCredentials(*cluster.second.get().info());
+    }
+    cluster_update_callbacks_handle_ =
+        cluster_manager.addThreadLocalClusterUpdateCallbacks(*this);
+
+    // Set up a filewatch and timer for sts token upating. They only hold a
+    // weak reference, so that the config, along with its credentials
+    // provider, its refresh timers and its cluster update callbacks, is
+    // destroyed once the listener drops it.
+    std::weak_ptr<AWSLambdaConfigImpl> weak_this = shared_from_this();
 
     // While the filewatch should be sufficient we have seen instances where the calls are dropped.
     // Given the usual usage of sts this should only be of concern when web token is self managed.
-    shared_this->timer_ = dispatcher.createTimer([shared_this] { 
+    timer_ = dispatcher.createTimer([weak_this] {
+        auto shared_this = weak_this.lock();
+        if (shared_this == nullptr) {
+          return;
+        }
         try {
             const auto web_token = shared_this->api_.fileSystem().fileReadToEnd(
                 shared_this->token_file_);
-            shared_this->tls_.runOnAllThreads(
-                [web_token](OptRef<ThreadLocalCredentials> prev_config) {
-                  prev_config->sts_credentials_->setWebToken(web_token);
-                });
+            shared_this->sts_credentials_->setWebToken(web_token);
             // TODO: check if web_token is valid
             // TODO: stats here
           } catch (const EnvoyException &e) {
@@ -156,20 +171,40 @@ void AWSLambdaConfigImpl::init(Event::Dispatcher &dispatcher) {
      });
     if (credential_refresh_delay_.count() > 0){
           ENVOY_LOG(debug, "{}: STS enabled with {} time refresh",
-       __func__, shared_this->credential_refresh_delay_.count());
-      shared_this->timer_->enableTimer(shared_this->credential_refresh_delay_);
+       __func__, credential_refresh_delay_.count());
+      timer_->enableTimer(credential_refresh_delay_);
     } else {
         ENVOY_LOG(debug, "{}: STS enabled without time based refresh",__func__);
     }
     file_watcher_->addWatch(
         token_file_, Filesystem::Watcher::Events::Modified,
-        [shared_this](uint32_t) {
-          // Force timer callback to happen immediately to pick up the change.
-          shared_this->timer_->enableTimer(std::chrono::milliseconds::zero());
+        [weak_this](uint32_t) {
+          if (auto shared_this = weak_this.lock()) {
+            // Force timer callback to happen immediately to pick up the
+            // change.
+            shared_this->timer_->enableTimer(std::chrono::milliseconds::zero());
+          }
         });
   }
 }
 
+void AWSLambdaConfigImpl::onClusterAddOrUpdate(
+    Upstream::ThreadLocalCluster &cluster) {
+  warmCredentials(*cluster.info());
+}
+
+void AWSLambdaConfigImpl::warmCredentials(
+    const Upstream::ClusterInfo &cluster_info) {
+  const auto ext_cfg = cluster_info.extensionProtocolOptionsTyped<
+      AWSLambdaProtocolExtensionConfig>(SoloHttpFilterNames::get().AwsLambda);
+  // clusters with their own credentials don't need STS.
+  if (ext_cfg == nullptr ||
+      (ext_cfg->accessKey().has_value() && ext_cfg->secretKey().has_value())) {
+    return;
+  }
+  sts_credentials_->warm(ext_cfg->roleArn());
+}
+
 /*
  * Three options, in order of precedence
  *   1. Protocol Options
@@ -206,8 +241,7 @@ StsConnectionPool::Context *AWSLambdaConfigImpl::getCredentials(
   if (sts_enabled_) {
     ENVOY_LOG(trace, "{}: Credentials being retrieved from STS provider",
               __func__);
-    return tls_->sts_credentials_->find(ext_cfg->roleArn(),
-                                                           callbacks);
+    return sts_credentials_->find(ext_cfg->roleArn(), callbacks);
   }
 
   ENVOY_LOG(debug, "{}: No valid credentials source found", __func__);
@@ -250,6 +284,7 @@ std::shared_ptr<AWSLambdaConfigImpl> AWSLambdaConfigImpl::create(
         &&provider,
     std::unique_ptr<StsCredentialsProviderFactory> &&sts_factory,
     Event::Dispatcher &dispatcher, Api::Api &api,
+    Upstream::ClusterManager &cluster_manager,
     Envoy::ThreadLocal::SlotAllocator &tls, const std::string &stats_prefix,
     Stats::Scope &scope,
     const envoy::config::filter::http::aws_lambda::v2::AWSLambdaConfig
@@ -259,7 +294,7 @@ std::shared_ptr<AWSLambdaConfigImpl> AWSLambdaConfigImpl::create(
   std::shared_ptr<AWSLambdaConfigImpl> ptr(new AWSLambdaConfigImpl(
       std::move(provider), std::move(sts_factory), dispatcher, api, tls,
       stats_prefix, scope, protoconfig));
-  ptr->init(dispatcher);
+  ptr->init(dispatcher, cluster_manager);
   return ptr;
 }
 
@@ -274,8 +309,14 @@ AWSLambdaConfigImpl::generateStats(const std::string &prefix,
 AWSLambdaRouteConfig::AWSLambdaRouteConfig(
     const envoy::config::filter::http::aws_lambda::v2::AWSLambdaPerRoute
         &protoconfig)
-    : path_(functionUrlPath(protoconfig.name(), protoconfig.qualifier())),
-      async_(protoconfig.async()), unwrap_as_alb_(protoconfig.unwrap_as_alb()) {
+    : path_(functionUrlPath(protoconfig.name(), protoconfig.qualifier(),
+                            protoconfig.response_streaming())),
+      async_(protoconfig.async()), unwrap_as_alb_(protoconfig.unwrap_as_alb()),
+      response_streaming_(protoconfig.response_streaming()) {
+  if (response_streaming_ && (async_ || unwrap_as_alb_)) {
+    throw EnvoyException(
+        "response_streaming can't be used with async or unwrap_as_alb");
+  }
 
   if (protoconfig.has_empty_body_override()) {
     default_body_ = protoconfig.empty_body_override().value();
@@ -284,10 +325,16 @@ AWSLambdaRouteConfig::AWSLambdaRouteConfig(
 
 std::string
 AWSLambdaRouteConfig::functionUrlPath(const std::string &name,
-                                      const std::string &qualifier) {
+                                      const std::string &qualifier,
+                                      bool response_streaming) {
 
   std::stringstream val;
-  val << "/2015-03-31/functions/" << name << "/invocations";
+  if (response_streaming) {
+    val << "/2021-11-15/functions/" << name
+        << "/response-streaming-invocations";
+  } else {
+    val << "/2015-03-31/functions/" << name << "/invocations";
+  }
   if (!qualifier.empty()) {
     val << "?Qualifier=" << qualifier;
   }
@@ -297,7 +344,8 @@ AWSLambdaRouteConfig::functionUrlPath(const std::string &name,
 AWSLambdaProtocolExtensionConfig::AWSLambdaProtocolExtensionConfig(
     const envoy::config::filter::http::aws_lambda::v2::
         AWSLambdaProtocolExtension &protoconfig)
-    : host_(protoconfig.host()), region_(protoconfig.region()) {
+    : host_(protoconfig.host()), region_(protoconfig.region()),
+      unsigned_payload_(protoconfig.unsigned_payload()) {
   if (!protoconfig.access_key().empty()) {
     access_key_ = protoconfig.access_key();
   }
@@ -9,6 +9,8 @@
 #include "envoy/upstream/cluster_manager.h"
 
 #include "source/extensions/common/aws/credentials_provider.h"
+#include "source/extensions/filters/http/aws_lambda/aws_authenticator.h"
+#include "source/extensions/filters/http/aws_lambda/shared_sts_credentials_provider.h"
 #include "source/extensions/filters/http/aws_lambda/sts_credentials_provider.h"
 
 #include "absl/types/optional.h"
@@ -55,6 +57,7 @@ public:
     return session_token_;
   }
   const absl::optional<std::string> &roleArn() const { return role_arn_; }
+  bool unsignedPayload() const { return unsigned_payload_; }
 
 private:
   std::string host_;
@@ -63,6 +66,7 @@ private:
   absl::optional<std::string> secret_key_;
   absl::optional<std::string> session_token_;
   absl::optional<std::string> role_arn_;
+  bool unsigned_payload_;
 };
 
 using SharedAWSLambdaProtocolExtensionConfig =
@@ -74,11 +78,14 @@ public:
   getCredentials(SharedAWSLambdaProtocolExtensionConfig ext_cfg,
                  StsConnectionPool::Context::Callbacks *callbacks) const PURE;
   virtual bool propagateOriginalRouting() const PURE;
+  // the signing caches of the current worker.
+  virtual SigningCaches &signingCaches() const PURE;
   virtual ~AWSLambdaConfig() = default;
 };
 
 class AWSLambdaConfigImpl
     : public AWSLambdaConfig,
+      public Upstream::ClusterUpdateCallbacks,
       public Envoy::Logger::Loggable<Envoy::Logger::Id::filter>,
       public std::enable_shared_from_this<AWSLambdaConfigImpl> {
 public:
@@ -89,6 +96,7 @@ public:
              &&provider,
          std::unique_ptr<StsCredentialsProviderFactory> &&sts_factory,
          Event::Dispatcher &dispatcher, Api::Api &api,
+         Upstream::ClusterManager &cluster_manager,
          Envoy::ThreadLocal::SlotAllocator &tls,
          const std::string &stats_prefix, Stats::Scope &scope,
          const envoy::config::filter::http::aws_lambda::v2::AWSLambdaConfig
@@ -102,6 +110,14 @@ public:
       return propagate_original_routing_;
     }
 
+  SigningCaches &signingCaches() const override {
+    return *signing_caches_.get();
+  }
+
+  // Upstream::ClusterUpdateCallbacks
+  void onClusterAddOrUpdate(Upstream::ThreadLocalCluster &cluster) override;
+  void onClusterRemoval(const std::string &) override {}
+
 private:
   AWSLambdaConfigImpl(
       std::unique_ptr<Envoy::Extensions::Common::Aws::CredentialsProvider>
@@ -117,10 +133,7 @@ private:
   struct ThreadLocalCredentials : public Envoy::ThreadLocal::ThreadLocalObject {
     ThreadLocalCredentials(CredentialsConstSharedPtr credentials)
         : credentials_(credentials) {}
-    ThreadLocalCredentials(StsCredentialsProviderPtr credentials)
-        : sts_credentials_(std::move(credentials)) {}
     CredentialsConstSharedPtr credentials_;
-    StsCredentialsProviderPtr sts_credentials_;
   };
 
   CredentialsConstSharedPtr getProviderCredentials() const;
@@ -130,7 +143,11 @@ private:
 
   void timerCallback();
 
-  void init(Event::Dispatcher &dispatcher);
+  void init(Event::Dispatcher &dispatcher,
+            Upstream::ClusterManager &cluster_manager);
+
+  // prefetches the STS credentials of the cluster's role.
+  void warmCredentials(const Upstream::ClusterInfo &cluster_info);
 
   void loadSTSData();
 
@@ -149,10 +166,12 @@ private:
   std::string role_arn_;
   
   ThreadLocal::TypedSlot<ThreadLocalCredentials> tls_;
+  mutable ThreadLocal::TypedSlot<SigningCaches> signing_caches_;
 
   Event::TimerPtr timer_;
 
-  std::unique_ptr<StsCredentialsProviderFactory> sts_factory_;
+  SharedStsCredentialsProviderSharedPtr sts_credentials_;
+  Upstream::ClusterUpdateCallbacksHandlePtr cluster_update_callbacks_handle_;
   std::chrono::milliseconds credential_refresh_delay_;
 
   bool propagate_original_routing_;
@@ -172,15 +191,18 @@ public:
     return default_body_;
   }
   bool unwrapAsAlb() const { return unwrap_as_alb_; }
+  bool responseStreaming() const { return response_streaming_; }
 
 private:
   std::string path_;
   bool async_;
   bool unwrap_as_alb_;
+  bool response_streaming_;
   absl::optional<std::string> default_body_;
 
   static std::string functionUrlPath(const std::string &name,
-                                     const std::string &qualifier);
+                                     const std::string &qualifier,
+                                     bool response_streaming);
 };
 
 } // namespace AwsLambda
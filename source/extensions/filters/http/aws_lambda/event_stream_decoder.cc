@@ -0,0 +1,217 @@
+#include "source/extensions/filters/http/aws_lambda/event_stream_decoder.h"
+
+#include "envoy/common/exception.h"
+
+#include "source/common/protobuf/utility.h"
+#include "source/common/singleton/const_singleton.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+namespace {
+
+struct EventStreamValues {
+  const std::string MessageTypeHeader{":message-type"};
+  const std::string EventTypeHeader{":event-type"};
+  const std::string ExceptionTypeHeader{":exception-type"};
+  const std::string ErrorCodeHeader{":error-code"};
+  const std::string ErrorMessageHeader{":error-message"};
+  const std::string Event{"event"};
+  const std::string Exception{"exception"};
+  const std::string Error{"error"};
+  const std::string PayloadChunk{"PayloadChunk"};
+  const std::string InvokeComplete{"InvokeComplete"};
+};
+using EventStreamConsts = ConstSingleton<EventStreamValues>;
+
+// the header value types of the event stream encoding.
+enum HeaderValueType : uint8_t {
+  BoolTrue = 0,
+  BoolFalse = 1,
+  Byte = 2,
+  Short = 3,
+  Integer = 4,
+  Long = 5,
+  ByteArray = 6,
+  String = 7,
+  Timestamp = 8,
+  Uuid = 9,
+};
+
+uint16_t readBEUint16(absl::string_view data) {
+  return static_cast<uint16_t>(static_cast<uint8_t>(data[0]) << 8 |
+                               static_cast<uint8_t>(data[1]));
+}
+
+} // namespace
+
+EventStreamDecoder::Status
+EventStreamDecoder::decode(Buffer::Instance &data, bool end_stream,
+                           Buffer::Instance &payload) {
+  buffer_.move(data);
+  // the crcs aren't checked, the stream is already protected by TLS.
+  while (buffer_.length() >= PRELUDE_SIZE) {
+    const uint32_t total_length = buffer_.peekBEInt<uint32_t>(0);
+    const uint32_t headers_length = buffer_.peekBEInt<uint32_t>(4);
+    if (total_length < PRELUDE_SIZE + MESSAGE_CRC_SIZE ||
+        total_length > MAX_MESSAGE_SIZE ||
+        headers_length > total_length - PRELUDE_SIZE - MESSAGE_CRC_SIZE) {
+      return Status::InvalidMessage;
+    }
+    if (buffer_.length() < total_length) {
+      break;
+    }
+    buffer_.drain(PRELUDE_SIZE);
+    Buffer::OwnedImpl message;
+    message.move(buffer_, total_length - PRELUDE_SIZE - MESSAGE_CRC_SIZE);
+    buffer_.drain(MESSAGE_CRC_SIZE);
+
+    std::string headers(headers_length, '\0');
+    message.copyOut(0, headers_length, headers.data());
+    message.drain(headers_length);
+    Headers parsed;
+    if (!parseHeaders(headers, parsed)) {
+      return Status::InvalidMessage;
+    }
+    const Status status = onMessage(parsed, message, payload);
+    if (status != Status::Ok) {
+      return status;
+    }
+  }
+  if (end_stream && (buffer_.length() != 0 || !complete_)) {
+    return Status::IncompleteMessage;
+  }
+  return Status::Ok;
+}
+
+bool EventStreamDecoder::parseHeaders(absl::string_view headers,
+                                      Headers &parsed) {
+  while (!headers.empty()) {
+    const uint8_t name_length = headers[0];
+    // the name, and the type of the value.
+    if (headers.size() < 1U + name_length + 1U) {
+      return false;
+    }
+    const absl::string_view name = headers.substr(1, name_length);
+    const uint8_t type = headers[1 + name_length];
+    headers.remove_prefix(1 + name_length + 1);
+
+    size_t value_length = 0;
+    switch (type) {
+    case BoolTrue:
+    case BoolFalse:
+      break;
+    case Byte:
+      value_length = 1;
+      break;
+    case Short:
+      value_length = 2;
+      break;
+    case Integer:
+      value_length = 4;
+      break;
+    case Long:
+    case Timestamp:
+      value_length = 8;
+      break;
+    case Uuid:
+      value_length = 16;
+      break;
+    case ByteArray:
+    case String: {
+      if (headers.size() < 2) {
+        return false;
+      }
+      const uint16_t length = readBEUint16(headers);
+      headers.remove_prefix(2);
+      if (headers.size() < length) {
+        return false;
+      }
+      if (type == String) {
+        const absl::string_view value = headers.substr(0, length);
+        const auto &consts = EventStreamConsts::get();
+        if (name == consts.MessageTypeHeader) {
+          parsed.message_type = value;
+        } else if (name == consts.EventTypeHeader) {
+          parsed.event_type = value;
+        } else if (name == consts.ExceptionTypeHeader) {
+          parsed.exception_type = value;
+        } else if (name == consts.ErrorCodeHeader) {
+          parsed.error_code = value;
+        } else if (name == consts.ErrorMessageHeader) {
+          parsed.error_message = value;
+        }
+      }
+      value_length = length;
+      break;
+    }
+    default:
+      return false;
+    }
+    if (headers.size() < value_length) {
+      return false;
+    }
+    headers.remove_prefix(value_length);
+  }
+  return true;
+}
+
+EventStreamDecoder::Status
+EventStreamDecoder::onMessage(const Headers &headers,
+                              Buffer::Instance &message,
+                              Buffer::Instance &payload) {
+  const auto &consts = EventStreamConsts::get();
+  if (headers.message_type == consts.Event) {
+    if (headers.event_type == consts.PayloadChunk) {
+      payload.move(message);
+    } else if (headers.event_type == consts.InvokeComplete) {
+      return onInvokeComplete(message.toString());
+    }
+    // other events carry nothing for the client.
+    return Status::Ok;
+  }
+  if (headers.message_type == consts.Exception) {
+    error_code_ = std::string(headers.exception_type);
+    error_details_ = message.toString();
+  } else if (headers.message_type == consts.Error) {
+    error_code_ = std::string(headers.error_code);
+    error_details_ = std::string(headers.error_message);
+  } else {
+    return Status::InvalidMessage;
+  }
+  complete_ = true;
+  return Status::Error;
+}
+
+EventStreamDecoder::Status
+EventStreamDecoder::onInvokeComplete(const std::string &json) {
+  complete_ = true;
+  if (json.empty()) {
+    return Status::Ok;
+  }
+  ProtobufWkt::Struct invoke_complete;
+  try {
+    MessageUtil::loadFromJson(json, invoke_complete);
+  } catch (EnvoyException &) {
+    return Status::InvalidMessage;
+  }
+  const auto &fields = invoke_complete.fields();
+  const auto error_code = fields.find("ErrorCode");
+  if (error_code == fields.end() ||
+      error_code->second.string_value().empty()) {
+    return Status::Ok;
+  }
+  error_code_ = error_code->second.string_value();
+  const auto error_details = fields.find("ErrorDetails");
+  if (error_details != fields.end()) {
+    error_details_ = error_details->second.string_value();
+  }
+  return Status::Error;
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
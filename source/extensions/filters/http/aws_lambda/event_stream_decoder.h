@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+
+#include "envoy/buffer/buffer.h"
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+/**
+ * Decodes the AWS event stream of a streamed Lambda invocation
+ * (InvokeWithResponseStream) as it arrives. The payload chunks of the
+ * function are passed on, and only the message currently being assembled is
+ * buffered.
+ *
+ * see: https://docs.aws.amazon.com/lambda/latest/dg/API_InvokeWithResponseStream.html
+ */
+class EventStreamDecoder {
+public:
+  enum class Status {
+    Ok,
+    // A message is malformed, or larger than the max message size.
+    InvalidMessage,
+    // The stream ended in the middle of a message.
+    IncompleteMessage,
+    // The function, or Lambda, reported an error. see errorCode().
+    Error,
+  };
+
+  /**
+   * Moves data into the decoder and decodes every complete message.
+   * @param data the newly arrived body bytes. fully drained by this call.
+   * @param end_stream whether this is the last data of the stream.
+   * @param payload receives the payload chunks of the function.
+   */
+  Status decode(Buffer::Instance &data, bool end_stream,
+                Buffer::Instance &payload);
+
+  // whether the stream has completed, successfully or not.
+  bool complete() const { return complete_; }
+  // the error, if decode returned Status::Error.
+  const std::string &errorCode() const { return error_code_; }
+  const std::string &errorDetails() const { return error_details_; }
+
+  // 12 bytes of prelude (total length, headers length and their crc) and the
+  // crc of the message.
+  static constexpr uint32_t PRELUDE_SIZE = 12;
+  static constexpr uint32_t MESSAGE_CRC_SIZE = 4;
+  static constexpr uint32_t MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+private:
+  struct Headers {
+    absl::string_view message_type;
+    absl::string_view event_type;
+    absl::string_view exception_type;
+    absl::string_view error_code;
+    absl::string_view error_message;
+  };
+
+  static bool parseHeaders(absl::string_view headers, Headers &parsed);
+  Status onMessage(const Headers &headers, Buffer::Instance &message,
+                   Buffer::Instance &payload);
+  Status onInvokeComplete(const std::string &json);
+
+  Buffer::OwnedImpl buffer_;
+  bool complete_{};
+  std::string error_code_;
+  std::string error_details_;
+};
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
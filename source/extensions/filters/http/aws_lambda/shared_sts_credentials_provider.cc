@@ -0,0 +1,202 @@
+#include "source/extensions/filters/http/aws_lambda/shared_sts_credentials_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+SharedStsCredentialsProvider::SharedStsCredentialsProvider(
+    StsCredentialsProviderPtr provider, Event::Dispatcher &dispatcher,
+    ThreadLocal::SlotAllocator &tls, TimeSource &time_source,
+    std::string_view default_role_arn)
+    : provider_(std::move(provider)), dispatcher_(dispatcher),
+      time_source_(time_source), default_role_arn_(default_role_arn),
+      tls_(tls) {
+  tls_.set([](Event::Dispatcher &dispatcher) {
+    return std::make_shared<ThreadLocalCache>(dispatcher);
+  });
+  // publish all the credentials the provider fetches, including the ones it
+  // refreshes on its own.
+  provider_->setCredentialsUpdateCallback(
+      [this](const std::string &role_arn,
+             StsCredentialsConstSharedPtr credentials) {
+        publish(role_arn, std::move(credentials));
+      });
+  // the workers use the credentials without asking the provider, so it asks
+  // whether they did before refreshing them.
+  provider_->setCredentialsUsedCallback([this](const std::string &role_arn) {
+    const auto used = used_.find(role_arn);
+    return used != used_.end() && used->second->exchange(false);
+  });
+}
+
+SharedStsCredentialsProvider::~SharedStsCredentialsProvider() {
+  // the connection pools of the provider fail the fetches when they are
+  // destroyed, there is no one to publish that to.
+  for (auto &fetch : fetches_) {
+    fetch.second->cancel();
+  }
+}
+
+SharedStsCredentialsProviderSharedPtr SharedStsCredentialsProvider::create(
+    StsCredentialsProviderPtr provider, Event::Dispatcher &dispatcher,
+    ThreadLocal::SlotAllocator &tls, TimeSource &time_source,
+    std::string_view default_role_arn) {
+  // We can't use make_shared here because the constructor of this class is
+  // private.
+  return SharedStsCredentialsProviderSharedPtr(new SharedStsCredentialsProvider(
+      std::move(provider), dispatcher, tls, time_source, default_role_arn));
+}
+
+StsConnectionPool::Context *SharedStsCredentialsProvider::find(
+    const absl::optional<std::string> &role_arn_arg,
+    StsConnectionPool::Context::Callbacks *callbacks) {
+  const std::string role_arn = role_arn_arg.value_or(default_role_arn_);
+  ThreadLocalCache &cache = *tls_;
+
+  const auto existing_token = cache.credentials_.find(role_arn);
+  if (existing_token != cache.credentials_.end() &&
+      existing_token->second.credentials_->expirationTime() -
+              time_source_.systemTime() >
+          REFRESH_GRACE_PERIOD) {
+    // only written once between refreshes, so the workers don't keep
+    // writing the shared flag.
+    std::atomic<bool> &used = *existing_token->second.used_;
+    if (!used.load(std::memory_order_relaxed)) {
+      used.store(true, std::memory_order_relaxed);
+    }
+    callbacks->onSuccess(existing_token->second.credentials_);
+    return nullptr;
+  }
+
+  // Only the first request to wait asks the main thread for the credentials,
+  // the others wait for the same answer.
+  auto &waiting = cache.waiting_[role_arn];
+  const bool requested = !waiting.empty();
+  LinkedList::moveIntoList(
+      std::make_unique<WaitingContext>(callbacks, waiting, cache.dispatcher_),
+      waiting);
+  StsConnectionPool::Context *context = waiting.front().get();
+  if (!requested) {
+    ENVOY_LOG(trace, "{}: Requesting credentials for ({})", __func__,
+              role_arn);
+    dispatcher_.post([weak_this = weak_from_this(), role_arn] {
+      if (auto shared_this = weak_this.lock()) {
+        shared_this->fetch(role_arn);
+      }
+    });
+  }
+  return context;
+}
+
+void SharedStsCredentialsProvider::setWebToken(std::string_view web_token) {
+  provider_->setWebToken(web_token);
+}
+
+void SharedStsCredentialsProvider::warm(
+    const absl::optional<std::string> &role_arn_arg) {
+  const std::string role_arn = role_arn_arg.value_or(default_role_arn_);
+  const auto fetch = fetches_.find(role_arn);
+  if (fetch != fetches_.end() && fetch->second->started()) {
+    // the provider keeps the credentials it fetched refreshed while they are
+    // used, and the workers fetch them again if they are used after that.
+    return;
+  }
+  ENVOY_LOG(debug, "{}: Warming credentials for ({})", __func__, role_arn);
+  fetch(role_arn);
+}
+
+void SharedStsCredentialsProvider::fetch(const std::string &role_arn) {
+  auto &fetch = fetches_[role_arn];
+  if (fetch == nullptr) {
+    fetch = std::make_unique<Fetch>(*this, role_arn);
+  }
+  fetch->start();
+}
+
+void SharedStsCredentialsProvider::publish(
+    const std::string &role_arn, StsCredentialsConstSharedPtr credentials) {
+  ENVOY_LOG(debug, "{}: Publishing credentials for ({})", __func__, role_arn);
+  UsedFlagSharedPtr &used = used_[role_arn];
+  if (used == nullptr) {
+    used = std::make_shared<std::atomic<bool>>(false);
+  }
+  tls_.runOnAllThreads(
+      [role_arn, credentials, used](OptRef<ThreadLocalCache> cache) {
+        cache->credentials_.insert_or_assign(
+            role_arn, CachedCredentials{credentials, used});
+        auto waiting = cache->waiting_.find(role_arn);
+        if (waiting == cache->waiting_.end()) {
+          return;
+        }
+        while (!waiting->second.empty()) {
+          WaitingContextPtr context =
+              waiting->second.back()->removeFromList(waiting->second);
+          context->callbacks()->onSuccess(credentials);
+        }
+      });
+}
+
+void SharedStsCredentialsProvider::publishFailure(
+    const std::string &role_arn, CredentialsFailureStatus status) {
+  ENVOY_LOG(debug, "{}: Failed to fetch credentials for ({})", __func__,
+            role_arn);
+  tls_.runOnAllThreads([role_arn, status](OptRef<ThreadLocalCache> cache) {
+    auto waiting = cache->waiting_.find(role_arn);
+    if (waiting == cache->waiting_.end()) {
+      return;
+    }
+    while (!waiting->second.empty()) {
+      WaitingContextPtr context =
+          waiting->second.back()->removeFromList(waiting->second);
+      context->callbacks()->onFailure(status);
+    }
+  });
+}
+
+void SharedStsCredentialsProvider::Fetch::start() {
+  if (in_flight_) {
+    // another worker already asked for these credentials.
+    return;
+  }
+  in_flight_ = true;
+  context_ = parent_.provider_->find(role_arn_, this);
+}
+
+void SharedStsCredentialsProvider::Fetch::cancel() {
+  if (context_ != nullptr) {
+    context_->cancel();
+    context_ = nullptr;
+  }
+  in_flight_ = false;
+}
+
+void SharedStsCredentialsProvider::Fetch::onSuccess(
+    std::shared_ptr<const Envoy::Extensions::Common::Aws::Credentials>
+        credentials) {
+  // Credentials fetched from STS were already published when the provider
+  // got them, only the ones it had cached, returned before find() did, still
+  // have to be.
+  if (context_ == nullptr) {
+    auto sts_credentials =
+        std::dynamic_pointer_cast<const StsCredentials>(credentials);
+    if (sts_credentials != nullptr) {
+      parent_.publish(role_arn_, std::move(sts_credentials));
+    }
+  }
+  context_ = nullptr;
+  in_flight_ = false;
+  fetched_ = true;
+}
+
+void SharedStsCredentialsProvider::Fetch::onFailure(
+    CredentialsFailureStatus status) {
+  context_ = nullptr;
+  in_flight_ = false;
+  parent_.publishFailure(role_arn_, status);
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "envoy/common/time.h"
+#include "envoy/event/deferred_deletable.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "source/common/common/linked_object.h"
+#include "source/common/common/logger.h"
+
+#include "source/extensions/filters/http/aws_lambda/sts_credentials_provider.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+class SharedStsCredentialsProvider;
+using SharedStsCredentialsProviderSharedPtr =
+    std::shared_ptr<SharedStsCredentialsProvider>;
+
+/**
+ * Shares a single StsCredentialsProvider, owned by the main thread, with all
+ * the workers. Credentials it fetches are published to a cache on every
+ * worker. A worker that needs credentials it doesn't have asks the main thread
+ * for them once, however many of its requests are waiting, and the main thread
+ * fetches them once, however many workers ask.
+ */
+class SharedStsCredentialsProvider
+    : public std::enable_shared_from_this<SharedStsCredentialsProvider>,
+      public Logger::Loggable<Logger::Id::aws> {
+public:
+  ~SharedStsCredentialsProvider();
+
+  // must be called on the main thread.
+  static SharedStsCredentialsProviderSharedPtr
+  create(StsCredentialsProviderPtr provider, Event::Dispatcher &dispatcher,
+         ThreadLocal::SlotAllocator &tls, TimeSource &time_source,
+         std::string_view default_role_arn);
+
+  // Called on the workers, like StsCredentialsProvider::find.
+  StsConnectionPool::Context *
+  find(const absl::optional<std::string> &role_arn,
+       StsConnectionPool::Context::Callbacks *callbacks);
+
+  // Called on the main thread.
+  void setWebToken(std::string_view web_token);
+
+  // Fetches the credentials of the role ahead of the requests that need them,
+  // unless they were already. Called on the main thread.
+  void warm(const absl::optional<std::string> &role_arn);
+
+private:
+  SharedStsCredentialsProvider(StsCredentialsProviderPtr provider,
+                               Event::Dispatcher &dispatcher,
+                               ThreadLocal::SlotAllocator &tls,
+                               TimeSource &time_source,
+                               std::string_view default_role_arn);
+
+  // A request of a worker waiting for the main thread.
+  class WaitingContext : public StsConnectionPool::Context,
+                         public Event::DeferredDeletable,
+                         public Envoy::LinkedObject<WaitingContext> {
+  public:
+    WaitingContext(StsConnectionPool::Context::Callbacks *callbacks,
+                   std::list<std::unique_ptr<WaitingContext>> &list,
+                   Event::Dispatcher &dispatcher)
+        : callbacks_(callbacks), list_(list), dispatcher_(dispatcher) {}
+
+    StsConnectionPool::Context::Callbacks *callbacks() const override {
+      return callbacks_;
+    }
+
+    void cancel() override {
+      ASSERT(inserted());
+      if (inserted()) {
+        dispatcher_.deferredDelete(removeFromList(list_));
+      }
+    }
+
+  private:
+    StsConnectionPool::Context::Callbacks *callbacks_;
+    std::list<std::unique_ptr<WaitingContext>> &list_;
+    Event::Dispatcher &dispatcher_;
+  };
+
+  using WaitingContextPtr = std::unique_ptr<WaitingContext>;
+
+  // Whether a worker used the credentials of a role since the provider last
+  // asked, shared by all the workers.
+  using UsedFlagSharedPtr = std::shared_ptr<std::atomic<bool>>;
+
+  struct CachedCredentials {
+    StsCredentialsConstSharedPtr credentials_;
+    UsedFlagSharedPtr used_;
+  };
+
+  struct ThreadLocalCache : public ThreadLocal::ThreadLocalObject {
+    ThreadLocalCache(Event::Dispatcher &dispatcher) : dispatcher_(dispatcher) {}
+
+    Event::Dispatcher &dispatcher_;
+    // Credentials keyed by arn
+    std::unordered_map<std::string, CachedCredentials> credentials_;
+    // Requests waiting for credentials, keyed by arn
+    std::unordered_map<std::string, std::list<WaitingContextPtr>> waiting_;
+  };
+
+  // A fetch of the credentials of a role, on the main thread.
+  class Fetch : public StsConnectionPool::Context::Callbacks {
+  public:
+    Fetch(SharedStsCredentialsProvider &parent, std::string role_arn)
+        : parent_(parent), role_arn_(std::move(role_arn)) {}
+
+    void start();
+    void cancel();
+    // whether the credentials were fetched, or are being.
+    bool started() const { return in_flight_ || fetched_; }
+
+    void onSuccess(std::shared_ptr<const Envoy::Extensions::Common::Aws::
+                                       Credentials>) override;
+    void onFailure(CredentialsFailureStatus status) override;
+
+  private:
+    SharedStsCredentialsProvider &parent_;
+    const std::string role_arn_;
+    bool in_flight_{};
+    bool fetched_{};
+    StsConnectionPool::Context *context_{};
+  };
+
+  using FetchPtr = std::unique_ptr<Fetch>;
+
+  void fetch(const std::string &role_arn);
+  void publish(const std::string &role_arn,
+               StsCredentialsConstSharedPtr credentials);
+  void publishFailure(const std::string &role_arn,
+                      CredentialsFailureStatus status);
+
+  StsCredentialsProviderPtr provider_;
+  Event::Dispatcher &dispatcher_;
+  TimeSource &time_source_;
+  const std::string default_role_arn_;
+  ThreadLocal::TypedSlot<ThreadLocalCache> tls_;
+  // Fetches keyed by arn, only used on the main thread
+  std::unordered_map<std::string, FetchPtr> fetches_;
+  // Used flags of the published credentials keyed by arn, only used on the
+  // main thread
+  std::unordered_map<std::string, UsedFlagSharedPtr> used_;
+};
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
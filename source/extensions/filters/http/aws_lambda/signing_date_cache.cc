@@ -0,0 +1,51 @@
+#include "source/extensions/filters/http/aws_lambda/signing_date_cache.h"
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "fmt/format.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+void SigningDateCache::update(SystemTime now) {
+  const int64_t second =
+      std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch())
+          .count();
+  if (second == second_) {
+    return;
+  }
+  second_ = second;
+
+  const absl::CivilSecond civil =
+      absl::ToCivilSecond(absl::FromChrono(now), absl::UTCTimeZone());
+  request_date_time_ =
+      fmt::format("{:04d}{:02d}{:02d}T{:02d}{:02d}{:02d}Z", civil.year(),
+                  civil.month(), civil.day(), civil.hour(), civil.minute(),
+                  civil.second());
+  absl::string_view scope_date(request_date_time_.data(), 8);
+  if (scope_date != scope_date_) {
+    scope_date_ = std::string(scope_date);
+    scopes_.clear();
+  }
+}
+
+const std::string &
+SigningDateCache::credentialScope(absl::string_view region,
+                                  absl::string_view service) {
+  for (const CredentialScope &scope : scopes_) {
+    if (scope.region_ == region && scope.service_ == service) {
+      return scope.scope_;
+    }
+  }
+  scopes_.push_back(CredentialScope{
+      std::string(region), std::string(service),
+      absl::StrCat(scope_date_, "/", region, "/", service, "/aws4_request")});
+  return scopes_.back().scope_;
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
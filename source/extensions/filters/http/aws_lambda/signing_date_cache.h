@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "envoy/common/time.h"
+
+#include "absl/strings/string_view.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+/**
+ * The dates of SigV4 signatures, formatted once per second rather than on
+ * every signature: the x-amz-date value, the credential scope date and the
+ * credential scopes of the current date. It is not thread safe.
+ */
+class SigningDateCache {
+public:
+  // Formats the dates of now, unless they are already those of its second.
+  void update(SystemTime now);
+
+  // e.g. 20150830T123600Z.
+  const std::string &requestDateTime() const { return request_date_time_; }
+  // e.g. 20150830.
+  const std::string &scopeDate() const { return scope_date_; }
+  // e.g. 20150830/us-east-1/lambda/aws4_request.
+  const std::string &credentialScope(absl::string_view region,
+                                     absl::string_view service);
+
+private:
+  struct CredentialScope {
+    std::string region_;
+    std::string service_;
+    std::string scope_;
+  };
+
+  int64_t second_{-1};
+  std::string request_date_time_;
+  std::string scope_date_;
+  // the scopes of scope_date_, one per region and service. there are few, so
+  // a linear search is fastest.
+  std::vector<CredentialScope> scopes_;
+};
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
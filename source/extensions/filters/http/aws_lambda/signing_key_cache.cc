@@ -0,0 +1,42 @@
+#include "source/extensions/filters/http/aws_lambda/signing_key_cache.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+const SigningKeyCache::SigningKey *
+SigningKeyCache::find(absl::string_view access_key,
+                      absl::string_view secret_key, absl::string_view date,
+                      absl::string_view region,
+                      absl::string_view service) const {
+  for (const Entry &entry : entries_) {
+    if (entry.date_ == date && entry.access_key_ == access_key &&
+        entry.region_ == region && entry.service_ == service &&
+        entry.secret_key_ == secret_key) {
+      return &entry.key_;
+    }
+  }
+  return nullptr;
+}
+
+void SigningKeyCache::insert(absl::string_view access_key,
+                             absl::string_view secret_key,
+                             absl::string_view date, absl::string_view region,
+                             absl::string_view service,
+                             const SigningKey &key) {
+  Entry entry{std::string(access_key), std::string(secret_key),
+              std::string(date),       std::string(region),
+              std::string(service),    key};
+  if (entries_.size() < MAX_ENTRIES) {
+    entries_.push_back(std::move(entry));
+    return;
+  }
+  entries_[next_] = std::move(entry);
+  next_ = (next_ + 1) % MAX_ENTRIES;
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
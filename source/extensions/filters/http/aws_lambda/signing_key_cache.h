@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "openssl/sha.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+/**
+ * The SigV4 signing keys derived so far. A signing key only changes with the
+ * date or the credentials, so a cached key saves the four HMACs that derive
+ * it on every signature. It is not thread safe.
+ */
+class SigningKeyCache {
+public:
+  using SigningKey = std::array<uint8_t, SHA256_DIGEST_LENGTH>;
+
+  // Returns the key cached for the credentials, credential scope date, region
+  // and service, or nullptr.
+  const SigningKey *find(absl::string_view access_key,
+                         absl::string_view secret_key, absl::string_view date,
+                         absl::string_view region,
+                         absl::string_view service) const;
+
+  // Caches key, replacing the oldest entry if the cache is full.
+  void insert(absl::string_view access_key, absl::string_view secret_key,
+              absl::string_view date, absl::string_view region,
+              absl::string_view service, const SigningKey &key);
+
+  size_t size() const { return entries_.size(); }
+
+  // Only a few keys are live at a time (one per credentials and region), and
+  // the ones of past dates are never used again. Entries are replaced in
+  // turn, so a worker signing for more than MAX_ENTRIES credentials and
+  // region pairs in turn misses every time, and derives the key again.
+  static constexpr size_t MAX_ENTRIES = 16;
+
+private:
+  struct Entry {
+    std::string access_key_;
+    // the secret is part of the key, so credentials rotated under the same
+    // access key don't use a stale signing key.
+    std::string secret_key_;
+    std::string date_;
+    std::string region_;
+    std::string service_;
+    SigningKey key_;
+  };
+
+  // few entries, so a linear search, which doesn't allocate, is fastest.
+  std::vector<Entry> entries_;
+  // the entry insert() replaces once the cache is full.
+  size_t next_{};
+};
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
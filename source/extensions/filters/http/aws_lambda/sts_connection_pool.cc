@@ -8,6 +8,7 @@
 
 #include "source/extensions/common/aws/credentials_provider.h"
 #include "source/extensions/filters/http/aws_lambda/sts_fetcher.h"
+#include "source/extensions/filters/http/aws_lambda/sts_response_parser.h"
 
 #include "api/envoy/config/filter/http/aws_lambda/v2/aws_lambda.pb.validate.h"
 
@@ -139,35 +140,18 @@ void StsConnectionPoolImpl::onSuccess(const absl::string_view body) {
   ASSERT(!body.empty());
   request_in_flight_ = false;
 
-  // using a macro as we need to return on error
-  // TODO(yuval-k): we can use string_view instead of string when we upgrade to
-  // newer absl.
-  #define GET_PARAM(X)                                                         \
-    std::string X;                                                             \
-    {                                                                          \
-      std::match_results<absl::string_view::const_iterator> matched;           \
-      bool result = std::regex_search(body.begin(), body.end(), matched,       \
-                                      StsResponseRegex::get().regex_##X);      \
-      if (!result || !(matched.size() != 1)) {                                 \
-        ENVOY_LOG(trace, "response body did not contain " #X);                 \
-        onFailure(CredentialsFailureStatus::InvalidSts);                       \
-        return;                                                                \
-      }                                                                        \
-      const auto &sub_match = matched[1];                                      \
-      decltype(X) matched_sv(sub_match.first, sub_match.length());             \
-      X = std::move(matched_sv);                                               \
-    }
-
-  GET_PARAM(access_key);
-  GET_PARAM(secret_key);
-  GET_PARAM(session_token);
-  GET_PARAM(expiration);
+  StsResponse response;
+  if (!parseStsResponse(body, response)) {
+    ENVOY_LOG(trace, "response body did not contain the credentials");
+    onFailure(CredentialsFailureStatus::InvalidSts);
+    return;
+  }
 
   SystemTime expiration_time;
   absl::Time absl_expiration_time;
   std::string error;
-  if (absl::ParseTime(absl::RFC3339_sec, expiration, &absl_expiration_time,
-                      &error)) {
+  if (absl::ParseTime(absl::RFC3339_sec, response.expiration,
+                      &absl_expiration_time, &error)) {
     ENVOY_LOG(trace, "Determined expiration from STS credentials result");
     expiration_time = absl::ToChronoTime(absl_expiration_time);
   } else {
@@ -179,7 +163,8 @@ void StsConnectionPoolImpl::onSuccess(const absl::string_view body) {
   }
 
   StsCredentialsConstSharedPtr result = std::make_shared<const StsCredentials>(
-      access_key, secret_key, session_token, expiration_time);
+      response.access_key, response.secret_key, response.session_token,
+      expiration_time);
 
   ENVOY_LOG(trace, "{} sts connection success",
                      api_.timeSource().systemTime().time_since_epoch().count());
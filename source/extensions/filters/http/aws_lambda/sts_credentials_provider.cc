@@ -1,5 +1,7 @@
 #include "source/extensions/filters/http/aws_lambda/sts_credentials_provider.h"
 
+#include <algorithm>
+
 #include "envoy/api/api.h"
 #include "envoy/common/pure.h"
 #include "envoy/common/time.h"
@@ -25,6 +27,7 @@ public:
       const envoy::config::filter::http::aws_lambda::v2::
           AWSLambdaConfig_ServiceAccountCredentials &config,
       Api::Api &api, Upstream::ClusterManager &cm,
+      Event::Dispatcher &dispatcher,
       StsConnectionPoolFactoryPtr conn_pool_factory, std::string_view web_token,
       std::string_view role_arn);
 
@@ -34,6 +37,14 @@ public:
 
   void setWebToken(std::string_view web_token) override;
 
+  void setCredentialsUpdateCallback(StsCredentialsUpdateCb cb) override {
+    credentials_update_cb_ = std::move(cb);
+  }
+
+  void setCredentialsUsedCallback(StsCredentialsUsedCb cb) override {
+    credentials_used_cb_ = std::move(cb);
+  }
+
   void onResult(std::shared_ptr<const StsCredentials>,
               std::string role_arn, 
               std::list<std::string>  &chained_requests) override;            
@@ -41,8 +52,28 @@ public:
               std::list<std::string>  &chained_requests) override; 
 
 private:
+  // Returns the connection pool of the role, creating it if needed.
+  StsConnectionPool &connectionPool(const std::string &role_arn);
+  // Starts fetching credentials for the role, unless it already is.
+  StsConnectionPool &fetch(const std::string &role_arn);
+  // Arms the background refresh of the role's credentials.
+  void scheduleRefresh(const std::string &role_arn,
+                       const StsCredentials &credentials);
+  void refresh(const std::string &role_arn);
+
+  // The background refresh of a role.
+  struct Refresh {
+    Event::TimerPtr timer_;
+    // whether find() was called for the role since the last refresh.
+    bool used_{};
+    // whether the next refresh is the first of the current credentials, and
+    // not a retry, so it checks that they were used.
+    bool check_used_{};
+  };
+
   Api::Api &api_;
   Upstream::ClusterManager &cm_;
+  Event::Dispatcher &dispatcher_;
   const envoy::config::filter::http::aws_lambda::v2::
       AWSLambdaConfig_ServiceAccountCredentials config_;
 
@@ -57,15 +88,21 @@ private:
       credentials_cache_;
 
   std::unordered_map<std::string, StsConnectionPoolPtr> connection_pools_;
+  // Background refreshes, keyed by arn
+  std::unordered_map<std::string, Refresh> refreshes_;
+
+  StsCredentialsUpdateCb credentials_update_cb_;
+  StsCredentialsUsedCb credentials_used_cb_;
 };
 
 StsCredentialsProviderImpl::StsCredentialsProviderImpl(
   const envoy::config::filter::http::aws_lambda::v2::
       AWSLambdaConfig_ServiceAccountCredentials &config,
-  Api::Api &api, Upstream::ClusterManager &cm,
+  Api::Api &api, Upstream::ClusterManager &cm, Event::Dispatcher &dispatcher,
   StsConnectionPoolFactoryPtr conn_pool_factory, std::string_view web_token,
   std::string_view role_arn)
-  : api_(api), cm_(cm), config_(config), default_role_arn_(role_arn),
+  : api_(api), cm_(cm), dispatcher_(dispatcher), config_(config),
+    default_role_arn_(role_arn),
     conn_pool_factory_(std::move(conn_pool_factory)), web_token_(web_token) {
 
   uri_.set_cluster(config_.cluster());
@@ -85,7 +122,11 @@ void StsCredentialsProviderImpl::setWebToken(std::string_view web_token) {
 void StsCredentialsProviderImpl::onResult(
     std::shared_ptr<const StsCredentials> result, std::string role_arn,
     std::list<std::string> &chained_requests) {
-  credentials_cache_.emplace(role_arn, result);
+  credentials_cache_.insert_or_assign(role_arn, result);
+  scheduleRefresh(role_arn, *result);
+  if (credentials_update_cb_) {
+    credentials_update_cb_(role_arn, result);
+  }
 
   // kick off any waiting chained assumption roles relying on this credential
   while( !chained_requests.empty()){
@@ -126,6 +167,7 @@ StsConnectionPool::Context *StsCredentialsProviderImpl::find(
   ASSERT(!role_arn.empty());
 
   ENVOY_LOG(trace, "{}: Attempting to assume role ({})", __func__, role_arn);
+  refreshes_[role_arn].used_ = true;
 
   const auto existing_token = credentials_cache_.find(role_arn);
   if (existing_token != credentials_cache_.end()) {
@@ -140,21 +182,29 @@ StsConnectionPool::Context *StsCredentialsProviderImpl::find(
     // token is expired, fallthrough to create a new one
   }
 
-  // Look for active connection pool for given role_arn
+  // generate and return a context with the current callbacks
+  return fetch(role_arn).add(callbacks);
+};
+
+StsConnectionPool &
+StsCredentialsProviderImpl::connectionPool(const std::string &role_arn) {
   auto conn_pool = connection_pools_.find(role_arn);
-  if (conn_pool != connection_pools_.end()) {
-    // We have an existing connection pool, 
-    // check if there is already a request in flight
-    if (conn_pool->second->requestInFlight()) {
-     // add new context to connection pool and return it to the caller
-     return conn_pool->second->add(callbacks);
-    }
-  }else{
-     // since there is no existing connection pool then we need to create one
-     conn_pool =  connection_pools_
-          .emplace(role_arn, conn_pool_factory_->build(
-              role_arn, this, StsFetcher::create(cm_, api_)))
-          .first;
+  if (conn_pool == connection_pools_.end()) {
+    conn_pool = connection_pools_
+                    .emplace(role_arn, conn_pool_factory_->build(
+                                           role_arn, this,
+                                           StsFetcher::create(cm_, api_)))
+                    .first;
+  }
+  return *conn_pool->second;
+}
+
+StsConnectionPool &
+StsCredentialsProviderImpl::fetch(const std::string &role_arn) {
+  StsConnectionPool &conn_pool = connectionPool(role_arn);
+  // check if there is already a request in flight
+  if (conn_pool.requestInFlight()) {
+    return conn_pool;
   }
 
   // Short circuit any additional checks if we are the base arn
@@ -164,8 +214,8 @@ StsConnectionPool::Context *StsCredentialsProviderImpl::find(
   if (role_arn == default_role_arn_  || Runtime::getInteger(
                 "envoy.reloadable_features.aws_lambda.sts_chaining", 1) ==0 ){
     // initialize the connection and subscribe to the callbacks
-    conn_pool->second->init(uri_, web_token_, NULL);
-    return conn_pool->second->add(callbacks);
+    conn_pool.init(uri_, web_token_, NULL);
+    return conn_pool;
   }
 
   // For chaining check to see if we need to get the base token in addition.
@@ -177,31 +227,76 @@ StsConnectionPool::Context *StsCredentialsProviderImpl::find(
     auto time_left = existing_base_token->second->expirationTime() - now;
     if (time_left > REFRESH_GRACE_PERIOD) {
       ENVOY_LOG(trace,"found base token with remaining time");
-      conn_pool->second->init(uri_, web_token_, existing_base_token->second);
-      return conn_pool->second->add(callbacks);
+      conn_pool.init(uri_, web_token_, existing_base_token->second);
+      return conn_pool;
     }
   }
   
   // find/create default connection pool
-  auto base_conn_pool = connection_pools_.find(default_role_arn_);
-  if (base_conn_pool == connection_pools_.end()) {
-     base_conn_pool =  connection_pools_
-          .emplace(default_role_arn_, conn_pool_factory_->build(
-            default_role_arn_, this, 
-            StsFetcher::create(cm_, api_))).first;
-  }
+  StsConnectionPool &base_conn_pool = connectionPool(default_role_arn_);
   // only recreate base request if its not in flight
-  if (!base_conn_pool->second->requestInFlight()) {
-   base_conn_pool->second->init(uri_, web_token_, NULL);
+  if (!base_conn_pool.requestInFlight()) {
+   base_conn_pool.init(uri_, web_token_, NULL);
   }
-  base_conn_pool->second->addChained(role_arn);
-
+  base_conn_pool.addChained(role_arn);
 
   // initialize the connection but dont fetch as we are waiting on base conn
-  conn_pool->second->setInFlight();
-  // generate and return a context with the current callbacks
-  return conn_pool->second->add(callbacks);
-};
+  conn_pool.setInFlight();
+  return conn_pool;
+}
+
+void StsCredentialsProviderImpl::scheduleRefresh(
+    const std::string &role_arn, const StsCredentials &credentials) {
+  Refresh &state = refreshes_[role_arn];
+  if (state.timer_ == nullptr) {
+    state.timer_ =
+        dispatcher_.createTimer([this, role_arn] { refresh(role_arn); });
+  }
+  state.check_used_ = true;
+
+  // Refresh before the grace period, so that requests never have to wait for
+  // STS. The jitter spreads the refreshes of the Envoys sharing the role.
+  const auto jitter = std::chrono::milliseconds(
+      api_.randomGenerator().random() %
+      std::chrono::milliseconds(REFRESH_JITTER).count());
+  const auto refresh_in = credentials.expirationTime() -
+                          api_.timeSource().systemTime() -
+                          REFRESH_GRACE_PERIOD - jitter;
+  // Credentials that are already within the grace period (short sessions,
+  // clock skew) would otherwise re-arm the timer to fire at once after every
+  // fetch, and call STS in a tight loop.
+  state.timer_->enableTimer(std::max(
+      std::chrono::duration_cast<std::chrono::milliseconds>(refresh_in),
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          REFRESH_RETRY_INTERVAL)));
+}
+
+void StsCredentialsProviderImpl::refresh(const std::string &role_arn) {
+  auto state = refreshes_.find(role_arn);
+  ASSERT(state != refreshes_.end());
+  if (state->second.check_used_) {
+    const bool used = state->second.used_ ||
+                      (credentials_used_cb_ && credentials_used_cb_(role_arn));
+    if (!used) {
+      ENVOY_LOG(debug, "no longer refreshing unused sts credentials for {}",
+                role_arn);
+      // role_arn belongs to the callback of the timer that is running, so
+      // the timer is destroyed once it returns.
+      std::shared_ptr<Event::Timer> timer = std::move(state->second.timer_);
+      refreshes_.erase(state);
+      dispatcher_.post([timer]() {});
+      return;
+    }
+    state->second.used_ = false;
+    state->second.check_used_ = false;
+  }
+
+  ENVOY_LOG(debug, "refreshing sts credentials for {}", role_arn);
+  fetch(role_arn);
+  // A successful refresh re-arms the timer for the new credentials, this is
+  // only left armed if it fails.
+  refreshes_[role_arn].timer_->enableTimer(REFRESH_RETRY_INTERVAL);
+}
 
 class StsCredentialsProviderFactoryImpl : public StsCredentialsProviderFactory {
 public:
@@ -226,19 +321,19 @@ StsCredentialsProviderPtr StsCredentialsProviderFactoryImpl::build(
     std::string_view role_arn) const {
 
   return StsCredentialsProvider::create(
-      config, api_, cm_, StsConnectionPoolFactory::create(api_, dispatcher),
-      web_token, role_arn);
+      config, api_, cm_, dispatcher,
+      StsConnectionPoolFactory::create(api_, dispatcher), web_token, role_arn);
 };
 
 StsCredentialsProviderPtr StsCredentialsProvider::create(
     const envoy::config::filter::http::aws_lambda::v2::
         AWSLambdaConfig_ServiceAccountCredentials &config,
-    Api::Api &api, Upstream::ClusterManager &cm,
+    Api::Api &api, Upstream::ClusterManager &cm, Event::Dispatcher &dispatcher,
     StsConnectionPoolFactoryPtr factory, std::string_view web_token,
     std::string_view role_arn) {
 
   return std::make_unique<StsCredentialsProviderImpl>(
-      config, api, cm, std::move(factory), web_token, role_arn);
+      config, api, cm, dispatcher, std::move(factory), web_token, role_arn);
 }
 
 StsCredentialsProviderFactoryPtr
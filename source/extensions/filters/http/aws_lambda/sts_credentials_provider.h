@@ -21,11 +21,27 @@ constexpr char AWS_ROLE_ARN[] = "AWS_ROLE_ARN";
 constexpr char AWS_WEB_IDENTITY_TOKEN_FILE[] = "AWS_WEB_IDENTITY_TOKEN_FILE";
 
 constexpr std::chrono::minutes REFRESH_GRACE_PERIOD{5};
+// Cached credentials are refreshed in the background up to this much before
+// the grace period, so that the Envoys of a fleet that fetched a role
+// together (e.g. when they were all started by a rollout) don't all call STS
+// at once again.
+constexpr std::chrono::minutes REFRESH_JITTER{1};
+// How long to wait before trying again when a background refresh failed.
+constexpr std::chrono::seconds REFRESH_RETRY_INTERVAL{30};
 } // namespace
 
 class StsCredentialsProvider;
 using StsCredentialsProviderPtr = std::unique_ptr<StsCredentialsProvider>;
 
+// Called with the role arn and the credentials every time new credentials are
+// fetched, including by background refreshes.
+using StsCredentialsUpdateCb = std::function<void(
+    const std::string &role_arn, StsCredentialsConstSharedPtr credentials)>;
+
+// Asked before a background refresh whether the credentials of the role were
+// used, other than through find(), since the last time it was asked.
+using StsCredentialsUsedCb = std::function<bool(const std::string &role_arn)>;
+
 class StsCredentialsProvider {
 public:
   virtual ~StsCredentialsProvider() = default;
@@ -37,12 +53,19 @@ public:
 
   virtual void setWebToken(std::string_view web_token) PURE;
 
+  virtual void setCredentialsUpdateCallback(StsCredentialsUpdateCb cb) PURE;
+
+  // The credentials of a role that isn't used for as long as they last are
+  // no longer refreshed in the background, they are fetched again by the
+  // next find() that needs them.
+  virtual void setCredentialsUsedCallback(StsCredentialsUsedCb cb) PURE;
+
   static StsCredentialsProviderPtr
   create(const envoy::config::filter::http::aws_lambda::v2::
              AWSLambdaConfig_ServiceAccountCredentials &config,
          Api::Api &api, Upstream::ClusterManager &cm,
-         StsConnectionPoolFactoryPtr factory, std::string_view web_token,
-         std::string_view role_arn);
+         Event::Dispatcher &dispatcher, StsConnectionPoolFactoryPtr factory,
+         std::string_view web_token, std::string_view role_arn);
 };
 
 class StsCredentialsProviderFactory;
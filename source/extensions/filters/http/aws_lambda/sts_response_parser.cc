@@ -0,0 +1,63 @@
+#include "source/extensions/filters/http/aws_lambda/sts_response_parser.h"
+
+#include <cstdint>
+#include <iterator>
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+namespace {
+
+struct StsField {
+  absl::string_view name;
+  absl::string_view close_tag;
+  absl::string_view StsResponse::*value;
+};
+
+constexpr StsField StsFields[] = {
+    {"AccessKeyId", "</AccessKeyId>", &StsResponse::access_key},
+    {"SecretAccessKey", "</SecretAccessKey>", &StsResponse::secret_key},
+    {"SessionToken", "</SessionToken>", &StsResponse::session_token},
+    {"Expiration", "</Expiration>", &StsResponse::expiration},
+};
+
+constexpr uint32_t AllStsFields = (1 << std::size(StsFields)) - 1;
+
+} // namespace
+
+bool parseStsResponse(absl::string_view body, StsResponse &response) {
+  uint32_t found = 0;
+  size_t pos = body.find('<');
+  while (pos != absl::string_view::npos && found != AllStsFields) {
+    const absl::string_view tag = body.substr(pos + 1);
+    // the end of the element we are at, if it is one of the fields.
+    size_t next = pos + 1;
+    for (uint32_t i = 0; i < std::size(StsFields); i++) {
+      const StsField &field = StsFields[i];
+      if ((found & (1 << i)) != 0 || tag.size() <= field.name.size() ||
+          tag[field.name.size()] != '>' ||
+          tag.substr(0, field.name.size()) != field.name) {
+        continue;
+      }
+      const size_t value_start = pos + 1 + field.name.size() + 1;
+      const size_t value_end = body.find(field.close_tag, value_start);
+      if (value_end == absl::string_view::npos) {
+        // no later element of this name can be closed either.
+        return false;
+      }
+      response.*field.value = body.substr(value_start, value_end - value_start);
+      found |= 1 << i;
+      next = value_end + field.close_tag.size();
+      break;
+    }
+    pos = body.find('<', next);
+  }
+  return found == AllStsFields;
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,7 +1,8 @@
 #pragma once
 
-#include "source/common/common/regex.h"
-#include "source/common/singleton/const_singleton.h"
+#include <chrono>
+
+#include "absl/strings/string_view.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -24,34 +25,22 @@ constexpr std::chrono::milliseconds DUPE_REFRESH_STS_CREDS =
     std::chrono::minutes(10);
 
 } // namespace
-
-
-class StsResponseRegexValues {
-public:
-  StsResponseRegexValues() {
-
-    // Initialize regex strings, should never fail
-    regex_access_key =
-        Regex::Utility::parseStdRegex("<AccessKeyId>(.*?)</AccessKeyId>");
-    regex_secret_key = Regex::Utility::parseStdRegex(
-        "<SecretAccessKey>(.*?)</SecretAccessKey>");
-    regex_session_token =
-        Regex::Utility::parseStdRegex("<SessionToken>(.*?)</SessionToken>");
-    regex_expiration =
-        Regex::Utility::parseStdRegex("<Expiration>(.*?)</Expiration>");
-  };
-
-  std::regex regex_access_key;
-
-  std::regex regex_secret_key;
-
-  std::regex regex_session_token;
-
-  std::regex regex_expiration;
+/**
+ * The credentials of an AssumeRoleWithWebIdentityResponse. They point into the
+ * parsed body.
+ */
+struct StsResponse {
+  absl::string_view access_key;
+  absl::string_view secret_key;
+  absl::string_view session_token;
+  absl::string_view expiration;
 };
 
-using StsResponseRegex = ConstSingleton<StsResponseRegexValues>;
-
+/**
+ * Finds the credentials in an STS response body in a single pass, taking the
+ * first occurrence of each element. Returns false if any of them is missing.
+ */
+bool parseStsResponse(absl::string_view body, StsResponse &response);
 
 } // namespace AwsLambda
 } // namespace HttpFilters
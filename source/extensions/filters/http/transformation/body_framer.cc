@@ -0,0 +1,138 @@
+#include "source/extensions/filters/http/transformation/body_framer.h"
+
+#include "source/common/protobuf/utility.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+namespace {
+
+constexpr uint32_t DEFAULT_MAX_FRAME_SIZE = 1024 * 1024;
+
+// gRPC frame header: one flags byte followed by a big endian 32 bit length.
+constexpr uint64_t GRPC_FRAME_HEADER_SIZE = 5;
+constexpr uint8_t GRPC_FH_COMPRESSED = 0x1;
+// gRPC-web sends the trailers as a frame with the high bit of the flags set.
+constexpr uint8_t GRPC_FH_TRAILERS = 0x80;
+
+class GrpcBodyFramer : public BodyFramer {
+public:
+  GrpcBodyFramer(uint32_t max_frame_size) : max_frame_size_(max_frame_size) {}
+
+  Status decode(Buffer::Instance &data, bool end_stream,
+                Buffer::Instance &output,
+                const FrameCallback &transform_frame) override {
+    buffer_.move(data);
+    while (buffer_.length() >= GRPC_FRAME_HEADER_SIZE) {
+      const uint8_t flags = buffer_.peekInt<uint8_t>(0);
+      const uint32_t length = buffer_.peekBEInt<uint32_t>(1);
+      if (length > max_frame_size_) {
+        return Status::FrameTooLarge;
+      }
+      if (buffer_.length() < GRPC_FRAME_HEADER_SIZE + length) {
+        break;
+      }
+      buffer_.drain(GRPC_FRAME_HEADER_SIZE);
+      Buffer::OwnedImpl payload;
+      payload.move(buffer_, length);
+      // we can't template a compressed message or the trailers, forward them
+      // as they are.
+      if ((flags & (GRPC_FH_COMPRESSED | GRPC_FH_TRAILERS)) == 0) {
+        transform_frame(payload);
+      }
+      output.writeByte(flags);
+      output.writeBEInt<uint32_t>(payload.length());
+      output.move(payload);
+    }
+    if (end_stream && buffer_.length() != 0) {
+      return Status::IncompleteFrame;
+    }
+    return Status::Ok;
+  }
+
+private:
+  const uint32_t max_frame_size_;
+  Buffer::OwnedImpl buffer_;
+};
+
+class NewlineBodyFramer : public BodyFramer {
+public:
+  NewlineBodyFramer(uint32_t max_frame_size)
+      : max_frame_size_(max_frame_size) {}
+
+  Status decode(Buffer::Instance &data, bool end_stream,
+                Buffer::Instance &output,
+                const FrameCallback &transform_frame) override {
+    buffer_.move(data);
+    while (true) {
+      // don't rescan the bytes of a partial line we already searched.
+      const ssize_t pos = buffer_.search("\n", 1, scanned_);
+      if (pos == -1) {
+        scanned_ = buffer_.length();
+        break;
+      }
+      if (static_cast<uint64_t>(pos) > max_frame_size_) {
+        return Status::FrameTooLarge;
+      }
+      // a CRLF line is transformed without its \r, which is put back after.
+      const bool crlf = pos > 0 && buffer_.peekInt<uint8_t>(pos - 1) == '\r';
+      Buffer::OwnedImpl payload;
+      payload.move(buffer_, crlf ? pos - 1 : pos);
+      buffer_.drain(crlf ? 2 : 1);
+      scanned_ = 0;
+      emit(payload, output, transform_frame);
+      if (crlf) {
+        output.add("\r\n", 2);
+      } else {
+        output.add("\n", 1);
+      }
+    }
+    if (buffer_.length() > max_frame_size_) {
+      return Status::FrameTooLarge;
+    }
+    if (end_stream && buffer_.length() != 0) {
+      // the last line doesn't have to be terminated.
+      emit(buffer_, output, transform_frame);
+      scanned_ = 0;
+    }
+    return Status::Ok;
+  }
+
+private:
+  static void emit(Buffer::Instance &payload, Buffer::Instance &output,
+                   const FrameCallback &transform_frame) {
+    // empty lines separate server-sent events; keep them as they are.
+    if (payload.length() != 0) {
+      transform_frame(payload);
+    }
+    output.move(payload);
+  }
+
+  const uint32_t max_frame_size_;
+  Buffer::OwnedImpl buffer_;
+  uint64_t scanned_{};
+};
+
+} // namespace
+
+BodyFramerPtr
+BodyFramer::create(const envoy::api::v2::filter::http::BodyFraming &config) {
+  const uint32_t max_frame_size =
+      PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_frame_size,
+                                      DEFAULT_MAX_FRAME_SIZE);
+  switch (config.framing()) {
+  case envoy::api::v2::filter::http::BodyFraming::GRPC:
+    return std::make_unique<GrpcBodyFramer>(max_frame_size);
+  case envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED:
+    return std::make_unique<NewlineBodyFramer>(max_frame_size);
+  default:
+    throw EnvoyException("unknown body framing");
+  }
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
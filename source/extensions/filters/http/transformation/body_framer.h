@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "envoy/buffer/buffer.h"
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "api/envoy/config/filter/http/transformation/v2/transformation_filter.pb.validate.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+class BodyFramer;
+using BodyFramerPtr = std::unique_ptr<BodyFramer>;
+
+/**
+ * Splits a streamed body into messages so that each message can be
+ * transformed on its own. Only the message currently being assembled is
+ * buffered, and it is bounded by the configured max frame size.
+ */
+class BodyFramer {
+public:
+  virtual ~BodyFramer() = default;
+
+  enum class Status {
+    Ok,
+    // A message is larger than the max frame size.
+    FrameTooLarge,
+    // The stream ended in the middle of a message.
+    IncompleteFrame,
+  };
+
+  // Transforms a single message payload in place.
+  using FrameCallback = std::function<void(Buffer::Instance &payload)>;
+
+  /**
+   * Moves data into the framer and transforms every complete message.
+   * @param data the newly arrived body bytes. fully drained by this call.
+   * @param end_stream whether this is the last data of the stream.
+   * @param output receives the re-framed transformed messages.
+   * @param transform_frame invoked with the payload of each message.
+   */
+  virtual Status decode(Buffer::Instance &data, bool end_stream,
+                        Buffer::Instance &output,
+                        const FrameCallback &transform_frame) PURE;
+
+  static BodyFramerPtr
+  create(const envoy::api::v2::filter::http::BodyFraming &config);
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
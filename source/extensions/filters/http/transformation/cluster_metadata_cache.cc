@@ -0,0 +1,38 @@
+#include "source/extensions/filters/http/transformation/cluster_metadata_cache.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+ClusterMetadataCache::Values &
+ClusterMetadataCache::values(const Upstream::ClusterInfoConstSharedPtr &cluster) {
+  auto it = entries_.find(cluster.get());
+  if (it != entries_.end()) {
+    // the address may have been reused by a newer ClusterInfo.
+    if (it->second.cluster_.lock() == cluster) {
+      return it->second.values_;
+    }
+    entries_.erase(it);
+  }
+
+  // a new cluster (or a new version of one); drop the clusters that are gone.
+  for (auto entry = entries_.begin(); entry != entries_.end();) {
+    if (entry->second.cluster_.expired()) {
+      entries_.erase(entry++);
+    } else {
+      ++entry;
+    }
+  }
+  Entry &entry = entries_[cluster.get()];
+  entry.cluster_ = cluster;
+  for (const std::string &key : keys_) {
+    entry.values_[key];
+  }
+  return entry.values_;
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/thread_local/thread_local.h"
+#include "envoy/upstream/upstream.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
+#include "nlohmann/json.hpp"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+/**
+ * Remembers the values clusterMetadata() rendered for each cluster. Cluster
+ * metadata only changes on CDS updates, and those replace the ClusterInfo, so
+ * the values of a cluster are kept until its ClusterInfo is replaced. Only the
+ * keys the templates pass as literals are kept, so the cache is bounded by
+ * the config rather than by the requests. There is one per worker, so it is
+ * not thread safe.
+ */
+class ClusterMetadataCache : public ThreadLocal::ThreadLocalObject {
+public:
+  // rendered value by metadata key. a null value wasn't rendered yet.
+  using Values = absl::flat_hash_map<std::string, nlohmann::json>;
+
+  explicit ClusterMetadataCache(std::vector<std::string> keys)
+      : keys_(std::move(keys)) {}
+
+  // Returns the values rendered for cluster so far, with an entry for each of
+  // the cached keys. The reference is valid until the next call.
+  Values &values(const Upstream::ClusterInfoConstSharedPtr &cluster);
+
+  uint64_t size() const { return entries_.size(); }
+
+private:
+  struct Entry {
+    std::weak_ptr<const Upstream::ClusterInfo> cluster_;
+    Values values_;
+  };
+
+  const std::vector<std::string> keys_;
+  absl::node_hash_map<const Upstream::ClusterInfo *, Entry> entries_;
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,156 @@
+#include "source/extensions/filters/http/transformation/content_encoding.h"
+
+#include <memory>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/utility.h"
+#include "source/common/http/headers.h"
+
+#include "absl/strings/match.h"
+#include "zlib.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+namespace {
+
+constexpr uint64_t CHUNK_SIZE = 16 * 1024;
+
+// 15 is the largest window zlib supports, adding 16 selects the gzip wrapper
+// instead of the zlib one.
+constexpr int DEFLATE_WINDOW_BITS = 15;
+constexpr int GZIP_WINDOW_BITS = DEFLATE_WINDOW_BITS + 16;
+constexpr int MEMORY_LEVEL = 8;
+
+// the encodings Http::CustomHeaders doesn't name.
+struct ExtraContentEncodingValues {
+  const std::string XGzip = "x-gzip";
+  const std::string Deflate = "deflate";
+};
+using ExtraContentEncodings = ConstSingleton<ExtraContentEncodingValues>;
+
+int windowBits(ContentEncoding::Type type) {
+  return type == ContentEncoding::Type::Gzip ? GZIP_WINDOW_BITS
+                                             : DEFLATE_WINDOW_BITS;
+}
+
+} // namespace
+
+ContentEncoding::Type ContentEncoding::fromHeaders(
+    const Http::RequestOrResponseHeaderMap &header_map) {
+  const auto result =
+      header_map.get(Http::CustomHeaders::get().ContentEncoding);
+  if (result.size() != 1) {
+    return Type::Identity;
+  }
+  const absl::string_view value =
+      StringUtil::trim(result[0]->value().getStringView());
+  if (absl::EqualsIgnoreCase(
+          value, Http::CustomHeaders::get().ContentEncodingValues.Gzip) ||
+      absl::EqualsIgnoreCase(value, ExtraContentEncodings::get().XGzip)) {
+    return Type::Gzip;
+  }
+  if (absl::EqualsIgnoreCase(value, ExtraContentEncodings::get().Deflate)) {
+    return Type::Deflate;
+  }
+  return Type::Identity;
+}
+
+void ContentEncoding::inflate(Type type, const Buffer::Instance &input,
+                              Buffer::Instance &output, uint64_t max_size) {
+  ASSERT(type != Type::Identity);
+  if (input.length() == 0) {
+    // e.g. a HEAD response or an empty body that still carries its header.
+    return;
+  }
+  z_stream zstream{};
+  if (inflateInit2(&zstream, windowBits(type)) != Z_OK) {
+    throw EnvoyException("failed to initialize inflate");
+  }
+  std::unique_ptr<z_stream, int (*)(z_streamp)> cleanup(&zstream,
+                                                        &inflateEnd);
+
+  uint64_t inflated = 0;
+  int result = Z_OK;
+  for (const Buffer::RawSlice &slice : input.getRawSlices()) {
+    zstream.next_in = static_cast<Bytef *>(slice.mem_);
+    zstream.avail_in = slice.len_;
+    // keep going while there is input left, or while the last call filled
+    // the whole output slice and may have more to give.
+    do {
+      Buffer::ReservationSingleSlice reservation =
+          output.reserveSingleSlice(CHUNK_SIZE);
+      const uint64_t available = reservation.slice().len_;
+      zstream.next_out = static_cast<Bytef *>(reservation.slice().mem_);
+      zstream.avail_out = available;
+      result = ::inflate(&zstream, Z_NO_FLUSH);
+      if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        throw EnvoyException("failed to inflate body");
+      }
+      const uint64_t produced = available - zstream.avail_out;
+      reservation.commit(produced);
+      inflated += produced;
+      if (inflated > max_size) {
+        throw EnvoyException("inflated body too large");
+      }
+      if (result == Z_BUF_ERROR) {
+        // no progress is possible until more input arrives.
+        break;
+      }
+    } while (result != Z_STREAM_END &&
+             (zstream.avail_in > 0 || zstream.avail_out == 0));
+    if (result == Z_STREAM_END) {
+      break;
+    }
+  }
+
+  if (result != Z_STREAM_END) {
+    throw EnvoyException("truncated compressed body");
+  }
+}
+
+void ContentEncoding::deflate(Type type, Buffer::Instance &input,
+                              Buffer::Instance &output) {
+  ASSERT(type != Type::Identity);
+  z_stream zstream{};
+  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   windowBits(type), MEMORY_LEVEL,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw EnvoyException("failed to initialize deflate");
+  }
+  std::unique_ptr<z_stream, int (*)(z_streamp)> cleanup(&zstream,
+                                                        &deflateEnd);
+
+  auto run = [&](int flush) {
+    int result;
+    do {
+      Buffer::ReservationSingleSlice reservation =
+          output.reserveSingleSlice(CHUNK_SIZE);
+      const uint64_t available = reservation.slice().len_;
+      zstream.next_out = static_cast<Bytef *>(reservation.slice().mem_);
+      zstream.avail_out = available;
+      result = ::deflate(&zstream, flush);
+      if (result == Z_STREAM_ERROR) {
+        throw EnvoyException("failed to deflate body");
+      }
+      reservation.commit(available - zstream.avail_out);
+    } while (zstream.avail_out == 0 ||
+             (flush == Z_FINISH && result != Z_STREAM_END));
+  };
+
+  for (const Buffer::RawSlice &slice : input.getRawSlices()) {
+    zstream.next_in = static_cast<Bytef *>(slice.mem_);
+    zstream.avail_in = slice.len_;
+    run(Z_NO_FLUSH);
+  }
+  run(Z_FINISH);
+  input.drain(input.length());
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
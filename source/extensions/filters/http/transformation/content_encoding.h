@@ -0,0 +1,49 @@
+#pragma once
+
+#include "envoy/buffer/buffer.h"
+#include "envoy/http/header_map.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+/**
+ * Inflates and deflates gzip and deflate encoded bodies. The data is streamed
+ * through zlib straight into the slices of the output buffer, so no
+ * intermediate contiguous copy of the body is made.
+ */
+class ContentEncoding {
+public:
+  enum class Type {
+    Identity,
+    Gzip,
+    Deflate,
+  };
+
+  /**
+   * @return the content encoding of the body. Identity is returned for
+   * anything we can't inflate, including stacked encodings.
+   */
+  static Type fromHeaders(const Http::RequestOrResponseHeaderMap &header_map);
+
+  /**
+   * Inflates input into output. input is left untouched, and an empty input
+   * inflates to an empty body.
+   * Throws EnvoyException if the input is corrupt or if the inflated body is
+   * larger than max_size.
+   */
+  static void inflate(Type type, const Buffer::Instance &input,
+                      Buffer::Instance &output, uint64_t max_size);
+
+  /**
+   * Compresses input into output with the given encoding. input is drained.
+   */
+  static void deflate(Type type, Buffer::Instance &input,
+                      Buffer::Instance &output);
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,388 @@
+#include "source/extensions/filters/http/transformation/fused_transformation_filter.h"
+
+#include "source/common/common/enum_to_int.h"
+#include "source/common/http/utility.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+namespace {
+
+struct RcDetailsValues {
+  const std::string TransformError = "transformation_filter_error";
+};
+typedef ConstSingleton<RcDetailsValues> RcDetails;
+
+} // namespace
+
+FusedTransformationFilter::FusedTransformationFilter(
+    FilterConfigSharedPtr config)
+    : filter_config_(config) {}
+
+void FusedTransformationFilter::onDestroy() {
+  destroyed_ = true;
+  request_body_.drain(request_body_.length());
+  response_body_.drain(response_body_.length());
+}
+
+Http::FilterHeadersStatus
+FusedTransformationFilter::decodeHeaders(Http::RequestHeaderMap &headers,
+                                         bool end_stream) {
+  request_headers_ = &headers;
+  request_body_complete_ = end_stream;
+  resolveRouteConfig();
+
+  const StagesResult result = runRequestStages(true);
+  if (result == StagesResult::Error) {
+    requestError();
+    return Http::FilterHeadersStatus::StopIteration;
+  }
+  if (result == StagesResult::NeedBody) {
+    return Http::FilterHeadersStatus::StopIteration;
+  }
+  if (request_body_.length() > 0) {
+    // a headers only request got a body from one of the stages.
+    decoder_callbacks_->addDecodedData(request_body_, false);
+  }
+  return Http::FilterHeadersStatus::Continue;
+}
+
+Http::FilterDataStatus
+FusedTransformationFilter::decodeData(Buffer::Instance &data,
+                                      bool end_stream) {
+  if (request_transformation_ == nullptr) {
+    return Http::FilterDataStatus::Continue;
+  }
+
+  request_body_.move(data);
+  if ((decoder_buffer_limit_ != 0) &&
+      (request_body_.length() > decoder_buffer_limit_)) {
+    error(Http::Code::PayloadTooLarge, "payload too large");
+    requestError();
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  }
+
+  if (end_stream) {
+    return finishRequestBody();
+  }
+  if (request_transformation_->canTransform(request_body_, false)) {
+    // the stage has the prefix of the body it reads.
+    return continueRequestBody();
+  }
+  return Http::FilterDataStatus::StopIterationNoBuffer;
+}
+
+Http::FilterTrailersStatus
+FusedTransformationFilter::decodeTrailers(Http::RequestTrailerMap &) {
+  if (request_transformation_ == nullptr) {
+    return Http::FilterTrailersStatus::Continue;
+  }
+  return finishRequestBody() == Http::FilterDataStatus::Continue
+             ? Http::FilterTrailersStatus::Continue
+             : Http::FilterTrailersStatus::StopIteration;
+}
+
+Http::FilterHeadersStatus
+FusedTransformationFilter::encodeHeaders(Http::ResponseHeaderMap &headers,
+                                         bool end_stream) {
+  response_headers_ = &headers;
+  response_body_complete_ = end_stream;
+  if (error_code_.has_value()) {
+    // this is our own local reply.
+    return Http::FilterHeadersStatus::Continue;
+  }
+
+  const StagesResult result = runResponseStages(true);
+  if (result == StagesResult::Error) {
+    responseError();
+  } else if (result == StagesResult::NeedBody) {
+    return Http::FilterHeadersStatus::StopIteration;
+  } else if (response_body_.length() > 0) {
+    encoder_callbacks_->addEncodedData(response_body_, false);
+  }
+  return destroyed_ ? Http::FilterHeadersStatus::StopIteration
+                    : Http::FilterHeadersStatus::Continue;
+}
+
+Http::FilterDataStatus
+FusedTransformationFilter::encodeData(Buffer::Instance &data,
+                                      bool end_stream) {
+  if (response_transformation_ == nullptr) {
+    return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer
+                      : Http::FilterDataStatus::Continue;
+  }
+
+  response_body_.move(data);
+  if ((encoder_buffer_limit_ != 0) &&
+      (response_body_.length() > encoder_buffer_limit_)) {
+    error(Http::Code::PayloadTooLarge, "payload too large");
+    responseError();
+    return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer
+                      : Http::FilterDataStatus::Continue;
+  }
+
+  if (end_stream) {
+    return finishResponseBody();
+  }
+  if (response_transformation_->canTransform(response_body_, false)) {
+    return continueResponseBody();
+  }
+  return Http::FilterDataStatus::StopIterationNoBuffer;
+}
+
+Http::FilterTrailersStatus
+FusedTransformationFilter::encodeTrailers(Http::ResponseTrailerMap &) {
+  if (response_transformation_ == nullptr) {
+    return destroyed_ ? Http::FilterTrailersStatus::StopIteration
+                      : Http::FilterTrailersStatus::Continue;
+  }
+  return finishResponseBody() == Http::FilterDataStatus::Continue
+             ? Http::FilterTrailersStatus::Continue
+             : Http::FilterTrailersStatus::StopIteration;
+}
+
+void FusedTransformationFilter::onStreamComplete() {
+  if (on_stream_completion_transformations_.empty()) {
+    return;
+  }
+
+  // response_headers_ is a nullptr if the client disconnected before the
+  // response started.
+  for (const auto &transformation : on_stream_completion_transformations_) {
+    try {
+      transformation->transformOnStreamCompletion(
+          response_headers_, request_headers_, *encoder_callbacks_);
+    } catch (std::exception &e) {
+      ENVOY_STREAM_LOG(debug, "failure transforming on stream completion {}",
+                       *encoder_callbacks_, e.what());
+      filter_config_->stats().on_stream_complete_error_.inc();
+    }
+  }
+}
+
+void FusedTransformationFilter::resolveRouteConfig() {
+  route_ = decoder_callbacks_->route();
+  route_config_ =
+      Http::Utility::resolveMostSpecificPerFilterConfig<RouteFilterConfig>(
+          filter_config_->name(), route_);
+}
+
+const TransformConfig *
+FusedTransformationFilter::configForStage(uint32_t stage) const {
+  if (route_config_ != nullptr) {
+    const TransformConfig *staged_config =
+        route_config_->transformConfigForStage(stage);
+    if (staged_config != nullptr) {
+      return staged_config;
+    }
+  }
+  // the listener level transformations belong to this filter's stage only.
+  return stage == filter_config_->stage() ? filter_config_.get() : nullptr;
+}
+
+FusedTransformationFilter::StagesResult
+FusedTransformationFilter::runRequestStages(bool on_headers) {
+  for (; request_index_ < numStages(); request_index_++) {
+    const uint32_t stage = filter_config_->stage() + request_index_;
+
+    if (request_transformation_ == nullptr) {
+      const TransformConfig *config = configForStage(stage);
+      if (config == nullptr) {
+        continue;
+      }
+      TransformerPairConstSharedPtr pair =
+          config->findTransformers(*request_headers_);
+      if (pair == nullptr) {
+        continue;
+      }
+      stage_response_transformations_[stage] =
+          pair->getResponseTranformation();
+      if (pair->getOnStreamCompletionTransformation() != nullptr) {
+        on_stream_completion_transformations_.push_back(
+            pair->getOnStreamCompletionTransformation());
+      }
+      request_clear_cache_ = pair->shouldClearCache();
+      request_transformation_ = pair->getRequestTranformation();
+      if (request_transformation_ == nullptr) {
+        continue;
+      }
+    }
+
+    if (!request_transformation_->canTransform(request_body_,
+                                             request_body_complete_)) {
+      return StagesResult::NeedBody;
+    }
+
+    if (on_headers || (request_transformation_->passthrough_body() &&
+                       request_transformation_->bodyPrefixLength() == 0)) {
+      filter_config_->stats().request_header_transformations_.inc();
+    } else {
+      filter_config_->stats().request_body_transformations_.inc();
+    }
+    TransformerConstSharedPtr transformation =
+        std::move(request_transformation_);
+    request_transformation_ = nullptr;
+    if (!runStage(*transformation, *request_headers_, request_body_,
+                  request_state_, *decoder_callbacks_)) {
+      return StagesResult::Error;
+    }
+    if (request_clear_cache_) {
+      // the next stages should see the route the new headers select.
+      decoder_callbacks_->clearRouteCache();
+      resolveRouteConfig();
+    }
+  }
+  return StagesResult::Done;
+}
+
+FusedTransformationFilter::StagesResult
+FusedTransformationFilter::runResponseStages(bool on_headers) {
+  for (; response_index_ < numStages(); response_index_++) {
+    const uint32_t stage = MAX_STAGE_NUMBER - response_index_;
+
+    if (response_transformation_ == nullptr) {
+      response_transformation_ = stage_response_transformations_[stage];
+      if (response_transformation_ == nullptr) {
+        const TransformConfig *config = configForStage(stage);
+        if (config != nullptr) {
+          response_transformation_ = config->findResponseTransform(
+              *response_headers_, encoder_callbacks_->streamInfo());
+        }
+      }
+      if (response_transformation_ == nullptr) {
+        continue;
+      }
+    }
+
+    if (!response_transformation_->canTransform(response_body_,
+                                             response_body_complete_)) {
+      return StagesResult::NeedBody;
+    }
+
+    if (on_headers || (response_transformation_->passthrough_body() &&
+                       response_transformation_->bodyPrefixLength() == 0)) {
+      filter_config_->stats().response_header_transformations_.inc();
+    } else {
+      filter_config_->stats().response_body_transformations_.inc();
+    }
+    TransformerConstSharedPtr transformation =
+        std::move(response_transformation_);
+    response_transformation_ = nullptr;
+    if (!runStage(*transformation, *response_headers_, response_body_,
+                  response_state_, *encoder_callbacks_)) {
+      return StagesResult::Error;
+    }
+  }
+  return StagesResult::Done;
+}
+
+bool FusedTransformationFilter::runStage(
+    const Transformer &transformation,
+    Http::RequestOrResponseHeaderMap &header_map, Buffer::Instance &body,
+    TransformationSharedStatePtr &state,
+    Http::StreamFilterCallbacks &callbacks) {
+  // framed transformations of the filter are rejected with its config, but
+  // the route configs can't tell whether the filter that runs them is fused.
+  if (transformation.framed()) {
+    error(Http::Code::InternalServerError,
+          "body framing is not supported with fused stages");
+    return false;
+  }
+
+  try {
+    if (transformation.passthrough_body()) {
+      // as with a filter per stage, passthrough stages don't see the body,
+      // unless they read a prefix of it. either way they leave it alone.
+      Buffer::OwnedImpl empty_body;
+      transformation.transform(
+          header_map, request_headers_,
+          transformation.bodyPrefixLength() != 0 ? body : empty_body,
+          callbacks);
+    } else {
+      transformation.transformStage(header_map, request_headers_, body,
+                                    callbacks, state);
+      if (body.length() == 0) {
+        // the empty body is a result of the transformation.
+        header_map.removeContentType();
+      }
+    }
+  } catch (std::exception &e) {
+    ENVOY_STREAM_LOG(debug, "failure transforming {}", callbacks, e.what());
+    error(Http::Code::BadRequest, fmt::format("bad request: {}", e.what()));
+    return false;
+  }
+  return true;
+}
+
+Http::FilterDataStatus FusedTransformationFilter::finishRequestBody() {
+  request_body_complete_ = true;
+  return continueRequestBody();
+}
+
+Http::FilterDataStatus FusedTransformationFilter::continueRequestBody() {
+  const StagesResult result = runRequestStages(false);
+  if (result == StagesResult::Error) {
+    requestError();
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  }
+  if (result == StagesResult::NeedBody) {
+    // a later stage needs more of the body.
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  }
+  if (request_body_.length() > 0) {
+    decoder_callbacks_->addDecodedData(request_body_, false);
+  }
+  return Http::FilterDataStatus::Continue;
+}
+
+Http::FilterDataStatus FusedTransformationFilter::finishResponseBody() {
+  response_body_complete_ = true;
+  return continueResponseBody();
+}
+
+Http::FilterDataStatus FusedTransformationFilter::continueResponseBody() {
+  const StagesResult result = runResponseStages(false);
+  if (result == StagesResult::Error) {
+    responseError();
+  } else if (result == StagesResult::NeedBody) {
+    return Http::FilterDataStatus::StopIterationNoBuffer;
+  } else if (response_body_.length() > 0) {
+    encoder_callbacks_->addEncodedData(response_body_, false);
+  }
+  return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer
+                    : Http::FilterDataStatus::Continue;
+}
+
+void FusedTransformationFilter::error(Http::Code code, std::string message) {
+  error_code_ = code;
+  error_message_ = std::move(message);
+  request_body_.drain(request_body_.length());
+  response_body_.drain(response_body_.length());
+}
+
+void FusedTransformationFilter::requestError() {
+  ASSERT(error_code_.has_value());
+  request_transformation_ = nullptr;
+  filter_config_->stats().request_error_.inc();
+  decoder_callbacks_->sendLocalReply(error_code_.value(), error_message_,
+                                     nullptr, absl::nullopt,
+                                     RcDetails::get().TransformError);
+}
+
+void FusedTransformationFilter::responseError() {
+  ASSERT(error_code_.has_value());
+  response_transformation_ = nullptr;
+  filter_config_->stats().response_error_.inc();
+  response_headers_->setStatus(enumToInt(error_code_.value()));
+  Buffer::OwnedImpl data(error_message_);
+  response_headers_->removeContentType();
+  response_headers_->setContentLength(data.length());
+  encoder_callbacks_->addEncodedData(data, false);
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
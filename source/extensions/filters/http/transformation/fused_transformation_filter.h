@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+
+#include "envoy/server/filter_config.h"
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "source/extensions/filters/http/transformation/transformation_filter_config.h"
+#include "source/extensions/filters/http/transformation/transformer.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+/**
+ * Runs the transformations of all the stages, starting at the configured
+ * stage, from a single filter. The body is buffered once and handed from
+ * stage to stage, and stages share whatever work they can through a
+ * TransformationSharedState (e.g. the parsed body).
+ *
+ * Stages run in the same order a chain of per stage filters would run them:
+ * increasing on the request path, decreasing on the response path. Each stage
+ * matches against the headers as transformed by the stages before it.
+ */
+class FusedTransformationFilter : public Http::StreamFilter,
+                                  Logger::Loggable<Logger::Id::filter> {
+public:
+  FusedTransformationFilter(FilterConfigSharedPtr config);
+
+  // Http::StreamFilterBase
+  void onDestroy() override;
+  void onStreamComplete() override;
+
+  // Http::StreamDecoderFilter
+  Http::FilterHeadersStatus decodeHeaders(Http::RequestHeaderMap &headers,
+                                          bool end_stream) override;
+  Http::FilterDataStatus decodeData(Buffer::Instance &data,
+                                    bool end_stream) override;
+  Http::FilterTrailersStatus decodeTrailers(Http::RequestTrailerMap &) override;
+
+  void setDecoderFilterCallbacks(
+      Http::StreamDecoderFilterCallbacks &callbacks) override {
+    decoder_callbacks_ = &callbacks;
+    decoder_buffer_limit_ = callbacks.decoderBufferLimit();
+  };
+
+  // Http::StreamEncoderFilter
+  Http::FilterHeadersStatus
+  encode1xxHeaders(Http::ResponseHeaderMap &) override {
+    return Http::FilterHeadersStatus::Continue;
+  }
+  Http::FilterHeadersStatus encodeHeaders(Http::ResponseHeaderMap &headers,
+                                          bool end_stream) override;
+  Http::FilterDataStatus encodeData(Buffer::Instance &data,
+                                    bool end_stream) override;
+  Http::FilterTrailersStatus
+  encodeTrailers(Http::ResponseTrailerMap &) override;
+  Http::FilterMetadataStatus encodeMetadata(Http::MetadataMap &) override {
+    return Http::FilterMetadataStatus::Continue;
+  }
+
+  void setEncoderFilterCallbacks(
+      Http::StreamEncoderFilterCallbacks &callbacks) override {
+    encoder_callbacks_ = &callbacks;
+    encoder_buffer_limit_ = callbacks.encoderBufferLimit();
+  };
+
+private:
+  enum class StagesResult {
+    // all the stages ran.
+    Done,
+    // a stage is waiting for the whole body.
+    NeedBody,
+    Error,
+  };
+
+  void resolveRouteConfig();
+  const TransformConfig *configForStage(uint32_t stage) const;
+  uint32_t numStages() const {
+    return MAX_STAGE_NUMBER - filter_config_->stage() + 1;
+  }
+
+  // on_headers is true when called from the headers callback, for stats.
+  StagesResult runRequestStages(bool on_headers);
+  StagesResult runResponseStages(bool on_headers);
+  bool runStage(const Transformer &transformation,
+                Http::RequestOrResponseHeaderMap &header_map,
+                Buffer::Instance &body, TransformationSharedStatePtr &state,
+                Http::StreamFilterCallbacks &callbacks);
+
+  Http::FilterDataStatus finishRequestBody();
+  Http::FilterDataStatus finishResponseBody();
+  // runs the stages on the body buffered so far.
+  Http::FilterDataStatus continueRequestBody();
+  Http::FilterDataStatus continueResponseBody();
+  void requestError();
+  void responseError();
+  void error(Http::Code code, std::string message);
+
+  Http::StreamDecoderFilterCallbacks *decoder_callbacks_{};
+  Http::StreamEncoderFilterCallbacks *encoder_callbacks_{};
+  Router::RouteConstSharedPtr route_;
+  const RouteFilterConfig *route_config_{};
+  uint32_t decoder_buffer_limit_{};
+  uint32_t encoder_buffer_limit_{};
+  Http::RequestHeaderMap *request_headers_{nullptr};
+  Http::ResponseHeaderMap *response_headers_{nullptr};
+  Buffer::OwnedImpl request_body_{};
+  Buffer::OwnedImpl response_body_{};
+  TransformationSharedStatePtr request_state_;
+  TransformationSharedStatePtr response_state_;
+
+  // how many stages each direction went through, and the transformation of
+  // the current stage if it is waiting for the body.
+  uint32_t request_index_{};
+  uint32_t response_index_{};
+  TransformerConstSharedPtr request_transformation_;
+  TransformerConstSharedPtr response_transformation_;
+  bool request_clear_cache_{};
+  bool request_body_complete_{};
+  bool response_body_complete_{};
+
+  // response transformations picked by the request matchers, per stage.
+  std::array<TransformerConstSharedPtr, MAX_STAGE_NUMBER + 1>
+      stage_response_transformations_;
+  std::vector<TransformerConstSharedPtr> on_stream_completion_transformations_;
+
+  absl::optional<Http::Code> error_code_;
+  std::string error_message_;
+  bool destroyed_{};
+
+  FilterConfigSharedPtr filter_config_;
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,14 +1,28 @@
 #include "source/extensions/filters/http/transformation/inja_transformer.h"
 
+#include <algorithm>
 #include <iterator>
+#include <ostream>
+#include <regex>
+#include <set>
 
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/macros.h"
 #include "source/common/common/regex.h"
 #include "source/common/common/utility.h"
 #include "source/common/config/metadata.h"
+#include "source/common/http/header_map_impl.h"
+#include "source/common/http/headers.h"
+#include "source/common/protobuf/utility.h"
 
 #include "source/extensions/filters/http/solo_well_known_names.h"
+#include "source/extensions/filters/http/transformation/content_encoding.h"
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "openssl/sha.h"
 
 extern char **environ;
 
@@ -26,6 +40,21 @@ namespace Transformation {
 using TransformationTemplate =
     envoy::api::v2::filter::http::TransformationTemplate;
 
+constexpr uint64_t DEFAULT_MAX_DECOMPRESSED_SIZE = 16 * 1024 * 1024;
+constexpr uint64_t DEFAULT_OUTPUT_CACHE_MAX_BYTES = 1024 * 1024;
+// the weight of each render in the average output size of a template is
+// 1 / RENDER_SIZE_WEIGHT.
+constexpr uint64_t RENDER_SIZE_WEIGHT = 8;
+// outputs that fit the reservation only update the average once every
+// RENDER_SIZE_SAMPLE_INTERVAL renders of a worker, so that the workers don't
+// keep writing the shared estimate.
+constexpr uint64_t RENDER_SIZE_SAMPLE_INTERVAL = 64;
+// how much of a template's text the profiler shows.
+constexpr size_t MAX_PROFILED_TEMPLATE_TEXT = 80;
+// outputs smaller than this are cheaper to copy than to hand over as a
+// fragment, which costs two allocations.
+constexpr size_t MIN_FRAGMENT_OUTPUT_SIZE = 16 * 1024;
+
 struct BoolHeaderValues {
   const std::string trueString = "true";
   const std::string falseString = "false";
@@ -48,12 +77,306 @@ getHeader(const Http::RequestOrResponseHeaderMap &header_map,
   return getHeader(header_map, lowerkey);
 }
 
+// Adds the names of the headers a template reads to headers and
+// request_headers. The output cache can only know what a template reads if
+// the names are string literals, so anything else is rejected.
+void collectHeaderReferences(absl::string_view text,
+                             std::set<std::string> &headers,
+                             std::set<std::string> &request_headers) {
+  static const std::regex call_regex(
+      R"re(\b(request_header|header)\s*\()re");
+  static const std::regex literal_regex(
+      R"re(\b(request_header|header)\s*\(\s*"([^"\\]*)"\s*\))re");
+
+  using Iterator = std::regex_iterator<absl::string_view::const_iterator>;
+  const auto calls =
+      std::distance(Iterator(text.begin(), text.end(), call_regex), Iterator());
+  int literals = 0;
+  for (Iterator it(text.begin(), text.end(), literal_regex); it != Iterator();
+       it++, literals++) {
+    auto &names = (*it)[1] == "header" ? headers : request_headers;
+    names.insert(absl::AsciiStrToLower((*it)[2].str()));
+  }
+  if (literals != calls) {
+    throw EnvoyException("output_cache requires the header names passed to "
+                         "header() and request_header() to be string literals");
+  }
+}
+
+// Makes (up to max_length bytes at the start of) buffer contiguous, in place,
+// and returns a view of it. Nothing is copied if they already are in a single
+// slice.
+absl::string_view linearizedView(Buffer::Instance &buffer,
+                                 uint64_t max_length = UINT64_MAX) {
+  const uint64_t length = std::min(buffer.length(), max_length);
+  if (length == 0) {
+    return {};
+  }
+  return {static_cast<const char *>(buffer.linearize(length)), length};
+}
+
+// Appends whatever is written to the stream to a string, so rendered output
+// is written in place rather than copied out of a stringstream.
+class StringOutputBuffer : public std::streambuf {
+public:
+  StringOutputBuffer(std::string &output) : output_(output) {}
+
+protected:
+  std::streamsize xsputn(const char *data, std::streamsize size) override {
+    output_.append(data, size);
+    return size;
+  }
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      output_.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+private:
+  std::string &output_;
+};
+
+// Hands output over to buffer, without copying it if it's large.
+void moveToBuffer(std::string &&output, Buffer::Instance &buffer) {
+  if (output.empty()) {
+    return;
+  }
+  if (output.size() < MIN_FRAGMENT_OUTPUT_SIZE) {
+    buffer.add(output);
+    return;
+  }
+  auto *owned = new std::string(std::move(output));
+  buffer.addBufferFragment(*new Buffer::BufferFragmentImpl(
+      owned->data(), owned->size(),
+      [owned](const void *, size_t,
+              const Buffer::BufferFragmentImpl *fragment) {
+        delete owned;
+        delete fragment;
+      }));
+}
+
+// What the profiler shows for a template: the transformation it belongs to,
+// what it renders and the start of its text.
+std::string profileDescription(absl::string_view transformation,
+                               absl::string_view name,
+                               const inja::Template &input) {
+  std::string text = input.content.substr(0, MAX_PROFILED_TEMPLATE_TEXT);
+  std::replace(text.begin(), text.end(), '\n', ' ');
+  return fmt::format("{} {}: {}",
+                     transformation.empty() ? "unnamed" : transformation,
+                     name, text);
+}
+
+std::vector<absl::string_view>
+templateTexts(const TransformationTemplate &transformation) {
+  std::vector<absl::string_view> texts;
+  for (const auto &header : transformation.headers()) {
+    texts.push_back(header.second.text());
+  }
+  for (const auto &header : transformation.headers_to_append()) {
+    texts.push_back(header.value().text());
+  }
+  for (const auto &value : transformation.dynamic_metadata_values()) {
+    texts.push_back(value.value().text());
+  }
+  if (transformation.has_body()) {
+    texts.push_back(transformation.body().text());
+  }
+  return texts;
+}
+
+bool usesClusterMetadata(const TransformationTemplate &transformation) {
+  for (absl::string_view text : templateTexts(transformation)) {
+    if (absl::StrContains(text, "clusterMetadata")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The keys the templates pass to clusterMetadata() as string literals. Keys
+// computed while rendering aren't known up front, so they aren't cached.
+std::vector<std::string>
+clusterMetadataKeys(const TransformationTemplate &transformation) {
+  static const std::regex literal_key(
+      R"(clusterMetadata\(\s*"([^"\\]*)"\s*\))");
+  std::set<std::string> keys;
+  for (absl::string_view text : templateTexts(transformation)) {
+    if (!absl::StrContains(text, "clusterMetadata")) {
+      continue;
+    }
+    for (std::cregex_iterator it(text.begin(), text.end(), literal_key), end;
+         it != end; ++it) {
+      keys.insert((*it)[1].str());
+    }
+  }
+  return {keys.begin(), keys.end()};
+}
+
+// Renders the value of key in the transformation filter metadata of a
+// cluster. Lists are joined with commas.
+json renderClusterMetadata(const envoy::config::core::v3::Metadata &metadata,
+                          const std::string &key) {
+  const ProtobufWkt::Value &value = Envoy::Config::Metadata::metadataValue(
+      &metadata, SoloHttpFilterNames::get().Transformation, key);
+
+  switch (value.kind_case()) {
+  case ProtobufWkt::Value::kStringValue: {
+    return value.string_value();
+    break;
+  }
+  case ProtobufWkt::Value::kNumberValue: {
+    return value.number_value();
+    break;
+  }
+  case ProtobufWkt::Value::kBoolValue: {
+    const std::string &stringval = value.bool_value()
+                                       ? BoolHeader::get().trueString
+                                       : BoolHeader::get().falseString;
+    return stringval;
+    break;
+  }
+  case ProtobufWkt::Value::kListValue: {
+    const auto &listval = value.list_value().values();
+    if (listval.size() == 0) {
+      break;
+    }
+
+    // size is not zero, so this will work
+    auto it = listval.begin();
+    std::stringstream ss;
+
+    auto addValue = [&ss, &it] {
+      const ProtobufWkt::Value &value = *it;
+
+      switch (value.kind_case()) {
+      case ProtobufWkt::Value::kStringValue: {
+        ss << value.string_value();
+        break;
+      }
+      case ProtobufWkt::Value::kNumberValue: {
+        ss << value.number_value();
+        break;
+      }
+      case ProtobufWkt::Value::kBoolValue: {
+        ss << (value.bool_value() ? BoolHeader::get().trueString
+                                  : BoolHeader::get().falseString);
+        break;
+      }
+      default:
+        break;
+      }
+    };
+
+    addValue();
+
+    for (it++; it != listval.end(); it++) {
+      ss << ",";
+      addValue();
+    }
+    return ss.str();
+  }
+  default: {
+    break;
+  }
+  }
+  return "";
+}
+
+std::unordered_map<std::string, std::string> parseEnvironment() {
+  std::unordered_map<std::string, std::string> result;
+  for (char **env = environ; *env != 0; env++) {
+    std::string current_env(*env);
+    size_t equals = current_env.find("=");
+    if (equals > 0) {
+      std::string key = current_env.substr(0, equals);
+      std::string value = current_env.substr(equals + 1);
+      result[key] = value;
+    }
+  }
+  return result;
+}
+
+// The response headers of streams whose response never started. Shared by
+// the workers, which is fine as nothing is cached on reads of an empty map.
+const Http::ResponseHeaderMapPtr &emptyResponseHeaders() {
+  CONSTRUCT_ON_FIRST_USE(Http::ResponseHeaderMapPtr,
+                         Http::ResponseHeaderMapImpl::create());
+}
+
+// Sets the field of json the dot separated name points to, e.g. "a.b" sets
+// b in the object a.
+void mergeExtraction(json &json_body, absl::string_view name,
+                     absl::string_view value) {
+  json *current = &json_body;
+  for (size_t pos = name.find("."); pos != std::string::npos;
+       pos = name.find(".")) {
+    current = &(*current)[std::string(name.substr(0, pos))];
+    name = name.substr(pos + 1);
+  }
+  (*current)[std::string(name)] = value;
+}
+
+// Appends value as a json string, escaped the way json::dump() escapes it.
+void writeJsonString(absl::string_view value, std::string &output) {
+  static constexpr char HEX[] = "0123456789abcdef";
+  if (std::any_of(value.begin(), value.end(), [](char c) {
+        return static_cast<unsigned char>(c) >= 0x80;
+      })) {
+    // leave non ascii strings to the json library, which also rejects invalid
+    // utf-8.
+    output += json(std::string(value)).dump();
+    return;
+  }
+  output.push_back('"');
+  for (const char c : value) {
+    switch (c) {
+    case '"':
+      output += "\\\"";
+      break;
+    case '\\':
+      output += "\\\\";
+      break;
+    case '\b':
+      output += "\\b";
+      break;
+    case '\f':
+      output += "\\f";
+      break;
+    case '\n':
+      output += "\\n";
+      break;
+    case '\r':
+      output += "\\r";
+      break;
+    case '\t':
+      output += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        output += "\\u00";
+        output.push_back(HEX[c >> 4]);
+        output.push_back(HEX[c & 0xf]);
+      } else {
+        output.push_back(c);
+      }
+    }
+  }
+  output.push_back('"');
+}
+
 } // namespace
 
 Extractor::Extractor(const envoy::api::v2::filter::http::Extraction &extractor)
     : headername_(extractor.header()), body_(extractor.has_body()),
+      body_prefix_length_(extractor.body_prefix_length()),
       group_(extractor.subgroup()),
       extract_regex_(Regex::Utility::parseStdRegex(extractor.regex())) {
+  if (body_prefix_length_ != 0 && !body_) {
+    throw EnvoyException(
+        "body_prefix_length is only valid for body extractors");
+  }
   // mark count == number of sub groups, and we need to add one for match number
   // 0 so we test for < instead of <= see:
   // http://www.cplusplus.com/reference/regex/basic_regex/mark_count/
@@ -69,9 +392,11 @@ Extractor::extract(Http::StreamFilterCallbacks &callbacks,
                    const Http::RequestOrResponseHeaderMap &header_map,
                    GetBodyFunc &body) const {
   if (body_) {
-    const std::string &string_body = body();
-    absl::string_view sv(string_body);
-    return extractValue(callbacks, sv);
+    absl::string_view value = body();
+    if (body_prefix_length_ != 0) {
+      value = value.substr(0, body_prefix_length_);
+    }
+    return extractValue(callbacks, value);
   } else {
     const Http::HeaderMap::GetResult header_entries = getHeader(header_map, headername_);
     if (header_entries.empty()) {
@@ -108,10 +433,12 @@ TransformerInstance::TransformerInstance(
     const std::unordered_map<std::string, absl::string_view> &extractions,
     const json &context,
     const std::unordered_map<std::string, std::string> &environ,
-    const envoy::config::core::v3::Metadata *cluster_metadata)
+    const envoy::config::core::v3::Metadata *cluster_metadata,
+    ClusterMetadataCache::Values *cluster_metadata_values)
     : header_map_(header_map), request_headers_(request_headers), body_(body),
       extractions_(extractions), context_(context), environ_(environ),
-      cluster_metadata_(cluster_metadata) {
+      cluster_metadata_(cluster_metadata),
+      cluster_metadata_values_(cluster_metadata_values) {
   env_.add_callback("header", 1,
                     [this](Arguments &args) { return header_callback(args); });
   env_.add_callback("request_header", 1, [this](Arguments &args) {
@@ -121,7 +448,11 @@ TransformerInstance::TransformerInstance(
     return extracted_callback(args);
   });
   env_.add_callback("context", 0, [this](Arguments &) { return context_; });
-  env_.add_callback("body", 0, [this](Arguments &) { return body_(); });
+  env_.add_callback("body", 0, [this](Arguments &) {
+    // the one copy of the body the template engine needs.
+    const absl::string_view body = body_();
+    return json(std::string(body));
+  });
   env_.add_callback("env", 1, [this](Arguments &args) { return env(args); });
   env_.add_callback("clusterMetadata", 1, [this](Arguments &args) {
     return cluster_metadata_callback(args);
@@ -177,85 +508,58 @@ json TransformerInstance::cluster_metadata_callback(
   if (!cluster_metadata_) {
     return "";
   }
-
-  const ProtobufWkt::Value &value = Envoy::Config::Metadata::metadataValue(
-      cluster_metadata_, SoloHttpFilterNames::get().Transformation, key);
-
-  switch (value.kind_case()) {
-  case ProtobufWkt::Value::kStringValue: {
-    return value.string_value();
-    break;
-  }
-  case ProtobufWkt::Value::kNumberValue: {
-    return value.number_value();
-    break;
+  if (cluster_metadata_values_ == nullptr) {
+    return renderClusterMetadata(*cluster_metadata_, key);
   }
-  case ProtobufWkt::Value::kBoolValue: {
-    const std::string &stringval = value.bool_value()
-                                       ? BoolHeader::get().trueString
-                                       : BoolHeader::get().falseString;
-    return stringval;
-    break;
-  }
-  case ProtobufWkt::Value::kListValue: {
-    const auto &listval = value.list_value().values();
-    if (listval.size() == 0) {
-      break;
-    }
-
-    // size is not zero, so this will work
-    auto it = listval.begin();
-    std::stringstream ss;
 
-    auto addValue = [&ss, &it] {
-      const ProtobufWkt::Value &value = *it;
-
-      switch (value.kind_case()) {
-      case ProtobufWkt::Value::kStringValue: {
-        ss << value.string_value();
-        break;
-      }
-      case ProtobufWkt::Value::kNumberValue: {
-        ss << value.number_value();
-        break;
-      }
-      case ProtobufWkt::Value::kBoolValue: {
-        ss << (value.bool_value() ? BoolHeader::get().trueString
-                                  : BoolHeader::get().falseString);
-        break;
-      }
-      default:
-        break;
-      }
-    };
-
-    addValue();
-
-    for (it++; it != listval.end(); it++) {
-      ss << ",";
-      addValue();
-    }
-    return ss.str();
-  }
-  default: {
-    break;
+  auto it = cluster_metadata_values_->find(key);
+  if (it == cluster_metadata_values_->end()) {
+    // only the keys of the config are cached.
+    return renderClusterMetadata(*cluster_metadata_, key);
   }
+  if (it->second.is_null()) {
+    it->second = renderClusterMetadata(*cluster_metadata_, key);
   }
-  return "";
+  return it->second;
 }
 
-std::string TransformerInstance::render(const inja::Template &input) {
+std::string TransformerInstance::render(const inja::Template &input,
+                                        uint64_t size_hint) {
+  std::string output;
+  output.reserve(size_hint);
+  StringOutputBuffer buffer(output);
+  std::ostream stream(&buffer);
   // inja can't handle context that are not objects correctly, so we give it an
   // empty object in that case
   if (context_.is_object()) {
-    return env_.render(input, context_);
+    env_.render_to(stream, input, context_);
   } else {
-    return env_.render(input, {});
+    env_.render_to(stream, input, {});
   }
+  return output;
 }
 
 InjaTransformer::InjaTransformer(const TransformationTemplate &transformation)
-    : advanced_templates_(transformation.advanced_templates()),
+    : InjaTransformer(transformation, nullptr, nullptr, {}, nullptr, "") {}
+
+InjaTransformer::InjaTransformer(const TransformationTemplate &transformation,
+                                 ThreadLocal::SlotAllocator &tls,
+                                 Event::Dispatcher &main_thread_dispatcher,
+                                 TransformerStats stats,
+                                 TemplateProfilerSharedPtr profiler,
+                                 std::string name)
+    : InjaTransformer(transformation, &tls, &main_thread_dispatcher,
+                      std::move(stats), std::move(profiler), std::move(name)) {}
+
+InjaTransformer::InjaTransformer(const TransformationTemplate &transformation,
+                                 ThreadLocal::SlotAllocator *tls,
+                                 Event::Dispatcher *main_thread_dispatcher,
+                                 TransformerStats stats,
+                                 TemplateProfilerSharedPtr profiler,
+                                 std::string name)
+    : stats_(std::move(stats)), profiler_(std::move(profiler)),
+      name_(std::move(name)),
+      advanced_templates_(transformation.advanced_templates()),
       passthrough_body_(transformation.has_passthrough()),
       parse_body_behavior_(transformation.parse_body_behavior()),
       ignore_error_on_parse_(transformation.ignore_error_on_parse()) {
@@ -327,6 +631,11 @@ InjaTransformer::InjaTransformer(const TransformationTemplate &transformation)
   }
   case TransformationTemplate::kMergeExtractorsToBody: {
     merged_extractors_to_body_ = true;
+    // the templates read the extractions from the merged json, so it is only
+    // skipped when there are none.
+    direct_merge_ = !advanced_templates_ && headers_.empty() &&
+                    headers_to_append_.empty() && dynamic_metadata_.empty() &&
+                    buildMergeTree();
     break;
   }
   case TransformationTemplate::kPassthrough:
@@ -336,103 +645,551 @@ InjaTransformer::InjaTransformer(const TransformationTemplate &transformation)
   }
   }
 
-  // parse environment
-  for (char **env = environ; *env != 0; env++) {
-    std::string current_env(*env);
-    size_t equals = current_env.find("=");
-    if (equals > 0) {
-      std::string key = current_env.substr(0, equals);
-      std::string value = current_env.substr(equals + 1);
-      environ_[key] = value;
+  if (transformation.has_body_framing()) {
+    if (transformation.has_passthrough()) {
+      throw EnvoyException("body_framing can't be used with passthrough");
+    }
+    body_framing_ = transformation.body_framing();
+    // the body is streamed, so it is never buffered as a whole.
+    passthrough_body_ = true;
+  }
+
+  if (transformation.has_content_decoding()) {
+    if (transformation.has_body_framing()) {
+      throw EnvoyException(
+          "content_decoding can't be used with body_framing");
+    }
+    decode_content_ = true;
+    recompress_ = transformation.content_decoding().recompress();
+    max_decompressed_size_ = PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+        transformation.content_decoding(), max_decompressed_size,
+        DEFAULT_MAX_DECOMPRESSED_SIZE);
+  }
+
+  setupBodyPrefix(transformation);
+
+  if (transformation.has_output_cache()) {
+    setupOutputCache(transformation, tls, main_thread_dispatcher);
+  }
+
+  std::vector<std::string> cluster_metadata_keys =
+      clusterMetadataKeys(transformation);
+  if (tls != nullptr && !cluster_metadata_keys.empty()) {
+    cluster_metadata_cache_ =
+        std::make_unique<MainThreadSlot<ClusterMetadataCache>>(
+            *tls, *main_thread_dispatcher);
+    cluster_metadata_cache_->set(
+        [keys = std::move(cluster_metadata_keys)](Event::Dispatcher &) {
+          return std::make_shared<ClusterMetadataCache>(keys);
+        });
+  }
+
+  environ_ = parseEnvironment();
+
+  forEachTemplate([this](const inja::Template &input, const std::string &) {
+    render_sizes_[&input] = 0;
+  });
+}
+
+InjaTransformer::~InjaTransformer() {
+  if (profiled_) {
+    forEachTemplate([this](const inja::Template &input, const std::string &) {
+      profiler_->removeTemplate(&input);
+    });
+  }
+}
+
+void InjaTransformer::setupBodyPrefix(
+    const TransformationTemplate &transformation) {
+  if (!transformation.has_passthrough()) {
+    return;
+  }
+  uint64_t body_prefix_length = 0;
+  for (const auto &extractor : transformation.extractors()) {
+    if (!extractor.second.has_body()) {
+      continue;
+    }
+    if (extractor.second.body_prefix_length() == 0) {
+      // reads all of the body, which passthrough transformations never see.
+      return;
     }
+    body_prefix_length = std::max<uint64_t>(
+        body_prefix_length, extractor.second.body_prefix_length());
   }
+  if (body_prefix_length != 0 && decode_content_) {
+    throw EnvoyException(
+        "body_prefix_length can't be used with content_decoding");
+  }
+  body_prefix_length_ = body_prefix_length;
 }
 
-InjaTransformer::~InjaTransformer() {}
+void InjaTransformer::registerProfiledTemplates() const {
+  forEachTemplate([this](const inja::Template &input,
+                         const std::string &name) {
+    profiler_->addTemplate(&input, profileDescription(name_, name, input));
+  });
+}
 
-void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
-                                Http::RequestHeaderMap *request_headers,
-                                Buffer::Instance &body,
-                                Http::StreamFilterCallbacks &callbacks) const {
-  absl::optional<std::string> string_body;
-  GetBodyFunc get_body = [&string_body, &body]() -> const std::string & {
-    if (!string_body.has_value()) {
-      string_body.emplace(body.toString());
+void InjaTransformer::forEachTemplate(
+    const std::function<void(const inja::Template &, const std::string &)>
+        &callback) const {
+  for (const auto &header : headers_) {
+    callback(header.second, absl::StrCat("header ", header.first.get()));
+  }
+  for (const auto &header : headers_to_append_) {
+    callback(header.second,
+             absl::StrCat("header to append ", header.first.get()));
+  }
+  for (const auto &value : dynamic_metadata_) {
+    callback(value.template_, absl::StrCat("dynamic metadata ", value.key_));
+  }
+  if (body_template_.has_value()) {
+    callback(body_template_.value(), "body");
+  }
+}
+
+std::string InjaTransformer::render(TransformerInstance &instance,
+                                    const inja::Template &input) const {
+  TemplateProfiler::Timer timer(profiler_.get(), &input);
+  if (timer.sampled() && !profiled_.load(std::memory_order_relaxed) &&
+      !profiled_.exchange(true)) {
+    registerProfiledTemplates();
+  }
+  std::atomic<uint64_t> &average_size = render_sizes_.at(&input);
+  const uint64_t estimate = average_size.load(std::memory_order_relaxed);
+  // a bit of headroom, as outputs vary in size.
+  const uint64_t reserved = estimate + estimate / 8;
+  std::string output = instance.render(input, reserved);
+  // races only lose a sample, which is fine for an estimate.
+  static thread_local uint64_t renders = 0;
+  if (output.size() > reserved) {
+    // the output didn't fit, grow right away.
+    average_size.store(output.size(), std::memory_order_relaxed);
+  } else if (++renders % RENDER_SIZE_SAMPLE_INTERVAL == 0) {
+    // shrinks slowly, on a sample of the renders.
+    average_size.store(estimate - estimate / RENDER_SIZE_WEIGHT +
+                           output.size() / RENDER_SIZE_WEIGHT,
+                       std::memory_order_relaxed);
+  }
+  return output;
+}
+
+void InjaTransformer::setupOutputCache(
+    const TransformationTemplate &transformation,
+    ThreadLocal::SlotAllocator *tls,
+    Event::Dispatcher *main_thread_dispatcher) {
+  if (tls == nullptr) {
+    throw EnvoyException("output_cache is not supported here");
+  }
+  if (body_framing_.has_value()) {
+    throw EnvoyException("output_cache can't be used with body_framing");
+  }
+
+  std::set<std::string> headers;
+  std::set<std::string> request_headers;
+  for (absl::string_view text : templateTexts(transformation)) {
+    collectHeaderReferences(text, headers, request_headers);
+  }
+  cache_key_cluster_ = usesClusterMetadata(transformation);
+  for (const auto &extractor : transformation.extractors()) {
+    if (!extractor.second.has_body()) {
+      headers.insert(absl::AsciiStrToLower(extractor.second.header()));
+    }
+  }
+  if (decode_content_) {
+    headers.insert(Http::CustomHeaders::get().ContentEncoding.get());
+  }
+  for (const auto &header : headers) {
+    cache_key_headers_.emplace_back(header);
+  }
+  for (const auto &header : request_headers) {
+    cache_key_request_headers_.emplace_back(header);
+  }
+
+  const uint64_t max_bytes =
+      PROTOBUF_GET_WRAPPED_OR_DEFAULT(transformation.output_cache(), max_bytes,
+                                      DEFAULT_OUTPUT_CACHE_MAX_BYTES);
+  output_cache_ = std::make_unique<MainThreadSlot<OutputCache>>(
+      *tls, *main_thread_dispatcher);
+  output_cache_->set([max_bytes](Event::Dispatcher &) {
+    return std::make_shared<OutputCache>(max_bytes);
+  });
+}
+
+std::string InjaTransformer::outputCacheKey(
+    const Http::RequestOrResponseHeaderMap &header_map,
+    const Http::RequestHeaderMap *request_headers,
+    const Buffer::Instance &body,
+    Http::StreamFilterCallbacks &callbacks) const {
+  std::string key;
+  // header values can't contain a null, so it can separate them.
+  auto add_header = [&key](const Http::HeaderMap *map,
+                           const Http::LowerCaseString &name) {
+    if (map != nullptr) {
+      const auto result = map->get(name);
+      if (!result.empty()) {
+        absl::StrAppend(&key, "+", result[0]->value().getStringView(),
+                        absl::string_view("\0", 1));
+        return;
+      }
     }
-    return string_body.value();
+    key.push_back('-');
   };
+  for (const auto &name : cache_key_headers_) {
+    add_header(&header_map, name);
+  }
+  for (const auto &name : cache_key_request_headers_) {
+    add_header(request_headers, name);
+  }
 
-  json json_body;
+  if (!passthrough_body_ || body_prefix_length_ != 0) {
+    // a hit replays output rendered for another request, so the body is keyed
+    // by a sha256, which can't be made to collide to poison the output served
+    // to others. only the prefix is hashed if that is all we read.
+    uint64_t remaining =
+        body_prefix_length_ != 0 ? std::min(body.length(), body_prefix_length_)
+                                 : body.length();
+    SHA256_CTX context;
+    SHA256_Init(&context);
+    for (const Buffer::RawSlice &slice : body.getRawSlices()) {
+      if (remaining == 0) {
+        break;
+      }
+      const uint64_t slice_length = std::min<uint64_t>(slice.len_, remaining);
+      SHA256_Update(&context, slice.mem_, slice_length);
+      remaining -= slice_length;
+    }
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256_Final(digest, &context);
+    key.append(reinterpret_cast<const char *>(digest), SHA256_DIGEST_LENGTH);
+  }
 
+  if (cache_key_cluster_) {
+    Upstream::ClusterInfoConstSharedPtr ci = callbacks.clusterInfo();
+    absl::StrAppend(&key, ":", ci ? ci->name() : "");
+  }
+  return key;
+}
+
+bool InjaTransformer::applyCachedOutput(
+    const std::string &key, Http::RequestOrResponseHeaderMap &header_map,
+    Buffer::Instance &body, Http::StreamFilterCallbacks &callbacks,
+    InjaSharedState *state) const {
+  OutputCache::OutputConstSharedPtr output = (*output_cache_)->lookup(key);
+  if (output == nullptr) {
+    return false;
+  }
+  if (cache_key_cluster_ && output->cluster_.lock() != callbacks.clusterInfo()) {
+    // the cluster was updated, its metadata may have changed.
+    (*output_cache_)->remove(key);
+    return false;
+  }
+
+  for (size_t i = 0; i < dynamic_metadata_.size(); i++) {
+    const std::string &value = output->dynamic_metadata_[i];
+    if (!value.empty()) {
+      callbacks.streamInfo().setDynamicMetadata(
+          dynamic_metadata_[i].namespace_,
+          MessageUtil::keyValueStruct(dynamic_metadata_[i].key_, value));
+    }
+  }
+  for (size_t i = 0; i < headers_.size(); i++) {
+    header_map.remove(headers_[i].first);
+    if (!output->headers_[i].empty()) {
+      header_map.addReferenceKey(headers_[i].first, output->headers_[i]);
+    }
+  }
+  for (size_t i = 0; i < headers_to_append_.size(); i++) {
+    if (!output->headers_to_append_[i].empty()) {
+      header_map.addReferenceKey(headers_to_append_[i].first,
+                                 output->headers_to_append_[i]);
+    }
+  }
+  if (output->body_.has_value()) {
+    if (output->remove_content_encoding_) {
+      header_map.remove(Http::CustomHeaders::get().ContentEncoding);
+    }
+    header_map.removeContentLength();
+    body.drain(body.length());
+    body.add(output->body_.value());
+    header_map.setContentLength(body.length());
+    if (state != nullptr) {
+      state->json_body_.reset();
+    }
+  }
+  return true;
+}
+
+bool InjaTransformer::buildMergeTree() {
+  for (const auto &named_extractor : extractors_) {
+    const std::string &name = named_extractor.first;
+    MergeNode *current = &merge_tree_;
+    for (absl::string_view field_name : absl::StrSplit(name, '.')) {
+      if (current->extraction_ != nullptr) {
+        return false;
+      }
+      auto &child = current->children_[std::string(field_name)];
+      if (child == nullptr) {
+        child = std::make_unique<MergeNode>();
+      }
+      current = child.get();
+    }
+    if (current->extraction_ != nullptr || !current->children_.empty()) {
+      return false;
+    }
+    current->extraction_ = &name;
+  }
+  return true;
+}
+
+std::string InjaTransformer::mergedBody(
+    const json &json_body,
+    const std::unordered_map<std::string, absl::string_view> &extractions)
+    const {
+  if (!direct_merge_ || merge_tree_.children_.empty()) {
+    return json_body.dump();
+  }
+  std::string output;
+  writeMerged(&json_body, merge_tree_, extractions, output);
+  return output;
+}
+
+void InjaTransformer::writeMerged(
+    const json *json_body, const MergeNode &node,
+    const std::unordered_map<std::string, absl::string_view> &extractions,
+    std::string &output) {
+  if (node.extraction_ != nullptr) {
+    writeJsonString(extractions.at(*node.extraction_), output);
+    return;
+  }
+  if (json_body != nullptr && json_body->is_null()) {
+    json_body = nullptr;
+  }
+  if (json_body != nullptr && !json_body->is_object()) {
+    // same as merging into the json.
+    throw EnvoyException(
+        fmt::format("can't merge extractions into a json {}",
+                    json_body->type_name()));
+  }
+
+  // both the json object's members and the children are sorted by name, so
+  // they are merged in a single pass, in the order json::dump() would use.
+  output.push_back('{');
+  bool first = true;
+  auto add_member = [&output, &first](const std::string &name) {
+    if (!first) {
+      output.push_back(',');
+    }
+    first = false;
+    writeJsonString(name, output);
+    output.push_back(':');
+  };
+  auto child = node.children_.begin();
+  if (json_body != nullptr) {
+    for (auto member = json_body->begin(); member != json_body->end();
+         member++) {
+      for (; child != node.children_.end() && child->first < member.key();
+           child++) {
+        add_member(child->first);
+        writeMerged(nullptr, *child->second, extractions, output);
+      }
+      add_member(member.key());
+      if (child != node.children_.end() && child->first == member.key()) {
+        writeMerged(&member.value(), *child->second, extractions, output);
+        child++;
+      } else {
+        output += member.value().dump();
+      }
+    }
+  }
+  for (; child != node.children_.end(); child++) {
+    add_member(child->first);
+    writeMerged(nullptr, *child->second, extractions, output);
+  }
+  output.push_back('}');
+}
+
+void InjaTransformer::parseAndExtract(
+    const Http::RequestOrResponseHeaderMap &header_map,
+    const Buffer::Instance &body, GetBodyFunc &get_body,
+    Http::StreamFilterCallbacks &callbacks, InjaSharedState *state,
+    json &json_body,
+    std::unordered_map<std::string, absl::string_view> &extractions) const {
+  // a prefix of the body can't be parsed.
   if (parse_body_behavior_ != TransformationTemplate::DontParse &&
-      body.length() > 0) {
-    const std::string &bodystring = get_body();
+      body_prefix_length_ == 0 && body.length() > 0) {
+    TransformerStats::StepTimer timer(stats_, TransformerStats::Step::Parse,
+                                      callbacks);
+    const absl::string_view bodystring = get_body();
     // parse the body as json
     // TODO: gate this under a parse_body boolean
     if (parse_body_behavior_ == TransformationTemplate::ParseAsJson) {
-      if (ignore_error_on_parse_) {
+      if (state != nullptr && state->json_body_.has_value()) {
+        // an earlier stage already parsed this body.
+        json_body = state->json_body_.value();
+      } else if (ignore_error_on_parse_) {
         try {
-          json_body = json::parse(bodystring);
+          json_body = json::parse(bodystring.begin(), bodystring.end());
         } catch (const std::exception &) {
         }
       } else {
-        json_body = json::parse(bodystring);
+        json_body = json::parse(bodystring.begin(), bodystring.end());
+      }
+      // save it before the extractors are merged in.
+      if (state != nullptr && !state->json_body_.has_value() &&
+          !json_body.is_null()) {
+        state->json_body_.emplace(json_body);
       }
     } else {
       ASSERT("missing behavior");
     }
   }
   // get the extractions
-  std::unordered_map<std::string, absl::string_view> extractions;
-  if (advanced_templates_) {
+  TransformerStats::StepTimer timer(stats_, TransformerStats::Step::Extract,
+                                    callbacks);
+  if (advanced_templates_ || direct_merge_) {
     extractions.reserve(extractors_.size());
   }
 
   for (const auto &named_extractor : extractors_) {
     const std::string &name = named_extractor.first;
-    if (advanced_templates_) {
+    if (advanced_templates_ || direct_merge_) {
       extractions[name] =
           named_extractor.second.extract(callbacks, header_map, get_body);
     } else {
-      absl::string_view name_to_split = name;
-      json *current = &json_body;
-      for (size_t pos = name_to_split.find("."); pos != std::string::npos;
-           pos = name_to_split.find(".")) {
-        auto &&field_name = name_to_split.substr(0, pos);
-        current = &(*current)[std::string(field_name)];
-        name_to_split = name_to_split.substr(pos + 1);
-      }
-      (*current)[std::string(name_to_split)] =
-          named_extractor.second.extract(callbacks, header_map, get_body);
+      mergeExtraction(
+          json_body, name,
+          named_extractor.second.extract(callbacks, header_map, get_body));
     }
   }
+}
 
-  // get cluster metadata
-  const envoy::config::core::v3::Metadata *cluster_metadata{};
+const envoy::config::core::v3::Metadata *
+InjaTransformer::clusterMetadata(Http::StreamFilterCallbacks &callbacks) {
   Upstream::ClusterInfoConstSharedPtr ci = callbacks.clusterInfo();
   if (ci.get()) {
-    cluster_metadata = &ci->metadata();
+    return &ci->metadata();
+  }
+  return nullptr;
+}
+
+ClusterMetadataCache::Values *InjaTransformer::clusterMetadataValues(
+    Http::StreamFilterCallbacks &callbacks) const {
+  if (cluster_metadata_cache_ == nullptr) {
+    return nullptr;
+  }
+  Upstream::ClusterInfoConstSharedPtr ci = callbacks.clusterInfo();
+  if (!ci) {
+    return nullptr;
   }
+  return &(*cluster_metadata_cache_)->values(ci);
+}
+
+void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
+                                Http::RequestHeaderMap *request_headers,
+                                Buffer::Instance &body,
+                                Http::StreamFilterCallbacks &callbacks) const {
+  transformImpl(header_map, request_headers, body, callbacks, nullptr);
+}
+
+void InjaTransformer::transformStage(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &body,
+    Http::StreamFilterCallbacks &callbacks,
+    TransformationSharedStatePtr &state) const {
+  auto *inja_state = dynamic_cast<InjaSharedState *>(state.get());
+  if (inja_state == nullptr) {
+    state = std::make_unique<InjaSharedState>();
+    inja_state = static_cast<InjaSharedState *>(state.get());
+  }
+  transformImpl(header_map, request_headers, body, callbacks, inja_state);
+}
+
+void InjaTransformer::transformImpl(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &body,
+    Http::StreamFilterCallbacks &callbacks, InjaSharedState *state) const {
+  const ContentEncoding::Type encoding =
+      decode_content_ ? ContentEncoding::fromHeaders(header_map)
+                      : ContentEncoding::Type::Identity;
+  if (state != nullptr && encoding != ContentEncoding::Type::Identity) {
+    // the shared state only ever holds the body as parsed off the wire.
+    state->json_body_.reset();
+    state = nullptr;
+  }
+  const uint64_t input_bytes = body.length();
+
+  std::string cache_key;
+  std::shared_ptr<OutputCache::Output> cache_output;
+  if (output_cache_ != nullptr) {
+    cache_key = outputCacheKey(header_map, request_headers, body, callbacks);
+    if (applyCachedOutput(cache_key, header_map, body, callbacks, state)) {
+      stats_.recordBytes(input_bytes, body.length());
+      return;
+    }
+    cache_output = std::make_shared<OutputCache::Output>();
+  }
+
+  absl::optional<Buffer::OwnedImpl> inflated_body;
+  GetBodyFunc get_body = [this, &inflated_body, &body,
+                          encoding]() -> absl::string_view {
+    if (body_prefix_length_ != 0) {
+      return linearizedView(body, body_prefix_length_);
+    }
+    if (encoding == ContentEncoding::Type::Identity) {
+      return linearizedView(body);
+    }
+    if (!inflated_body.has_value()) {
+      // only inflate once something actually reads the body.
+      Buffer::OwnedImpl inflated;
+      ContentEncoding::inflate(encoding, body, inflated,
+                               max_decompressed_size_);
+      inflated_body.emplace();
+      inflated_body->move(inflated);
+    }
+    return linearizedView(inflated_body.value());
+  };
+
+  json json_body;
+  std::unordered_map<std::string, absl::string_view> extractions;
+  parseAndExtract(header_map, body, get_body, callbacks, state, json_body,
+                  extractions);
+
+  // get cluster metadata
+  const envoy::config::core::v3::Metadata *cluster_metadata =
+      clusterMetadata(callbacks);
 
   // start transforming!
   TransformerInstance instance(header_map, request_headers, get_body,
                                extractions, json_body, environ_,
-                               cluster_metadata);
+                               cluster_metadata,
+                               clusterMetadataValues(callbacks));
+
+  absl::optional<TransformerStats::StepTimer> render_timer;
+  render_timer.emplace(stats_, TransformerStats::Step::Render, callbacks);
 
   // Body transform:
   absl::optional<Buffer::OwnedImpl> maybe_body;
 
-  if (body_template_.has_value()) {
-    std::string output = instance.render(body_template_.value());
-    maybe_body.emplace(output);
-  } else if (merged_extractors_to_body_) {
-    std::string output = json_body.dump();
-    maybe_body.emplace(output);
+  // framed bodies are transformed message by message in transformFrame.
+  if (!body_framing_.has_value()) {
+    if (body_template_.has_value()) {
+      maybe_body.emplace();
+      moveToBuffer(render(instance, body_template_.value()),
+                   maybe_body.value());
+    } else if (merged_extractors_to_body_) {
+      maybe_body.emplace();
+      moveToBuffer(mergedBody(json_body, extractions), maybe_body.value());
+    }
   }
 
   // DynamicMetadata transform:
   for (const auto &templated_dynamic_metadata : dynamic_metadata_) {
-    std::string output = instance.render(templated_dynamic_metadata.template_);
+    std::string output =
+        render(instance, templated_dynamic_metadata.template_);
+    if (cache_output != nullptr) {
+      cache_output->dynamic_metadata_.push_back(output);
+    }
     if (!output.empty()) {
       ProtobufWkt::Struct strct(
           MessageUtil::keyValueStruct(templated_dynamic_metadata.key_, output));
@@ -443,7 +1200,10 @@ void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
 
   // Headers transform:
   for (const auto &templated_header : headers_) {
-    std::string output = instance.render(templated_header.second);
+    std::string output = render(instance, templated_header.second);
+    if (cache_output != nullptr) {
+      cache_output->headers_.push_back(output);
+    }
     // remove existing header
     header_map.remove(templated_header.first);
     // TODO(yuval-k): Do we need to support intentional empty headers?
@@ -456,7 +1216,10 @@ void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
 
   // Headers to Append Values transform:
   for (const auto &templated_header : headers_to_append_) {
-    std::string output = instance.render(templated_header.second);
+    std::string output = render(instance, templated_header.second);
+    if (cache_output != nullptr) {
+      cache_output->headers_to_append_.push_back(output);
+    }
     if (!output.empty()) {
       // we can add the key as reference as the headers_to_append_ lifetime is as the
       // route's
@@ -464,10 +1227,20 @@ void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
       header_map.addReferenceKey(templated_header.first, output);
     }
   }
+  render_timer.reset();
 
   // replace body. we do it here so that headers and dynamic metadata have the
   // original body.
   if (maybe_body.has_value()) {
+    if (encoding != ContentEncoding::Type::Identity) {
+      if (recompress_) {
+        Buffer::OwnedImpl compressed;
+        ContentEncoding::deflate(encoding, maybe_body.value(), compressed);
+        maybe_body.value().move(compressed);
+      } else {
+        header_map.remove(Http::CustomHeaders::get().ContentEncoding);
+      }
+    }
     // remove content length, as we have new body.
     header_map.removeContentLength();
     // replace body
@@ -475,6 +1248,222 @@ void InjaTransformer::transform(Http::RequestOrResponseHeaderMap &header_map,
     // prepend is used because it doesn't copy, it drains maybe_body
     body.prepend(maybe_body.value());
     header_map.setContentLength(body.length());
+    if (state != nullptr) {
+      state->json_body_.reset();
+    }
+  }
+
+  if (body_framing_.has_value()) {
+    // every message may change size, so the length is no longer known.
+    header_map.removeContentLength();
+  }
+
+  if (cache_output != nullptr) {
+    if (maybe_body.has_value()) {
+      cache_output->body_.emplace(body.toString());
+      cache_output->remove_content_encoding_ =
+          encoding != ContentEncoding::Type::Identity && !recompress_;
+    }
+    if (cache_key_cluster_) {
+      cache_output->cluster_ = callbacks.clusterInfo();
+    }
+    (*output_cache_)->insert(std::move(cache_key), std::move(cache_output));
+  }
+  stats_.recordBytes(input_bytes, body.length());
+}
+
+BodyFramerPtr InjaTransformer::createBodyFramer() const {
+  if (!body_framing_.has_value()) {
+    return nullptr;
+  }
+  return BodyFramer::create(body_framing_.value());
+}
+
+void InjaTransformer::transformFrame(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &frame,
+    Http::StreamFilterCallbacks &callbacks) const {
+  transformFrameStage(header_map, request_headers, frame, callbacks, nullptr);
+}
+
+void InjaTransformer::transformFrameStage(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &frame,
+    Http::StreamFilterCallbacks &callbacks, InjaSharedState *state) const {
+  // headers and dynamic metadata were transformed when the headers arrived,
+  // only the message itself is transformed here.
+  if (!body_template_.has_value() && !merged_extractors_to_body_) {
+    return;
+  }
+
+  GetBodyFunc get_body = [&frame]() -> absl::string_view {
+    return linearizedView(frame);
+  };
+
+  json json_body;
+  std::unordered_map<std::string, absl::string_view> extractions;
+  parseAndExtract(header_map, frame, get_body, callbacks, state, json_body,
+                  extractions);
+
+  std::string output;
+  if (body_template_.has_value()) {
+    TransformerInstance instance(header_map, request_headers, get_body,
+                                 extractions, json_body, environ_,
+                                 clusterMetadata(callbacks),
+                                 clusterMetadataValues(callbacks));
+    TransformerStats::StepTimer timer(stats_, TransformerStats::Step::Render,
+                                      callbacks);
+    output = render(instance, body_template_.value());
+  } else {
+    output = mergedBody(json_body, extractions);
+  }
+  frame.drain(frame.length());
+  frame.add(output);
+}
+
+InjaMetadataTransformer::InjaMetadataTransformer(
+    const TransformationTemplate &transformation, TransformerStats stats,
+    TemplateProfilerSharedPtr profiler, std::string name)
+    : stats_(std::move(stats)), profiler_(std::move(profiler)),
+      name_(std::move(name)),
+      advanced_templates_(transformation.advanced_templates()),
+      environ_(parseEnvironment()) {
+  if (!isMetadataOnly(transformation)) {
+    throw EnvoyException(
+        "transformation does more than set dynamic metadata");
+  }
+  inja::ParserConfig parser_config;
+  inja::LexerConfig lexer_config;
+  inja::TemplateStorage template_storage;
+  if (!advanced_templates_) {
+    parser_config.notation = inja::ElementNotation::Dot;
+  }
+  inja::Parser parser(parser_config, lexer_config, template_storage);
+
+  for (const auto &extractor : transformation.extractors()) {
+    extractors_.emplace_back(
+        std::make_pair(extractor.first, Extractor(extractor.second)));
+  }
+  for (const auto &value : transformation.dynamic_metadata_values()) {
+    const std::string &name = value.metadata_namespace().empty()
+                                  ? SoloHttpFilterNames::get().Transformation
+                                  : value.metadata_namespace();
+    auto metadata_namespace =
+        std::find_if(namespaces_.begin(), namespaces_.end(),
+                     [&name](const MetadataNamespace &other) {
+                       return other.name_ == name;
+                     });
+    if (metadata_namespace == namespaces_.end()) {
+      metadata_namespace =
+          namespaces_.insert(namespaces_.end(), MetadataNamespace{name, {}});
+    }
+    try {
+      metadata_namespace->values_.emplace_back(
+          value.key(), parser.parse(value.value().text()));
+    } catch (const std::exception &e) {
+      throw EnvoyException(
+          fmt::format("Failed to parse dynamic metadata template '{}': {}",
+                      value.key(), e.what()));
+    }
+  }
+}
+
+InjaMetadataTransformer::~InjaMetadataTransformer() {
+  if (profiled_) {
+    for (const auto &metadata_namespace : namespaces_) {
+      for (const auto &value : metadata_namespace.values_) {
+        profiler_->removeTemplate(&value.second);
+      }
+    }
+  }
+}
+
+void InjaMetadataTransformer::registerProfiledTemplates() const {
+  for (const auto &metadata_namespace : namespaces_) {
+    for (const auto &value : metadata_namespace.values_) {
+      profiler_->addTemplate(
+          &value.second,
+          profileDescription(name_,
+                             absl::StrCat("dynamic metadata ", value.first),
+                             value.second));
+    }
+  }
+}
+
+bool InjaMetadataTransformer::isMetadataOnly(
+    const TransformationTemplate &transformation) {
+  // a body, even an empty one, would change the content length.
+  return transformation.headers().empty() &&
+         transformation.headers_to_append().empty() &&
+         !transformation.has_body() &&
+         !transformation.has_merge_extractors_to_body() &&
+         !transformation.has_body_framing() &&
+         !transformation.has_output_cache();
+}
+
+void InjaMetadataTransformer::transform(
+    Http::RequestOrResponseHeaderMap &map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &,
+    Http::StreamFilterCallbacks &callbacks) const {
+  setMetadata(map, request_headers, callbacks);
+}
+
+void InjaMetadataTransformer::transformOnStreamCompletion(
+    Http::ResponseHeaderMap *response_headers,
+    Http::RequestHeaderMap *request_headers,
+    Http::StreamFilterCallbacks &callbacks) const {
+  setMetadata(response_headers != nullptr ? *response_headers
+                                          : *emptyResponseHeaders(),
+              request_headers, callbacks);
+}
+
+void InjaMetadataTransformer::setMetadata(
+    const Http::RequestOrResponseHeaderMap &header_map,
+    const Http::RequestHeaderMap *request_headers,
+    Http::StreamFilterCallbacks &callbacks) const {
+  // there is no body once the stream is complete.
+  GetBodyFunc get_body = [] { return absl::string_view(); };
+  json context;
+  std::unordered_map<std::string, absl::string_view> extractions;
+  {
+    TransformerStats::StepTimer timer(stats_, TransformerStats::Step::Extract,
+                                      callbacks);
+    for (const auto &named_extractor : extractors_) {
+      const absl::string_view value =
+          named_extractor.second.extract(callbacks, header_map, get_body);
+      if (advanced_templates_) {
+        extractions[named_extractor.first] = value;
+      } else {
+        mergeExtraction(context, named_extractor.first, value);
+      }
+    }
+  }
+
+  Upstream::ClusterInfoConstSharedPtr cluster_info = callbacks.clusterInfo();
+  TransformerInstance instance(
+      header_map, request_headers, get_body, extractions, context, environ_,
+      cluster_info != nullptr ? &cluster_info->metadata() : nullptr);
+
+  TransformerStats::StepTimer timer(stats_, TransformerStats::Step::Render,
+                                    callbacks);
+  for (const auto &metadata_namespace : namespaces_) {
+    ProtobufWkt::Struct values;
+    auto &fields = *values.mutable_fields();
+    for (const auto &value : metadata_namespace.values_) {
+      TemplateProfiler::Timer timer(profiler_.get(), &value.second);
+      if (timer.sampled() && !profiled_.load(std::memory_order_relaxed) &&
+          !profiled_.exchange(true)) {
+        registerProfiledTemplates();
+      }
+      std::string output = instance.render(value.second);
+      if (!output.empty()) {
+        fields[value.first].set_string_value(std::move(output));
+      }
+    }
+    if (!fields.empty()) {
+      callbacks.streamInfo().setDynamicMetadata(metadata_namespace.name_,
+                                                values);
+    }
   }
 }
 
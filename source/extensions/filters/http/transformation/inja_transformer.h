@@ -1,12 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <map>
 
 #include "envoy/buffer/buffer.h"
+#include "envoy/event/dispatcher.h"
 #include "envoy/http/header_map.h"
+#include "envoy/thread_local/thread_local.h"
 
+#include "source/extensions/filters/http/transformation/cluster_metadata_cache.h"
+#include "source/extensions/filters/http/transformation/main_thread_slot.h"
+#include "source/extensions/filters/http/transformation/output_cache.h"
+#include "source/extensions/filters/http/transformation/template_profiler.h"
 #include "source/extensions/filters/http/transformation/transformer.h"
 
+#include "absl/container/node_hash_map.h"
+
 // clang-format off
 #include "nlohmann/json.hpp"
 #include "inja/inja.hpp"
@@ -19,7 +28,9 @@ namespace Extensions {
 namespace HttpFilters {
 namespace Transformation {
 
-using GetBodyFunc = std::function<const std::string &()>;
+// Returns the body the templates read. The view stays valid for the rest of
+// the transformation.
+using GetBodyFunc = std::function<absl::string_view()>;
 
 class TransformerInstance {
 public:
@@ -29,9 +40,11 @@ public:
       const std::unordered_map<std::string, absl::string_view> &extractions,
       const nlohmann::json &context,
       const std::unordered_map<std::string, std::string> &environ,
-      const envoy::config::core::v3::Metadata *cluster_metadata);
+      const envoy::config::core::v3::Metadata *cluster_metadata,
+      ClusterMetadataCache::Values *cluster_metadata_values = nullptr);
 
-  std::string render(const inja::Template &input);
+  // size_hint is reserved for the output up front.
+  std::string render(const inja::Template &input, uint64_t size_hint = 0);
 
 private:
   // header_value(name)
@@ -51,6 +64,8 @@ private:
   const nlohmann::json &context_;
   const std::unordered_map<std::string, std::string> &environ_;
   const envoy::config::core::v3::Metadata *cluster_metadata_;
+  // memoized clusterMetadata() values of the cluster, if any.
+  ClusterMetadataCache::Values *cluster_metadata_values_;
 };
 
 class Extractor : Logger::Loggable<Logger::Id::filter> {
@@ -66,14 +81,31 @@ private:
 
   const Http::LowerCaseString headername_;
   const bool body_;
+  const uint32_t body_prefix_length_;
   const unsigned int group_;
   const std::regex extract_regex_;
 };
 
+// The parsed body, shared by the inja transformers of a fused pipeline. Reset
+// whenever a stage replaces the body.
+class InjaSharedState : public TransformationSharedState {
+public:
+  absl::optional<nlohmann::json> json_body_;
+};
+
 class InjaTransformer : public Transformer {
 public:
   InjaTransformer(const envoy::api::v2::filter::http::TransformationTemplate
                       &transformation);
+  // output_cache needs thread local storage for its per-worker caches, which
+  // are released on the main thread.
+  InjaTransformer(const envoy::api::v2::filter::http::TransformationTemplate
+                      &transformation,
+                  ThreadLocal::SlotAllocator &tls,
+                  Event::Dispatcher &main_thread_dispatcher,
+                  TransformerStats stats = {},
+                  TemplateProfilerSharedPtr profiler = nullptr,
+                  std::string name = "");
   ~InjaTransformer();
 
   void transform(Http::RequestOrResponseHeaderMap &map,
@@ -81,16 +113,129 @@ public:
                  Buffer::Instance &body,
                  Http::StreamFilterCallbacks &) const override;
   bool passthrough_body() const override { return passthrough_body_; };
+  uint64_t bodyPrefixLength() const override { return body_prefix_length_; }
+
+  BodyFramerPtr createBodyFramer() const override;
+  bool framed() const override { return body_framing_.has_value(); }
+  void transformFrame(Http::RequestOrResponseHeaderMap &header_map,
+                      Http::RequestHeaderMap *request_headers,
+                      Buffer::Instance &frame,
+                      Http::StreamFilterCallbacks &callbacks) const override;
+  void transformStage(Http::RequestOrResponseHeaderMap &header_map,
+                      Http::RequestHeaderMap *request_headers,
+                      Buffer::Instance &body,
+                      Http::StreamFilterCallbacks &callbacks,
+                      TransformationSharedStatePtr &state) const override;
+  // transformFrame() that takes the parsed message from state, if it is
+  // there, e.g. when it was decoded from another format.
+  void transformFrameStage(Http::RequestOrResponseHeaderMap &header_map,
+                           Http::RequestHeaderMap *request_headers,
+                           Buffer::Instance &frame,
+                           Http::StreamFilterCallbacks &callbacks,
+                           InjaSharedState *state) const;
 
 private:
+  InjaTransformer(const envoy::api::v2::filter::http::TransformationTemplate
+                      &transformation,
+                  ThreadLocal::SlotAllocator *tls,
+                  Event::Dispatcher *main_thread_dispatcher,
+                  TransformerStats stats, TemplateProfilerSharedPtr profiler,
+                  std::string name);
+
+  // registers the templates with profiler_, once a render is sampled.
+  void registerProfiledTemplates() const;
+  // calls callback with every template and what it renders, e.g. "body".
+  void forEachTemplate(
+      const std::function<void(const inja::Template &, const std::string &)>
+          &callback) const;
+  std::string render(TransformerInstance &instance,
+                     const inja::Template &input) const;
+
+  void setupBodyPrefix(
+      const envoy::api::v2::filter::http::TransformationTemplate
+          &transformation);
+  void setupOutputCache(
+      const envoy::api::v2::filter::http::TransformationTemplate
+          &transformation,
+      ThreadLocal::SlotAllocator *tls,
+      Event::Dispatcher *main_thread_dispatcher);
+  // keys on everything the templates read, the body by its sha256.
+  std::string outputCacheKey(const Http::RequestOrResponseHeaderMap &header_map,
+                             const Http::RequestHeaderMap *request_headers,
+                             const Buffer::Instance &body,
+                             Http::StreamFilterCallbacks &callbacks) const;
+  // returns false if nothing usable is cached for key.
+  bool applyCachedOutput(const std::string &key,
+                         Http::RequestOrResponseHeaderMap &header_map,
+                         Buffer::Instance &body,
+                         Http::StreamFilterCallbacks &callbacks,
+                         InjaSharedState *state) const;
+
+  void transformImpl(Http::RequestOrResponseHeaderMap &header_map,
+                     Http::RequestHeaderMap *request_headers,
+                     Buffer::Instance &body,
+                     Http::StreamFilterCallbacks &callbacks,
+                     InjaSharedState *state) const;
+
+  // parses the body (if configured) and runs the extractors on it. the
+  // parsed body is taken from and saved to state, if present.
+  void parseAndExtract(
+      const Http::RequestOrResponseHeaderMap &header_map,
+      const Buffer::Instance &body, GetBodyFunc &get_body,
+      Http::StreamFilterCallbacks &callbacks, InjaSharedState *state,
+      nlohmann::json &json_body,
+      std::unordered_map<std::string, absl::string_view> &extractions) const;
+
+  static const envoy::config::core::v3::Metadata *
+  clusterMetadata(Http::StreamFilterCallbacks &callbacks);
+  // the memoized clusterMetadata() values of the upstream cluster, or
+  // nullptr if they aren't cached.
+  ClusterMetadataCache::Values *
+  clusterMetadataValues(Http::StreamFilterCallbacks &callbacks) const;
+
   struct DynamicMetadataValue {
     std::string namespace_;
     std::string key_;
     inja::Template template_;
   };
 
+  // the extractor names split on '.', as merged into the body. a node is
+  // either an extraction or an object of its children.
+  struct MergeNode {
+    const std::string *extraction_{};
+    std::map<std::string, std::unique_ptr<MergeNode>> children_;
+  };
+
+  // returns false if an extraction and an object would share a name, as the
+  // result then depends on the order the extractors run in.
+  bool buildMergeTree();
+  // serializes json_body with the extractions merged in, without merging
+  // them into the json first when possible.
+  std::string mergedBody(
+      const nlohmann::json &json_body,
+      const std::unordered_map<std::string, absl::string_view> &extractions)
+      const;
+  static void
+  writeMerged(const nlohmann::json *json_body, const MergeNode &node,
+              const std::unordered_map<std::string, absl::string_view>
+                  &extractions,
+              std::string &output);
+
+  const TransformerStats stats_;
+  const TemplateProfilerSharedPtr profiler_;
+  // names the transformation in the profile, e.g. by its rule.
+  const std::string name_;
+  // set once the templates are registered with profiler_.
+  mutable std::atomic<bool> profiled_{};
+  // an estimate of the size of each template's output, to reserve for the
+  // next render. shared by the workers, so it is rarely written: it grows to
+  // outputs that don't fit, and follows smaller ones on a sample of renders.
+  mutable absl::node_hash_map<const inja::Template *, std::atomic<uint64_t>>
+      render_sizes_;
   bool advanced_templates_{};
   bool passthrough_body_{};
+  // set when only a prefix of the body is read, @see bodyPrefixLength().
+  uint64_t body_prefix_length_{};
   std::vector<std::pair<std::string, Extractor>> extractors_;
   std::vector<std::pair<Http::LowerCaseString, inja::Template>> headers_;
   std::vector<std::pair<Http::LowerCaseString, inja::Template>> headers_to_append_;
@@ -103,6 +248,79 @@ private:
 
   absl::optional<inja::Template> body_template_;
   bool merged_extractors_to_body_{};
+  // set when the extractions are written straight into the merged body.
+  bool direct_merge_{};
+  MergeNode merge_tree_;
+  absl::optional<envoy::api::v2::filter::http::BodyFraming> body_framing_;
+
+  bool decode_content_{};
+  bool recompress_{};
+  uint64_t max_decompressed_size_{};
+
+  // set when the templates read cluster metadata by a literal key.
+  std::unique_ptr<MainThreadSlot<ClusterMetadataCache>> cluster_metadata_cache_;
+
+  // set when the output is cached.
+  std::unique_ptr<MainThreadSlot<OutputCache>> output_cache_;
+  std::vector<Http::LowerCaseString> cache_key_headers_;
+  std::vector<Http::LowerCaseString> cache_key_request_headers_;
+  bool cache_key_cluster_{};
+};
+
+/**
+ * A transformation template that only sets dynamic metadata, run once the
+ * stream is complete (e.g. to enrich the access logs). None of the body,
+ * header and caching machinery of InjaTransformer is set up, and the values
+ * of each namespace are written in a single call.
+ */
+class InjaMetadataTransformer : public Transformer {
+public:
+  // throws EnvoyException if transformation does more than set metadata.
+  InjaMetadataTransformer(
+      const envoy::api::v2::filter::http::TransformationTemplate
+          &transformation,
+      TransformerStats stats = {}, TemplateProfilerSharedPtr profiler = nullptr,
+      std::string name = "");
+  ~InjaMetadataTransformer();
+
+  /**
+   * @return true if all transformation does, once the stream is complete, is
+   * set dynamic metadata.
+   */
+  static bool
+  isMetadataOnly(const envoy::api::v2::filter::http::TransformationTemplate
+                     &transformation);
+
+  bool passthrough_body() const override { return true; }
+  void transform(Http::RequestOrResponseHeaderMap &map,
+                 Http::RequestHeaderMap *request_headers,
+                 Buffer::Instance &body,
+                 Http::StreamFilterCallbacks &callbacks) const override;
+  void transformOnStreamCompletion(
+      Http::ResponseHeaderMap *response_headers,
+      Http::RequestHeaderMap *request_headers,
+      Http::StreamFilterCallbacks &callbacks) const override;
+
+private:
+  void setMetadata(const Http::RequestOrResponseHeaderMap &header_map,
+                   const Http::RequestHeaderMap *request_headers,
+                   Http::StreamFilterCallbacks &callbacks) const;
+
+  struct MetadataNamespace {
+    std::string name_;
+    std::vector<std::pair<std::string, inja::Template>> values_;
+  };
+
+  void registerProfiledTemplates() const;
+
+  const TransformerStats stats_;
+  const TemplateProfilerSharedPtr profiler_;
+  const std::string name_;
+  mutable std::atomic<bool> profiled_{};
+  bool advanced_templates_{};
+  std::vector<std::pair<std::string, Extractor>> extractors_;
+  std::vector<MetadataNamespace> namespaces_;
+  std::unordered_map<std::string, std::string> environ_;
 };
 
 } // namespace Transformation
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/thread_local/thread_local.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+/**
+ * A TypedSlot that can be released on any thread. Transformers belong to route
+ * configs, and the last reference to those may be dropped on a worker, but
+ * slots must be destroyed on the main thread, so the slot is handed over to
+ * the main thread dispatcher to be destroyed there.
+ */
+template <class T> class MainThreadSlot {
+public:
+  MainThreadSlot(ThreadLocal::SlotAllocator &tls,
+                 Event::Dispatcher &main_thread_dispatcher)
+      : slot_(std::make_shared<ThreadLocal::TypedSlot<T>>(tls)),
+        main_thread_dispatcher_(main_thread_dispatcher) {}
+
+  ~MainThreadSlot() {
+    // the posted callback holds the only reference, so the slot goes away
+    // with it on the main thread.
+    main_thread_dispatcher_.post([slot = std::move(slot_)]() {});
+  }
+
+  void set(typename ThreadLocal::TypedSlot<T>::InitializeCb cb) {
+    slot_->set(std::move(cb));
+  }
+
+  // the object of the current thread.
+  T *operator->() const { return slot_->operator->(); }
+
+private:
+  std::shared_ptr<ThreadLocal::TypedSlot<T>> slot_;
+  Event::Dispatcher &main_thread_dispatcher_;
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
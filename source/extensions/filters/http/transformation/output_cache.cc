@@ -0,0 +1,65 @@
+#include "source/extensions/filters/http/transformation/output_cache.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+uint64_t OutputCache::Output::byteSize() const {
+  uint64_t size = sizeof(Output);
+  for (const auto &value : headers_) {
+    size += value.size();
+  }
+  for (const auto &value : headers_to_append_) {
+    size += value.size();
+  }
+  for (const auto &value : dynamic_metadata_) {
+    size += value.size();
+  }
+  if (body_.has_value()) {
+    size += body_->size();
+  }
+  return size;
+}
+
+OutputCache::OutputConstSharedPtr
+OutputCache::lookup(const std::string &key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->output_;
+}
+
+void OutputCache::insert(std::string key, OutputConstSharedPtr output) {
+  remove(key);
+  const uint64_t byte_size = key.size() + output->byteSize();
+  if (byte_size > max_bytes_) {
+    return;
+  }
+  while (bytes_ + byte_size > max_bytes_) {
+    erase(std::prev(entries_.end()));
+  }
+  entries_.push_front(Entry{std::move(key), std::move(output), byte_size});
+  bytes_ += byte_size;
+  index_.emplace(entries_.front().key_, entries_.begin());
+}
+
+void OutputCache::remove(const std::string &key) {
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    erase(it->second);
+  }
+}
+
+void OutputCache::erase(EntryList::iterator it) {
+  index_.erase(it->key_);
+  bytes_ -= it->byte_size_;
+  entries_.erase(it);
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
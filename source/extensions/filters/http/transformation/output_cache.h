@@ -0,0 +1,76 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/thread_local/thread_local.h"
+#include "envoy/upstream/upstream.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+/**
+ * A size bounded LRU of rendered transformation outputs, keyed by the
+ * transformation inputs. There is one per worker, so it is not thread safe.
+ */
+class OutputCache : public ThreadLocal::ThreadLocalObject {
+public:
+  struct Output {
+    // rendered values, in the order of the transformer's templates.
+    std::vector<std::string> headers_;
+    std::vector<std::string> headers_to_append_;
+    std::vector<std::string> dynamic_metadata_;
+    // the new body, if the transformation replaces it.
+    absl::optional<std::string> body_;
+    bool remove_content_encoding_{};
+    // the cluster whose metadata was rendered. the entry is stale once the
+    // cluster is updated.
+    std::weak_ptr<const Upstream::ClusterInfo> cluster_;
+
+    uint64_t byteSize() const;
+  };
+  using OutputConstSharedPtr = std::shared_ptr<const Output>;
+
+  OutputCache(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+  // Returns the output cached for key, or nullptr. A hit becomes the most
+  // recently used entry.
+  OutputConstSharedPtr lookup(const std::string &key);
+
+  // Caches output under key, evicting the least recently used entries to
+  // stay within the size bound.
+  void insert(std::string key, OutputConstSharedPtr output);
+
+  void remove(const std::string &key);
+
+  uint64_t size() const { return entries_.size(); }
+
+private:
+  struct Entry {
+    std::string key_;
+    OutputConstSharedPtr output_;
+    uint64_t byte_size_;
+  };
+  using EntryList = std::list<Entry>;
+
+  void erase(EntryList::iterator it);
+
+  const uint64_t max_bytes_;
+  uint64_t bytes_{};
+  // most recently used first.
+  EntryList entries_;
+  // keys point into the entries.
+  absl::flat_hash_map<absl::string_view, EntryList::iterator> index_;
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
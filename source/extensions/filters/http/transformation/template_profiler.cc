@@ -0,0 +1,192 @@
+#include "source/extensions/filters/http/transformation/template_profiler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "envoy/singleton/manager.h"
+
+#include "source/common/common/lock_guard.h"
+#include "source/common/http/utility.h"
+
+#include "absl/strings/numbers.h"
+#include "fmt/format.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+SINGLETON_MANAGER_REGISTRATION(transformation_template_profiler);
+
+namespace {
+constexpr absl::string_view PROFILE_PATH = "/transformation/profile";
+constexpr absl::string_view SAMPLE_PATH = "/transformation/profile/sample";
+constexpr absl::string_view RESET_PATH = "/transformation/profile/reset";
+} // namespace
+
+TemplateProfiler::TemplateProfiler(Server::Admin &admin,
+                                   TimeSource &time_source,
+                                   Event::Dispatcher &main_thread_dispatcher)
+    : admin_(admin), time_source_(time_source),
+      main_thread_dispatcher_(main_thread_dispatcher) {
+  addHandler(PROFILE_PATH, "render time of the transformation templates",
+             MAKE_ADMIN_HANDLER(handlerProfile), false);
+  addHandler(SAMPLE_PATH, "time 1 in rate transformation template renders",
+             MAKE_ADMIN_HANDLER(handlerSample), true);
+  addHandler(RESET_PATH, "reset the transformation template profile",
+             MAKE_ADMIN_HANDLER(handlerReset), true);
+}
+
+TemplateProfiler::~TemplateProfiler() {
+  // the last transformer may go away on a worker, but admin handlers are
+  // only removed on the main thread.
+  main_thread_dispatcher_.post(
+      [&admin = admin_, paths = std::move(handler_paths_)]() {
+        for (const auto &path : paths) {
+          admin.removeHandler(path);
+        }
+      });
+}
+
+void TemplateProfiler::addHandler(absl::string_view path,
+                                  const std::string &help,
+                                  Server::Admin::HandlerCb handler,
+                                  bool mutates_state) {
+  std::string prefix(path);
+  if (admin_.addHandler(prefix, help, handler, true, mutates_state)) {
+    handler_paths_.push_back(std::move(prefix));
+  } else {
+    ENVOY_LOG(warn, "could not add the admin handler {}", path);
+  }
+}
+
+TemplateProfilerSharedPtr
+TemplateProfiler::get(Server::Configuration::CommonFactoryContext &context) {
+  return context.singletonManager().getTyped<TemplateProfiler>(
+      SINGLETON_MANAGER_REGISTERED_NAME(transformation_template_profiler),
+      [&context] {
+        return std::make_shared<TemplateProfiler>(
+            context.admin(), context.timeSource(),
+            context.mainThreadDispatcher());
+      });
+}
+
+TemplateProfiler::Timer::Timer(TemplateProfiler *profiler, const void *key)
+    : key_(key) {
+  if (profiler != nullptr && profiler->sample()) {
+    profiler_ = profiler;
+    start_ = profiler_->time_source_.monotonicTime();
+  }
+}
+
+TemplateProfiler::Timer::~Timer() {
+  if (profiler_ != nullptr) {
+    profiler_->record(key_, profiler_->time_source_.monotonicTime() - start_);
+  }
+}
+
+bool TemplateProfiler::sample() {
+  const uint64_t rate = sample_rate_.load(std::memory_order_relaxed);
+  if (rate == 0) {
+    return false;
+  }
+  // counted per worker, so that the workers don't contend on it.
+  static thread_local uint64_t renders = 0;
+  return renders++ % rate == 0;
+}
+
+void TemplateProfiler::addTemplate(const void *key, std::string description) {
+  Thread::LockGuard lock(lock_);
+  entries_[key].description_ = std::move(description);
+}
+
+void TemplateProfiler::removeTemplate(const void *key) {
+  Thread::LockGuard lock(lock_);
+  entries_.erase(key);
+}
+
+void TemplateProfiler::record(const void *key,
+                              std::chrono::nanoseconds elapsed) {
+  Thread::LockGuard lock(lock_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    it->second.samples_++;
+    it->second.total_ += elapsed;
+  }
+}
+
+void TemplateProfiler::reset() {
+  Thread::LockGuard lock(lock_);
+  for (auto &entry : entries_) {
+    entry.second.samples_ = 0;
+    entry.second.total_ = std::chrono::nanoseconds::zero();
+  }
+}
+
+std::string TemplateProfiler::dump() {
+  std::vector<Entry> entries;
+  {
+    Thread::LockGuard lock(lock_);
+    for (const auto &entry : entries_) {
+      if (entry.second.samples_ > 0) {
+        entries.push_back(entry.second);
+      }
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.total_ > b.total_; });
+
+  const uint64_t rate = sample_rate_;
+  std::string output =
+      rate == 0 ? "sampling: off\n"
+                : fmt::format("sampling: 1 in {} renders\n", rate);
+  output += fmt::format("{:>10} {:>14} {:>10}  template\n", "samples",
+                        "total_us", "mean_us");
+  for (const auto &entry : entries) {
+    const auto total =
+        std::chrono::duration_cast<std::chrono::microseconds>(entry.total_);
+    output += fmt::format("{:>10} {:>14} {:>10}  {}\n", entry.samples_,
+                          total.count(), total.count() / entry.samples_,
+                          entry.description_);
+  }
+  return output;
+}
+
+Http::Code TemplateProfiler::handlerProfile(absl::string_view,
+                                            Http::ResponseHeaderMap &,
+                                            Buffer::Instance &response,
+                                            Server::AdminStream &) {
+  response.add(dump());
+  return Http::Code::OK;
+}
+
+Http::Code TemplateProfiler::handlerSample(absl::string_view path_and_query,
+                                           Http::ResponseHeaderMap &,
+                                           Buffer::Instance &response,
+                                           Server::AdminStream &) {
+  const Http::Utility::QueryParams params =
+      Http::Utility::parseAndDecodeQueryString(path_and_query);
+  uint64_t rate;
+  auto it = params.find("rate");
+  if (it == params.end() || !absl::SimpleAtoi(it->second, &rate)) {
+    response.add("usage: /transformation/profile/sample?rate=<n> (0 stops)\n");
+    return Http::Code::BadRequest;
+  }
+  setSampleRate(rate);
+  response.add("OK\n");
+  return Http::Code::OK;
+}
+
+Http::Code TemplateProfiler::handlerReset(absl::string_view,
+                                          Http::ResponseHeaderMap &,
+                                          Buffer::Instance &response,
+                                          Server::AdminStream &) {
+  reset();
+  response.add("OK\n");
+  return Http::Code::OK;
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/server/admin.h"
+#include "envoy/server/factory_context.h"
+#include "envoy/singleton/instance.h"
+
+#include "source/common/common/logger.h"
+#include "source/common/common/thread.h"
+
+#include "absl/container/flat_hash_map.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+class TemplateProfiler;
+using TemplateProfilerSharedPtr = std::shared_ptr<TemplateProfiler>;
+
+/**
+ * Samples the time it takes to render each template of every transformer,
+ * so the expensive ones can be found in production. It is off until enabled
+ * through the admin interface:
+ *
+ *   /transformation/profile                  the templates, slowest first.
+ *   /transformation/profile/sample?rate=<n>  time 1 in n renders, 0 stops.
+ *   /transformation/profile/reset            forget the samples so far.
+ *
+ * There is one per server, shared by all the transformers. Templates are
+ * only registered once one of their transformer's renders is sampled, so
+ * nothing is registered while sampling is off.
+ */
+class TemplateProfiler : public Singleton::Instance,
+                         Logger::Loggable<Logger::Id::filter> {
+public:
+  TemplateProfiler(Server::Admin &admin, TimeSource &time_source,
+                   Event::Dispatcher &main_thread_dispatcher);
+  ~TemplateProfiler() override;
+
+  static TemplateProfilerSharedPtr
+  get(Server::Configuration::CommonFactoryContext &context);
+
+  /**
+   * Times a render of the template registered under key, if it is sampled.
+   */
+  class Timer {
+  public:
+    Timer(TemplateProfiler *profiler, const void *key);
+    ~Timer();
+
+    bool sampled() const { return profiler_ != nullptr; }
+
+  private:
+    TemplateProfiler *profiler_{};
+    const void *key_;
+    MonotonicTime start_;
+  };
+
+  // Templates are registered by address, with a description for the output,
+  // no later than the end of their first sampled render. Registered templates
+  // must be removed before they are destroyed.
+  void addTemplate(const void *key, std::string description);
+  void removeTemplate(const void *key);
+
+  void setSampleRate(uint64_t rate) { sample_rate_ = rate; }
+  void reset();
+  std::string dump();
+
+private:
+  struct Entry {
+    std::string description_;
+    uint64_t samples_{};
+    std::chrono::nanoseconds total_{};
+  };
+
+  void addHandler(absl::string_view path, const std::string &help,
+                  Server::Admin::HandlerCb handler, bool mutates_state);
+  bool sample();
+  void record(const void *key, std::chrono::nanoseconds elapsed);
+
+  Http::Code handlerProfile(absl::string_view path_and_query,
+                            Http::ResponseHeaderMap &response_headers,
+                            Buffer::Instance &response,
+                            Server::AdminStream &admin_stream);
+  Http::Code handlerSample(absl::string_view path_and_query,
+                           Http::ResponseHeaderMap &response_headers,
+                           Buffer::Instance &response,
+                           Server::AdminStream &admin_stream);
+  Http::Code handlerReset(absl::string_view path_and_query,
+                          Http::ResponseHeaderMap &response_headers,
+                          Buffer::Instance &response,
+                          Server::AdminStream &admin_stream);
+
+  Server::Admin &admin_;
+  TimeSource &time_source_;
+  Event::Dispatcher &main_thread_dispatcher_;
+  std::vector<std::string> handler_paths_;
+  // 0 when off.
+  std::atomic<uint64_t> sample_rate_{};
+
+  Thread::MutexBasicLockable lock_;
+  absl::flat_hash_map<const void *, Entry> entries_ ABSL_GUARDED_BY(lock_);
+};
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
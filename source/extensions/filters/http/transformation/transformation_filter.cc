@@ -4,7 +4,6 @@
 #include "source/common/common/enum_to_int.h"
 #include "source/common/config/metadata.h"
 #include "source/common/http/header_utility.h"
-#include "source/common/http/header_map_impl.h"
 #include "source/common/http/utility.h"
 
 #include "source/extensions/filters/http/solo_well_known_names.h"
@@ -48,9 +47,16 @@ TransformationFilter::decodeHeaders(Http::RequestHeaderMap &header_map,
     return Http::FilterHeadersStatus::Continue;
   }
 
-  if (end_stream || request_transformation_->passthrough_body()) {
+  if (request_transformation_->canTransform(request_body_, end_stream)) {
+    // transformRequest() clears the transformation, keep it for the framing.
+    TransformerConstSharedPtr transformation = request_transformation_;
     filter_config_->stats().request_header_transformations_.inc();
     transformRequest();
+    // only frame the body of a request whose headers were transformed.
+    if (!end_stream && !is_error()) {
+      setupFraming(transformation, request_framer_,
+                   request_frame_transformation_);
+    }
 
     return is_error() ? Http::FilterHeadersStatus::StopIteration
                       : Http::FilterHeadersStatus::Continue;
@@ -61,6 +67,17 @@ TransformationFilter::decodeHeaders(Http::RequestHeaderMap &header_map,
 
 Http::FilterDataStatus TransformationFilter::decodeData(Buffer::Instance &data,
                                                         bool end_stream) {
+  if (request_framer_ != nullptr) {
+    if (!transformFrames(*decoder_callbacks_, *request_framer_,
+                         *request_frame_transformation_, *request_headers_,
+                         data, end_stream)) {
+      request_framer_.reset();
+      requestError();
+      return Http::FilterDataStatus::StopIterationNoBuffer;
+    }
+    return Http::FilterDataStatus::Continue;
+  }
+
   if (!requestActive()) {
     return Http::FilterDataStatus::Continue;
   }
@@ -73,7 +90,7 @@ Http::FilterDataStatus TransformationFilter::decodeData(Buffer::Instance &data,
     return Http::FilterDataStatus::StopIterationNoBuffer;
   }
 
-  if (end_stream) {
+  if (request_transformation_->canTransform(request_body_, end_stream)) {
     filter_config_->stats().request_body_transformations_.inc();
     transformRequest();
     return is_error() ? Http::FilterDataStatus::StopIterationNoBuffer
@@ -85,6 +102,20 @@ Http::FilterDataStatus TransformationFilter::decodeData(Buffer::Instance &data,
 
 Http::FilterTrailersStatus
 TransformationFilter::decodeTrailers(Http::RequestTrailerMap &) {
+  if (request_framer_ != nullptr) {
+    Buffer::OwnedImpl data;
+    if (!transformFrames(*decoder_callbacks_, *request_framer_,
+                         *request_frame_transformation_, *request_headers_,
+                         data, true)) {
+      request_framer_.reset();
+      requestError();
+      return Http::FilterTrailersStatus::StopIteration;
+    }
+    if (data.length() > 0) {
+      addDecoderData(data);
+    }
+    return Http::FilterTrailersStatus::Continue;
+  }
   if (requestActive()) {
     filter_config_->stats().request_body_transformations_.inc();
     transformRequest();
@@ -115,9 +146,14 @@ TransformationFilter::encodeHeaders(Http::ResponseHeaderMap &header_map,
     // responseActive() == false
     return destroyed_ ? Http::FilterHeadersStatus::StopIteration : Http::FilterHeadersStatus::Continue;
   }
-  if (end_stream || response_transformation_->passthrough_body()) {
+  if (response_transformation_->canTransform(response_body_, end_stream)) {
+    TransformerConstSharedPtr transformation = response_transformation_;
     filter_config_->stats().response_header_transformations_.inc();
     transformResponse();
+    if (!end_stream && !is_error()) {
+      setupFraming(transformation, response_framer_,
+                   response_frame_transformation_);
+    }
     return destroyed_ ? Http::FilterHeadersStatus::StopIteration : Http::FilterHeadersStatus::Continue;
   }
 
@@ -126,6 +162,16 @@ TransformationFilter::encodeHeaders(Http::ResponseHeaderMap &header_map,
 
 Http::FilterDataStatus TransformationFilter::encodeData(Buffer::Instance &data,
                                                         bool end_stream) {
+  if (response_framer_ != nullptr && !destroyed_) {
+    if (!transformFrames(*encoder_callbacks_, *response_framer_,
+                         *response_frame_transformation_, *response_headers_,
+                         data, end_stream)) {
+      frameResponseError();
+      return Http::FilterDataStatus::StopIterationNoBuffer;
+    }
+    return Http::FilterDataStatus::Continue;
+  }
+
   if (!responseActive()) {
     return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer : Http::FilterDataStatus::Continue;
   }
@@ -138,7 +184,7 @@ Http::FilterDataStatus TransformationFilter::encodeData(Buffer::Instance &data,
     return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer : Http::FilterDataStatus::Continue;
   }
 
-  if (end_stream) {
+  if (response_transformation_->canTransform(response_body_, end_stream)) {
     filter_config_->stats().response_body_transformations_.inc();
     transformResponse();
     return destroyed_ ? Http::FilterDataStatus::StopIterationNoBuffer : Http::FilterDataStatus::Continue;
@@ -149,6 +195,19 @@ Http::FilterDataStatus TransformationFilter::encodeData(Buffer::Instance &data,
 
 Http::FilterTrailersStatus
 TransformationFilter::encodeTrailers(Http::ResponseTrailerMap &) {
+  if (response_framer_ != nullptr && !destroyed_) {
+    Buffer::OwnedImpl data;
+    if (!transformFrames(*encoder_callbacks_, *response_framer_,
+                         *response_frame_transformation_, *response_headers_,
+                         data, true)) {
+      frameResponseError();
+      return Http::FilterTrailersStatus::StopIteration;
+    }
+    if (data.length() > 0) {
+      addEncoderData(data);
+    }
+    return Http::FilterTrailersStatus::Continue;
+  }
   if (responseActive()) {
     filter_config_->stats().response_body_transformations_.inc();
     transformResponse();
@@ -218,23 +277,11 @@ void TransformationFilter::transformOnStreamCompletion() {
     return;
   }
 
-  // Body isn't required for this transformer since it isn't included
-  // in access logs
-  Buffer::OwnedImpl emptyBody{};
-  std::unique_ptr<Http::ResponseHeaderMapImpl> emptyResponseHeaderMap;
-
-  // If response_headers_ is a nullptr (this can happpen if a client disconnects)
-  // we pass in an empty response header to avoid errors within the transformer.
-  if (response_headers_ == nullptr) {
-    emptyResponseHeaderMap = Http::ResponseHeaderMapImpl::create();
-    response_headers_ = emptyResponseHeaderMap.get();
-  }
-
+  // response_headers_ is a nullptr if the client disconnected before the
+  // response started.
   try {
-    on_stream_completion_transformation_->transform(*response_headers_,
-                                                    request_headers_, 
-                                                    emptyBody, 
-                                                    *encoder_callbacks_);
+    on_stream_completion_transformation_->transformOnStreamCompletion(
+        response_headers_, request_headers_, *encoder_callbacks_);
   } catch (std::exception &e)  {
     ENVOY_STREAM_LOG(debug, 
                      "failure transforming on stream completion {}", 
@@ -244,6 +291,61 @@ void TransformationFilter::transformOnStreamCompletion() {
   }
 }
 
+void TransformationFilter::setupFraming(
+    const TransformerConstSharedPtr &transformation, BodyFramerPtr &framer,
+    TransformerConstSharedPtr &frame_transformation) {
+  framer = transformation->createBodyFramer();
+  if (framer != nullptr) {
+    // transformSomething clears the transformation once the headers are
+    // done, keep it around for the messages.
+    frame_transformation = transformation;
+  }
+}
+
+bool TransformationFilter::transformFrames(
+    Http::StreamFilterCallbacks &callbacks, BodyFramer &framer,
+    const Transformer &transformation,
+    Http::RequestOrResponseHeaderMap &header_map, Buffer::Instance &data,
+    bool end_stream) {
+  Buffer::OwnedImpl output;
+  BodyFramer::Status status;
+  try {
+    status = framer.decode(
+        data, end_stream, output, [&](Buffer::Instance &frame) {
+          transformation.transformFrame(header_map, request_headers_, frame,
+                                        callbacks);
+        });
+  } catch (std::exception &e) {
+    ENVOY_STREAM_LOG(debug, "failure transforming frame {}", callbacks,
+                     e.what());
+    error(Error::TemplateParseError, e.what());
+    return false;
+  }
+
+  switch (status) {
+  case BodyFramer::Status::Ok:
+    break;
+  case BodyFramer::Status::FrameTooLarge:
+    error(Error::PayloadTooLarge);
+    return false;
+  case BodyFramer::Status::IncompleteFrame:
+    error(Error::InvalidFrame);
+    return false;
+  }
+
+  data.move(output);
+  return true;
+}
+
+void TransformationFilter::frameResponseError() {
+  ASSERT(is_error());
+  // the response headers were already sent, so we can't turn this into an
+  // error response.
+  filter_config_->stats().response_error_.inc();
+  response_framer_.reset();
+  encoder_callbacks_->resetStream();
+}
+
 void TransformationFilter::transformSomething(
     Http::StreamFilterCallbacks &callbacks,
     TransformerConstSharedPtr &transformation,
@@ -320,6 +422,11 @@ void TransformationFilter::error(Error error, std::string msg) {
     error_code_ = Http::Code::NotFound;
     break;
   }
+  case Error::InvalidFrame: {
+    error_messgae_ = "incomplete message";
+    error_code_ = Http::Code::BadRequest;
+    break;
+  }
   }
   if (!msg.empty()) {
     if (error_messgae_.empty()) {
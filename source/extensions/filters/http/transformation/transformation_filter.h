@@ -68,6 +68,7 @@ private:
     JsonParseError,
     TemplateParseError,
     TransformationNotFound,
+    InvalidFrame,
   };
 
   enum class Direction {
@@ -99,6 +100,17 @@ private:
                      void (TransformationFilter::*responeWithError)(),
                      void (TransformationFilter::*addData)(Buffer::Instance &));
 
+  // Transforms every complete message in data, replacing data with the
+  // transformed messages. Returns false on error.
+  bool transformFrames(Http::StreamFilterCallbacks &callbacks,
+                       BodyFramer &framer, const Transformer &transformation,
+                       Http::RequestOrResponseHeaderMap &header_map,
+                       Buffer::Instance &data, bool end_stream);
+  void setupFraming(const TransformerConstSharedPtr &transformation,
+                    BodyFramerPtr &framer,
+                    TransformerConstSharedPtr &frame_transformation);
+  void frameResponseError();
+
   void resetInternalState();
 
   Http::StreamDecoderFilterCallbacks *decoder_callbacks_{};
@@ -115,6 +127,11 @@ private:
   TransformerConstSharedPtr request_transformation_;
   TransformerConstSharedPtr response_transformation_;
   TransformerConstSharedPtr on_stream_completion_transformation_;
+  // set when the body is transformed message by message.
+  BodyFramerPtr request_framer_;
+  BodyFramerPtr response_framer_;
+  TransformerConstSharedPtr request_frame_transformation_;
+  TransformerConstSharedPtr response_frame_transformation_;
   absl::optional<Error> error_;
   Http::Code error_code_;
   std::string error_messgae_;
@@ -6,6 +6,8 @@
 #include "source/common/protobuf/message_validator_impl.h"
 #include "source/common/config/utility.h"
 
+#include "absl/strings/str_cat.h"
+
 
 #include "source/extensions/filters/http/transformation/body_header_transformer.h"
 #include "source/extensions/filters/http/transformation/inja_transformer.h"
@@ -17,11 +19,14 @@ namespace Transformation {
 
 TransformerConstSharedPtr Transformation::getTransformer(
     const envoy::api::v2::filter::http::Transformation &transformation,
-    Server::Configuration::CommonFactoryContext &context) {
+    Server::Configuration::CommonFactoryContext &context,
+    const TransformerStats &stats, const std::string &name) {
   switch (transformation.transformation_type_case()) {
   case envoy::api::v2::filter::http::Transformation::kTransformationTemplate:
     return std::make_unique<InjaTransformer>(
-        transformation.transformation_template());
+        transformation.transformation_template(), context.threadLocal(),
+        context.mainThreadDispatcher(), stats, TemplateProfiler::get(context),
+        name);
   case envoy::api::v2::filter::http::Transformation::kHeaderBodyTransform: {
     const auto& header_body_transform = transformation.header_body_transform();
     return std::make_unique<BodyHeaderTransformer>(header_body_transform.add_request_metadata());
@@ -39,15 +44,61 @@ TransformerConstSharedPtr Transformation::getTransformer(
   }
 }
 
+TransformerConstSharedPtr Transformation::getOnStreamCompletionTransformer(
+    const envoy::api::v2::filter::http::Transformation &transformation,
+    Server::Configuration::CommonFactoryContext &context,
+    const TransformerStats &stats, const std::string &name) {
+  if (transformation.has_transformation_template() &&
+      InjaMetadataTransformer::isMetadataOnly(
+          transformation.transformation_template())) {
+    return std::make_unique<InjaMetadataTransformer>(
+        transformation.transformation_template(), stats,
+        TemplateProfiler::get(context), name);
+  }
+  return getTransformer(transformation, context, stats, name);
+}
+
+namespace {
+
+// The detailed stats of a transformation direction: those under each prefix,
+// e.g. the stage's and the rule's.
+TransformerStats detailedStats(const std::vector<std::string> &prefixes,
+                               absl::string_view direction,
+                               Stats::Scope &scope) {
+  TransformerStats stats;
+  for (const auto &prefix : prefixes) {
+    stats.add(TransformerStats::generateStats(
+        absl::StrCat(prefix, direction, "."), scope));
+  }
+  return stats;
+}
+
+} // namespace
+
 TransformationFilterConfig::TransformationFilterConfig(
     const TransformationConfigProto &proto_config, const std::string &prefix,
     Server::Configuration::FactoryContext &context)
     : FilterConfig(prefix, context.scope(), proto_config.stage()) {
 
-  for (const auto &rule : proto_config.transformations()) {
+  for (int i = 0; i < proto_config.transformations_size(); i++) {
+    const auto &rule = proto_config.transformations(i);
     if (!rule.has_match()) {
       continue;
     }
+    const std::string &stats_name = rule.route_transformations().stats_name();
+    const std::string name =
+        absl::StrCat("listener stage ", proto_config.stage(), " rule ",
+                     stats_name.empty() ? absl::StrCat("#", i) : stats_name);
+    std::vector<std::string> stats_prefixes;
+    if (proto_config.detailed_stats()) {
+      stats_prefixes.push_back(absl::StrCat(prefix, "transformation.stage_",
+                                            proto_config.stage(), "."));
+    }
+    if (!rule.route_transformations().stats_name().empty()) {
+      stats_prefixes.push_back(
+          absl::StrCat(prefix, "transformation.rule.",
+                       rule.route_transformations().stats_name(), "."));
+    }
     TransformerConstSharedPtr request_transformation;
     TransformerConstSharedPtr response_transformation;
     TransformerConstSharedPtr on_stream_completion_transformation;
@@ -58,7 +109,9 @@ TransformationFilterConfig::TransformationFilterConfig(
       if (route_transformation.has_request_transformation()) {
         try {
           request_transformation = Transformation::getTransformer(
-              route_transformation.request_transformation(), context);
+              route_transformation.request_transformation(), context,
+              detailedStats(stats_prefixes, "request", context.scope()),
+              absl::StrCat(name, " request"));
         } catch (const std::exception &e) {
           throw EnvoyException(
               fmt::format("Failed to parse request template: {}", e.what()));
@@ -67,7 +120,9 @@ TransformationFilterConfig::TransformationFilterConfig(
       if (route_transformation.has_response_transformation()) {
         try {
           response_transformation = Transformation::getTransformer(
-              route_transformation.response_transformation(), context);
+              route_transformation.response_transformation(), context,
+              detailedStats(stats_prefixes, "response", context.scope()),
+              absl::StrCat(name, " response"));
         } catch (const std::exception &e) {
           throw EnvoyException(
               fmt::format("Failed to parse response template: {}", e.what()));
@@ -75,14 +130,26 @@ TransformationFilterConfig::TransformationFilterConfig(
       }
       if (route_transformation.has_on_stream_completion_transformation()) {
         try {
-          on_stream_completion_transformation = Transformation::getTransformer(
-              route_transformation.on_stream_completion_transformation(), context);
+          on_stream_completion_transformation =
+              Transformation::getOnStreamCompletionTransformer(
+                  route_transformation.on_stream_completion_transformation(),
+                  context,
+                  detailedStats(stats_prefixes, "on_stream_completion",
+                                context.scope()),
+                  absl::StrCat(name, " on stream completion"));
         } catch (const std::exception &e) {
           throw EnvoyException(
               fmt::format("Failed to get the on stream completion transformation: {}", e.what()));
         }
       }
     }
+    if (proto_config.fuse_stages() &&
+        ((request_transformation != nullptr &&
+          request_transformation->framed()) ||
+         (response_transformation != nullptr &&
+          response_transformation->framed()))) {
+      throw EnvoyException("body_framing can't be used with fuse_stages");
+    }
     TransformerPairConstSharedPtr transformer_pair =
         std::make_unique<TransformerPair>(request_transformation,
                                           response_transformation,
@@ -161,13 +228,18 @@ RouteTransformationFilterConfig::RouteTransformationFilterConfig(
   std::vector<std::unique_ptr<PerStageRouteTransformationFilterConfig>>
       temp_stages(stages_.size());
 
-  for (auto &&transformation : proto_config.transformations()) {
+  for (int i = 0; i < proto_config.transformations_size(); i++) {
+    const auto &transformation = proto_config.transformations(i);
     RELEASE_ASSERT(transformation.stage() < stages_.size(), "");
     if (!temp_stages[transformation.stage()]) {
       temp_stages[transformation.stage()].reset(
           new PerStageRouteTransformationFilterConfig());
     }
-    temp_stages[transformation.stage()]->addTransformation(transformation, context);
+    const std::string &stats_name = transformation.stats_name();
+    temp_stages[transformation.stage()]->addTransformation(
+        transformation, context,
+        absl::StrCat("route stage ", transformation.stage(), " ",
+                     stats_name.empty() ? absl::StrCat("#", i) : stats_name));
   }
   for (uint32_t i = 0; i < stages_.size(); i++) {
     stages_[i] = std::move(temp_stages[i]);
@@ -176,8 +248,14 @@ RouteTransformationFilterConfig::RouteTransformationFilterConfig(
 
 void PerStageRouteTransformationFilterConfig::addTransformation(
     const envoy::api::v2::filter::http::RouteTransformations_RouteTransformation
-        &transformation, Server::Configuration::CommonFactoryContext &context) {
+        &transformation, Server::Configuration::CommonFactoryContext &context,
+    const std::string &name) {
   using envoy::api::v2::filter::http::RouteTransformations_RouteTransformation;
+  std::vector<std::string> stats_prefixes;
+  if (!transformation.stats_name().empty()) {
+    stats_prefixes.push_back(
+        absl::StrCat("transformation.route.", transformation.stats_name(), "."));
+  }
   // create either request or response one.
   switch (transformation.match_case()) {
   case RouteTransformations_RouteTransformation::kRequestMatch: {
@@ -194,7 +272,9 @@ void PerStageRouteTransformationFilterConfig::addTransformation(
     if (request_match.has_request_transformation()) {
       try {
         request_transformation = Transformation::getTransformer(
-            request_match.request_transformation(), context);
+            request_match.request_transformation(), context,
+            detailedStats(stats_prefixes, "request", context.scope()),
+            absl::StrCat(name, " request"));
       } catch (const std::exception &e) {
         throw EnvoyException(
             fmt::format("Failed to parse request template: {}", e.what()));
@@ -203,7 +283,9 @@ void PerStageRouteTransformationFilterConfig::addTransformation(
     if (request_match.has_response_transformation()) {
       try {
         response_transformation = Transformation::getTransformer(
-            request_match.response_transformation(), context);
+            request_match.response_transformation(), context,
+            detailedStats(stats_prefixes, "response", context.scope()),
+            absl::StrCat(name, " response"));
       } catch (const std::exception &e) {
         throw EnvoyException(
             fmt::format("Failed to parse response template: {}", e.what()));
@@ -231,7 +313,11 @@ void PerStageRouteTransformationFilterConfig::addTransformation(
     auto &&transformation = response_match.response_transformation();
     try {
       std::pair<ResponseMatcherConstPtr, TransformerConstSharedPtr> pair(
-          std::move(matcher), Transformation::getTransformer(transformation, context));
+          std::move(matcher),
+          Transformation::getTransformer(
+              transformation, context,
+              detailedStats(stats_prefixes, "response", context.scope()),
+              absl::StrCat(name, " response")));
       response_transformations_.emplace_back(std::move(pair));
     } catch (const std::exception &e) {
       throw EnvoyException(fmt::format(
@@ -19,9 +19,19 @@ namespace Transformation {
 
 class Transformation {
 public:
+  // stats are the detailed stats the transformer records, if it can. name
+  // tells the transformation apart in the template profile.
   static TransformerConstSharedPtr getTransformer(
       const envoy::api::v2::filter::http::Transformation &transformation,
-      Server::Configuration::CommonFactoryContext &context );
+      Server::Configuration::CommonFactoryContext &context,
+      const TransformerStats &stats = {}, const std::string &name = "");
+  // same as getTransformer(), for transformations that run once the stream
+  // is complete. templates that only set dynamic metadata get a transformer
+  // that skips everything else.
+  static TransformerConstSharedPtr getOnStreamCompletionTransformer(
+      const envoy::api::v2::filter::http::Transformation &transformation,
+      Server::Configuration::CommonFactoryContext &context,
+      const TransformerStats &stats = {}, const std::string &name = "");
 };
 
 class ResponseMatcher;
@@ -66,10 +76,12 @@ private:
 class PerStageRouteTransformationFilterConfig : public TransformConfig {
 public:
   PerStageRouteTransformationFilterConfig() = default;
+  // name tells the transformation apart in the template profile.
   void addTransformation(
       const envoy::api::v2::filter::http::
           RouteTransformations_RouteTransformation &transformations,
-          Server::Configuration::CommonFactoryContext &context);
+          Server::Configuration::CommonFactoryContext &context,
+          const std::string &name);
 
   TransformerPairConstSharedPtr
   findTransformers(const Http::RequestHeaderMap &headers) const override;
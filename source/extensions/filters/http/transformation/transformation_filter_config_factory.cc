@@ -7,6 +7,7 @@
 #include "source/common/common/macros.h"
 #include "source/common/protobuf/utility.h"
 
+#include "source/extensions/filters/http/transformation/fused_transformation_filter.h"
 #include "source/extensions/filters/http/transformation/transformation_filter.h"
 #include "source/extensions/filters/http/transformation/transformation_filter_config.h"
 
@@ -24,6 +25,13 @@ TransformationFilterConfigFactory::createFilterFactoryFromProtoTyped(
   FilterConfigSharedPtr config = std::make_shared<TransformationFilterConfig>(
       proto_config, stats_prefix, context);
 
+  if (proto_config.fuse_stages()) {
+    return [config](Http::FilterChainFactoryCallbacks &callbacks) -> void {
+      auto filter = new FusedTransformationFilter(config);
+      callbacks.addStreamFilter(Http::StreamFilterSharedPtr{filter});
+    };
+  }
+
   return [config](Http::FilterChainFactoryCallbacks &callbacks) -> void {
     auto filter = new TransformationFilter(config);
     callbacks.addStreamFilter(Http::StreamFilterSharedPtr{filter});
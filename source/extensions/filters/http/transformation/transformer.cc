@@ -1,12 +1,24 @@
 #include "source/extensions/filters/http/transformation/transformer.h"
 
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/http/header_map_impl.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace HttpFilters {
 namespace Transformation {
 
-namespace {
-constexpr uint64_t MAX_STAGE_NUMBER = 10UL;
+void Transformer::transformOnStreamCompletion(
+    Http::ResponseHeaderMap *response_headers,
+    Http::RequestHeaderMap *request_headers,
+    Http::StreamFilterCallbacks &callbacks) const {
+  Buffer::OwnedImpl empty_body;
+  Http::ResponseHeaderMapPtr empty_response_headers;
+  if (response_headers == nullptr) {
+    empty_response_headers = Http::ResponseHeaderMapImpl::create();
+    response_headers = empty_response_headers.get();
+  }
+  transform(*response_headers, request_headers, empty_body, callbacks);
 }
 
 TransformerPair::TransformerPair(TransformerConstSharedPtr request_transformer,
@@ -35,6 +47,55 @@ TransformationFilterStats FilterConfig::generateStats(const std::string &prefix,
       POOL_COUNTER_PREFIX(scope, final_prefix))};
 }
 
+TransformationDetailedStats
+TransformerStats::generateStats(const std::string &prefix,
+                                Stats::Scope &scope) {
+  return {ALL_TRANSFORMATION_DETAILED_STATS(POOL_COUNTER_PREFIX(scope, prefix),
+                                            POOL_HISTOGRAM_PREFIX(scope, prefix))};
+}
+
+void TransformerStats::recordBytes(uint64_t input, uint64_t output) const {
+  for (const auto &stats : stats_) {
+    stats.input_bytes_.add(input);
+    stats.output_bytes_.add(output);
+  }
+}
+
+void TransformerStats::recordTime(Step step,
+                                  std::chrono::microseconds elapsed) const {
+  for (const auto &stats : stats_) {
+    switch (step) {
+    case Step::Parse:
+      stats.parse_time_.recordValue(elapsed.count());
+      break;
+    case Step::Extract:
+      stats.extract_time_.recordValue(elapsed.count());
+      break;
+    case Step::Render:
+      stats.render_time_.recordValue(elapsed.count());
+      break;
+    }
+  }
+}
+
+TransformerStats::StepTimer::StepTimer(const TransformerStats &stats,
+                                       Step step,
+                                       Http::StreamFilterCallbacks &callbacks)
+    : stats_(stats), step_(step) {
+  if (stats_.enabled()) {
+    time_source_ = &callbacks.dispatcher().timeSource();
+    start_ = time_source_->monotonicTime();
+  }
+}
+
+TransformerStats::StepTimer::~StepTimer() {
+  if (time_source_ != nullptr) {
+    stats_.recordTime(step_,
+                      std::chrono::duration_cast<std::chrono::microseconds>(
+                          time_source_->monotonicTime() - start_));
+  }
+}
+
 RouteFilterConfig::RouteFilterConfig() : stages_(MAX_STAGE_NUMBER + 1) {}
 
 const TransformConfig *
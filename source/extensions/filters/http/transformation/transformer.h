@@ -3,6 +3,7 @@
 #include <string>
 
 #include "envoy/buffer/buffer.h"
+#include "envoy/common/time.h"
 #include "envoy/http/filter.h"
 #include "envoy/http/header_map.h"
 #include "envoy/router/router.h"
@@ -12,6 +13,7 @@
 #include "source/common/http/header_utility.h"
 #include "source/common/matcher/solo_matcher.h"
 #include "source/common/protobuf/protobuf.h"
+#include "source/extensions/filters/http/transformation/body_framer.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -37,18 +39,159 @@ struct TransformationFilterStats {
   ALL_TRANSFORMATION_FILTER_STATS(GENERATE_COUNTER_STRUCT)
 };
 
+/**
+ * Opt-in stats of the work done by transformations. @see stats_macros.h
+ */
+#define ALL_TRANSFORMATION_DETAILED_STATS(COUNTER, HISTOGRAM)                 \
+  COUNTER(input_bytes)                                                         \
+  COUNTER(output_bytes)                                                        \
+  HISTOGRAM(parse_time, Microseconds)                                          \
+  HISTOGRAM(extract_time, Microseconds)                                        \
+  HISTOGRAM(render_time, Microseconds)
+
+/**
+ * Wrapper struct for detailed transformation stats @see stats_macros.h
+ */
+struct TransformationDetailedStats {
+  ALL_TRANSFORMATION_DETAILED_STATS(GENERATE_COUNTER_STRUCT,
+                                    GENERATE_HISTOGRAM_STRUCT)
+};
+
+/**
+ * The detailed stats a transformer records into, e.g. those of its filter
+ * stage and those of its rule. Empty unless detailed stats were asked for.
+ */
+class TransformerStats {
+public:
+  enum class Step {
+    Parse,
+    Extract,
+    Render,
+  };
+
+  static TransformationDetailedStats generateStats(const std::string &prefix,
+                                                   Stats::Scope &scope);
+
+  void add(const TransformationDetailedStats &stats) {
+    stats_.push_back(stats);
+  }
+  bool enabled() const { return !stats_.empty(); }
+
+  void recordBytes(uint64_t input, uint64_t output) const;
+  void recordTime(Step step, std::chrono::microseconds elapsed) const;
+
+  /**
+   * Records the time until it is destroyed as a sample of step. Does nothing
+   * if the stats are not enabled.
+   */
+  class StepTimer {
+  public:
+    StepTimer(const TransformerStats &stats, Step step,
+              Http::StreamFilterCallbacks &callbacks);
+    ~StepTimer();
+
+  private:
+    const TransformerStats &stats_;
+    const Step step_;
+    TimeSource *time_source_{};
+    MonotonicTime start_;
+  };
+
+private:
+  std::vector<TransformationDetailedStats> stats_;
+};
+
+// Stages are numbered 0 to MAX_STAGE_NUMBER (inclusive).
+constexpr uint32_t MAX_STAGE_NUMBER = 10;
+
+/**
+ * Per-stream state shared by the stages of a fused transformation pipeline.
+ * Transformers can keep work here (e.g. the parsed body) so that later stages
+ * don't have to redo it as long as the body wasn't replaced in between.
+ */
+class TransformationSharedState {
+public:
+  virtual ~TransformationSharedState() = default;
+};
+using TransformationSharedStatePtr =
+    std::unique_ptr<TransformationSharedState>;
+
 class Transformer {
 public:
   virtual ~Transformer() {}
 
   virtual bool passthrough_body() const PURE;
 
+  /**
+   * Returns how many bytes at the start of the body a passthrough_body()
+   * transformation reads, or 0 if it doesn't read the body at all. Such
+   * transformations run once that many bytes were buffered, or the body
+   * ended, rather than on the headers. The rest of the body streams through.
+   */
+  virtual uint64_t bodyPrefixLength() const { return 0; }
+
+  /**
+   * @return true if the transformation can run with the body buffered so
+   * far, false if it has to wait for more of it.
+   */
+  bool canTransform(const Buffer::Instance &body, bool end_stream) const {
+    if (end_stream) {
+      return true;
+    }
+    if (!passthrough_body()) {
+      return false;
+    }
+    const uint64_t prefix_length = bodyPrefixLength();
+    return prefix_length == 0 || body.length() >= prefix_length;
+  }
+
   virtual void transform(Http::RequestOrResponseHeaderMap &map,
                          // request header map. this has the request header map
                          // even when transforming responses.
                          Http::RequestHeaderMap *request_headers,
                          Buffer::Instance &body,
                          Http::StreamFilterCallbacks &callbacks) const PURE;
+
+  /**
+   * Returns a framer if the body should be transformed message by message as
+   * it streams, or nullptr if the body is transformed as a whole. Framed
+   * transformers should report passthrough_body(), as transform() is called
+   * once with an empty body when the headers arrive and transformFrame() is
+   * called for every message afterwards.
+   */
+  virtual BodyFramerPtr createBodyFramer() const { return nullptr; }
+  // Whether createBodyFramer() returns a framer, without creating one.
+  virtual bool framed() const { return false; }
+
+  virtual void transformFrame(Http::RequestOrResponseHeaderMap &,
+                              Http::RequestHeaderMap *,
+                              Buffer::Instance &,
+                              Http::StreamFilterCallbacks &) const {}
+
+  /**
+   * Runs the transformation once the stream is complete, e.g. to add dynamic
+   * metadata for the access logs. There is no body, and response_headers is
+   * nullptr if the response never started. By default, transform() is called
+   * with an empty body and, if needed, empty response headers.
+   */
+  virtual void
+  transformOnStreamCompletion(Http::ResponseHeaderMap *response_headers,
+                              Http::RequestHeaderMap *request_headers,
+                              Http::StreamFilterCallbacks &callbacks) const;
+
+  /**
+   * Same as transform(), for a stage of a fused pipeline. state is shared by
+   * all the stages that transform the same body. Transformers that don't
+   * know how to use it must clear it, as they may change the body.
+   */
+  virtual void transformStage(Http::RequestOrResponseHeaderMap &map,
+                              Http::RequestHeaderMap *request_headers,
+                              Buffer::Instance &body,
+                              Http::StreamFilterCallbacks &callbacks,
+                              TransformationSharedStatePtr &state) const {
+    state.reset();
+    transform(map, request_headers, body, callbacks);
+  }
 };
 
 typedef std::shared_ptr<const Transformer> TransformerConstSharedPtr;
@@ -0,0 +1,43 @@
+#include "source/extensions/transformers/protobuf/config.h"
+
+#include "envoy/registry/registry.h"
+
+#include "source/common/config/datasource.h"
+#include "source/common/protobuf/utility.h"
+#include "source/extensions/transformers/protobuf/descriptor_cache.h"
+#include "source/extensions/transformers/protobuf/protobuf_transformer.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+HttpFilters::Transformation::TransformerConstSharedPtr
+ProtobufTransformerFactory::createTransformer(
+    const Protobuf::Message &config,
+    Server::Configuration::CommonFactoryContext &context) {
+  const auto &proto_config = MessageUtil::downcastAndValidate<
+      const ProtobufTransformerProto &>(
+      config, context.messageValidationVisitor());
+  DescriptorSetSharedPtr descriptor_set =
+      DescriptorCache::get(context)->descriptorSet(Config::DataSource::read(
+          proto_config.descriptor_set(), false, context.api()));
+  return std::make_shared<ProtobufTransformer>(
+      proto_config, std::move(descriptor_set), context.threadLocal(),
+      context.mainThreadDispatcher());
+}
+
+ProtobufTypes::MessagePtr ProtobufTransformerFactory::createEmptyConfigProto() {
+  return std::make_unique<ProtobufTransformerProto>();
+}
+
+/**
+ * Static registration for the protobuf transformer. @see RegisterFactory.
+ */
+REGISTER_FACTORY(ProtobufTransformerFactory,
+                 HttpFilters::Transformation::TransformerExtensionFactory);
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
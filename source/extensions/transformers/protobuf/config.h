@@ -0,0 +1,29 @@
+#pragma once
+
+#include "source/extensions/filters/http/transformation/transformation_filter_config.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+/**
+ * Config registration for the protobuf transformer.
+ */
+class ProtobufTransformerFactory
+    : public HttpFilters::Transformation::TransformerExtensionFactory {
+public:
+  std::string name() const override { return "io.solo.transformer.protobuf"; }
+
+  HttpFilters::Transformation::TransformerConstSharedPtr
+  createTransformer(const Protobuf::Message &config,
+                    Server::Configuration::CommonFactoryContext &context)
+      override;
+
+  ProtobufTypes::MessagePtr createEmptyConfigProto() override;
+};
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
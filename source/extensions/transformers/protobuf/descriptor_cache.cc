@@ -0,0 +1,88 @@
+#include "source/extensions/transformers/protobuf/descriptor_cache.h"
+
+#include "envoy/common/exception.h"
+#include "envoy/singleton/manager.h"
+
+#include "absl/strings/str_cat.h"
+#include "fmt/format.h"
+#include "google/protobuf/util/type_resolver_util.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+SINGLETON_MANAGER_REGISTRATION(protobuf_transformer_descriptor_cache);
+
+namespace {
+constexpr absl::string_view TYPE_URL_PREFIX = "type.googleapis.com";
+} // namespace
+
+DescriptorSet::DescriptorSet(const std::string &descriptor_set) {
+  Protobuf::FileDescriptorSet files;
+  if (!files.ParseFromString(descriptor_set)) {
+    throw EnvoyException("unable to parse the protobuf descriptor set");
+  }
+  // protoc lists the imports of a file before the file.
+  for (const auto &file : files.file()) {
+    if (pool_.BuildFile(file) == nullptr) {
+      throw EnvoyException(
+          fmt::format("unable to build the protobuf descriptor {}",
+                      file.name()));
+    }
+  }
+  type_resolver_.reset(Protobuf::util::NewTypeResolverForDescriptorPool(
+      std::string(TYPE_URL_PREFIX), &pool_));
+}
+
+std::string DescriptorSet::typeUrl(const Protobuf::Descriptor &descriptor) {
+  return absl::StrCat(TYPE_URL_PREFIX, "/", descriptor.full_name());
+}
+
+const Protobuf::Message &DescriptorSet::prototype(const std::string &type) {
+  auto it = prototypes_.find(type);
+  if (it != prototypes_.end()) {
+    return *it->second;
+  }
+  const Protobuf::Descriptor *descriptor = pool_.FindMessageTypeByName(type);
+  if (descriptor == nullptr) {
+    throw EnvoyException(
+        fmt::format("protobuf message type {} not in the descriptor set",
+                    type));
+  }
+  const Protobuf::Message *prototype = factory_.GetPrototype(descriptor);
+  prototypes_.emplace(type, prototype);
+  return *prototype;
+}
+
+std::shared_ptr<DescriptorCache>
+DescriptorCache::get(Server::Configuration::CommonFactoryContext &context) {
+  return context.singletonManager().getTyped<DescriptorCache>(
+      SINGLETON_MANAGER_REGISTERED_NAME(protobuf_transformer_descriptor_cache),
+      [] { return std::make_shared<DescriptorCache>(); });
+}
+
+DescriptorSetSharedPtr
+DescriptorCache::descriptorSet(const std::string &descriptor_set) {
+  // forget the sets no transformer uses anymore.
+  for (auto it = descriptor_sets_.begin(); it != descriptor_sets_.end();) {
+    if (it->second.expired()) {
+      descriptor_sets_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  auto &entry = descriptor_sets_[descriptor_set];
+  DescriptorSetSharedPtr set = entry.lock();
+  if (set == nullptr) {
+    set = std::make_shared<DescriptorSet>(descriptor_set);
+    entry = set;
+  }
+  return set;
+}
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "envoy/server/factory_context.h"
+#include "envoy/singleton/instance.h"
+
+#include "source/common/protobuf/protobuf.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "google/protobuf/util/type_resolver.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+/**
+ * The message types of a FileDescriptorSet, built once and shared by all the
+ * transformers configured with that set.
+ */
+class DescriptorSet {
+public:
+  // throws EnvoyException if descriptor_set isn't a valid FileDescriptorSet.
+  explicit DescriptorSet(const std::string &descriptor_set);
+
+  /**
+   * @return the prototype of the message type with the given full name. It
+   * lives as long as the set, and New() on it is safe from any thread.
+   * Throws EnvoyException if the set has no such type.
+   */
+  const Protobuf::Message &prototype(const std::string &type);
+
+  /**
+   * @return the resolver of the types of the set, for the json conversions.
+   * Built once with the set, and safe to use from any thread.
+   */
+  Protobuf::util::TypeResolver &typeResolver() const {
+    return *type_resolver_;
+  }
+  // the url typeResolver() knows descriptor by.
+  static std::string typeUrl(const Protobuf::Descriptor &descriptor);
+
+private:
+  Protobuf::DescriptorPool pool_;
+  Protobuf::DynamicMessageFactory factory_;
+  std::unique_ptr<Protobuf::util::TypeResolver> type_resolver_;
+  // per message type, so every transformer of a type shares its prototype.
+  absl::flat_hash_map<std::string, const Protobuf::Message *> prototypes_;
+};
+
+using DescriptorSetSharedPtr = std::shared_ptr<DescriptorSet>;
+
+/**
+ * The descriptor sets of the server, by their serialized contents, so each is
+ * only built once. They are kept only as long as a transformer uses them. It
+ * is only used from the main thread, when transformers are created.
+ */
+class DescriptorCache : public Singleton::Instance {
+public:
+  static std::shared_ptr<DescriptorCache>
+  get(Server::Configuration::CommonFactoryContext &context);
+
+  DescriptorSetSharedPtr descriptorSet(const std::string &descriptor_set);
+
+private:
+  absl::flat_hash_map<std::string, std::weak_ptr<DescriptorSet>>
+      descriptor_sets_;
+};
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,235 @@
+#include "source/extensions/transformers/protobuf/protobuf_transformer.h"
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/base64.h"
+
+#include "absl/strings/match.h"
+#include "fmt/format.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+using HttpFilters::Transformation::InjaSharedState;
+using HttpFilters::Transformation::InjaTransformer;
+using HttpFilters::Transformation::TransformationSharedStatePtr;
+using TransformationTemplate =
+    envoy::api::v2::filter::http::TransformationTemplate;
+using json = nlohmann::json;
+
+ProtobufTransformer::ProtobufTransformer(
+    const ProtobufTransformerProto &config,
+    DescriptorSetSharedPtr descriptor_set, ThreadLocal::SlotAllocator &tls,
+    Event::Dispatcher &main_thread_dispatcher)
+    : descriptor_set_(std::move(descriptor_set)),
+      framed_(config.transformation_template().has_body_framing()),
+      preserve_proto_field_names_(config.preserve_proto_field_names()) {
+  const TransformationTemplate &transformation =
+      config.transformation_template();
+  if (transformation.has_content_decoding()) {
+    throw EnvoyException(
+        "content_decoding can't be used with the protobuf transformer");
+  }
+  if (!config.input_message_type().empty()) {
+    if (transformation.parse_body_behavior() ==
+        TransformationTemplate::DontParse) {
+      throw EnvoyException(
+          "input_message_type can't be used with parse_body_behavior "
+          "DontParse");
+    }
+    input_prototype_ =
+        &descriptor_set_->prototype(config.input_message_type());
+  }
+  if (!config.output_message_type().empty()) {
+    if (!transformation.has_body() &&
+        !transformation.has_merge_extractors_to_body()) {
+      throw EnvoyException(
+          "output_message_type requires a template that renders the body");
+    }
+    output_prototype_ =
+        &descriptor_set_->prototype(config.output_message_type());
+    output_type_url_ =
+        DescriptorSet::typeUrl(*output_prototype_->GetDescriptor());
+  }
+  transformer_ = std::make_unique<InjaTransformer>(transformation, tls,
+                                                   main_thread_dispatcher);
+}
+
+void ProtobufTransformer::transform(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &body,
+    Http::StreamFilterCallbacks &callbacks) const {
+  TransformationSharedStatePtr state = decode(body);
+  transformer_->transformStage(header_map, request_headers, body, callbacks,
+                               state);
+  // framed bodies are encoded message by message.
+  if (output_prototype_ != nullptr && !framed_) {
+    encode(body);
+    header_map.setContentLength(body.length());
+  }
+}
+
+void ProtobufTransformer::transformFrame(
+    Http::RequestOrResponseHeaderMap &header_map,
+    Http::RequestHeaderMap *request_headers, Buffer::Instance &frame,
+    Http::StreamFilterCallbacks &callbacks) const {
+  auto state = decode(frame);
+  transformer_->transformFrameStage(header_map, request_headers, frame,
+                                    callbacks, state.get());
+  if (output_prototype_ != nullptr) {
+    encode(frame);
+  }
+}
+
+std::unique_ptr<InjaSharedState>
+ProtobufTransformer::decode(Buffer::Instance &body) const {
+  auto state = std::make_unique<InjaSharedState>();
+  if (input_prototype_ == nullptr || body.length() == 0) {
+    return state;
+  }
+  std::unique_ptr<Protobuf::Message> message(input_prototype_->New());
+  if (!message->ParseFromArray(body.linearize(body.length()),
+                               static_cast<int>(body.length()))) {
+    throw EnvoyException(fmt::format("unable to decode the body as {}",
+                                     input_prototype_->GetTypeName()));
+  }
+  state->json_body_.emplace(toJson(*message));
+  return state;
+}
+
+void ProtobufTransformer::encode(Buffer::Instance &body) const {
+  // converted straight from the rendered json, without a message in between.
+  const uint64_t length = body.length();
+  const char *json_body =
+      length == 0 ? "" : static_cast<const char *>(body.linearize(length));
+  std::string binary;
+  const auto status = Protobuf::util::JsonToBinaryString(
+      &descriptor_set_->typeResolver(), output_type_url_, {json_body, length},
+      &binary);
+  if (!status.ok()) {
+    throw EnvoyException(fmt::format("unable to encode the body as {}: {}",
+                                     output_prototype_->GetTypeName(),
+                                     status.ToString()));
+  }
+  body.drain(length);
+  body.add(binary);
+}
+
+json ProtobufTransformer::toJson(const Protobuf::Message &message) const {
+  if (absl::StartsWith(message.GetDescriptor()->file()->name(),
+                       "google/protobuf/")) {
+    // well known types have json of their own, e.g. timestamps are strings.
+    std::string output;
+    const auto status = Protobuf::util::BinaryToJsonString(
+        &descriptor_set_->typeResolver(),
+        DescriptorSet::typeUrl(*message.GetDescriptor()),
+        message.SerializeAsString(), &output);
+    if (!status.ok()) {
+      throw EnvoyException(fmt::format("unable to decode {}: {}",
+                                       message.GetTypeName(),
+                                       status.ToString()));
+    }
+    return json::parse(output);
+  }
+
+  const Protobuf::Reflection *reflection = message.GetReflection();
+  std::vector<const Protobuf::FieldDescriptor *> fields;
+  // only the fields that are set, as the proto3 json mapping does.
+  reflection->ListFields(message, &fields);
+
+  json object = json::object();
+  for (const Protobuf::FieldDescriptor *field : fields) {
+    const std::string &name =
+        preserve_proto_field_names_ ? field->name() : field->json_name();
+    if (field->is_map()) {
+      const Protobuf::Descriptor *entry = field->message_type();
+      const Protobuf::FieldDescriptor *key = entry->map_key();
+      const Protobuf::FieldDescriptor *value = entry->map_value();
+      json map = json::object();
+      for (int i = 0; i < reflection->FieldSize(message, field); i++) {
+        const Protobuf::Message &pair =
+            reflection->GetRepeatedMessage(message, field, i);
+        json key_json = fieldToJson(pair, *key, -1);
+        map[key_json.is_string() ? key_json.get<std::string>()
+                                 : key_json.dump()] =
+            fieldToJson(pair, *value, -1);
+      }
+      object[name] = std::move(map);
+    } else if (field->is_repeated()) {
+      json array = json::array();
+      for (int i = 0; i < reflection->FieldSize(message, field); i++) {
+        array.push_back(fieldToJson(message, *field, i));
+      }
+      object[name] = std::move(array);
+    } else {
+      object[name] = fieldToJson(message, *field, -1);
+    }
+  }
+  return object;
+}
+
+// index is the element of a repeated field, or -1 for a singular field.
+json ProtobufTransformer::fieldToJson(const Protobuf::Message &message,
+                                      const Protobuf::FieldDescriptor &field,
+                                      int index) const {
+  const Protobuf::Reflection *reflection = message.GetReflection();
+  const bool repeated = index >= 0;
+  switch (field.cpp_type()) {
+  case Protobuf::FieldDescriptor::CPPTYPE_INT32:
+    return repeated ? reflection->GetRepeatedInt32(message, &field, index)
+                    : reflection->GetInt32(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_INT64:
+    return repeated ? reflection->GetRepeatedInt64(message, &field, index)
+                    : reflection->GetInt64(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_UINT32:
+    return repeated ? reflection->GetRepeatedUInt32(message, &field, index)
+                    : reflection->GetUInt32(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_UINT64:
+    return repeated ? reflection->GetRepeatedUInt64(message, &field, index)
+                    : reflection->GetUInt64(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+    return repeated ? reflection->GetRepeatedDouble(message, &field, index)
+                    : reflection->GetDouble(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+    return repeated ? reflection->GetRepeatedFloat(message, &field, index)
+                    : reflection->GetFloat(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_BOOL:
+    return repeated ? reflection->GetRepeatedBool(message, &field, index)
+                    : reflection->GetBool(message, &field);
+  case Protobuf::FieldDescriptor::CPPTYPE_ENUM: {
+    const int number =
+        repeated ? reflection->GetRepeatedEnumValue(message, &field, index)
+                 : reflection->GetEnumValue(message, &field);
+    const Protobuf::EnumValueDescriptor *value =
+        field.enum_type()->FindValueByNumber(number);
+    // values unknown to the descriptor are kept as numbers.
+    if (value == nullptr) {
+      return number;
+    }
+    return value->name();
+  }
+  case Protobuf::FieldDescriptor::CPPTYPE_STRING: {
+    std::string scratch;
+    const std::string &value =
+        repeated ? reflection->GetRepeatedStringReference(message, &field,
+                                                          index, &scratch)
+                 : reflection->GetStringReference(message, &field, &scratch);
+    if (field.type() == Protobuf::FieldDescriptor::TYPE_BYTES) {
+      return Base64::encode(value.data(), value.size());
+    }
+    return value;
+  }
+  case Protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+    return toJson(repeated
+                      ? reflection->GetRepeatedMessage(message, &field, index)
+                      : reflection->GetMessage(message, &field));
+  }
+  return nullptr;
+}
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "envoy/event/dispatcher.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "source/extensions/filters/http/transformation/inja_transformer.h"
+#include "source/extensions/filters/http/transformation/transformer.h"
+#include "source/extensions/transformers/protobuf/descriptor_cache.h"
+
+#include "api/envoy/config/transformer/protobuf/v2/protobuf_transformer.pb.validate.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+using ProtobufTransformerProto =
+    envoy::config::transformer::protobuf::v2::ProtobufTransformer;
+
+/**
+ * Runs a transformation template over binary protobuf bodies. The body, or
+ * every message of a framed body, is decoded into the template's parsed body
+ * without serializing it to json first, and what the template renders can be
+ * encoded back to protobuf.
+ */
+class ProtobufTransformer : public HttpFilters::Transformation::Transformer {
+public:
+  ProtobufTransformer(const ProtobufTransformerProto &config,
+                      DescriptorSetSharedPtr descriptor_set,
+                      ThreadLocal::SlotAllocator &tls,
+                      Event::Dispatcher &main_thread_dispatcher);
+
+  void transform(Http::RequestOrResponseHeaderMap &header_map,
+                 Http::RequestHeaderMap *request_headers,
+                 Buffer::Instance &body,
+                 Http::StreamFilterCallbacks &callbacks) const override;
+  bool passthrough_body() const override {
+    return transformer_->passthrough_body();
+  }
+
+  HttpFilters::Transformation::BodyFramerPtr
+  createBodyFramer() const override {
+    return transformer_->createBodyFramer();
+  }
+  bool framed() const override { return transformer_->framed(); }
+  void transformFrame(Http::RequestOrResponseHeaderMap &header_map,
+                      Http::RequestHeaderMap *request_headers,
+                      Buffer::Instance &frame,
+                      Http::StreamFilterCallbacks &callbacks) const override;
+
+  // the template context of message.
+  nlohmann::json toJson(const Protobuf::Message &message) const;
+
+private:
+  // a state holding the decoded body, if there is one to decode.
+  std::unique_ptr<HttpFilters::Transformation::InjaSharedState>
+  decode(Buffer::Instance &body) const;
+  void encode(Buffer::Instance &body) const;
+  nlohmann::json fieldToJson(const Protobuf::Message &message,
+                             const Protobuf::FieldDescriptor &field,
+                             int index) const;
+
+  // keeps the prototypes alive.
+  const DescriptorSetSharedPtr descriptor_set_;
+  const Protobuf::Message *input_prototype_{};
+  const Protobuf::Message *output_prototype_{};
+  // the type url of output_prototype_, for the descriptor set's resolver.
+  std::string output_type_url_;
+  const bool framed_;
+  const bool preserve_proto_field_names_;
+  std::unique_ptr<HttpFilters::Transformation::InjaTransformer> transformer_;
+};
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy
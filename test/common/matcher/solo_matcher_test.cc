@@ -0,0 +1,114 @@
+#include "source/common/matcher/solo_matcher.h"
+
+#include "test/test_common/utility.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Matcher {
+namespace {
+
+MatcherConstPtr create(const std::string &yaml) {
+  envoy::config::route::v3::RouteMatch match;
+  TestUtility::loadFromYaml(yaml, match);
+  return Matcher::create(match);
+}
+
+bool matches(const MatcherConstPtr &matcher, const std::string &path,
+             const std::string &header = "") {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", path}};
+  if (!header.empty()) {
+    headers.addCopy("x-header", header);
+  }
+  return matcher->matches(headers);
+}
+
+TEST(SoloMatcherTest, Prefix) {
+  const auto matcher = create("prefix: /api");
+  EXPECT_TRUE(matches(matcher, "/api/users"));
+  EXPECT_FALSE(matches(matcher, "/API/users"));
+  EXPECT_FALSE(matches(matcher, "/other"));
+
+  Http::TestRequestHeaderMapImpl no_path{{":method", "GET"}};
+  EXPECT_FALSE(matcher->matches(no_path));
+  EXPECT_FALSE(create("prefix: /")->matches(no_path));
+}
+
+TEST(SoloMatcherTest, PrefixIgnoringCase) {
+  const auto matcher = create(R"EOF(
+prefix: /api
+case_sensitive: false
+)EOF");
+  EXPECT_TRUE(matches(matcher, "/API/users"));
+  EXPECT_FALSE(matches(matcher, "/other"));
+}
+
+TEST(SoloMatcherTest, PathIgnoresQueryString) {
+  const auto matcher = create("path: /api");
+  EXPECT_TRUE(matches(matcher, "/api"));
+  EXPECT_TRUE(matches(matcher, "/api?a=b"));
+  EXPECT_FALSE(matches(matcher, "/api/users"));
+  EXPECT_FALSE(matches(matcher, "/API"));
+
+  const auto insensitive = create(R"EOF(
+path: /api
+case_sensitive: false
+)EOF");
+  EXPECT_TRUE(matches(insensitive, "/API?a=b"));
+}
+
+TEST(SoloMatcherTest, Regex) {
+  const auto matcher = create(R"EOF(
+safe_regex:
+  google_re2: {}
+  regex: /users/\d+
+)EOF");
+  EXPECT_TRUE(matches(matcher, "/users/123?a=b"));
+  EXPECT_FALSE(matches(matcher, "/users/abc"));
+}
+
+TEST(SoloMatcherTest, Headers) {
+  const auto matcher = create(R"EOF(
+prefix: /
+headers:
+- name: x-header
+  exact_match: value
+)EOF");
+  EXPECT_TRUE(matches(matcher, "/api", "value"));
+  EXPECT_FALSE(matches(matcher, "/api", "other"));
+  EXPECT_FALSE(matches(matcher, "/api"));
+}
+
+TEST(SoloMatcherTest, QueryParameters) {
+  const auto matcher = create(R"EOF(
+path: /api
+query_parameters:
+- name: a
+  string_match:
+    exact: b
+)EOF");
+  EXPECT_TRUE(matches(matcher, "/api?a=b"));
+  EXPECT_FALSE(matches(matcher, "/api?a=c"));
+  EXPECT_FALSE(matches(matcher, "/api"));
+}
+
+TEST(SoloMatcherTest, HeadersAndQueryParameters) {
+  const auto matcher = create(R"EOF(
+safe_regex:
+  google_re2: {}
+  regex: /api.*
+headers:
+- name: x-header
+  present_match: true
+query_parameters:
+- name: a
+  present_match: true
+)EOF");
+  EXPECT_TRUE(matches(matcher, "/api/users?a=b", "value"));
+  EXPECT_FALSE(matches(matcher, "/api/users?a=b"));
+  EXPECT_FALSE(matches(matcher, "/api/users", "value"));
+}
+
+} // namespace
+} // namespace Matcher
+} // namespace Envoy
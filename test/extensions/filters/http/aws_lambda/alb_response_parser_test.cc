@@ -0,0 +1,93 @@
+#include "source/common/buffer/buffer_impl.h"
+#include "source/extensions/filters/http/aws_lambda/alb_response_parser.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+namespace {
+
+// parses response split into parts of split_size bytes.
+bool parse(AlbResponseParser &parser, const std::string &response,
+           size_t split_size) {
+  for (size_t i = 0; i < response.size(); i += split_size) {
+    Buffer::OwnedImpl data(response.substr(i, split_size));
+    parser.parse(data);
+  }
+  return parser.finish();
+}
+
+} // namespace
+
+class AlbResponseParserTest : public testing::TestWithParam<size_t> {};
+
+INSTANTIATE_TEST_SUITE_P(SplitSizes, AlbResponseParserTest,
+                         testing::Values(1, 3, 4096));
+
+TEST_P(AlbResponseParserTest, ParsesResponse) {
+  AlbResponseParser parser;
+  ASSERT_TRUE(parse(parser,
+                    R"({"statusCode": 201, "statusDescription": "201 Created",
+                        "headers": {"a": "1", "b": 2},
+                        "multiValueHeaders": {"c": ["3", "4"]},
+                        "unknown": {"nested": [1, {"x": null}, "y"]},
+                        "body": "hello \"lambda\" é😀"})",
+                    GetParam()));
+
+  EXPECT_EQ(201U, parser.statusCode().value());
+  const std::vector<std::pair<std::string, std::string>> expected{
+      {"a", "1"}, {"b", ""}, {"c", "3"}, {"c", "4"}};
+  EXPECT_EQ(expected, parser.headers());
+  EXPECT_EQ("hello \"lambda\" \xc3\xa9\xf0\x9f\x98\x80",
+            parser.body().toString());
+}
+
+TEST_P(AlbResponseParserTest, DecodesBase64Body) {
+  AlbResponseParser parser;
+  ASSERT_TRUE(parse(parser,
+                    R"({"isBase64Encoded": true, "body": "aGVsbG8\/IQ=="})",
+                    GetParam()));
+  EXPECT_EQ("hello?!", parser.body().toString());
+}
+
+TEST_P(AlbResponseParserTest, DecodesBase64BodyFlaggedAfterwards) {
+  AlbResponseParser parser;
+  ASSERT_TRUE(parse(parser, R"({"body": "aGVsbG8=", "isBase64Encoded": true})",
+                    GetParam()));
+  EXPECT_EQ("hello", parser.body().toString());
+}
+
+TEST_P(AlbResponseParserTest, InvalidBase64IsAnEmptyBody) {
+  AlbResponseParser parser;
+  ASSERT_TRUE(parse(parser, R"({"isBase64Encoded": true, "body": "aGVsbG8"})",
+                    GetParam()));
+  EXPECT_EQ(0U, parser.body().length());
+}
+
+TEST_P(AlbResponseParserTest, RejectsInvalidResponses) {
+  for (const std::string response : {
+           R"({"isBase64Encoded": "true"})",
+           R"({"statusCode": "200"})",
+           R"({"statusCode": 0})",
+           R"({"statusCode": 200.7})",
+           R"({"statusCode": 1e300})",
+           R"({"statusCode": -200})",
+           R"({"statusCode": 600})",
+           R"({"body": floof})",
+           R"({"body": "x"} "body")",
+           R"({"body": "x")",
+           R"(["body"])",
+           R"({"body": "\ud83d"})",
+       }) {
+    AlbResponseParser parser;
+    EXPECT_FALSE(parse(parser, response, GetParam())) << response;
+  }
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
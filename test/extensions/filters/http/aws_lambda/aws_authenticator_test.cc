@@ -34,8 +34,9 @@ public:
   }
 
   std::string getBodyHexSha(AwsAuthenticator &aws) {
-
-    return aws.getBodyHexSha();
+    AwsAuthenticator::HexSha256 hexsha;
+    aws.getBodyHexSha(hexsha);
+    return std::string(AwsAuthenticator::view(hexsha));
   }
 
   std::string get_query(const AwsAuthenticator &aws) {
@@ -53,13 +54,49 @@ public:
   std::string
   signWithTime(AwsAuthenticator &aws, Http::RequestHeaderMap *request_headers,
                const HeaderList &headers, const std::string &region,
-               std::chrono::time_point<std::chrono::system_clock> now) {
-    return aws.signWithTime(request_headers, std::move(headers), region, now);
+               std::chrono::time_point<std::chrono::system_clock> now,
+               bool unsigned_payload = false) {
+    return aws.signWithTime(request_headers, std::move(headers), region, now,
+                            unsigned_payload);
+  }
+
+  // signs the request of the signature v4 test suite, at its time.
+  std::string signGuideRequest(AwsAuthenticator &aws) {
+    return signGuideRequest(aws, AwsAuthenticator::createHeaderToSign(
+                                     {Http::LowerCaseString("host")}));
+  }
+
+  std::string signGuideRequest(AwsAuthenticator &aws,
+                               const HeaderList &headers_to_sign) {
+    Http::TestRequestHeaderMapImpl headers;
+    headers.setPath(std::string("/?Param1=value1&Param2=value2"));
+    headers.setMethod(std::string("GET"));
+    headers.setHost(std::string("example.amazonaws.com"));
+    set_guide_test_params(aws);
+
+    struct tm timeinfo = {};
+    timeinfo.tm_year = 2015 - 1900;
+    timeinfo.tm_mon = 7; // 0 based august.
+    timeinfo.tm_mday = 30;
+    timeinfo.tm_hour = 12;
+    timeinfo.tm_min = 36;
+    timeinfo.tm_sec = 0;
+    return signWithTime(
+        aws, &headers, headers_to_sign, "us-east-1",
+        std::chrono::system_clock::from_time_t(std::mktime(&timeinfo)));
   }
 
   static const std::string SERVICE;
+  static const std::string GUIDE_SIGNATURE;
 };
 const std::string AwsAuthenticatorTest::SERVICE = "service";
+const std::string AwsAuthenticatorTest::GUIDE_SIGNATURE =
+    "AWS4-HMAC-SHA256 "
+    "Credential=AKIDEXAMPLE/20150830/us-east-1/service/"
+    "aws4_request, SignedHeaders=host;x-amz-date, "
+    "Signature="
+    "b97d918cfa904a5beff61c982a1b6f458b799221646efd99d3219"
+    "ec94cdf2500";
 
 TEST_F(AwsAuthenticatorTest, BodyHash) {
   DangerousDeprecatedTestTime time;
@@ -155,6 +192,130 @@ TEST_F(AwsAuthenticatorTest, TestGuide) {
   EXPECT_EQ(session_header, sessiontoken);
 }
 
+TEST_F(AwsAuthenticatorTest, SignsOnlyPresentHeaders) {
+  DangerousDeprecatedTestTime time;
+  AwsAuthenticator aws(time.timeSystem());
+  std::string secretkey = "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY";
+  std::string accesskey = "AKIDEXAMPLE";
+  aws.init(&accesskey, &secretkey, nullptr);
+
+  // the request has no x-amz-content-sha256 header, so it isn't signed.
+  EXPECT_EQ(GUIDE_SIGNATURE,
+            signGuideRequest(aws, AwsAuthenticator::createHeaderToSign(
+                                      {Http::LowerCaseString("host"),
+                                       Http::LowerCaseString(
+                                           "x-amz-content-sha256")})));
+}
+
+TEST_F(AwsAuthenticatorTest, SignsUnsignedPayload) {
+  DangerousDeprecatedTestTime time;
+  AwsAuthenticator aws(time.timeSystem());
+  std::string secretkey = "secretkey";
+  std::string accesskey = "accesskey";
+  aws.init(&accesskey, &secretkey, nullptr);
+
+  // the body isn't part of the signature.
+  updatePayloadHash(aws, "abc");
+  Http::TestRequestHeaderMapImpl headers{{":method", "POST"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/"}};
+  const std::string sig = signWithTime(
+      aws, &headers,
+      AwsAuthenticator::createHeaderToSign(
+          {Http::LowerCaseString("host"),
+           AwsAuthenticatorConsts::get().ContentSha256Header}),
+      "us-east-1", std::chrono::system_clock::from_time_t(0), true);
+
+  EXPECT_EQ("UNSIGNED-PAYLOAD",
+            headers.get_(AwsAuthenticatorConsts::get().ContentSha256Header));
+  EXPECT_THAT(sig, testing::HasSubstr(
+                       "SignedHeaders=host;x-amz-content-sha256;x-amz-date,"));
+}
+
+TEST(HeaderListTest, SortsAndDeduplicates) {
+  HeaderList headers = AwsAuthenticator::createHeaderToSign(
+      {Http::LowerCaseString("x-amz-date"), Http::LowerCaseString("host"),
+       Http::LowerCaseString("content-type")});
+
+  ASSERT_EQ(3U, headers.headers().size());
+  EXPECT_EQ("content-type", headers.headers()[0].get());
+  EXPECT_EQ("content-type;host;x-amz-date", headers.signedHeaders());
+}
+
+TEST_F(AwsAuthenticatorTest, SigningKeyCache) {
+  DangerousDeprecatedTestTime time;
+  SigningCaches caches;
+  std::string secretkey = "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY";
+  std::string accesskey = "AKIDEXAMPLE";
+
+  // the first signature derives the key, the second one uses it.
+  for (int i = 0; i < 2; i++) {
+    AwsAuthenticator aws(time.timeSystem());
+    aws.init(&accesskey, &secretkey, nullptr, &caches);
+    EXPECT_EQ(GUIDE_SIGNATURE, signGuideRequest(aws));
+    EXPECT_EQ(1U, caches.keys_.size());
+  }
+}
+
+TEST_F(AwsAuthenticatorTest, SigningKeyCacheChecksTheSecret) {
+  DangerousDeprecatedTestTime time;
+  SigningCaches caches;
+  std::string accesskey = "AKIDEXAMPLE";
+
+  std::string oldsecretkey = "oldsecretkey";
+  AwsAuthenticator old_aws(time.timeSystem());
+  old_aws.init(&accesskey, &oldsecretkey, nullptr, &caches);
+  EXPECT_NE(GUIDE_SIGNATURE, signGuideRequest(old_aws));
+
+  std::string secretkey = "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY";
+  AwsAuthenticator aws(time.timeSystem());
+  aws.init(&accesskey, &secretkey, nullptr, &caches);
+  EXPECT_EQ(GUIDE_SIGNATURE, signGuideRequest(aws));
+  EXPECT_EQ(2U, caches.keys_.size());
+}
+
+TEST(SigningKeyCacheTest, ReplacesOldestEntryWhenFull) {
+  SigningKeyCache signing_keys;
+  SigningKeyCache::SigningKey key{};
+  for (size_t i = 0; i <= SigningKeyCache::MAX_ENTRIES; i++) {
+    key[0] = static_cast<uint8_t>(i);
+    signing_keys.insert("access", "secret", std::to_string(i), "us-east-1",
+                        "lambda", key);
+  }
+
+  EXPECT_EQ(SigningKeyCache::MAX_ENTRIES, signing_keys.size());
+  EXPECT_EQ(nullptr,
+            signing_keys.find("access", "secret", "0", "us-east-1", "lambda"));
+  const SigningKeyCache::SigningKey *found =
+      signing_keys.find("access", "secret", "1", "us-east-1", "lambda");
+  ASSERT_NE(nullptr, found);
+  EXPECT_EQ(1, (*found)[0]);
+  EXPECT_EQ(nullptr,
+            signing_keys.find("access", "secret", "1", "us-west-2", "lambda"));
+}
+
+TEST(SigningDateCacheTest, FormatsDatesOncePerSecond) {
+  SigningDateCache dates;
+  const SystemTime now = std::chrono::system_clock::from_time_t(1440938160);
+  dates.update(now);
+  EXPECT_EQ("20150830T123600Z", dates.requestDateTime());
+  EXPECT_EQ("20150830", dates.scopeDate());
+  const std::string &scope = dates.credentialScope("us-east-1", "lambda");
+  EXPECT_EQ("20150830/us-east-1/lambda/aws4_request", scope);
+  EXPECT_EQ(&scope, &dates.credentialScope("us-east-1", "lambda"));
+  EXPECT_EQ("20150830/us-west-2/lambda/aws4_request",
+            dates.credentialScope("us-west-2", "lambda"));
+
+  dates.update(now + std::chrono::milliseconds(999));
+  EXPECT_EQ("20150830T123600Z", dates.requestDateTime());
+  dates.update(now + std::chrono::seconds(1));
+  EXPECT_EQ("20150830T123601Z", dates.requestDateTime());
+  dates.update(now + std::chrono::hours(12));
+  EXPECT_EQ("20150831T003600Z", dates.requestDateTime());
+  EXPECT_EQ("20150831/us-east-1/lambda/aws4_request",
+            dates.credentialScope("us-east-1", "lambda"));
+}
+
 } // namespace AwsLambda
 } // namespace HttpFilters
 } // namespace Extensions
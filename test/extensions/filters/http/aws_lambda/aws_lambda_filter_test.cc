@@ -2,7 +2,9 @@
 #include "source/extensions/filters/http/aws_lambda/aws_lambda_filter.h"
 #include "source/extensions/filters/http/aws_lambda/aws_lambda_filter_config_factory.h"
 
+#include "test/extensions/filters/http/aws_lambda/event_stream.h"
 #include "test/mocks/common.h"
+#include "test/mocks/network/mocks.h"
 #include "test/mocks/server/mocks.h"
 #include "test/mocks/upstream/mocks.h"
 #include "test/test_common/utility.h"
@@ -46,6 +48,9 @@ public:
     return propagate_original_routing_;
   }
   bool propagate_original_routing_;
+
+  SigningCaches &signingCaches() const override { return signing_caches_; }
+  mutable SigningCaches signing_caches_;
 };
 
 class AWSLambdaFilterTest : public testing::Test {
@@ -56,7 +61,8 @@ protected:
   void SetUp() override { setupRoute(); }
 
   void setupRoute(bool sessionToken = false, bool noCredentials = false,
-                bool persistOriginalHeaders = false, bool unwrapAsAlb = false) {
+                bool persistOriginalHeaders = false, bool unwrapAsAlb = false,
+                bool unsignedPayload = false) {
     factory_context_.cluster_manager_.initializeClusters({"fake_cluster"}, {});
     factory_context_.cluster_manager_.initializeThreadLocalClusters({"fake_cluster"});
 
@@ -71,6 +77,7 @@ protected:
         protoextconfig;
     protoextconfig.set_host("lambda.us-east-1.amazonaws.com");
     protoextconfig.set_region("us-east-1");
+    protoextconfig.set_unsigned_payload(unsignedPayload);
     filter_config_ = std::make_shared<AWSLambdaConfigTestImpl>();
 
     if (!noCredentials) {
@@ -109,6 +116,21 @@ protected:
         .WillByDefault(Return(filter_route_config_.get()));
   }
 
+  // makes the cluster's default transport socket a secure one.
+  void setupSecureTransport() {
+    auto socket_factory =
+        std::make_unique<NiceMock<Network::MockTransportSocketFactory>>();
+    ON_CALL(*socket_factory, implementsSecureTransport())
+        .WillByDefault(Return(true));
+    transport_socket_matcher_ =
+        std::make_unique<NiceMock<Upstream::MockTransportSocketMatcher>>(
+            std::move(socket_factory));
+    ON_CALL(
+        *factory_context_.cluster_manager_.thread_local_cluster_.cluster_.info_,
+        transportSocketMatcher())
+        .WillByDefault(ReturnRef(*transport_socket_matcher_));
+  }
+
   Http::TestResponseHeaderMapImpl setup_encode(){
     // Run normal operations for side-effects e.g.: setting function_on_route_
     Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
@@ -129,6 +151,7 @@ protected:
   envoy::config::filter::http::aws_lambda::v2::AWSLambdaPerRoute routeconfig_;
   std::unique_ptr<AWSLambdaRouteConfig> filter_route_config_;
   std::shared_ptr<AWSLambdaConfigTestImpl> filter_config_;
+  std::unique_ptr<Upstream::MockTransportSocketMatcher> transport_socket_matcher_;
 };
 
 // see:
@@ -224,6 +247,89 @@ TEST_F(AWSLambdaFilterTest, SignsOnDataEndStream) {
   EXPECT_TRUE(headers.has("Authorization"));
 }
 
+TEST_F(AWSLambdaFilterTest, StreamsUnsignedPayload) {
+  setupRoute(false, false, false, false, true);
+  setupSecureTransport();
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(headers, false));
+  EXPECT_TRUE(headers.has("Authorization"));
+  EXPECT_EQ("UNSIGNED-PAYLOAD",
+            headers.get_(AwsAuthenticatorConsts::get().ContentSha256Header));
+
+  Buffer::OwnedImpl data("data");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(data, false));
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(data, true));
+}
+
+TEST_F(AWSLambdaFilterTest, SignsPayloadWithoutTls) {
+  setupRoute(false, false, false, false, true);
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+
+  // the body isn't left unsigned over plaintext.
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers, false));
+  EXPECT_FALSE(headers.has("Authorization"));
+
+  Buffer::OwnedImpl data("data");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(data, true));
+  EXPECT_TRUE(headers.has("Authorization"));
+  EXPECT_NE("UNSIGNED-PAYLOAD",
+            headers.get_(AwsAuthenticatorConsts::get().ContentSha256Header));
+}
+
+TEST_F(AWSLambdaFilterTest, SignsPayloadWithPlaintextHost) {
+  setupRoute(false, false, false, false, true);
+  setupSecureTransport();
+
+  // a host of the cluster matched a transport socket without TLS.
+  NiceMock<Network::MockTransportSocketFactory> plaintext_socket_factory;
+  auto host = std::make_shared<NiceMock<Upstream::MockHost>>();
+  ON_CALL(*host, transportSocketFactory())
+      .WillByDefault(ReturnRef(plaintext_socket_factory));
+  factory_context_.cluster_manager_.thread_local_cluster_.cluster_
+      .priority_set_.getMockHostSet(0)
+      ->hosts_.push_back(host);
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers, false));
+  EXPECT_FALSE(headers.has("Authorization"));
+
+  Buffer::OwnedImpl data("data");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(data, true));
+  EXPECT_NE("UNSIGNED-PAYLOAD",
+            headers.get_(AwsAuthenticatorConsts::get().ContentSha256Header));
+}
+
+TEST_F(AWSLambdaFilterTest, SignsPayloadWithDefaultBody) {
+  routeconfig_.mutable_empty_body_override()->set_value("{}");
+  setupRoute(false, false, false, false, true);
+  setupSecureTransport();
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+
+  // the body is buffered, in case it is empty and has to be replaced.
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers, false));
+  EXPECT_CALL(filter_callbacks_, addDecodedData(_, false));
+  Buffer::OwnedImpl data;
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(data, true));
+  EXPECT_TRUE(headers.has("Authorization"));
+}
+
 // see: https://docs.aws.amazon.com/lambda/latest/dg/API_Invoke.html
 TEST_F(AWSLambdaFilterTest, CorrectFuncCalled) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
@@ -461,6 +567,94 @@ TEST_F(AWSLambdaFilterTest, UpstreamErrorSetTo504) {
   
 }
 
+TEST_F(AWSLambdaFilterTest, StreamsInvocationResponse) {
+  routeconfig_.set_response_streaming(true);
+  setup_func();
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(headers, true));
+  EXPECT_EQ("/2021-11-15/functions/func/response-streaming-invocations"
+            "?Qualifier=v1",
+            headers.getPathValue());
+
+  Http::TestResponseHeaderMapImpl response_headers{
+      {":status", "200"},
+      {"content-length", "100"},
+      {"content-type", "application/vnd.amazon.eventstream"}};
+  filter_->setEncoderFilterCallbacks(filter_encode_callbacks_);
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->encodeHeaders(response_headers, false));
+  EXPECT_FALSE(response_headers.has("content-length"));
+  EXPECT_FALSE(response_headers.has("content-type"));
+
+  // the first chunk is sent as soon as it arrives.
+  const std::string stream = eventStreamEvent("PayloadChunk", "hello ") +
+                             eventStreamEvent("PayloadChunk", "world");
+  Buffer::OwnedImpl data(stream.substr(0, stream.size() - 1));
+  EXPECT_EQ(Http::FilterDataStatus::Continue,
+            filter_->encodeData(data, false));
+  EXPECT_EQ("hello ", data.toString());
+
+  data.drain(data.length());
+  data.add(stream.substr(stream.size() - 1));
+  data.add(eventStreamEvent("InvokeComplete", "{}"));
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(data, true));
+  EXPECT_EQ("world", data.toString());
+}
+
+TEST_F(AWSLambdaFilterTest, ResetsStreamedResponseOnFunctionError) {
+  routeconfig_.set_response_streaming(true);
+  setup_func();
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+  filter_->decodeHeaders(headers, true);
+  Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+  filter_->setEncoderFilterCallbacks(filter_encode_callbacks_);
+  filter_->encodeHeaders(response_headers, false);
+
+  Buffer::OwnedImpl data(eventStreamEvent(
+      "InvokeComplete", R"({"ErrorCode":"Unhandled","ErrorDetails":"boom"})"));
+  EXPECT_CALL(filter_encode_callbacks_, resetStream());
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer,
+            filter_->encodeData(data, true));
+}
+
+TEST_F(AWSLambdaFilterTest, ResetsStreamedResponseEndingInTrailers) {
+  routeconfig_.set_response_streaming(true);
+  setup_func();
+
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/getsomething"}};
+  filter_->decodeHeaders(headers, true);
+  Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+  filter_->setEncoderFilterCallbacks(filter_encode_callbacks_);
+  filter_->encodeHeaders(response_headers, false);
+
+  Buffer::OwnedImpl data(eventStreamEvent("PayloadChunk", "hello"));
+  EXPECT_EQ(Http::FilterDataStatus::Continue,
+            filter_->encodeData(data, false));
+
+  // the invocation never completed.
+  Http::TestResponseTrailerMapImpl trailers;
+  EXPECT_CALL(filter_encode_callbacks_, resetStream());
+  EXPECT_EQ(Http::FilterTrailersStatus::StopIteration,
+            filter_->encodeTrailers(trailers));
+}
+
+TEST_F(AWSLambdaFilterTest, ResponseStreamingCantBeAsync) {
+  routeconfig_.set_response_streaming(true);
+  routeconfig_.set_async(true);
+  EXPECT_THROW_WITH_MESSAGE(
+      AWSLambdaRouteConfig config(routeconfig_), EnvoyException,
+      "response_streaming can't be used with async or unwrap_as_alb");
+}
+
 TEST_F(AWSLambdaFilterTest, ALBDecodingBasic) {
   setupRoute(false, false, false, true);
   
@@ -484,6 +678,7 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingBasic) {
    
 
   auto edResult = filter_->encodeData(buf, false);
+  EXPECT_EQ(0U, buf.length());
   buf.add(
    "\"statusDescription\": \"200 OK\","
     "\"headers\": {"
@@ -491,18 +686,21 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingBasic) {
     "},"
     "\"body\": \"Hello from Lambda (optional)\""
     "}");
-  EXPECT_EQ(Http::FilterDataStatus::StopIterationAndBuffer, edResult);
-  auto on_buf_mod = [&buf](std::function<void(Buffer::Instance&)> cb){cb(buf);};
-  EXPECT_CALL(filter_encode_callbacks_, encodingBuffer).WillOnce(Return(&buf));
-  EXPECT_CALL(filter_encode_callbacks_, modifyEncodingBuffer)
-      .WillOnce(Invoke(on_buf_mod));
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, edResult);
 
   auto edResult2 = filter_->encodeData(buf, false);
-  EXPECT_EQ(Http::FilterDataStatus::StopIterationAndBuffer, edResult2);
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, edResult2);
+  // the body is added at the end of the response.
+  Buffer::OwnedImpl body;
+  EXPECT_CALL(filter_encode_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke([&body](Buffer::Instance &data, bool) {
+        body.move(data);
+      }));
   Http::TestResponseTrailerMapImpl response_trailers_;
   auto etResult = filter_->encodeTrailers(response_trailers_);
   EXPECT_EQ(Http::FilterTrailersStatus::Continue, etResult);
-  EXPECT_STREQ("Hello from Lambda (optional)", buf.toString().c_str());
+  EXPECT_STREQ("Hello from Lambda (optional)", body.toString().c_str());
+  EXPECT_EQ("28", response_headers.getContentLengthValue());
   EXPECT_EQ("200", response_headers.getStatusValue());
   ASSERT_NE(response_headers.ContentType(), nullptr);
   EXPECT_EQ("application/json", response_headers.getContentTypeValue());
@@ -522,11 +720,6 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingMultiValueHeaders) {
       "\"Content-Type\": [\"application/json\"]"
       "},}");
 
-  auto on_buf_mod = [&buf](std::function<void(Buffer::Instance&)> cb){cb(buf);};
-  EXPECT_CALL(filter_encode_callbacks_, encodingBuffer).WillOnce(Return(&buf));
-  EXPECT_CALL(filter_encode_callbacks_, modifyEncodingBuffer)
-      .WillOnce(Invoke(on_buf_mod));
-
   auto edResult2 = filter_->encodeData(buf, true);
   EXPECT_EQ(Http::FilterDataStatus::Continue, edResult2);
   EXPECT_STREQ("", buf.toString().c_str());
@@ -547,12 +740,6 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingBase64) {
   buf.add("{ \"isBase64Encoded\": true, \"statusCode\": 201,"
             "\"body\": \"SGVsbG8gZnJvbSBMYW1iZGEgKG9wdGlvbmFsKQ==\"}");
 
-  auto on_buf_mod = [&buf](std::function<void(Buffer::Instance&)> cb){cb(buf);};
-  EXPECT_CALL(filter_encode_callbacks_, encodingBuffer).WillOnce(Return(&buf));
-  EXPECT_CALL(filter_encode_callbacks_, modifyEncodingBuffer)
-      .WillOnce(Invoke(on_buf_mod));
-
-
   auto edResult2 = filter_->encodeData(buf, true);
   EXPECT_EQ(Http::FilterDataStatus::Continue, edResult2);
   EXPECT_STREQ("Hello from Lambda (optional)", buf.toString().c_str());
@@ -567,18 +754,33 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingInvalidTypes) {
   buf.add("{ \"isBase64Encoded\": \"notabool\", \"statusCode\": 201,"
             "\"body\": \"else==\"}");
 
-  auto on_buf_mod = [&buf](std::function<void(Buffer::Instance&)> cb){cb(buf);};
-
-  EXPECT_CALL(filter_encode_callbacks_, encodingBuffer).WillOnce(Return(&buf));
-  EXPECT_CALL(filter_encode_callbacks_, modifyEncodingBuffer)
-      .WillOnce(Invoke(on_buf_mod));
-
   auto edResult2 = filter_->encodeData(buf, true);
   EXPECT_EQ(Http::FilterDataStatus::Continue, edResult2);
   EXPECT_STREQ("", buf.toString().c_str());
   EXPECT_EQ("500", response_headers.getStatusValue());
 }
 
+TEST_F(AWSLambdaFilterTest, ALBDecodingSplitBase64Body) {
+  setupRoute(false, false, false, true);
+  auto response_headers = setup_encode();
+
+  // the body is decoded as it arrives, whatever its split.
+  const std::string response =
+      "{\"statusCode\": 202, \"isBase64Encoded\": true,"
+      "\"body\": \"SGVsbG8gZnJvbSBMYW1iZGEgKG9wdGlvbmFsKQ==\"}";
+  for (size_t i = 0; i < response.size(); i += 5) {
+    Buffer::OwnedImpl buf(response.substr(i, 5));
+    const bool end_stream = i + 5 >= response.size();
+    EXPECT_EQ(end_stream ? Http::FilterDataStatus::Continue
+                         : Http::FilterDataStatus::StopIterationNoBuffer,
+              filter_->encodeData(buf, end_stream));
+    if (end_stream) {
+      EXPECT_EQ("Hello from Lambda (optional)", buf.toString());
+    }
+  }
+  EXPECT_EQ("202", response_headers.getStatusValue());
+}
+
 TEST_F(AWSLambdaFilterTest, ALBDecodingInvalidJSON) {
   setupRoute(false, false, false, true);
   auto response_headers = setup_encode();
@@ -588,19 +790,34 @@ TEST_F(AWSLambdaFilterTest, ALBDecodingInvalidJSON) {
             "\"body\": \"something\"}"
             "\"body\": \"else==\"}");
 
-  auto on_buf_mod = [&buf](std::function<void(Buffer::Instance&)> cb){cb(buf);};
-
-  EXPECT_CALL(filter_encode_callbacks_, encodingBuffer).WillOnce(Return(&buf));
-  EXPECT_CALL(filter_encode_callbacks_, modifyEncodingBuffer)
-      .WillOnce(Invoke(on_buf_mod));
-
-
   auto edResult2 = filter_->encodeData(buf, true);
   EXPECT_EQ(Http::FilterDataStatus::Continue, edResult2);
   EXPECT_STREQ("", buf.toString().c_str());
   EXPECT_EQ("500", response_headers.getStatusValue());
 }
 
+TEST_F(AWSLambdaFilterTest, ALBDecodingHeadersTooLarge) {
+  setupRoute(false, false, false, true);
+  auto response_headers = setup_encode();
+  ON_CALL(filter_encode_callbacks_, encoderBufferLimit())
+      .WillByDefault(Return(64));
+
+  // the body is tiny, but the headers the parser holds on to aren't.
+  EXPECT_CALL(filter_encode_callbacks_,
+              sendLocalReply(Http::Code::InternalServerError, _, _, _,
+                             "aws_lambda_alb_response_too_large"));
+  Buffer::OwnedImpl buf(
+      "{\"statusCode\": 200, \"headers\": {\"x-big\": \"" +
+      std::string(64, 'a') + "\"},");
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer,
+            filter_->encodeData(buf, false));
+
+  // nothing else is parsed.
+  Buffer::OwnedImpl rest("\"body\": \"b\"}");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(rest, true));
+  EXPECT_EQ("\"body\": \"b\"}", rest.toString());
+}
+
 } // namespace AwsLambda
 } // namespace HttpFilters
 } // namespace Extensions
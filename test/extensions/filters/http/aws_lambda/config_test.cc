@@ -1,4 +1,5 @@
 #include "source/extensions/filters/http/aws_lambda/config.h"
+#include "source/extensions/filters/http/solo_well_known_names.h"
 
 #include "test/extensions/common/aws/mocks.h"
 #include "test/extensions/filters/http/aws_lambda/mocks.h"
@@ -13,6 +14,7 @@
 
 using testing::_;
 using testing::AtLeast;
+using testing::ByMove;
 using testing::Invoke;
 using testing::Return;
 using testing::ReturnPointee;
@@ -85,7 +87,8 @@ TEST_F(ConfigTest, WithUseDefaultCreds) {
       sts_factory_};
   auto config = AWSLambdaConfigImpl::create(
       std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
-      context_.api_, context_.thread_local_, "prefix.", stats_, protoconfig);
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
 
   NiceMock<MockStsContextCallbacks> callbacks_1;
 
@@ -151,7 +154,8 @@ TEST_F(ConfigTest, FailingToRotate) {
       sts_factory_};
   auto config = AWSLambdaConfigImpl::create(
       std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
-      context_.api_, context_.thread_local_, "prefix.", stats_, protoconfig);
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
 
   std::shared_ptr<const AWSLambdaProtocolExtensionConfig> ext_config_1 =
       std::make_shared<const AWSLambdaProtocolExtensionConfig>(protoextconfig);
@@ -201,7 +205,8 @@ TEST_F(ConfigTest, WithProtocolExtensionCreds) {
       sts_factory_};
   auto config = AWSLambdaConfigImpl::create(
       std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
-      context_.api_, context_.thread_local_, "prefix.", stats_, protoconfig);
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
 
   NiceMock<MockStsContextCallbacks> callbacks_1;
 
@@ -277,26 +282,185 @@ TEST_F(ConfigTest, WithStsCreds) {
       .WillOnce(Return(watcher));
   EXPECT_CALL(*watcher, addWatch("test", _, _)).Times(1);
 
+  // the default role is warmed up.
+  EXPECT_CALL(*sts_cred_provider_,
+              find(absl::optional<std::string>("test_arn"), _))
+      .WillOnce(Return(nullptr));
+
   std::unique_ptr<NiceMock<MockStsCredentialsProviderFactory>> unique_factory{
       sts_factory_};
   auto config = AWSLambdaConfigImpl::create(
       std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
-      context_.api_, context_.thread_local_, "prefix.", stats_, protoconfig);
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
 
   NiceMock<MockStsContextCallbacks> callbacks;
 
   std::shared_ptr<const AWSLambdaProtocolExtensionConfig> ext_config =
       std::make_shared<const AWSLambdaProtocolExtensionConfig>(protoextconfig);
 
+  // the worker asks the main thread for the credentials.
+  Event::PostCb post_cb;
+  EXPECT_CALL(context_.dispatcher_, post(_)).WillOnce(SaveArg<0>(&post_cb));
+  auto ptr = config->getCredentials(ext_config, &callbacks);
+  EXPECT_NE(nullptr, ptr);
+
   EXPECT_CALL(*sts_cred_provider_, find(_, _))
       .WillOnce(Invoke([&](const absl::optional<std::string> &role_arn_arg,
-                           StsConnectionPool::Context::Callbacks *)
+                           StsConnectionPool::Context::Callbacks *callbacks)
                            -> StsConnectionPool::Context * {
         EXPECT_EQ(ext_config->roleArn().value(), role_arn_arg);
+        callbacks->onSuccess(std::make_shared<const StsCredentials>(
+            "access_key", "secret_key", "session_token",
+            context_.api_.timeSource().systemTime() + std::chrono::hours(1)));
         return nullptr;
       }));
-  auto ptr = config->getCredentials(ext_config, &callbacks);
-  EXPECT_EQ(nullptr, ptr);
+  EXPECT_CALL(callbacks, onSuccess(_));
+  post_cb();
+
+  // and then has them cached.
+  NiceMock<MockStsContextCallbacks> callbacks_2;
+  EXPECT_CALL(callbacks_2, onSuccess(_));
+  EXPECT_EQ(nullptr, config->getCredentials(ext_config, &callbacks_2));
+}
+
+TEST_F(ConfigTest, WarmsStsCreds) {
+
+  prepareSTS();
+
+  auto cred_provider = std::make_unique<
+      NiceMock<Envoy::Extensions::Common::Aws::MockCredentialsProvider>>();
+
+  auto sts_cred_provider_ = new NiceMock<MockStsCredentialsProvider>();
+  std::unique_ptr<NiceMock<MockStsCredentialsProvider>> sts_cred_provider{
+      sts_cred_provider_};
+
+  setenv("AWS_WEB_IDENTITY_TOKEN_FILE", "test", 1);
+  setenv("AWS_ROLE_ARN", "test_arn", 1);
+
+  EXPECT_CALL(context_.api_.file_system_, fileExists(_))
+      .WillOnce(Return(true));
+  EXPECT_CALL(context_.api_.file_system_, fileReadToEnd(_))
+      .WillOnce(Return("web_token"));
+  EXPECT_CALL(*sts_factory_, build(_, _, _, _))
+      .WillOnce(Return(ByMove(std::move(sts_cred_provider))));
+
+  // a known cluster with a chained role, and one with its own credentials.
+  envoy::config::filter::http::aws_lambda::v2::AWSLambdaProtocolExtension
+      protoextconfig;
+  protoextconfig.set_role_arn("role_arn");
+  NiceMock<Upstream::MockClusterMockPrioritySet> cluster;
+  ON_CALL(*cluster.info_,
+          extensionProtocolOptions(SoloHttpFilterNames::get().AwsLambda))
+      .WillByDefault(Return(
+          std::make_shared<const AWSLambdaProtocolExtensionConfig>(
+              protoextconfig)));
+  protoextconfig.set_access_key("access_key");
+  protoextconfig.set_secret_key("secret_key");
+  protoextconfig.set_role_arn("static_role_arn");
+  NiceMock<Upstream::MockClusterMockPrioritySet> static_cluster;
+  ON_CALL(*static_cluster.info_,
+          extensionProtocolOptions(SoloHttpFilterNames::get().AwsLambda))
+      .WillByDefault(Return(
+          std::make_shared<const AWSLambdaProtocolExtensionConfig>(
+              protoextconfig)));
+  Upstream::ClusterManager::ClusterInfoMaps cluster_maps;
+  cluster_maps.active_clusters_.emplace("lambda", cluster);
+  cluster_maps.active_clusters_.emplace("static_lambda", static_cluster);
+  EXPECT_CALL(context_.cluster_manager_, clusters())
+      .WillOnce(Return(cluster_maps));
+
+  Upstream::ClusterUpdateCallbacks *cluster_update_callbacks;
+  EXPECT_CALL(context_.cluster_manager_,
+              addThreadLocalClusterUpdateCallbacks_(_))
+      .WillOnce(Invoke([&](Upstream::ClusterUpdateCallbacks &callbacks) {
+        cluster_update_callbacks = &callbacks;
+        return nullptr;
+      }));
+
+  // the base role is fetched first, then the chained one.
+  {
+    testing::InSequence s;
+    EXPECT_CALL(*sts_cred_provider_,
+                find(absl::optional<std::string>("test_arn"), _));
+    EXPECT_CALL(*sts_cred_provider_,
+                find(absl::optional<std::string>("role_arn"), _));
+  }
+
+  std::unique_ptr<NiceMock<MockStsCredentialsProviderFactory>> unique_factory{
+      sts_factory_};
+  auto config = AWSLambdaConfigImpl::create(
+      std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
+
+  // clusters added later are warmed up too, but roles only once.
+  protoextconfig.clear_access_key();
+  protoextconfig.clear_secret_key();
+  protoextconfig.set_role_arn("role_arn_2");
+  ON_CALL(*context_.cluster_manager_.thread_local_cluster_.cluster_.info_,
+          extensionProtocolOptions(SoloHttpFilterNames::get().AwsLambda))
+      .WillByDefault(Return(
+          std::make_shared<const AWSLambdaProtocolExtensionConfig>(
+              protoextconfig)));
+  EXPECT_CALL(*sts_cred_provider_,
+              find(absl::optional<std::string>("role_arn_2"), _));
+  cluster_update_callbacks->onClusterAddOrUpdate(
+      context_.cluster_manager_.thread_local_cluster_);
+  cluster_update_callbacks->onClusterAddOrUpdate(
+      context_.cluster_manager_.thread_local_cluster_);
+}
+
+TEST_F(ConfigTest, DestroyedStsConfigStopsRefreshing) {
+
+  prepareSTS();
+
+  auto cred_provider = std::make_unique<
+      NiceMock<Envoy::Extensions::Common::Aws::MockCredentialsProvider>>();
+
+  auto sts_cred_provider_ = new NiceMock<MockStsCredentialsProvider>();
+  StsCredentialsProviderPtr sts_cred_provider{sts_cred_provider_};
+
+  setenv("AWS_WEB_IDENTITY_TOKEN_FILE", "test", 1);
+  setenv("AWS_ROLE_ARN", "test_arn", 1);
+
+  EXPECT_CALL(context_.api_.file_system_, fileExists(_))
+      .WillOnce(Return(true));
+  // the token is only read when the config is created.
+  EXPECT_CALL(context_.api_.file_system_, fileReadToEnd(_))
+      .WillOnce(Return("web_token"));
+
+  EXPECT_CALL(*sts_factory_, build(_, _, _, _))
+      .WillOnce(Return(ByMove(std::move(sts_cred_provider))));
+
+  Filesystem::Watcher::OnChangedCb on_changed;
+  auto watcher = new Filesystem::MockWatcher();
+  EXPECT_CALL(context_.dispatcher_, createFilesystemWatcher_())
+      .WillOnce(Return(watcher));
+  EXPECT_CALL(*watcher, addWatch("test", _, _))
+      .WillOnce(SaveArg<2>(&on_changed));
+
+  // the default role is warmed up, and never fetched again.
+  EXPECT_CALL(*sts_cred_provider_,
+              find(absl::optional<std::string>("test_arn"), _))
+      .WillOnce(Return(nullptr));
+  EXPECT_CALL(*sts_cred_provider_, setWebToken(_)).Times(0);
+
+  std::unique_ptr<NiceMock<MockStsCredentialsProviderFactory>> unique_factory{
+      sts_factory_};
+  auto config = AWSLambdaConfigImpl::create(
+      std::move(cred_provider), std::move(unique_factory), context_.dispatcher_,
+      context_.api_, context_.cluster_manager_, context_.thread_local_,
+      "prefix.", stats_, protoconfig);
+
+  // nothing but the listener keeps the config, and with it the credentials
+  // provider, alive.
+  std::weak_ptr<AWSLambdaConfigImpl> weak_config = config;
+  config.reset();
+  EXPECT_TRUE(weak_config.expired());
+
+  // a token change that was already queued doesn't refresh anything.
+  on_changed(Filesystem::Watcher::Events::Modified);
 }
 
 } // namespace AwsLambda
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+#include "source/common/buffer/buffer_impl.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+// Encodes event stream messages as a streamed Lambda invocation responds.
+// The crcs are left zeroed.
+
+inline std::string eventStreamHeader(const std::string &name,
+                                     const std::string &value) {
+  Buffer::OwnedImpl header;
+  header.writeByte(static_cast<uint8_t>(name.size()));
+  header.add(name);
+  // a string value.
+  header.writeByte(7);
+  header.writeBEInt<uint16_t>(value.size());
+  header.add(value);
+  return header.toString();
+}
+
+inline std::string eventStreamMessage(const std::string &headers,
+                                      const std::string &payload) {
+  Buffer::OwnedImpl message;
+  message.writeBEInt<uint32_t>(12 + headers.size() + payload.size() + 4);
+  message.writeBEInt<uint32_t>(headers.size());
+  message.writeBEInt<uint32_t>(0);
+  message.add(headers);
+  message.add(payload);
+  message.writeBEInt<uint32_t>(0);
+  return message.toString();
+}
+
+inline std::string eventStreamEvent(const std::string &event_type,
+                                    const std::string &payload) {
+  return eventStreamMessage(eventStreamHeader(":message-type", "event") +
+                                eventStreamHeader(":event-type", event_type),
+                            payload);
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,111 @@
+#include "source/common/buffer/buffer_impl.h"
+#include "source/extensions/filters/http/aws_lambda/event_stream_decoder.h"
+
+#include "test/extensions/filters/http/aws_lambda/event_stream.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+using Status = EventStreamDecoder::Status;
+
+TEST(EventStreamDecoderTest, DecodesPayloadChunks) {
+  EventStreamDecoder decoder;
+  Buffer::OwnedImpl data;
+  data.add(eventStreamEvent("PayloadChunk", "hello "));
+  data.add(eventStreamEvent("PayloadChunk", "world"));
+  data.add(eventStreamEvent("InvokeComplete", "{}"));
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::Ok, decoder.decode(data, true, payload));
+  EXPECT_EQ("hello world", payload.toString());
+  EXPECT_EQ(0U, data.length());
+  EXPECT_TRUE(decoder.complete());
+}
+
+TEST(EventStreamDecoderTest, DecodesSplitMessages) {
+  EventStreamDecoder decoder;
+  const std::string stream = eventStreamEvent("PayloadChunk", "hello") +
+                             eventStreamEvent("InvokeComplete", "");
+
+  // feed the stream a byte at a time.
+  Buffer::OwnedImpl payload;
+  for (size_t i = 0; i < stream.size(); i++) {
+    Buffer::OwnedImpl data(stream.substr(i, 1));
+    EXPECT_EQ(Status::Ok,
+              decoder.decode(data, i == stream.size() - 1, payload));
+    if (i < stream.size() / 2) {
+      EXPECT_EQ(0U, payload.length());
+    }
+  }
+  EXPECT_EQ("hello", payload.toString());
+}
+
+TEST(EventStreamDecoderTest, SkipsHeadersOfAllTypes) {
+  EventStreamDecoder decoder;
+  std::string headers;
+  headers += eventStreamHeader(":message-type", "event");
+  headers += eventStreamHeader(":event-type", "PayloadChunk");
+  // a bool, an int and a uuid header.
+  headers += std::string("\x01t\x00", 3);
+  headers += std::string("\x01i\x04\x00\x00\x00\x01", 7);
+  headers += std::string("\x01u\x09", 3) + std::string(16, 'u');
+  Buffer::OwnedImpl data(eventStreamMessage(headers, "chunk"));
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::Ok, decoder.decode(data, false, payload));
+  EXPECT_EQ("chunk", payload.toString());
+}
+
+TEST(EventStreamDecoderTest, ReportsFunctionErrors) {
+  EventStreamDecoder decoder;
+  Buffer::OwnedImpl data(eventStreamEvent(
+      "InvokeComplete",
+      R"({"ErrorCode":"Unhandled","ErrorDetails":"boom","LogResult":""})"));
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::Error, decoder.decode(data, true, payload));
+  EXPECT_EQ("Unhandled", decoder.errorCode());
+  EXPECT_EQ("boom", decoder.errorDetails());
+}
+
+TEST(EventStreamDecoderTest, ReportsExceptions) {
+  EventStreamDecoder decoder;
+  Buffer::OwnedImpl data(eventStreamMessage(
+      eventStreamHeader(":message-type", "exception") +
+          eventStreamHeader(":exception-type", "ServiceException"),
+      R"({"message":"oops"})"));
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::Error, decoder.decode(data, false, payload));
+  EXPECT_EQ("ServiceException", decoder.errorCode());
+}
+
+TEST(EventStreamDecoderTest, RequiresCompletion) {
+  EventStreamDecoder decoder;
+  Buffer::OwnedImpl data(eventStreamEvent("PayloadChunk", "hello"));
+  data.add("\x00\x00", 2);
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::IncompleteMessage, decoder.decode(data, true, payload));
+  EXPECT_EQ("hello", payload.toString());
+}
+
+TEST(EventStreamDecoderTest, RejectsInvalidLengths) {
+  EventStreamDecoder decoder;
+  Buffer::OwnedImpl data;
+  data.writeBEInt<uint32_t>(EventStreamDecoder::MAX_MESSAGE_SIZE + 1);
+  data.writeBEInt<uint32_t>(0);
+  data.writeBEInt<uint32_t>(0);
+
+  Buffer::OwnedImpl payload;
+  EXPECT_EQ(Status::InvalidMessage, decoder.decode(data, false, payload));
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -82,6 +82,8 @@ public:
               (const absl::optional<std::string> &role_arn,
                StsConnectionPool::Context::Callbacks *callbacks));
   MOCK_METHOD(void, setWebToken, (std::string_view web_token));
+  MOCK_METHOD(void, setCredentialsUpdateCallback, (StsCredentialsUpdateCb cb));
+  MOCK_METHOD(void, setCredentialsUsedCallback, (StsCredentialsUsedCb cb));
 };
 
 class MockStsConnectionPool : public StsConnectionPool {
@@ -0,0 +1,201 @@
+#include "source/extensions/filters/http/aws_lambda/shared_sts_credentials_provider.h"
+
+#include "test/extensions/filters/http/aws_lambda/mocks.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::_;
+using testing::DoAll;
+using testing::Invoke;
+using testing::Return;
+using testing::SaveArg;
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+class SharedStsCredentialsProviderTest : public testing::Test {
+public:
+  void SetUp() override {
+    auto provider =
+        std::make_unique<testing::NiceMock<MockStsCredentialsProvider>>();
+    provider_ = provider.get();
+    EXPECT_CALL(*provider_, setCredentialsUpdateCallback(_))
+        .WillOnce(SaveArg<0>(&update_cb_));
+    EXPECT_CALL(*provider_, setCredentialsUsedCallback(_))
+        .WillOnce(SaveArg<0>(&used_cb_));
+    shared_provider_ = SharedStsCredentialsProvider::create(
+        std::move(provider), dispatcher_, tls_, time_system_, "default_arn");
+  }
+
+  StsCredentialsConstSharedPtr credentials(std::string access_key) {
+    return std::make_shared<const StsCredentials>(
+        access_key, "secret_key", "session_token",
+        time_system_.systemTime() + std::chrono::hours(1));
+  }
+
+  // finds the credentials of the role and returns what was posted to the main
+  // thread.
+  Event::PostCb find(const absl::optional<std::string> &role_arn,
+                     MockStsContextCallbacks &callbacks) {
+    Event::PostCb post_cb;
+    EXPECT_CALL(dispatcher_, post(_)).WillOnce(SaveArg<0>(&post_cb));
+    EXPECT_NE(nullptr, shared_provider_->find(role_arn, &callbacks));
+    testing::Mock::VerifyAndClearExpectations(&dispatcher_);
+    return post_cb;
+  }
+
+  Event::SimulatedTimeSystem time_system_;
+  testing::NiceMock<Event::MockDispatcher> dispatcher_;
+  testing::NiceMock<ThreadLocal::MockInstance> tls_;
+  testing::NiceMock<MockStsCredentialsProvider> *provider_;
+  StsCredentialsUpdateCb update_cb_;
+  StsCredentialsUsedCb used_cb_;
+  SharedStsCredentialsProviderSharedPtr shared_provider_;
+};
+
+TEST_F(SharedStsCredentialsProviderTest, CoalescesFetches) {
+  testing::NiceMock<MockStsContextCallbacks> callbacks_1;
+  Event::PostCb post_cb = find("role_arn", callbacks_1);
+
+  // the second request doesn't ask the main thread again.
+  testing::NiceMock<MockStsContextCallbacks> callbacks_2;
+  EXPECT_CALL(dispatcher_, post(_)).Times(0);
+  EXPECT_NE(nullptr, shared_provider_->find("role_arn", &callbacks_2));
+
+  // and a second worker asking doesn't fetch again.
+  StsConnectionPool::Context::Callbacks *fetch_callbacks;
+  testing::NiceMock<MockStsContext> fetch_context;
+  EXPECT_CALL(*provider_, find(absl::optional<std::string>("role_arn"), _))
+      .WillOnce(DoAll(SaveArg<1>(&fetch_callbacks), Return(&fetch_context)));
+  post_cb();
+  post_cb();
+
+  // the credentials are published to the waiting requests.
+  EXPECT_CALL(callbacks_1, onSuccess(_));
+  EXPECT_CALL(callbacks_2, onSuccess(_));
+  auto fetched = credentials("access_key");
+  update_cb_("role_arn", fetched);
+  fetch_callbacks->onSuccess(fetched);
+
+  // and cached for the next ones.
+  testing::NiceMock<MockStsContextCallbacks> callbacks_3;
+  EXPECT_CALL(callbacks_3, onSuccess(_))
+      .WillOnce(Invoke(
+          [&](std::shared_ptr<const Envoy::Extensions::Common::Aws::Credentials>
+                  success_creds) {
+            EXPECT_EQ(success_creds->accessKeyId(), "access_key");
+          }));
+  EXPECT_EQ(nullptr, shared_provider_->find("role_arn", &callbacks_3));
+}
+
+TEST_F(SharedStsCredentialsProviderTest, UsesDefaultRole) {
+  testing::NiceMock<MockStsContextCallbacks> callbacks;
+  Event::PostCb post_cb = find(absl::nullopt, callbacks);
+
+  // credentials the provider had cached are published too.
+  EXPECT_CALL(*provider_, find(absl::optional<std::string>("default_arn"), _))
+      .WillOnce(Invoke([&](const absl::optional<std::string> &,
+                           StsConnectionPool::Context::Callbacks *callbacks)
+                           -> StsConnectionPool::Context * {
+        callbacks->onSuccess(credentials("access_key"));
+        return nullptr;
+      }));
+  EXPECT_CALL(callbacks, onSuccess(_));
+  post_cb();
+}
+
+TEST_F(SharedStsCredentialsProviderTest, PublishesRefreshedCredentials) {
+  update_cb_("role_arn", credentials("access_key"));
+  update_cb_("role_arn", credentials("access_key_2"));
+
+  testing::NiceMock<MockStsContextCallbacks> callbacks;
+  EXPECT_CALL(dispatcher_, post(_)).Times(0);
+  EXPECT_CALL(callbacks, onSuccess(_))
+      .WillOnce(Invoke(
+          [&](std::shared_ptr<const Envoy::Extensions::Common::Aws::Credentials>
+                  success_creds) {
+            EXPECT_EQ(success_creds->accessKeyId(), "access_key_2");
+          }));
+  EXPECT_EQ(nullptr, shared_provider_->find("role_arn", &callbacks));
+}
+
+TEST_F(SharedStsCredentialsProviderTest, ReportsUseOfPublishedCredentials) {
+  EXPECT_FALSE(used_cb_("role_arn"));
+  update_cb_("role_arn", credentials("access_key"));
+  EXPECT_FALSE(used_cb_("role_arn"));
+
+  testing::NiceMock<MockStsContextCallbacks> callbacks;
+  EXPECT_CALL(callbacks, onSuccess(_)).Times(2);
+  EXPECT_EQ(nullptr, shared_provider_->find("role_arn", &callbacks));
+  EXPECT_EQ(nullptr, shared_provider_->find("role_arn", &callbacks));
+
+  // the use is reported once.
+  EXPECT_TRUE(used_cb_("role_arn"));
+  EXPECT_FALSE(used_cb_("role_arn"));
+  EXPECT_FALSE(used_cb_("other_arn"));
+}
+
+TEST_F(SharedStsCredentialsProviderTest, PublishesFailures) {
+  testing::NiceMock<MockStsContextCallbacks> callbacks_1;
+  Event::PostCb post_cb = find("role_arn", callbacks_1);
+  testing::NiceMock<MockStsContextCallbacks> callbacks_2;
+  auto context = shared_provider_->find("role_arn", &callbacks_2);
+
+  StsConnectionPool::Context::Callbacks *fetch_callbacks;
+  testing::NiceMock<MockStsContext> fetch_context;
+  EXPECT_CALL(*provider_, find(_, _))
+      .WillOnce(DoAll(SaveArg<1>(&fetch_callbacks), Return(&fetch_context)));
+  post_cb();
+
+  // cancelled requests are not called back.
+  context->cancel();
+  EXPECT_CALL(callbacks_1, onFailure(CredentialsFailureStatus::InvalidSts));
+  EXPECT_CALL(callbacks_2, onFailure(_)).Times(0);
+  fetch_callbacks->onFailure(CredentialsFailureStatus::InvalidSts);
+
+  // the next request asks again.
+  testing::NiceMock<MockStsContextCallbacks> callbacks_3;
+  post_cb = find("role_arn", callbacks_3);
+  EXPECT_CALL(*provider_, find(_, _)).WillOnce(Return(&fetch_context));
+  post_cb();
+
+  // and the fetch is cancelled with the provider.
+  EXPECT_CALL(fetch_context, cancel());
+  shared_provider_.reset();
+}
+
+TEST_F(SharedStsCredentialsProviderTest, WarmsCredentials) {
+  StsConnectionPool::Context::Callbacks *fetch_callbacks;
+  testing::NiceMock<MockStsContext> fetch_context;
+  EXPECT_CALL(*provider_, find(absl::optional<std::string>("default_arn"), _))
+      .WillOnce(DoAll(SaveArg<1>(&fetch_callbacks), Return(&fetch_context)));
+  shared_provider_->warm(absl::nullopt);
+  shared_provider_->warm("default_arn");
+
+  // failed warm ups are tried again.
+  fetch_callbacks->onFailure(CredentialsFailureStatus::InvalidSts);
+  EXPECT_CALL(*provider_, find(absl::optional<std::string>("default_arn"), _))
+      .WillOnce(DoAll(SaveArg<1>(&fetch_callbacks), Return(&fetch_context)));
+  shared_provider_->warm(absl::nullopt);
+
+  // and the warmed up credentials are published.
+  auto fetched = credentials("access_key");
+  update_cb_("default_arn", fetched);
+  fetch_callbacks->onSuccess(fetched);
+  shared_provider_->warm(absl::nullopt);
+
+  testing::NiceMock<MockStsContextCallbacks> callbacks;
+  EXPECT_CALL(callbacks, onSuccess(_));
+  EXPECT_EQ(nullptr, shared_provider_->find(absl::nullopt, &callbacks));
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -11,6 +11,7 @@
 #include "test/extensions/filters/http/aws_lambda/mocks.h"
 #include "test/extensions/filters/http/common/mock.h"
 #include "test/mocks/api/mocks.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/http/mocks.h"
 #include "test/mocks/server/factory_context.h"
 #include "test/mocks/thread_local/mocks.h"
@@ -79,7 +80,7 @@ TEST_F(StsCredentialsProviderTest, TestFullFlow) {
       sts_connection_pool_factory_};
   auto sts_provider = StsCredentialsProvider::create(
       config_, mock_factory_ctx_.api_, mock_factory_ctx_.cluster_manager_,
-      std::move(factory_), token, role_arn);
+      mock_factory_ctx_.dispatcher_, std::move(factory_), token, role_arn);
   testing::NiceMock<MockStsContextCallbacks> ctx_callbacks_1;
 
   std::unique_ptr<testing::NiceMock<MockStsConnectionPool>> unique_pool{
@@ -142,7 +143,7 @@ TEST_F(StsCredentialsProviderTest, TestFullChainedFlow) {
       sts_connection_pool_factory_};
   auto sts_provider = StsCredentialsProvider::create(
       config_, mock_factory_ctx_.api_, mock_factory_ctx_.cluster_manager_,
-      std::move(factory_), token, base_role_arn);
+      mock_factory_ctx_.dispatcher_, std::move(factory_), token, base_role_arn);
   testing::NiceMock<MockStsContextCallbacks> ctx_callbacks_1;
 
   std::unique_ptr<testing::NiceMock<MockStsConnectionPool>> unique_pool{
@@ -214,6 +215,191 @@ TEST_F(StsCredentialsProviderTest, TestFullChainedFlow) {
   sts_provider->find(role_arn, &ctx_callbacks_4);
 }
 
+TEST_F(StsCredentialsProviderTest, TestRefreshesBeforeExpiry) {
+  // Setup
+  std::string role_arn = "test_arn";
+  std::string token = "test_token";
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPoolFactory>> factory_{
+      sts_connection_pool_factory_};
+  auto sts_provider = StsCredentialsProvider::create(
+      config_, mock_factory_ctx_.api_, mock_factory_ctx_.cluster_manager_,
+      mock_factory_ctx_.dispatcher_, std::move(factory_), token, role_arn);
+  testing::NiceMock<MockStsContextCallbacks> ctx_callbacks_1;
+
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPool>> unique_pool{
+      sts_connection_pool_};
+  StsConnectionPool::Callbacks *credentials_provider_callbacks;
+
+  EXPECT_CALL(*sts_connection_pool_factory_, build(_, _, _))
+      .WillOnce(Invoke([&](const absl::string_view,
+                           StsConnectionPool::Callbacks *callbacks,
+                           StsFetcherPtr) -> StsConnectionPoolPtr {
+        credentials_provider_callbacks = callbacks;
+        return std::move(unique_pool);
+      }));
+  EXPECT_CALL(*sts_connection_pool_, init(_, _, _));
+  EXPECT_CALL(*sts_connection_pool_, add(_));
+  sts_provider->find(role_arn, &ctx_callbacks_1);
+
+  // the credentials are refreshed ahead of the grace period, less the jitter.
+  auto *timer = new testing::NiceMock<Event::MockTimer>(
+      &mock_factory_ctx_.dispatcher_);
+  EXPECT_CALL(mock_factory_ctx_.api_.random_, random())
+      .WillOnce(Return(30 * 1000));
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(
+                                      std::chrono::minutes(55) -
+                                      std::chrono::seconds(30)),
+                                  _));
+  const auto now = mock_factory_ctx_.api_.timeSource().systemTime();
+  std::list<std::string> to_chain;
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(60)),
+      role_arn, to_chain);
+
+  // the refresh is retried until it succeeds.
+  EXPECT_CALL(*sts_connection_pool_, init(_, _, _));
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(
+                                      std::chrono::seconds(30)),
+                                  _));
+  timer->invokeCallback();
+
+  // requests keep using the cached credentials while it is in flight.
+  EXPECT_CALL(*sts_connection_pool_, add(_)).Times(0);
+  testing::NiceMock<MockStsContextCallbacks> ctx_callbacks_2;
+  EXPECT_CALL(ctx_callbacks_2, onSuccess(_));
+  sts_provider->find(role_arn, &ctx_callbacks_2);
+
+  // and the refreshed credentials once it completes.
+  EXPECT_CALL(*timer, enableTimer(_, _));
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key_2", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(120)),
+      role_arn, to_chain);
+
+  testing::NiceMock<MockStsContextCallbacks> ctx_callbacks_3;
+  EXPECT_CALL(ctx_callbacks_3, onSuccess(_))
+      .WillOnce(Invoke(
+          [&](std::shared_ptr<const Envoy::Extensions::Common::Aws::Credentials>
+                  success_creds) {
+            EXPECT_EQ(success_creds->accessKeyId(), "access_key_2");
+          }));
+  sts_provider->find(role_arn, &ctx_callbacks_3);
+}
+
+TEST_F(StsCredentialsProviderTest, TestStopsRefreshingUnusedCredentials) {
+  // Setup
+  std::string role_arn = "test_arn";
+  std::string token = "test_token";
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPoolFactory>> factory_{
+      sts_connection_pool_factory_};
+  auto sts_provider = StsCredentialsProvider::create(
+      config_, mock_factory_ctx_.api_, mock_factory_ctx_.cluster_manager_,
+      mock_factory_ctx_.dispatcher_, std::move(factory_), token, role_arn);
+  bool used_elsewhere = false;
+  sts_provider->setCredentialsUsedCallback(
+      [&](const std::string &) { return used_elsewhere; });
+  testing::NiceMock<MockStsContextCallbacks> ctx_callbacks;
+
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPool>> unique_pool{
+      sts_connection_pool_};
+  StsConnectionPool::Callbacks *credentials_provider_callbacks;
+
+  EXPECT_CALL(*sts_connection_pool_factory_, build(_, _, _))
+      .WillOnce(Invoke([&](const absl::string_view,
+                           StsConnectionPool::Callbacks *callbacks,
+                           StsFetcherPtr) -> StsConnectionPoolPtr {
+        credentials_provider_callbacks = callbacks;
+        return std::move(unique_pool);
+      }));
+  sts_provider->find(role_arn, &ctx_callbacks);
+
+  auto *timer = new testing::NiceMock<Event::MockTimer>(
+      &mock_factory_ctx_.dispatcher_);
+  const auto now = mock_factory_ctx_.api_.timeSource().systemTime();
+  std::list<std::string> to_chain;
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(60)),
+      role_arn, to_chain);
+
+  // the credentials were used by the find() that fetched them.
+  EXPECT_CALL(*sts_connection_pool_, init(_, _, _));
+  timer->invokeCallback();
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key_2", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(120)),
+      role_arn, to_chain);
+
+  // these were used without asking the provider.
+  used_elsewhere = true;
+  EXPECT_CALL(*sts_connection_pool_, init(_, _, _));
+  timer->invokeCallback();
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key_3", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(180)),
+      role_arn, to_chain);
+
+  // these weren't used at all, so they are no longer refreshed.
+  used_elsewhere = false;
+  EXPECT_CALL(*sts_connection_pool_, init(_, _, _)).Times(0);
+  EXPECT_CALL(*timer, enableTimer(_, _)).Times(0);
+  timer->invokeCallback();
+}
+
+TEST_F(StsCredentialsProviderTest, TestShortLivedCredentialsRefreshBackOff) {
+  // Setup
+  std::string role_arn = "test_arn";
+  std::string token = "test_token";
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPoolFactory>> factory_{
+      sts_connection_pool_factory_};
+  auto sts_provider = StsCredentialsProvider::create(
+      config_, mock_factory_ctx_.api_, mock_factory_ctx_.cluster_manager_,
+      mock_factory_ctx_.dispatcher_, std::move(factory_), token, role_arn);
+  testing::NiceMock<MockStsContextCallbacks> ctx_callbacks;
+
+  std::unique_ptr<testing::NiceMock<MockStsConnectionPool>> unique_pool{
+      sts_connection_pool_};
+  StsConnectionPool::Callbacks *credentials_provider_callbacks;
+
+  EXPECT_CALL(*sts_connection_pool_factory_, build(_, _, _))
+      .WillOnce(Invoke([&](const absl::string_view,
+                           StsConnectionPool::Callbacks *callbacks,
+                           StsFetcherPtr) -> StsConnectionPoolPtr {
+        credentials_provider_callbacks = callbacks;
+        return std::move(unique_pool);
+      }));
+  sts_provider->find(role_arn, &ctx_callbacks);
+
+  // credentials that expire within the grace period are not refreshed at
+  // once, but after the retry interval.
+  auto *timer = new testing::NiceMock<Event::MockTimer>(
+      &mock_factory_ctx_.dispatcher_);
+  EXPECT_CALL(*timer, enableTimer(std::chrono::milliseconds(
+                                      std::chrono::seconds(30)),
+                                  _))
+      .Times(2);
+  const auto now = mock_factory_ctx_.api_.timeSource().systemTime();
+  std::list<std::string> to_chain;
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(2)),
+      role_arn, to_chain);
+
+  // nor is the next fetch that gets short lived credentials again.
+  credentials_provider_callbacks->onResult(
+      std::make_shared<const StsCredentials>("access_key_2", "secret_key",
+                                             "session_token",
+                                             now + std::chrono::minutes(2)),
+      role_arn, to_chain);
+}
+
 } // namespace AwsLambda
 } // namespace HttpFilters
 } // namespace Extensions
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <random>
+#include <regex>
+
+#include "source/extensions/filters/http/aws_lambda/sts_response_parser.h"
+
+#include "test/benchmark/main.h"
+
+#include "benchmark/benchmark.h"
+#include "fmt/format.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+namespace {
+
+// Random STS responses, with the credentials in a random order among noise
+// elements, and a field missing from some of them.
+std::vector<std::string> stsResponses(size_t count) {
+  std::mt19937 random(count);
+  auto randomString = [&random](size_t max_length) {
+    std::uniform_int_distribution<size_t> length(0, max_length);
+    std::uniform_int_distribution<int> chars('a', 'z');
+    std::string s(length(random), ' ');
+    std::generate(s.begin(), s.end(), [&] { return chars(random); });
+    return s;
+  };
+
+  std::vector<std::string> responses;
+  responses.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    std::vector<std::string> elements{
+        fmt::format("<AccessKeyId>{}</AccessKeyId>", randomString(20)),
+        fmt::format("<SecretAccessKey>{}</SecretAccessKey>", randomString(40)),
+        fmt::format("<SessionToken>{}</SessionToken>", randomString(1024)),
+        "<Expiration>2100-07-28T21:20:25Z</Expiration>",
+    };
+    if (i % 8 == 0) {
+      elements.erase(elements.begin() + i / 8 % elements.size());
+    }
+    for (size_t noise = 0; noise < 4; noise++) {
+      const std::string name = randomString(16);
+      elements.push_back(
+          fmt::format("<{}>{}</{}>", name, randomString(256), name));
+    }
+    std::shuffle(elements.begin(), elements.end(), random);
+
+    std::string response = "<AssumeRoleWithWebIdentityResponse "
+                           "xmlns=\"https://sts.amazonaws.com/doc/2011-06-15/\">"
+                           "<AssumeRoleWithWebIdentityResult><Credentials>";
+    for (const std::string &element : elements) {
+      response += element;
+    }
+    response += "</Credentials></AssumeRoleWithWebIdentityResult>"
+                "</AssumeRoleWithWebIdentityResponse>";
+    responses.push_back(std::move(response));
+  }
+  return responses;
+}
+
+} // namespace
+
+static void BM_ParseStsResponse(benchmark::State &state) {
+  const std::vector<std::string> responses = stsResponses(64);
+  size_t bytes = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::string &body = responses[i++ % responses.size()];
+    StsResponse response;
+    benchmark::DoNotOptimize(parseStsResponse(body, response));
+    benchmark::DoNotOptimize(response);
+    bytes += body.size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_ParseStsResponse);
+
+// The regex searches the parser replaced, for comparison.
+static void BM_RegexStsResponse(benchmark::State &state) {
+  const std::vector<std::string> responses = stsResponses(64);
+  const std::regex regexes[] = {
+      std::regex("<AccessKeyId>(.*?)</AccessKeyId>"),
+      std::regex("<SecretAccessKey>(.*?)</SecretAccessKey>"),
+      std::regex("<SessionToken>(.*?)</SessionToken>"),
+      std::regex("<Expiration>(.*?)</Expiration>"),
+  };
+  size_t bytes = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::string &body = responses[i++ % responses.size()];
+    for (const std::regex &regex : regexes) {
+      std::smatch matched;
+      if (!std::regex_search(body, matched, regex)) {
+        break;
+      }
+      benchmark::DoNotOptimize(matched);
+    }
+    bytes += body.size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_RegexStsResponse);
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,67 @@
+#include "source/extensions/filters/http/aws_lambda/sts_response_parser.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace AwsLambda {
+
+TEST(StsResponseParserTest, ParsesCredentials) {
+  const std::string body = R"(
+<AssumeRoleWithWebIdentityResponse xmlns="https://sts.amazonaws.com/doc/2011-06-15/">
+  <AssumeRoleWithWebIdentityResult>
+    <SubjectFromWebIdentityToken>system:serviceaccount</SubjectFromWebIdentityToken>
+    <Credentials>
+      <SessionToken>some_session_token</SessionToken>
+      <SecretAccessKey>some_secret_key</SecretAccessKey>
+      <Expiration>2100-07-28T21:20:25Z</Expiration>
+      <AccessKeyId>some_access_key</AccessKeyId>
+    </Credentials>
+  </AssumeRoleWithWebIdentityResult>
+</AssumeRoleWithWebIdentityResponse>
+)";
+
+  StsResponse response;
+  ASSERT_TRUE(parseStsResponse(body, response));
+  EXPECT_EQ("some_access_key", response.access_key);
+  EXPECT_EQ("some_secret_key", response.secret_key);
+  EXPECT_EQ("some_session_token", response.session_token);
+  EXPECT_EQ("2100-07-28T21:20:25Z", response.expiration);
+}
+
+TEST(StsResponseParserTest, TakesFirstOccurrences) {
+  const std::string body =
+      "<AccessKeyId>a1</AccessKeyId><AccessKeyId>a2</AccessKeyId>"
+      "<SecretAccessKey></SecretAccessKey><SessionToken>s<x/></SessionToken>"
+      "<Expiration>e1</Expiration><Expiration>e2</Expiration>";
+
+  StsResponse response;
+  ASSERT_TRUE(parseStsResponse(body, response));
+  EXPECT_EQ("a1", response.access_key);
+  EXPECT_EQ("", response.secret_key);
+  EXPECT_EQ("s<x/>", response.session_token);
+  EXPECT_EQ("e1", response.expiration);
+}
+
+TEST(StsResponseParserTest, RejectsMissingCredentials) {
+  for (const std::string body : {
+           "",
+           "<AccessKeyId>a</AccessKeyId><SecretAccessKey>s</SecretAccessKey>"
+           "<SessionToken>t</SessionToken>",
+           "<AccessKeyId>a</AccessKeyId><SecretAccessKey>s</SecretAccessKey>"
+           "<SessionToken>t</SessionToken><Expiration>e</Expiration2>",
+           "<AccessKeyIds>a</AccessKeyIds><SecretAccessKey>s</SecretAccessKey>"
+           "<SessionToken>t</SessionToken><Expiration>e</Expiration>",
+           "<AccessKeyId>a</AccessKeyId><SecretAccessKey>s</SecretAccessKey>"
+           "<SessionToken>t</SessionToken><Expiration>e",
+       }) {
+    StsResponse response;
+    EXPECT_FALSE(parseStsResponse(body, response)) << body;
+  }
+}
+
+} // namespace AwsLambda
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,195 @@
+#include "source/common/buffer/buffer_impl.h"
+
+#include "source/extensions/filters/http/transformation/body_framer.h"
+
+#include "absl/strings/ascii.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+namespace {
+
+void addGrpcFrame(Buffer::Instance &buffer, absl::string_view payload,
+                  uint8_t flags = 0) {
+  buffer.writeByte(flags);
+  buffer.writeBEInt<uint32_t>(payload.size());
+  buffer.add(payload);
+}
+
+BodyFramerPtr createFramer(envoy::api::v2::filter::http::BodyFraming::Framing framing,
+                           uint32_t max_frame_size = 0) {
+  envoy::api::v2::filter::http::BodyFraming config;
+  config.set_framing(framing);
+  if (max_frame_size != 0) {
+    config.mutable_max_frame_size()->set_value(max_frame_size);
+  }
+  return BodyFramer::create(config);
+}
+
+const auto upper_case = [](Buffer::Instance &payload) {
+  std::string data = absl::AsciiStrToUpper(payload.toString());
+  payload.drain(payload.length());
+  payload.add(data);
+};
+
+} // namespace
+
+TEST(GrpcBodyFramer, TransformsEachMessage) {
+  auto framer = createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC);
+
+  Buffer::OwnedImpl data;
+  addGrpcFrame(data, "abc");
+  addGrpcFrame(data, "de");
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(data, true, output, upper_case));
+  EXPECT_EQ(0, data.length());
+
+  Buffer::OwnedImpl expected;
+  addGrpcFrame(expected, "ABC");
+  addGrpcFrame(expected, "DE");
+  EXPECT_EQ(expected.toString(), output.toString());
+}
+
+TEST(GrpcBodyFramer, MessageSplitAcrossChunks) {
+  auto framer = createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC);
+
+  Buffer::OwnedImpl frame;
+  addGrpcFrame(frame, "hello");
+  std::string wire = frame.toString();
+
+  Buffer::OwnedImpl output;
+  Buffer::OwnedImpl first(wire.substr(0, 3));
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(first, false, output, upper_case));
+  EXPECT_EQ(0, output.length());
+
+  Buffer::OwnedImpl second(wire.substr(3));
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(second, true, output, upper_case));
+
+  Buffer::OwnedImpl expected;
+  addGrpcFrame(expected, "HELLO");
+  EXPECT_EQ(expected.toString(), output.toString());
+}
+
+TEST(GrpcBodyFramer, CompressedMessageIsNotTransformed) {
+  auto framer = createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC);
+
+  Buffer::OwnedImpl data;
+  addGrpcFrame(data, "abc", 1);
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(data, true, output, upper_case));
+
+  Buffer::OwnedImpl expected;
+  addGrpcFrame(expected, "abc", 1);
+  EXPECT_EQ(expected.toString(), output.toString());
+}
+
+TEST(GrpcBodyFramer, TrailersAreNotTransformed) {
+  auto framer = createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC);
+
+  Buffer::OwnedImpl data;
+  addGrpcFrame(data, "abc");
+  addGrpcFrame(data, "grpc-status:0\r\ngrpc-message:ok\r\n", 0x80);
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(data, true, output, upper_case));
+
+  Buffer::OwnedImpl expected;
+  addGrpcFrame(expected, "ABC");
+  addGrpcFrame(expected, "grpc-status:0\r\ngrpc-message:ok\r\n", 0x80);
+  EXPECT_EQ(expected.toString(), output.toString());
+}
+
+TEST(GrpcBodyFramer, FrameTooLarge) {
+  auto framer =
+      createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC, 4);
+
+  Buffer::OwnedImpl data;
+  addGrpcFrame(data, "hello");
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::FrameTooLarge,
+            framer->decode(data, false, output, upper_case));
+}
+
+TEST(GrpcBodyFramer, IncompleteFrame) {
+  auto framer = createFramer(envoy::api::v2::filter::http::BodyFraming::GRPC);
+
+  Buffer::OwnedImpl frame;
+  addGrpcFrame(frame, "hello");
+  Buffer::OwnedImpl data(frame.toString().substr(0, 7));
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::IncompleteFrame,
+            framer->decode(data, true, output, upper_case));
+}
+
+TEST(NewlineBodyFramer, TransformsEachLine) {
+  auto framer = createFramer(
+      envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED);
+
+  Buffer::OwnedImpl output;
+  Buffer::OwnedImpl first("ab\nc");
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(first, false, output, upper_case));
+  EXPECT_EQ("AB\n", output.toString());
+
+  Buffer::OwnedImpl second("d\n\ne");
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(second, false, output, upper_case));
+  EXPECT_EQ("AB\nCD\n\n", output.toString());
+
+  // the last line doesn't need a terminator.
+  Buffer::OwnedImpl last;
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(last, true, output, upper_case));
+  EXPECT_EQ("AB\nCD\n\nE", output.toString());
+}
+
+TEST(NewlineBodyFramer, TransformsCrlfLinesWithoutTheCr) {
+  auto framer = createFramer(
+      envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED);
+
+  std::vector<std::string> lines;
+  Buffer::OwnedImpl data("data: a\r\n\r\ndata: b\n");
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::Ok,
+            framer->decode(data, false, output,
+                           [&](Buffer::Instance &payload) {
+                             lines.push_back(payload.toString());
+                             upper_case(payload);
+                           }));
+  EXPECT_THAT(lines, testing::ElementsAre("data: a", "data: b"));
+  EXPECT_EQ("DATA: A\r\n\r\nDATA: B\n", output.toString());
+}
+
+TEST(NewlineBodyFramer, FrameTooLarge) {
+  auto framer = createFramer(
+      envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED, 4);
+
+  Buffer::OwnedImpl data("abc\nhello");
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::FrameTooLarge,
+            framer->decode(data, false, output, upper_case));
+}
+
+TEST(NewlineBodyFramer, CompleteFrameTooLarge) {
+  auto framer = createFramer(
+      envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED, 4);
+
+  // a terminated line in a single chunk is bounded too.
+  Buffer::OwnedImpl data("abc\nhello\nde");
+  Buffer::OwnedImpl output;
+  EXPECT_EQ(BodyFramer::Status::FrameTooLarge,
+            framer->decode(data, false, output, upper_case));
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,50 @@
+#include "source/extensions/filters/http/transformation/cluster_metadata_cache.h"
+
+#include "test/mocks/upstream/mocks.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::NiceMock;
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+TEST(ClusterMetadataCache, ValuesArePerCluster) {
+  ClusterMetadataCache cache({"key"});
+  auto cluster = std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+  auto other_cluster = std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+
+  cache.values(cluster)["key"] = "value";
+  EXPECT_EQ("value", cache.values(cluster)["key"]);
+  EXPECT_TRUE(cache.values(other_cluster)["key"].is_null());
+  EXPECT_EQ(2, cache.size());
+}
+
+TEST(ClusterMetadataCache, HasOnlyTheConfiguredKeys) {
+  ClusterMetadataCache cache({"key", "other"});
+  auto cluster = std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+
+  const ClusterMetadataCache::Values &values = cache.values(cluster);
+  EXPECT_EQ(2, values.size());
+  EXPECT_TRUE(values.contains("key"));
+  EXPECT_TRUE(values.contains("other"));
+}
+
+TEST(ClusterMetadataCache, DropsReplacedClusters) {
+  ClusterMetadataCache cache({"key"});
+  auto cluster = std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+  cache.values(cluster)["key"] = "value";
+
+  // the cluster is updated, and the old ClusterInfo goes away.
+  cluster = std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+  EXPECT_TRUE(cache.values(cluster)["key"].is_null());
+  EXPECT_EQ(1, cache.size());
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
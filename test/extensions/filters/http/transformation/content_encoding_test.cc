@@ -0,0 +1,102 @@
+#include "source/common/buffer/buffer_impl.h"
+
+#include "source/extensions/filters/http/transformation/content_encoding.h"
+
+#include "test/test_common/utility.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+TEST(ContentEncoding, FromHeaders) {
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"}};
+  EXPECT_EQ(ContentEncoding::Type::Identity,
+            ContentEncoding::fromHeaders(headers));
+
+  headers.setCopy(Http::LowerCaseString("content-encoding"), "GZIP");
+  EXPECT_EQ(ContentEncoding::Type::Gzip, ContentEncoding::fromHeaders(headers));
+
+  headers.setCopy(Http::LowerCaseString("content-encoding"), "deflate");
+  EXPECT_EQ(ContentEncoding::Type::Deflate,
+            ContentEncoding::fromHeaders(headers));
+
+  // stacked encodings are left alone.
+  headers.setCopy(Http::LowerCaseString("content-encoding"), "gzip, br");
+  EXPECT_EQ(ContentEncoding::Type::Identity,
+            ContentEncoding::fromHeaders(headers));
+}
+
+TEST(ContentEncoding, RoundTrip) {
+  // large enough to span several output chunks.
+  std::string payload;
+  for (int i = 0; i < 10000; i++) {
+    payload += std::to_string(i);
+  }
+
+  for (auto type :
+       {ContentEncoding::Type::Gzip, ContentEncoding::Type::Deflate}) {
+    Buffer::OwnedImpl input(payload);
+    Buffer::OwnedImpl compressed;
+    ContentEncoding::deflate(type, input, compressed);
+    EXPECT_EQ(0, input.length());
+    EXPECT_LT(compressed.length(), payload.size());
+
+    Buffer::OwnedImpl inflated;
+    ContentEncoding::inflate(type, compressed, inflated, payload.size());
+    EXPECT_EQ(payload, inflated.toString());
+  }
+}
+
+TEST(ContentEncoding, InflateTooLarge) {
+  Buffer::OwnedImpl input(std::string(1024, 'a'));
+  Buffer::OwnedImpl compressed;
+  ContentEncoding::deflate(ContentEncoding::Type::Gzip, input, compressed);
+
+  Buffer::OwnedImpl inflated;
+  EXPECT_THROW_WITH_MESSAGE(ContentEncoding::inflate(
+                                ContentEncoding::Type::Gzip, compressed,
+                                inflated, 1023),
+                            EnvoyException, "inflated body too large");
+}
+
+TEST(ContentEncoding, InflateCorrupt) {
+  Buffer::OwnedImpl input("not compressed");
+  Buffer::OwnedImpl inflated;
+  EXPECT_THROW_WITH_MESSAGE(ContentEncoding::inflate(
+                                ContentEncoding::Type::Gzip, input, inflated,
+                                1024),
+                            EnvoyException, "failed to inflate body");
+}
+
+TEST(ContentEncoding, InflateTruncated) {
+  Buffer::OwnedImpl input("some data");
+  Buffer::OwnedImpl compressed;
+  ContentEncoding::deflate(ContentEncoding::Type::Gzip, input, compressed);
+  const std::string wire = compressed.toString();
+
+  Buffer::OwnedImpl truncated(wire.substr(0, wire.size() - 4));
+  Buffer::OwnedImpl inflated;
+  EXPECT_THROW_WITH_MESSAGE(ContentEncoding::inflate(
+                                ContentEncoding::Type::Gzip, truncated,
+                                inflated, 1024),
+                            EnvoyException, "truncated compressed body");
+}
+
+TEST(ContentEncoding, InflateEmpty) {
+  Buffer::OwnedImpl input;
+  Buffer::OwnedImpl inflated;
+  ContentEncoding::inflate(ContentEncoding::Type::Gzip, input, inflated, 1024);
+  EXPECT_EQ(0, inflated.length());
+  ContentEncoding::inflate(ContentEncoding::Type::Deflate, input, inflated,
+                           1024);
+  EXPECT_EQ(0, inflated.length());
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,320 @@
+#include "source/extensions/filters/http/solo_well_known_names.h"
+#include "source/extensions/filters/http/transformation/fused_transformation_filter.h"
+#include "source/extensions/filters/http/transformation/inja_transformer.h"
+
+#include "test/mocks/common.h"
+#include "test/mocks/server/mocks.h"
+#include "test/mocks/upstream/mocks.h"
+#include "test/test_common/utility.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::_;
+using testing::Invoke;
+using testing::Return;
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+// a filter config with a listener level response transformation.
+class ResponseTransformationFilterConfig : public TransformationFilterConfig {
+public:
+  using TransformationFilterConfig::TransformationFilterConfig;
+
+  TransformerConstSharedPtr
+  findResponseTransform(const Http::ResponseHeaderMap &,
+                        StreamInfo::StreamInfo &) const override {
+    return response_transformation_;
+  }
+
+  TransformerConstSharedPtr response_transformation_;
+};
+
+class FusedTransformationFilterTest : public testing::Test {
+public:
+  void initFilter(const std::string &route_yaml) {
+    TestUtility::loadFromYaml(route_yaml, route_config_);
+    route_config_wrapper_ = std::make_shared<RouteTransformationFilterConfig>(
+        route_config_, server_factory_context_);
+
+    ON_CALL(*decoder_callbacks_.route_,
+            mostSpecificPerFilterConfig(
+                SoloHttpFilterNames::get().Transformation))
+        .WillByDefault(Return(route_config_wrapper_.get()));
+
+    listener_config_.set_fuse_stages(true);
+    config_ = std::make_shared<TransformationFilterConfig>(
+        listener_config_, "test_", factory_context_);
+    filter_ = std::make_unique<FusedTransformationFilter>(config_);
+    filter_->setDecoderFilterCallbacks(decoder_callbacks_);
+    filter_->setEncoderFilterCallbacks(encoder_callbacks_);
+  }
+
+  NiceMock<Server::Configuration::MockFactoryContext> factory_context_;
+  NiceMock<Server::Configuration::MockServerFactoryContext>
+      server_factory_context_;
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> decoder_callbacks_;
+  NiceMock<Http::MockStreamEncoderFilterCallbacks> encoder_callbacks_;
+
+  Http::TestRequestHeaderMapImpl headers_{{":method", "GET"},
+                                          {":authority", "www.solo.io"},
+                                          {":path", "/path"}};
+
+  RouteTransformationConfigProto route_config_;
+  TransformationConfigProto listener_config_;
+  RouteFilterConfigConstSharedPtr route_config_wrapper_;
+  FilterConfigSharedPtr config_;
+  std::unique_ptr<FusedTransformationFilter> filter_;
+};
+
+TEST_F(FusedTransformationFilterTest, RunsRequestStagesInOrder) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 1
+    request_match:
+      request_transformation:
+        transformation_template:
+          body:
+            text: "{{a}}-1"
+  - stage: 0
+    request_match:
+      request_transformation:
+        transformation_template:
+          body:
+            text: '{"a":"{{a}}-0"}'
+  )EOF");
+
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers_, false));
+
+  std::string upstream_body;
+  EXPECT_CALL(decoder_callbacks_, addDecodedData(_, false))
+      .WillOnce(Invoke(
+          [&](Buffer::Instance &b, bool) { upstream_body = b.toString(); }));
+
+  Buffer::OwnedImpl body("{\"a\":\"b\"}");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(body, true));
+  EXPECT_EQ("b-0-1", upstream_body);
+  EXPECT_EQ(2U, config_->stats().request_body_transformations_.value());
+}
+
+TEST_F(FusedTransformationFilterTest, LaterStageMatchesTransformedHeaders) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 0
+    request_match:
+      request_transformation:
+        transformation_template:
+          passthrough: {}
+          headers:
+            x-stage:
+              text: "zero"
+  - stage: 1
+    request_match:
+      match:
+        prefix: /
+        headers:
+        - name: x-stage
+          exact_match: zero
+      request_transformation:
+        transformation_template:
+          passthrough: {}
+          headers:
+            x-stage:
+              text: "one"
+  )EOF");
+
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(headers_, true));
+  EXPECT_EQ("one", headers_.get_("x-stage"));
+  EXPECT_EQ(2U, config_->stats().request_header_transformations_.value());
+}
+
+TEST_F(FusedTransformationFilterTest, RunsPrefixStageBeforeTheBodyEnds) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 0
+    request_match:
+      request_transformation:
+        transformation_template:
+          passthrough: {}
+          extractors:
+            kind:
+              body: {}
+              regex: "kind=(\\w+).*"
+              subgroup: 1
+              body_prefix_length: 8
+          headers:
+            x-kind:
+              text: "{{kind}}"
+  - stage: 1
+    request_match:
+      request_transformation:
+        transformation_template:
+          passthrough: {}
+          headers:
+            x-stage:
+              text: "one"
+  )EOF");
+
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers_, false));
+
+  Buffer::OwnedImpl first("kind");
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer,
+            filter_->decodeData(first, false));
+
+  std::string upstream_body;
+  EXPECT_CALL(decoder_callbacks_, addDecodedData(_, false))
+      .WillOnce(Invoke(
+          [&](Buffer::Instance &b, bool) { upstream_body = b.toString(); }));
+  Buffer::OwnedImpl second("=abc&more");
+  EXPECT_EQ(Http::FilterDataStatus::Continue,
+            filter_->decodeData(second, false));
+  EXPECT_EQ("kind=abc&more", upstream_body);
+  EXPECT_EQ("abc", headers_.get_("x-kind"));
+  EXPECT_EQ("one", headers_.get_("x-stage"));
+
+  // the rest of the body isn't buffered.
+  Buffer::OwnedImpl third("data");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->decodeData(third, true));
+  EXPECT_EQ("data", third.toString());
+  EXPECT_EQ(1U, config_->stats().request_body_transformations_.value());
+  EXPECT_EQ(1U, config_->stats().request_header_transformations_.value());
+}
+
+TEST_F(FusedTransformationFilterTest, RunsResponseStagesInReverseOrder) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 0
+    request_match:
+      response_transformation:
+        transformation_template:
+          body:
+            text: "{{x}}0"
+  - stage: 1
+    request_match:
+      response_transformation:
+        transformation_template:
+          body:
+            text: '{"x":"{{x}}1"}'
+  )EOF");
+
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(headers_, true));
+
+  Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->encodeHeaders(response_headers, false));
+
+  std::string downstream_body;
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke(
+          [&](Buffer::Instance &b, bool) { downstream_body = b.toString(); }));
+
+  Buffer::OwnedImpl body("{\"x\":\"r\"}");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(body, true));
+  EXPECT_EQ("r10", downstream_body);
+  EXPECT_EQ(2U, config_->stats().response_body_transformations_.value());
+}
+
+TEST_F(FusedTransformationFilterTest, RunsListenerResponseTransformation) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 1
+    request_match:
+      response_transformation:
+        transformation_template:
+          body:
+            text: '{"x":"{{x}}1"}'
+  )EOF");
+  auto config = std::make_shared<ResponseTransformationFilterConfig>(
+      listener_config_, "test_", factory_context_);
+  envoy::api::v2::filter::http::TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{x}}0");
+  config->response_transformation_ =
+      std::make_shared<InjaTransformer>(transformation);
+  filter_ = std::make_unique<FusedTransformationFilter>(config);
+  filter_->setDecoderFilterCallbacks(decoder_callbacks_);
+  filter_->setEncoderFilterCallbacks(encoder_callbacks_);
+
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue,
+            filter_->decodeHeaders(headers_, true));
+
+  // the filter's own stage has no route transformation, the listener level
+  // one applies, as it does with a filter per stage.
+  Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->encodeHeaders(response_headers, false));
+
+  std::string downstream_body;
+  EXPECT_CALL(encoder_callbacks_, addEncodedData(_, false))
+      .WillOnce(Invoke(
+          [&](Buffer::Instance &b, bool) { downstream_body = b.toString(); }));
+
+  Buffer::OwnedImpl body("{\"x\":\"r\"}");
+  EXPECT_EQ(Http::FilterDataStatus::Continue, filter_->encodeData(body, true));
+  EXPECT_EQ("r10", downstream_body);
+}
+
+TEST_F(FusedTransformationFilterTest, ErrorStopsTheRequest) {
+  initFilter(R"EOF(
+  transformations:
+  - stage: 0
+    request_match:
+      request_transformation:
+        transformation_template:
+          body:
+            text: "{{a}}"
+  - stage: 1
+    request_match:
+      request_transformation:
+        transformation_template:
+          body:
+            text: "{{a}}"
+  )EOF");
+
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration,
+            filter_->decodeHeaders(headers_, false));
+
+  std::string status;
+  EXPECT_CALL(decoder_callbacks_, encodeHeaders_(_, _))
+      .WillOnce(Invoke([&](Http::ResponseHeaderMap &headers, bool) {
+        status = std::string(headers.getStatusValue());
+      }));
+
+  Buffer::OwnedImpl body("not json");
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer,
+            filter_->decodeData(body, true));
+  EXPECT_EQ("400", status);
+  EXPECT_EQ(1U, config_->stats().request_error_.value());
+  EXPECT_EQ(1U, config_->stats().request_body_transformations_.value());
+}
+
+TEST_F(FusedTransformationFilterTest, RejectsBodyFraming) {
+  TestUtility::loadFromYaml(R"EOF(
+  fuse_stages: true
+  transformations:
+  - match:
+      prefix: /
+    route_transformations:
+      request_transformation:
+        transformation_template:
+          body:
+            text: "{{a}}"
+          body_framing:
+            framing: NEWLINE_DELIMITED
+  )EOF",
+                            listener_config_);
+  EXPECT_THROW_WITH_MESSAGE(
+      TransformationFilterConfig(listener_config_, "test_", factory_context_),
+      EnvoyException, "body_framing can't be used with fuse_stages");
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,24 +1,92 @@
-#include "source/common/common/empty_string.h"
+#include "source/common/buffer/buffer_impl.h"
 
+#include "source/extensions/filters/http/transformation/body_header_transformer.h"
 #include "source/extensions/filters/http/transformation/inja_transformer.h"
+#include "source/extensions/filters/http/transformation/transformation_filter_config.h"
 
+#include "test/benchmark/main.h"
 #include "test/mocks/http/mocks.h"
+#include "test/mocks/server/mocks.h"
 #include "test/test_common/utility.h"
 
 #include "benchmark/benchmark.h"
 #include "fmt/format.h"
 
 using json = nlohmann::json;
+using testing::NiceMock;
 
 namespace Envoy {
 namespace Extensions {
 namespace HttpFilters {
 namespace Transformation {
 
+using TransformationTemplate =
+    envoy::api::v2::filter::http::TransformationTemplate;
+
 namespace {
-std::function<const std::string &()> empty_body = [] { return EMPTY_STRING; };
+GetBodyFunc empty_body = [] { return absl::string_view(); };
+
+// A json object with string fields field0, field1, ... of about size bytes.
+std::string jsonBody(uint64_t size) {
+  json body = json::object();
+  uint64_t length = 2;
+  for (int i = 0; length < size; i++) {
+    std::string key = fmt::format("field{}", i);
+    std::string value = fmt::format("value{}", i);
+    length += key.size() + value.size() + 6;
+    body[key] = value;
+  }
+  return body.dump();
+}
+
+Http::TestRequestHeaderMapImpl requestHeaders() {
+  return Http::TestRequestHeaderMapImpl{{":method", "GET"},
+                                        {":authority", "www.solo.io"},
+                                        {":path", "/users/123"},
+                                        {"x-user-agent", "benchmark"}};
+}
+
+void addHeaderTemplate(TransformationTemplate &transformation,
+                       const std::string &name, const std::string &text) {
+  envoy::api::v2::filter::http::InjaTemplate header;
+  header.set_text(text);
+  (*transformation.mutable_headers())[name] = header;
+}
+
+void addPathExtractor(TransformationTemplate &transformation,
+                      const std::string &name) {
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":path");
+  extractor.set_regex("/users/(\\d+)");
+  extractor.set_subgroup(1);
+  (*transformation.mutable_extractors())[name] = extractor;
 }
 
+// Runs transformer over a fresh copy of body on every iteration, as
+// transformations replace the body.
+void runTransformer(benchmark::State &state, const Transformer &transformer,
+                    const std::string &body) {
+  auto headers = requestHeaders();
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  uint64_t output_bytes = 0;
+  for (auto _ : state) {
+    Buffer::OwnedImpl buffer(body);
+    transformer.transform(headers, &headers, buffer, callbacks);
+    output_bytes += buffer.length();
+  }
+  benchmark::DoNotOptimize(output_bytes);
+  state.SetBytesProcessed(state.iterations() * body.size());
+}
+
+bool skipped(benchmark::State &state, uint64_t size) {
+  if (size > 64 * 1024 && Envoy::benchmark::skipExpensiveBenchmarks()) {
+    state.SkipWithError("Skipping expensive benchmark");
+    return true;
+  }
+  return false;
+}
+} // namespace
+
 static void BM_ExrtactHeader(benchmark::State &state) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
                                          {":authority", "www.solo.io"},
@@ -40,10 +108,121 @@ static void BM_ExrtactHeader(benchmark::State &state) {
 // Register the function as a benchmark
 BENCHMARK(BM_ExrtactHeader);
 
+// Headers rendered from other headers and an extraction, the body is left
+// alone.
+static void BM_HeaderTemplates(benchmark::State &state) {
+  TransformationTemplate transformation;
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+  transformation.mutable_passthrough();
+  addPathExtractor(transformation, "user");
+  addHeaderTemplate(transformation, "x-user", "{{extraction(\"user\")}}");
+  addHeaderTemplate(transformation, "x-host", "{{header(\":authority\")}}");
+  addHeaderTemplate(transformation, "x-agent",
+                    "agent/{{header(\"x-user-agent\")}}");
+  InjaTransformer transformer(transformation);
+
+  runTransformer(state, transformer, "");
+}
+BENCHMARK(BM_HeaderTemplates);
+
+// The body, unparsed, wrapped into a new body.
+static void BM_BodyTemplate(benchmark::State &state) {
+  const uint64_t size = state.range(0);
+  if (skipped(state, size)) {
+    return;
+  }
+  TransformationTemplate transformation;
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+  transformation.set_advanced_templates(true);
+  transformation.mutable_body()->set_text(
+      "{\"wrapped\": {{body()}}, \"path\": \"{{header(\":path\")}}\"}");
+  InjaTransformer transformer(transformation);
+
+  runTransformer(state, transformer, jsonBody(size));
+}
+BENCHMARK(BM_BodyTemplate)->Arg(1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+// A json body parsed to render a single field of it.
+static void BM_ParseAsJson(benchmark::State &state) {
+  const uint64_t size = state.range(0);
+  if (skipped(state, size)) {
+    return;
+  }
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{field0}}");
+  InjaTransformer transformer(transformation);
+
+  runTransformer(state, transformer, jsonBody(size));
+}
+BENCHMARK(BM_ParseAsJson)->Arg(1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+// Extractions added to the parsed body.
+static void BM_MergeExtractorsToBody(benchmark::State &state) {
+  TransformationTemplate transformation;
+  addPathExtractor(transformation, "user.id");
+  addPathExtractor(transformation, "user.again");
+  transformation.mutable_merge_extractors_to_body();
+  InjaTransformer transformer(transformation);
+
+  runTransformer(state, transformer, jsonBody(1024));
+}
+BENCHMARK(BM_MergeExtractorsToBody);
+
+static void BM_DynamicMetadata(benchmark::State &state) {
+  TransformationTemplate transformation;
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+  transformation.mutable_passthrough();
+  addPathExtractor(transformation, "user");
+  for (int i = 0; i < 3; i++) {
+    auto *metadata = transformation.add_dynamic_metadata_values();
+    metadata->set_key(fmt::format("key{}", i));
+    metadata->mutable_value()->set_text("{{extraction(\"user\")}}");
+  }
+  InjaTransformer transformer(transformation);
+
+  runTransformer(state, transformer, "");
+}
+BENCHMARK(BM_DynamicMetadata);
+
+static void BM_BodyHeaderTransformer(benchmark::State &state) {
+  BodyHeaderTransformer transformer(true);
+
+  runTransformer(state, transformer, jsonBody(1024));
+}
+BENCHMARK(BM_BodyHeaderTransformer);
+
+// Finding the transformation of a request that matches the last of the
+// filter's rules.
+static void BM_FindTransformers(benchmark::State &state) {
+  const int64_t rules = state.range(0);
+  if (rules > 1000 && Envoy::benchmark::skipExpensiveBenchmarks()) {
+    state.SkipWithError("Skipping expensive benchmark");
+    return;
+  }
+  TransformationConfigProto proto_config;
+  for (int64_t i = 0; i < rules; i++) {
+    auto *rule = proto_config.add_transformations();
+    rule->mutable_match()->set_prefix(fmt::format("/rule{}/", i));
+    rule->mutable_route_transformations()
+        ->mutable_request_transformation()
+        ->mutable_header_body_transform();
+  }
+  NiceMock<Server::Configuration::MockFactoryContext> context;
+  TransformationFilterConfig config(proto_config, "", context);
+
+  Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"},
+      {":authority", "www.solo.io"},
+      {":path", fmt::format("/rule{}/users/123", rules - 1)}};
+  uint64_t found = 0;
+  for (auto _ : state) {
+    found += config.findTransformers(headers) != nullptr;
+  }
+  benchmark::DoNotOptimize(found);
+}
+BENCHMARK(BM_FindTransformers)->Arg(10)->Arg(1000)->Arg(10000);
+
 } // namespace Transformation
 } // namespace HttpFilters
 } // namespace Extensions
 } // namespace Envoy
-
-// Run the benchmark
-BENCHMARK_MAIN();
@@ -1,11 +1,17 @@
 #include "source/extensions/filters/http/solo_well_known_names.h"
+#include "source/extensions/filters/http/transformation/content_encoding.h"
 #include "source/extensions/filters/http/transformation/inja_transformer.h"
 
+#include "test/common/stats/stat_test_utility.h"
 #include "test/mocks/common.h"
+#include "test/mocks/event/mocks.h"
 #include "test/mocks/http/mocks.h"
+#include "test/mocks/server/admin.h"
 #include "test/mocks/server/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
 #include "test/mocks/upstream/mocks.h"
 #include "test/test_common/environment.h"
+#include "test/test_common/simulated_time_system.h"
 
 #include "fmt/format.h"
 #include "gmock/gmock.h"
@@ -32,7 +38,7 @@ using TransformationTemplate =
     envoy::api::v2::filter::http::TransformationTemplate;
 
 namespace {
-std::function<const std::string &()> empty_body = [] { return EMPTY_STRING; };
+GetBodyFunc empty_body = [] { return absl::string_view(); };
 }
 
 inja::Template parse(std::string s) {
@@ -238,13 +244,43 @@ TEST(Extraction, ExtractorWorkWithNewlines) {
   NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
 
   std::string body("1\n2\n3");
-  GetBodyFunc bodyfunc = [&body]() -> const std::string & { return body; };
+  GetBodyFunc bodyfunc = [&body]() -> absl::string_view { return body; };
 
   std::string res(Extractor(extractor).extract(callbacks, headers, bodyfunc));
 
   EXPECT_EQ(body, res);
 }
 
+TEST(Extraction, ExtractsFromBodyPrefix) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/users/123"}};
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.mutable_body();
+  extractor.set_regex("[\\S\\s]*");
+  extractor.set_subgroup(0);
+  extractor.set_body_prefix_length(4);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  std::string body("1\n2\n3");
+  GetBodyFunc bodyfunc = [&body]() -> absl::string_view { return body; };
+  EXPECT_EQ("1\n2\n",
+            Extractor(extractor).extract(callbacks, headers, bodyfunc));
+
+  body = "1";
+  EXPECT_EQ("1", Extractor(extractor).extract(callbacks, headers, bodyfunc));
+}
+
+TEST(Extraction, BodyPrefixRequiresBody) {
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":path");
+  extractor.set_regex(".*");
+  extractor.set_body_prefix_length(4);
+  EXPECT_THROW_WITH_MESSAGE(
+      Extractor a(extractor), EnvoyException,
+      "body_prefix_length is only valid for body extractors");
+}
+
 TEST(Extraction, ExtractorFail) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
                                          {":authority", "www.solo.io"},
@@ -485,6 +521,57 @@ TEST(Transformer, transformMergeExtractorsToBody) {
   EXPECT_EQ("{\"ext1\":\"123\"}", res);
 }
 
+TEST(Transformer, transformMergeExtractorsToParsedBody) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {"x-test", "say \"hi\"\t\x01"},
+                                         {":path", "/users/123"}};
+  Buffer::OwnedImpl body("{\"b\":1,\"a\":{\"x\":2},\"d\":null}");
+
+  TransformationTemplate transformation;
+  transformation.mutable_merge_extractors_to_body();
+
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":path");
+  extractor.set_regex("/users/(\\d+)");
+  extractor.set_subgroup(1);
+  (*transformation.mutable_extractors())["a.y"] = extractor;
+  (*transformation.mutable_extractors())["d.e.f"] = extractor;
+  extractor.set_header("x-test");
+  extractor.set_regex(".*");
+  extractor.set_subgroup(0);
+  (*transformation.mutable_extractors())["c"] = extractor;
+
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  transformer.transform(headers, &headers, body, callbacks);
+
+  EXPECT_EQ("{\"a\":{\"x\":2,\"y\":\"123\"},\"b\":1,\"c\":\"say "
+            "\\\"hi\\\"\\t\\u0001\",\"d\":{\"e\":{\"f\":\"123\"}}}",
+            body.toString());
+}
+
+TEST(Transformer, transformMergeExtractorsToNonObjectBody) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":authority", "www.solo.io"},
+                                         {":path", "/users/123"}};
+  Buffer::OwnedImpl body("[1,2]");
+
+  TransformationTemplate transformation;
+  transformation.mutable_merge_extractors_to_body();
+
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":path");
+  extractor.set_regex("/users/(\\d+)");
+  extractor.set_subgroup(1);
+  (*transformation.mutable_extractors())["ext1"] = extractor;
+
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  EXPECT_THROW(transformer.transform(headers, &headers, body, callbacks),
+               EnvoyException);
+}
+
 TEST(Transformer, transformBodyNotSet) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
                                          {":authority", "www.solo.io"},
@@ -557,6 +644,46 @@ TEST(InjaTransformer, RemoveHeadersUsingEmptyTemplate) {
   EXPECT_FALSE(headers.has(content_type));
 }
 
+TEST(InjaTransformer, ReadsBodySpreadOverSlices) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  std::string first("{\"a\":");
+  std::string second("\"b\"}");
+  Buffer::BufferFragmentImpl first_fragment(first.data(), first.size(),
+                                            nullptr);
+  Buffer::BufferFragmentImpl second_fragment(second.data(), second.size(),
+                                             nullptr);
+  Buffer::OwnedImpl body;
+  body.addBufferFragment(first_fragment);
+  body.addBufferFragment(second_fragment);
+
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{a}} {{body()}}");
+
+  InjaTransformer transformer(transformation);
+
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("b {\"a\":\"b\"}", body.toString());
+}
+
+TEST(InjaTransformer, RendersOutputsOfChangingSize) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  TransformationTemplate transformation;
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+  transformation.mutable_body()->set_text("[{{body()}}]");
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  // the space reserved for each render follows the sizes seen so far, it
+  // must not matter for the output.
+  for (uint64_t size : {100000, 10, 200000, 0}) {
+    const std::string input(size, 'a');
+    Buffer::OwnedImpl body(input);
+    transformer.transform(headers, &headers, body, callbacks);
+    EXPECT_EQ("[" + input + "]", body.toString());
+  }
+}
+
 TEST(InjaTransformer, DontParseBodyAndExtractFromIt) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
   Buffer::OwnedImpl body("not json body");
@@ -580,6 +707,62 @@ TEST(InjaTransformer, DontParseBodyAndExtractFromIt) {
   EXPECT_EQ(body.toString(), "json");
 }
 
+TEST(InjaTransformer, ReadsBodyPrefix) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  TransformationTemplate transformation;
+  transformation.mutable_passthrough();
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.mutable_body();
+  extractor.set_regex("type=(\\w+).*");
+  extractor.set_subgroup(1);
+  extractor.set_body_prefix_length(10);
+  (*transformation.mutable_extractors())["type"] = extractor;
+  extractor.set_body_prefix_length(4);
+  (*transformation.mutable_extractors())["start"] = extractor;
+  envoy::api::v2::filter::http::InjaTemplate header;
+  header.set_text("{{type}}");
+  (*transformation.mutable_headers())["x-type"] = header;
+  header.set_text("{{body()}}");
+  (*transformation.mutable_headers())["x-body"] = header;
+
+  InjaTransformer transformer(transformation);
+  EXPECT_TRUE(transformer.passthrough_body());
+  EXPECT_EQ(10U, transformer.bodyPrefixLength());
+
+  // not json, as the body isn't parsed.
+  Buffer::OwnedImpl body("type=user,{\"not\": \"read\"}");
+  EXPECT_TRUE(transformer.canTransform(body, false));
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("user", headers.get_("x-type"));
+  EXPECT_EQ("type=user,", headers.get_("x-body"));
+  EXPECT_EQ("type=user,{\"not\": \"read\"}", body.toString());
+}
+
+TEST(InjaTransformer, ReadsWholeBodyWithoutPrefixes) {
+  TransformationTemplate transformation;
+  transformation.mutable_passthrough();
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.mutable_body();
+  extractor.set_regex(".*");
+  extractor.set_body_prefix_length(10);
+  (*transformation.mutable_extractors())["prefix"] = extractor;
+  extractor.set_body_prefix_length(0);
+  (*transformation.mutable_extractors())["all"] = extractor;
+
+  EXPECT_EQ(0U, InjaTransformer(transformation).bodyPrefixLength());
+
+  transformation.clear_passthrough();
+  transformation.mutable_extractors()->erase("all");
+  EXPECT_EQ(0U, InjaTransformer(transformation).bodyPrefixLength());
+
+  transformation.mutable_passthrough();
+  transformation.mutable_content_decoding();
+  EXPECT_THROW_WITH_MESSAGE(
+      InjaTransformer transformer(transformation), EnvoyException,
+      "body_prefix_length can't be used with content_decoding");
+}
+
 TEST(InjaTransformer, UseBodyFunction) {
   Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
   TransformationTemplate transformation;
@@ -732,6 +915,451 @@ TEST(InjaTransformer, ParseFromNilClusterInfo) {
   EXPECT_EQ(body.toString(), "");
 }
 
+TEST(InjaTransformer, InflatesGzipBody) {
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"},
+                                          {"content-encoding", "gzip"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{a}}");
+  transformation.mutable_content_decoding();
+
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  Buffer::OwnedImpl plain("{\"a\":\"b\"}");
+  Buffer::OwnedImpl body;
+  ContentEncoding::deflate(ContentEncoding::Type::Gzip, plain, body);
+  transformer.transform(headers, nullptr, body, callbacks);
+  EXPECT_EQ("b", body.toString());
+  EXPECT_TRUE(headers.get(Http::LowerCaseString("content-encoding")).empty());
+}
+
+TEST(InjaTransformer, RecompressesGzipBody) {
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"},
+                                          {"content-encoding", "gzip"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{a}}");
+  transformation.mutable_content_decoding()->set_recompress(true);
+
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  Buffer::OwnedImpl plain("{\"a\":\"b\"}");
+  Buffer::OwnedImpl body;
+  ContentEncoding::deflate(ContentEncoding::Type::Gzip, plain, body);
+  transformer.transform(headers, nullptr, body, callbacks);
+
+  Buffer::OwnedImpl inflated;
+  ContentEncoding::inflate(ContentEncoding::Type::Gzip, body, inflated, 1024);
+  EXPECT_EQ("b", inflated.toString());
+  EXPECT_EQ("gzip", headers.get_("content-encoding"));
+  EXPECT_EQ(std::to_string(body.length()), headers.get_("content-length"));
+}
+
+TEST(InjaTransformer, DoesNotInflateUnusedBody) {
+  Http::TestResponseHeaderMapImpl headers{{":status", "200"},
+                                          {"content-encoding", "gzip"}};
+  TransformationTemplate transformation;
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+  envoy::api::v2::filter::http::InjaTemplate header_value;
+  header_value.set_text("{{header(\":status\")}}");
+  (*transformation.mutable_headers())["x-status"] = header_value;
+  transformation.mutable_content_decoding();
+
+  InjaTransformer transformer(transformation);
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  // not valid gzip; this would throw if the body was inflated.
+  Buffer::OwnedImpl body("not gzip");
+  transformer.transform(headers, nullptr, body, callbacks);
+  EXPECT_EQ("not gzip", body.toString());
+  EXPECT_EQ("200", headers.get_("x-status"));
+  EXPECT_EQ("gzip", headers.get_("content-encoding"));
+}
+
+TEST(InjaTransformer, StagesShareParsedBody) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+
+  TransformationTemplate header_only;
+  header_only.set_parse_body_behavior(TransformationTemplate::ParseAsJson);
+  envoy::api::v2::filter::http::InjaTemplate header_value;
+  header_value.set_text("{{a}}");
+  (*header_only.mutable_headers())["x-a"] = header_value;
+  InjaTransformer first(header_only);
+
+  TransformationTemplate with_body;
+  with_body.mutable_body()->set_text("{{a}}-2");
+  InjaTransformer second(with_body);
+
+  Buffer::OwnedImpl body("{\"a\":\"b\"}");
+  TransformationSharedStatePtr state;
+  first.transformStage(headers, &headers, body, callbacks, state);
+  EXPECT_EQ("b", headers.get_("x-a"));
+  auto *inja_state = dynamic_cast<InjaSharedState *>(state.get());
+  ASSERT_NE(nullptr, inja_state);
+  // the body didn't change, so the next stage can use the parsed body.
+  ASSERT_TRUE(inja_state->json_body_.has_value());
+  EXPECT_EQ("b", inja_state->json_body_.value()["a"]);
+
+  second.transformStage(headers, &headers, body, callbacks, state);
+  EXPECT_EQ("b-2", body.toString());
+  // the body was replaced.
+  EXPECT_FALSE(inja_state->json_body_.has_value());
+}
+
+TEST(InjaTransformer, CachesOutput) {
+  Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/foo"}, {"x-in", "1"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text(
+      "{{a}}-{{header(\"x-in\")}}-{{clusterMetadata(\"key\")}}");
+  transformation.mutable_output_cache();
+
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  InjaTransformer transformer(transformation, tls, dispatcher);
+
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  envoy::config::core::v3::Metadata meta;
+  meta.mutable_filter_metadata()->insert(
+      {SoloHttpFilterNames::get().Transformation,
+       MessageUtil::keyValueStruct("key", "v1")});
+  ON_CALL(*callbacks.cluster_info_, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+
+  Buffer::OwnedImpl body("{\"a\":\"b\"}");
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("b-1-v1", body.toString());
+
+  Buffer::OwnedImpl same_body("{\"a\":\"b\"}");
+  transformer.transform(headers, &headers, same_body, callbacks);
+  EXPECT_EQ("b-1-v1", same_body.toString());
+
+  // the cluster was updated.
+  meta.mutable_filter_metadata()->clear();
+  meta.mutable_filter_metadata()->insert(
+      {SoloHttpFilterNames::get().Transformation,
+       MessageUtil::keyValueStruct("key", "v2")});
+  auto updated_cluster =
+      std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+  ON_CALL(*updated_cluster, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+  ON_CALL(callbacks, clusterInfo())
+      .WillByDefault(testing::Return(updated_cluster));
+
+  Buffer::OwnedImpl body_for_new_cluster("{\"a\":\"b\"}");
+  transformer.transform(headers, &headers, body_for_new_cluster, callbacks);
+  EXPECT_EQ("b-1-v2", body_for_new_cluster.toString());
+
+  // a referenced header changed.
+  headers.setCopy(Http::LowerCaseString("x-in"), "2");
+  Buffer::OwnedImpl body_for_new_header("{\"a\":\"b\"}");
+  transformer.transform(headers, &headers, body_for_new_header, callbacks);
+  EXPECT_EQ("b-2-v2", body_for_new_header.toString());
+
+  // the body changed.
+  Buffer::OwnedImpl other_body("{\"a\":\"c\"}");
+  transformer.transform(headers, &headers, other_body, callbacks);
+  EXPECT_EQ("c-2-v2", other_body.toString());
+}
+
+TEST(InjaTransformer, CachesClusterMetadataUntilClusterUpdate) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"},
+                                         {":path", "/foo"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{clusterMetadata(\"key\")}}");
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  InjaTransformer transformer(transformation, tls, dispatcher);
+
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  envoy::config::core::v3::Metadata meta;
+  meta.mutable_filter_metadata()->insert(
+      {SoloHttpFilterNames::get().Transformation,
+       MessageUtil::keyValueStruct("key", "v1")});
+  ON_CALL(*callbacks.cluster_info_, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+
+  Buffer::OwnedImpl body;
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("v1", body.toString());
+
+  // ClusterInfo is immutable, so the value rendered for it is reused even if
+  // the mock returns something else now.
+  meta.mutable_filter_metadata()->clear();
+  meta.mutable_filter_metadata()->insert(
+      {SoloHttpFilterNames::get().Transformation,
+       MessageUtil::keyValueStruct("key", "v2")});
+  ON_CALL(*callbacks.cluster_info_, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+  Buffer::OwnedImpl cached_body;
+  transformer.transform(headers, &headers, cached_body, callbacks);
+  EXPECT_EQ("v1", cached_body.toString());
+
+  auto updated_cluster =
+      std::make_shared<NiceMock<Upstream::MockClusterInfo>>();
+  ON_CALL(*updated_cluster, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+  ON_CALL(callbacks, clusterInfo())
+      .WillByDefault(testing::Return(updated_cluster));
+  Buffer::OwnedImpl updated_body;
+  transformer.transform(headers, &headers, updated_body, callbacks);
+  EXPECT_EQ("v2", updated_body.toString());
+}
+
+TEST(InjaTransformer, ReleasesOutputCacheOnMainThread) {
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{a}}");
+  transformation.mutable_output_cache();
+
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  auto transformer =
+      std::make_unique<InjaTransformer>(transformation, tls, dispatcher);
+
+  EXPECT_CALL(dispatcher, post(_));
+  transformer.reset();
+}
+
+TEST(InjaTransformer, CachesOnlyLiteralClusterMetadataKeys) {
+  Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/foo"}, {"x-key", "key"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text(
+      "{{clusterMetadata(header(\"x-key\"))}}");
+  transformation.set_parse_body_behavior(TransformationTemplate::DontParse);
+
+  // keys that come from the request aren't cached, so there is no cache.
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  EXPECT_CALL(tls, allocateSlot()).Times(0);
+  InjaTransformer transformer(transformation, tls, dispatcher);
+
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  envoy::config::core::v3::Metadata meta;
+  meta.mutable_filter_metadata()->insert(
+      {SoloHttpFilterNames::get().Transformation,
+       MessageUtil::keyValueStruct("key", "v1")});
+  ON_CALL(*callbacks.cluster_info_, metadata())
+      .WillByDefault(testing::ReturnRefOfCopy(meta));
+
+  Buffer::OwnedImpl body;
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("v1", body.toString());
+}
+
+TEST(InjaTransformer, ReleasesClusterMetadataCacheOnMainThread) {
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{clusterMetadata(\"key\")}}");
+
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  auto transformer =
+      std::make_unique<InjaTransformer>(transformation, tls, dispatcher);
+
+  // the slot is handed over to the main thread rather than destroyed on
+  // whichever thread drops the transformer.
+  EXPECT_CALL(dispatcher, post(_));
+  transformer.reset();
+}
+
+TEST(InjaTransformer, RecordsDetailedStats) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  TransformationTemplate transformation;
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":path");
+  extractor.set_regex("/(.*)");
+  extractor.set_subgroup(1);
+  (*transformation.mutable_extractors())["path"] = extractor;
+  transformation.mutable_body()->set_text("{{a}}-{{path}}");
+
+  Stats::TestUtil::TestStore store;
+  TransformerStats stats;
+  stats.add(TransformerStats::generateStats("stage.", store));
+  stats.add(TransformerStats::generateStats("rule.", store));
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  InjaTransformer transformer(transformation, tls, dispatcher, stats);
+
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  Buffer::OwnedImpl body("{\"a\":\"b\"}");
+  transformer.transform(headers, &headers, body, callbacks);
+  EXPECT_EQ("b-foo", body.toString());
+
+  for (const std::string prefix : {"stage.", "rule."}) {
+    EXPECT_EQ(9, store.counterFromString(prefix + "input_bytes").value());
+    EXPECT_EQ(5, store.counterFromString(prefix + "output_bytes").value());
+    EXPECT_EQ(1, store.histogramValues(prefix + "parse_time", false).size());
+    EXPECT_EQ(1, store.histogramValues(prefix + "extract_time", false).size());
+    EXPECT_EQ(1, store.histogramValues(prefix + "render_time", false).size());
+  }
+}
+
+TEST(InjaTransformer, ProfilesTemplates) {
+  Http::TestRequestHeaderMapImpl headers{{":method", "GET"}, {":path", "/foo"}};
+  TransformationTemplate transformation;
+  transformation.mutable_body()->set_text("{{a}}");
+  envoy::api::v2::filter::http::InjaTemplate header_value;
+  header_value.set_text("{{header(\":path\")}}");
+  (*transformation.mutable_headers())["x-path"] = header_value;
+
+  NiceMock<Server::MockAdmin> admin;
+  Event::SimulatedTimeSystem time_system;
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  auto profiler =
+      std::make_shared<TemplateProfiler>(admin, time_system, dispatcher);
+  auto transformer = std::make_unique<InjaTransformer>(
+      transformation, tls, dispatcher, TransformerStats(), profiler,
+      "route stage 0 #1 request");
+
+  // nothing is registered until a render is sampled.
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks;
+  Buffer::OwnedImpl unsampled_body("{\"a\":\"b\"}");
+  transformer->transform(headers, &headers, unsampled_body, callbacks);
+  profiler->setSampleRate(1);
+  EXPECT_THAT(profiler->dump(), testing::Not(testing::HasSubstr("route")));
+
+  Buffer::OwnedImpl body("{\"a\":\"b\"}");
+  transformer->transform(headers, &headers, body, callbacks);
+
+  std::string profile = profiler->dump();
+  EXPECT_THAT(profile,
+              testing::HasSubstr("route stage 0 #1 request body: {{a}}"));
+  EXPECT_THAT(profile, testing::HasSubstr("route stage 0 #1 request header "
+                                          "x-path: {{header(\":path\")}}"));
+
+  // the templates go away with the transformer.
+  transformer.reset();
+  EXPECT_THAT(profiler->dump(), testing::Not(testing::HasSubstr("route")));
+}
+
+TEST(InjaTransformer, CacheRequiresLiteralHeaderNames) {
+  TransformationTemplate transformation;
+  transformation.set_advanced_templates(true);
+  transformation.mutable_body()->set_text("{{header(name)}}");
+  transformation.mutable_output_cache();
+
+  NiceMock<ThreadLocal::MockInstance> tls;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  EXPECT_THROW_WITH_MESSAGE(
+      InjaTransformer transformer(transformation, tls, dispatcher),
+      EnvoyException,
+      "output_cache requires the header names passed to header() and "
+      "request_header() to be string literals");
+}
+
+TEST(InjaMetadataTransformer, WritesMetadataOncePerNamespace) {
+  Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"},
+                                                 {":path", "/users/123"}};
+  Http::TestResponseHeaderMapImpl response_headers{{":status", "200"}};
+  TransformationTemplate transformation;
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.set_header(":status");
+  extractor.set_regex("(\\d)\\d\\d");
+  extractor.set_subgroup(1);
+  (*transformation.mutable_extractors())["status.class"] = extractor;
+
+  auto add_value = [&transformation](const std::string &metadata_namespace,
+                                     const std::string &key,
+                                     const std::string &text) {
+    auto *value = transformation.add_dynamic_metadata_values();
+    value->set_metadata_namespace(metadata_namespace);
+    value->set_key(key);
+    value->mutable_value()->set_text(text);
+  };
+  add_value("", "path", "{{request_header(\":path\")}}");
+  add_value("", "class", "{{status.class}}xx");
+  add_value("", "empty", "");
+  add_value("custom.ns", "status", "{{header(\":status\")}}");
+
+  ASSERT_TRUE(InjaMetadataTransformer::isMetadataOnly(transformation));
+  InjaMetadataTransformer transformer(transformation);
+  NiceMock<Http::MockStreamEncoderFilterCallbacks> callbacks;
+
+  EXPECT_CALL(callbacks.stream_info_,
+              setDynamicMetadata(SoloHttpFilterNames::get().Transformation, _))
+      .WillOnce(
+          Invoke([](const std::string &, const ProtobufWkt::Struct &value) {
+            EXPECT_EQ(2U, value.fields().size());
+            EXPECT_EQ("/users/123", value.fields().at("path").string_value());
+            EXPECT_EQ("2xx", value.fields().at("class").string_value());
+          }));
+  EXPECT_CALL(callbacks.stream_info_, setDynamicMetadata("custom.ns", _))
+      .WillOnce(
+          Invoke([](const std::string &, const ProtobufWkt::Struct &value) {
+            EXPECT_EQ("200", value.fields().at("status").string_value());
+          }));
+  transformer.transformOnStreamCompletion(&response_headers, &request_headers,
+                                          callbacks);
+}
+
+TEST(InjaMetadataTransformer, RendersWithoutResponseHeaders) {
+  Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"}};
+  TransformationTemplate transformation;
+  transformation.mutable_passthrough();
+  auto *value = transformation.add_dynamic_metadata_values();
+  value->set_key("status");
+  value->mutable_value()->set_text(
+      "{{request_header(\":method\")}}:{{header(\":status\")}}");
+
+  InjaMetadataTransformer transformer(transformation);
+  NiceMock<Http::MockStreamEncoderFilterCallbacks> callbacks;
+
+  EXPECT_CALL(callbacks.stream_info_,
+              setDynamicMetadata(SoloHttpFilterNames::get().Transformation, _))
+      .WillOnce(
+          Invoke([](const std::string &, const ProtobufWkt::Struct &value) {
+            EXPECT_EQ("GET:", value.fields().at("status").string_value());
+          }));
+  transformer.transformOnStreamCompletion(nullptr, &request_headers,
+                                          callbacks);
+}
+
+TEST(InjaMetadataTransformer, ProfilesTemplates) {
+  Http::TestRequestHeaderMapImpl request_headers{{":method", "GET"}};
+  TransformationTemplate transformation;
+  auto *value = transformation.add_dynamic_metadata_values();
+  value->set_key("method");
+  value->mutable_value()->set_text("{{request_header(\":method\")}}");
+
+  NiceMock<Server::MockAdmin> admin;
+  Event::SimulatedTimeSystem time_system;
+  NiceMock<Event::MockDispatcher> dispatcher;
+  auto profiler =
+      std::make_shared<TemplateProfiler>(admin, time_system, dispatcher);
+  profiler->setSampleRate(1);
+  auto transformer = std::make_unique<InjaMetadataTransformer>(
+      transformation, TransformerStats(), profiler,
+      "listener stage 0 rule logs on stream completion");
+
+  NiceMock<Http::MockStreamEncoderFilterCallbacks> callbacks;
+  transformer->transformOnStreamCompletion(nullptr, &request_headers,
+                                           callbacks);
+  EXPECT_THAT(profiler->dump(),
+              testing::HasSubstr("listener stage 0 rule logs on stream "
+                                 "completion dynamic metadata method: "
+                                 "{{request_header(\":method\")}}"));
+
+  transformer.reset();
+  EXPECT_THAT(profiler->dump(), testing::Not(testing::HasSubstr("listener")));
+}
+
+TEST(InjaMetadataTransformer, RequiresMetadataOnly) {
+  TransformationTemplate transformation;
+  (*transformation.mutable_headers())["x-header"].set_text("value");
+  EXPECT_FALSE(InjaMetadataTransformer::isMetadataOnly(transformation));
+  EXPECT_THROW_WITH_MESSAGE(
+      InjaMetadataTransformer transformer(transformation), EnvoyException,
+      "transformation does more than set dynamic metadata");
+
+  transformation.clear_headers();
+  transformation.mutable_body()->set_text("body");
+  EXPECT_FALSE(InjaMetadataTransformer::isMetadataOnly(transformation));
+}
+
 } // namespace Transformation
 } // namespace HttpFilters
 } // namespace Extensions
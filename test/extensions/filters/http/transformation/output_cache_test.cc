@@ -0,0 +1,69 @@
+#include "source/extensions/filters/http/transformation/output_cache.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+namespace {
+
+OutputCache::OutputConstSharedPtr outputWithBody(std::string body) {
+  auto output = std::make_shared<OutputCache::Output>();
+  output->body_.emplace(std::move(body));
+  return output;
+}
+
+uint64_t entrySize(absl::string_view key, absl::string_view body) {
+  return key.size() + sizeof(OutputCache::Output) + body.size();
+}
+
+} // namespace
+
+TEST(OutputCache, LookupAndReplace) {
+  OutputCache cache(1024);
+  EXPECT_EQ(nullptr, cache.lookup("a"));
+
+  cache.insert("a", outputWithBody("1"));
+  ASSERT_NE(nullptr, cache.lookup("a"));
+  EXPECT_EQ("1", cache.lookup("a")->body_.value());
+
+  cache.insert("a", outputWithBody("2"));
+  EXPECT_EQ("2", cache.lookup("a")->body_.value());
+  EXPECT_EQ(1, cache.size());
+
+  cache.remove("a");
+  EXPECT_EQ(nullptr, cache.lookup("a"));
+  EXPECT_EQ(0, cache.size());
+}
+
+TEST(OutputCache, EvictsLeastRecentlyUsed) {
+  // room for exactly two entries.
+  OutputCache cache(2 * entrySize("a", "1"));
+  cache.insert("a", outputWithBody("1"));
+  cache.insert("b", outputWithBody("2"));
+  // a becomes the most recently used.
+  EXPECT_NE(nullptr, cache.lookup("a"));
+
+  cache.insert("c", outputWithBody("3"));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_NE(nullptr, cache.lookup("a"));
+  EXPECT_EQ(nullptr, cache.lookup("b"));
+  EXPECT_NE(nullptr, cache.lookup("c"));
+}
+
+TEST(OutputCache, SkipsEntriesLargerThanTheCache) {
+  OutputCache cache(entrySize("a", "1"));
+  cache.insert("a", outputWithBody("1"));
+  cache.insert("b", outputWithBody("too large"));
+  EXPECT_EQ(1, cache.size());
+  EXPECT_NE(nullptr, cache.lookup("a"));
+  EXPECT_EQ(nullptr, cache.lookup("b"));
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
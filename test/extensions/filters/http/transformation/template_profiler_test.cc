@@ -0,0 +1,139 @@
+#include "source/common/buffer/buffer_impl.h"
+
+#include "source/extensions/filters/http/transformation/template_profiler.h"
+
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/server/admin.h"
+#include "test/mocks/server/admin_stream.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::SaveArg;
+
+namespace Envoy {
+namespace Extensions {
+namespace HttpFilters {
+namespace Transformation {
+
+class TemplateProfilerTest : public testing::Test {
+public:
+  TemplateProfilerTest() {
+    ON_CALL(admin_, addHandler(_, _, _, _, _))
+        .WillByDefault(Invoke([this](const std::string &prefix,
+                                     const std::string &,
+                                     Server::Admin::HandlerCb handler, bool,
+                                     bool) {
+          handlers_[prefix] = handler;
+          return true;
+        }));
+    profiler_ = std::make_unique<TemplateProfiler>(admin_, time_system_,
+                                                   dispatcher_);
+  }
+
+  std::pair<Http::Code, std::string> request(const std::string &path,
+                                             const std::string &query = "") {
+    Http::TestResponseHeaderMapImpl headers;
+    Buffer::OwnedImpl response;
+    Http::Code code = handlers_.at(path)(path + query, headers, response,
+                                         admin_stream_);
+    return {code, response.toString()};
+  }
+
+  void render(const void *key, std::chrono::microseconds duration) {
+    TemplateProfiler::Timer timer(profiler_.get(), key);
+    time_system_.advanceTimeWait(duration);
+  }
+
+  NiceMock<Server::MockAdmin> admin_;
+  NiceMock<Server::MockAdminStream> admin_stream_;
+  NiceMock<Event::MockDispatcher> dispatcher_;
+  Event::SimulatedTimeSystem time_system_;
+  std::map<std::string, Server::Admin::HandlerCb> handlers_;
+  std::unique_ptr<TemplateProfiler> profiler_;
+};
+
+TEST_F(TemplateProfilerTest, OffByDefault) {
+  int key;
+  profiler_->addTemplate(&key, "transformer 0 body: {{a}}");
+  render(&key, std::chrono::microseconds(10));
+
+  auto response = request("/transformation/profile");
+  EXPECT_EQ(Http::Code::OK, response.first);
+  EXPECT_THAT(response.second, testing::HasSubstr("sampling: off"));
+  EXPECT_THAT(response.second, testing::Not(testing::HasSubstr("{{a}}")));
+}
+
+TEST_F(TemplateProfilerTest, SamplesSlowestFirst) {
+  int fast;
+  int slow;
+  profiler_->addTemplate(&fast, "fast template");
+  profiler_->addTemplate(&slow, "slow template");
+
+  EXPECT_EQ(Http::Code::OK,
+            request("/transformation/profile/sample", "?rate=1").first);
+  render(&fast, std::chrono::microseconds(10));
+  render(&slow, std::chrono::microseconds(500));
+  render(&slow, std::chrono::microseconds(500));
+
+  const std::string profile = request("/transformation/profile").second;
+  EXPECT_THAT(profile, testing::HasSubstr("sampling: 1 in 1 renders"));
+  EXPECT_THAT(profile, testing::ContainsRegex("2 +1000 +500  slow template"));
+  EXPECT_THAT(profile, testing::ContainsRegex("1 +10 +10  fast template"));
+  EXPECT_LT(profile.find("slow template"), profile.find("fast template"));
+
+  EXPECT_EQ(Http::Code::OK, request("/transformation/profile/reset").first);
+  EXPECT_THAT(request("/transformation/profile").second,
+              testing::Not(testing::HasSubstr("template")));
+}
+
+TEST_F(TemplateProfilerTest, SamplesOneInRate) {
+  int key;
+  profiler_->addTemplate(&key, "some template");
+  request("/transformation/profile/sample", "?rate=2");
+  for (int i = 0; i < 4; i++) {
+    render(&key, std::chrono::microseconds(10));
+  }
+  EXPECT_THAT(request("/transformation/profile").second,
+              testing::ContainsRegex("2 +20 +10  some template"));
+}
+
+TEST_F(TemplateProfilerTest, RemovedTemplatesAreNotRecorded) {
+  int key;
+  profiler_->addTemplate(&key, "some template");
+  profiler_->removeTemplate(&key);
+  request("/transformation/profile/sample", "?rate=1");
+  render(&key, std::chrono::microseconds(10));
+  EXPECT_THAT(request("/transformation/profile").second,
+              testing::Not(testing::HasSubstr("some template")));
+}
+
+TEST_F(TemplateProfilerTest, BadSampleRate) {
+  EXPECT_EQ(Http::Code::BadRequest,
+            request("/transformation/profile/sample", "?rate=x").first);
+}
+
+TEST_F(TemplateProfilerTest, RemovesHandlersOnMainThread) {
+  // the profiler may be released on a worker, the handlers are removed once
+  // the main thread gets to it.
+  Event::PostCb remove_handlers;
+  EXPECT_CALL(dispatcher_, post(_)).WillOnce(SaveArg<0>(&remove_handlers));
+  EXPECT_CALL(admin_, removeHandler(_)).Times(0);
+  profiler_.reset();
+  testing::Mock::VerifyAndClearExpectations(&admin_);
+
+  EXPECT_CALL(admin_, removeHandler("/transformation/profile"));
+  EXPECT_CALL(admin_, removeHandler("/transformation/profile/sample"));
+  EXPECT_CALL(admin_, removeHandler("/transformation/profile/reset"));
+  remove_handlers();
+}
+
+} // namespace Transformation
+} // namespace HttpFilters
+} // namespace Extensions
+} // namespace Envoy
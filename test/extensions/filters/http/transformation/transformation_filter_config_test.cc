@@ -1,4 +1,5 @@
 #include "source/extensions/filters/http/transformation/transformation_filter_config.h"
+#include "source/extensions/filters/http/transformation/inja_transformer.h"
 #include "test/extensions/filters/http/transformation/fake_transformer.h"
 #include "test/test_common/utility.h"
 #include "source/common/config/utility.h"
@@ -54,6 +55,27 @@ TEST(Transformation, TestGetTransformer){
   EXPECT_NE(fakeTransformer, nullptr);
 }
 
+TEST(Transformation, TestGetOnStreamCompletionTransformer) {
+  NiceMock<Server::Configuration::MockFactoryContext> factory_context_;
+
+  envoy::api::v2::filter::http::Transformation transformation;
+  auto *transformation_template =
+      transformation.mutable_transformation_template();
+  auto *value = transformation_template->add_dynamic_metadata_values();
+  value->set_key("key");
+  value->mutable_value()->set_text("{{header(\":status\")}}");
+  auto transformer = Transformation::getOnStreamCompletionTransformer(
+      transformation, factory_context_);
+  EXPECT_NE(nullptr,
+            dynamic_cast<const InjaMetadataTransformer *>(transformer.get()));
+
+  // header templates change the headers the access logs see.
+  (*transformation_template->mutable_headers())["x-key"].set_text("value");
+  transformer = Transformation::getOnStreamCompletionTransformer(
+      transformation, factory_context_);
+  EXPECT_NE(nullptr, dynamic_cast<const InjaTransformer *>(transformer.get()));
+}
+
 }
 }
 }
@@ -688,6 +688,122 @@ TEST_F(TransformationFilterTest, HappyPathWithHeadersBodyTemplate) {
   EXPECT_EQ(Http::FilterDataStatus::Continue, res);
 }
 
+TEST_F(TransformationFilterTest, TransformsFramedRequestBody) {
+  auto &transformation = (*route_config_.mutable_request_transformation());
+  transformation.mutable_transformation_template()->mutable_body()->set_text(
+      "{{a}}");
+  transformation.mutable_transformation_template()
+      ->mutable_body_framing()
+      ->set_framing(envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED);
+  initFilter();
+
+  headers_.setContentLength(18);
+  auto resheaders = filter_->decodeHeaders(headers_, false);
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, resheaders);
+  EXPECT_EQ(nullptr, headers_.ContentLength());
+
+  Buffer::OwnedImpl first("{\"a\":\"b\"}\n{\"a\":");
+  auto res = filter_->decodeData(first, false);
+  EXPECT_EQ(Http::FilterDataStatus::Continue, res);
+  EXPECT_EQ("b\n", first.toString());
+
+  Buffer::OwnedImpl second("\"c\"}");
+  res = filter_->decodeData(second, true);
+  EXPECT_EQ(Http::FilterDataStatus::Continue, res);
+  EXPECT_EQ("c", second.toString());
+  EXPECT_EQ(1U, config_->stats().request_header_transformations_.value());
+}
+
+TEST_F(TransformationFilterTest, ErrorOnIncompleteFramedRequestBody) {
+  auto &transformation = (*route_config_.mutable_request_transformation());
+  transformation.mutable_transformation_template()->mutable_body()->set_text(
+      "{{a}}");
+  transformation.mutable_transformation_template()
+      ->mutable_body_framing()
+      ->set_framing(envoy::api::v2::filter::http::BodyFraming::GRPC);
+  initFilter();
+
+  auto resheaders = filter_->decodeHeaders(headers_, false);
+  EXPECT_EQ(Http::FilterHeadersStatus::Continue, resheaders);
+
+  std::string status;
+  EXPECT_CALL(filter_callbacks_, encodeHeaders_(_, _))
+      .WillOnce(Invoke([&](Http::ResponseHeaderMap &headers, bool) {
+        status = std::string(headers.Status()->value().getStringView());
+      }));
+
+  Buffer::OwnedImpl body("\0\0\0", 3);
+  auto res = filter_->decodeData(body, true);
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, res);
+  EXPECT_EQ("400", status);
+  EXPECT_EQ(1U, config_->stats().request_error_.value());
+}
+
+TEST_F(TransformationFilterTest, NoFramingAfterFailedHeaderTransformation) {
+  auto &transformation = (*route_config_.mutable_request_transformation());
+  auto *transformation_template =
+      transformation.mutable_transformation_template();
+  transformation_template->mutable_body()->set_text("{{a}}");
+  transformation_template->mutable_body_framing()->set_framing(
+      envoy::api::v2::filter::http::BodyFraming::NEWLINE_DELIMITED);
+  envoy::api::v2::filter::http::InjaTemplate header_value;
+  header_value.set_text("{{nonexistentvar}}");
+  (*transformation_template->mutable_headers())["x-a"] = header_value;
+  initFilter();
+
+  auto resheaders = filter_->decodeHeaders(headers_, false);
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration, resheaders);
+  EXPECT_EQ(1U, config_->stats().request_error_.value());
+
+  // the local reply is on its way, the body is left alone.
+  Buffer::OwnedImpl body("{\"a\":\"b\"}\n");
+  auto res = filter_->decodeData(body, true);
+  EXPECT_EQ(Http::FilterDataStatus::Continue, res);
+  EXPECT_EQ("{\"a\":\"b\"}\n", body.toString());
+  EXPECT_EQ(1U, config_->stats().request_error_.value());
+}
+
+TEST_F(TransformationFilterTest, TransformsOnRequestBodyPrefix) {
+  auto &transformation = (*route_config_.mutable_request_transformation());
+  auto *transformation_template =
+      transformation.mutable_transformation_template();
+  transformation_template->mutable_passthrough();
+  envoy::api::v2::filter::http::Extraction extractor;
+  extractor.mutable_body();
+  extractor.set_regex("\\{\"tenant\":\"(\\w+)\".*");
+  extractor.set_subgroup(1);
+  extractor.set_body_prefix_length(20);
+  (*transformation_template->mutable_extractors())["tenant"] = extractor;
+  envoy::api::v2::filter::http::InjaTemplate header_value;
+  header_value.set_text("{{tenant}}");
+  (*transformation_template->mutable_headers())["x-tenant"] = header_value;
+  initFilter();
+
+  auto resheaders = filter_->decodeHeaders(headers_, false);
+  EXPECT_EQ(Http::FilterHeadersStatus::StopIteration, resheaders);
+
+  Buffer::OwnedImpl first("{\"tenant\":\"");
+  auto res = filter_->decodeData(first, false);
+  EXPECT_EQ(Http::FilterDataStatus::StopIterationNoBuffer, res);
+
+  // the rest of the body is passed on as is.
+  EXPECT_CALL(filter_callbacks_, addDecodedData(_, false))
+      .WillOnce(Invoke([](Buffer::Instance &data, bool) {
+        EXPECT_EQ("{\"tenant\":\"solo\",\"data\":\"a", data.toString());
+      }));
+  Buffer::OwnedImpl second("solo\",\"data\":\"a");
+  res = filter_->decodeData(second, false);
+  EXPECT_EQ(Http::FilterDataStatus::Continue, res);
+  EXPECT_EQ("solo", headers_.get_("x-tenant"));
+  EXPECT_EQ("test", headers_.get_("content-type"));
+
+  Buffer::OwnedImpl third("bc\"}");
+  res = filter_->decodeData(third, true);
+  EXPECT_EQ(Http::FilterDataStatus::Continue, res);
+  EXPECT_EQ("bc\"}", third.toString());
+  EXPECT_EQ(1U, config_->stats().request_body_transformations_.value());
+}
+
 TEST_F(TransformationFilterTest, HappyPathOnStreamComplete) {
   initOnStreamCompleteTransformHeader();
 
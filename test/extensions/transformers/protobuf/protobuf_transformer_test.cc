@@ -0,0 +1,296 @@
+#include "source/common/buffer/buffer_impl.h"
+#include "source/extensions/filters/http/transformation/transformation_filter_config.h"
+#include "source/extensions/transformers/protobuf/descriptor_cache.h"
+#include "source/extensions/transformers/protobuf/protobuf_transformer.h"
+
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/http/mocks.h"
+#include "test/mocks/server/mocks.h"
+#include "test/mocks/thread_local/mocks.h"
+#include "test/test_common/utility.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::NiceMock;
+
+namespace Envoy {
+namespace Extensions {
+namespace Transformer {
+namespace ProtobufBody {
+
+namespace {
+
+const std::string USERS_PROTO = R"EOF(
+file {
+  name: "acme/users.proto"
+  package: "acme.users"
+  syntax: "proto3"
+  message_type {
+    name: "User"
+    field { name: "user_id" number: 1 label: LABEL_OPTIONAL type: TYPE_STRING json_name: "userId" }
+    field { name: "age" number: 2 label: LABEL_OPTIONAL type: TYPE_INT32 json_name: "age" }
+    field { name: "tags" number: 3 label: LABEL_REPEATED type: TYPE_STRING json_name: "tags" }
+    field { name: "role" number: 4 label: LABEL_OPTIONAL type: TYPE_ENUM type_name: ".acme.users.Role" json_name: "role" }
+    field { name: "address" number: 5 label: LABEL_OPTIONAL type: TYPE_MESSAGE type_name: ".acme.users.Address" json_name: "address" }
+    field { name: "labels" number: 6 label: LABEL_REPEATED type: TYPE_MESSAGE type_name: ".acme.users.User.LabelsEntry" json_name: "labels" }
+    field { name: "avatar" number: 7 label: LABEL_OPTIONAL type: TYPE_BYTES json_name: "avatar" }
+    nested_type {
+      name: "LabelsEntry"
+      field { name: "key" number: 1 label: LABEL_OPTIONAL type: TYPE_STRING json_name: "key" }
+      field { name: "value" number: 2 label: LABEL_OPTIONAL type: TYPE_STRING json_name: "value" }
+      options { map_entry: true }
+    }
+  }
+  message_type {
+    name: "Address"
+    field { name: "city" number: 1 label: LABEL_OPTIONAL type: TYPE_STRING json_name: "city" }
+  }
+  message_type {
+    name: "Greeting"
+    field { name: "text" number: 1 label: LABEL_OPTIONAL type: TYPE_STRING json_name: "text" }
+  }
+  enum_type {
+    name: "Role"
+    value { name: "MEMBER" number: 0 }
+    value { name: "ADMIN" number: 1 }
+  }
+}
+)EOF";
+
+const std::string USER = R"EOF(
+user_id: "123"
+age: 42
+tags: "a"
+tags: "b"
+role: ADMIN
+address { city: "Paris" }
+labels { key: "team" value: "gloo" }
+avatar: "hi"
+)EOF";
+
+std::string descriptorSet() {
+  Protobuf::FileDescriptorSet files;
+  EXPECT_TRUE(Protobuf::TextFormat::ParseFromString(USERS_PROTO, &files));
+  return files.SerializeAsString();
+}
+
+} // namespace
+
+class ProtobufTransformerTest : public testing::Test {
+protected:
+  std::string serialize(const std::string &type, const std::string &text) {
+    std::unique_ptr<Protobuf::Message> message(
+        descriptor_set_->prototype(type).New());
+    EXPECT_TRUE(Protobuf::TextFormat::ParseFromString(text, message.get()));
+    return message->SerializeAsString();
+  }
+
+  std::string parse(const std::string &type, const std::string &binary) {
+    std::unique_ptr<Protobuf::Message> message(
+        descriptor_set_->prototype(type).New());
+    EXPECT_TRUE(message->ParseFromString(binary));
+    return message->ShortDebugString();
+  }
+
+  std::unique_ptr<ProtobufTransformer> transformer() {
+    return std::make_unique<ProtobufTransformer>(config_, descriptor_set_,
+                                                 tls_, dispatcher_);
+  }
+
+  // renders body and returns what the template made of it.
+  std::string transform(const std::string &body) {
+    auto protobuf_transformer = transformer();
+    Buffer::OwnedImpl buffer(body);
+    protobuf_transformer->transform(headers_, &headers_, buffer, callbacks_);
+    return buffer.toString();
+  }
+
+  DescriptorSetSharedPtr descriptor_set_{
+      std::make_shared<DescriptorSet>(descriptorSet())};
+  ProtobufTransformerProto config_;
+  NiceMock<ThreadLocal::MockInstance> tls_;
+  NiceMock<Event::MockDispatcher> dispatcher_;
+  Http::TestRequestHeaderMapImpl headers_{{":method", "POST"},
+                                          {":authority", "www.solo.io"},
+                                          {":path", "/acme.users.Users/Get"}};
+  NiceMock<Http::MockStreamDecoderFilterCallbacks> callbacks_;
+};
+
+TEST_F(ProtobufTransformerTest, DecodesBodyForTemplates) {
+  config_.set_input_message_type("acme.users.User");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{{ userId }} {{ age }} {{ tags.1 }} {{ role }} {{ address.city }} "
+      "{{ labels.team }} {{ avatar }}");
+
+  EXPECT_EQ("123 42 b ADMIN Paris gloo aGk=",
+            transform(serialize("acme.users.User", USER)));
+}
+
+TEST_F(ProtobufTransformerTest, PreservesProtoFieldNames) {
+  config_.set_input_message_type("acme.users.User");
+  config_.set_preserve_proto_field_names(true);
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{{ user_id }}");
+
+  EXPECT_EQ("123", transform(serialize("acme.users.User", USER)));
+}
+
+TEST_F(ProtobufTransformerTest, LeavesUnsetFieldsOut) {
+  config_.set_input_message_type("acme.users.User");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{{ context() }}");
+
+  EXPECT_EQ("{\"userId\":\"123\"}",
+            transform(serialize("acme.users.User", "user_id: \"123\"")));
+}
+
+TEST_F(ProtobufTransformerTest, EncodesRenderedBody) {
+  config_.set_input_message_type("acme.users.User");
+  config_.set_output_message_type("acme.users.Greeting");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{\"text\": \"hello {{ userId }} from {{ address.city }}\"}");
+
+  auto protobuf_transformer = transformer();
+  Buffer::OwnedImpl body(serialize("acme.users.User", USER));
+  protobuf_transformer->transform(headers_, &headers_, body, callbacks_);
+
+  EXPECT_EQ("text: \"hello 123 from Paris\"",
+            parse("acme.users.Greeting", body.toString()));
+  EXPECT_EQ(std::to_string(body.length()),
+            headers_.getContentLengthValue());
+}
+
+TEST_F(ProtobufTransformerTest, EncodesJsonBody) {
+  config_.set_output_message_type("acme.users.Greeting");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{\"text\": \"hello {{ name }}\"}");
+
+  EXPECT_EQ("text: \"hello solo\"",
+            parse("acme.users.Greeting", transform("{\"name\": \"solo\"}")));
+}
+
+TEST_F(ProtobufTransformerTest, TransformsFramedMessages) {
+  config_.set_input_message_type("acme.users.User");
+  config_.set_output_message_type("acme.users.Greeting");
+  auto *transformation_template = config_.mutable_transformation_template();
+  transformation_template->mutable_body()->set_text(
+      "{\"text\": \"hello {{ userId }}\"}");
+  transformation_template->mutable_body_framing()->set_framing(
+      envoy::api::v2::filter::http::BodyFraming::GRPC);
+  auto protobuf_transformer = transformer();
+
+  Buffer::OwnedImpl data;
+  for (const std::string &user : {"user_id: \"1\"", "user_id: \"2\""}) {
+    const std::string message = serialize("acme.users.User", user);
+    data.writeByte(0);
+    data.writeBEInt<uint32_t>(message.size());
+    data.add(message);
+  }
+  Buffer::OwnedImpl output;
+  auto framer = protobuf_transformer->createBodyFramer();
+  ASSERT_NE(nullptr, framer);
+  EXPECT_EQ(HttpFilters::Transformation::BodyFramer::Status::Ok,
+            framer->decode(data, true, output, [&](Buffer::Instance &frame) {
+              protobuf_transformer->transformFrame(headers_, &headers_, frame,
+                                                   callbacks_);
+            }));
+
+  for (const std::string &expected : {"hello 1", "hello 2"}) {
+    ASSERT_GE(output.length(), 5U);
+    EXPECT_EQ(0, output.peekInt<uint8_t>(0));
+    const uint32_t length = output.peekBEInt<uint32_t>(1);
+    output.drain(5);
+    Buffer::OwnedImpl message;
+    message.move(output, length);
+    EXPECT_EQ("text: \"" + expected + "\"",
+              parse("acme.users.Greeting", message.toString()));
+  }
+  EXPECT_EQ(0U, output.length());
+}
+
+TEST_F(ProtobufTransformerTest, ThrowsOnUndecodableBody) {
+  config_.set_input_message_type("acme.users.User");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{{ userId }}");
+  auto protobuf_transformer = transformer();
+
+  Buffer::OwnedImpl body("\xff\xff\xff");
+  EXPECT_THROW_WITH_MESSAGE(
+      protobuf_transformer->transform(headers_, &headers_, body, callbacks_),
+      EnvoyException, "unable to decode the body as acme.users.User");
+}
+
+TEST_F(ProtobufTransformerTest, ThrowsOnUnencodableBody) {
+  config_.set_output_message_type("acme.users.Greeting");
+  config_.mutable_transformation_template()->mutable_body()->set_text(
+      "{\"greeting\": \"hi\"}");
+  auto protobuf_transformer = transformer();
+
+  Buffer::OwnedImpl body;
+  EXPECT_THROW(
+      protobuf_transformer->transform(headers_, &headers_, body, callbacks_),
+      EnvoyException);
+}
+
+TEST_F(ProtobufTransformerTest, RequiresKnownMessageTypes) {
+  config_.set_input_message_type("acme.users.Group");
+  EXPECT_THROW_WITH_MESSAGE(
+      transformer(), EnvoyException,
+      "protobuf message type acme.users.Group not in the descriptor set");
+}
+
+TEST_F(ProtobufTransformerTest, EncodingRequiresRenderedBody) {
+  config_.set_output_message_type("acme.users.Greeting");
+  config_.mutable_transformation_template()->mutable_passthrough();
+  EXPECT_THROW_WITH_MESSAGE(
+      transformer(), EnvoyException,
+      "output_message_type requires a template that renders the body");
+}
+
+TEST_F(ProtobufTransformerTest, FramedTemplateCantBeFused) {
+  config_.set_input_message_type("acme.users.User");
+  config_.mutable_descriptor_set()->set_inline_bytes(descriptorSet());
+  auto *transformation_template = config_.mutable_transformation_template();
+  transformation_template->mutable_body()->set_text("{{ userId }}");
+  transformation_template->mutable_body_framing()->set_framing(
+      envoy::api::v2::filter::http::BodyFraming::GRPC);
+  EXPECT_TRUE(transformer()->framed());
+
+  HttpFilters::Transformation::TransformationConfigProto filter_config;
+  filter_config.set_fuse_stages(true);
+  auto *rule = filter_config.add_transformations();
+  rule->mutable_match()->set_prefix("/");
+  auto *transformer_config = rule->mutable_route_transformations()
+                                 ->mutable_request_transformation()
+                                 ->mutable_transformer_config();
+  transformer_config->set_name("io.solo.transformer.protobuf");
+  transformer_config->mutable_typed_config()->PackFrom(config_);
+
+  NiceMock<Server::Configuration::MockFactoryContext> factory_context;
+  EXPECT_THROW_WITH_MESSAGE(
+      HttpFilters::Transformation::TransformationFilterConfig(
+          filter_config, "test_", factory_context),
+      EnvoyException, "body_framing can't be used with fuse_stages");
+}
+
+TEST(DescriptorCacheTest, SharesDescriptorSets) {
+  DescriptorCache cache;
+  DescriptorSetSharedPtr first = cache.descriptorSet(descriptorSet());
+  DescriptorSetSharedPtr second = cache.descriptorSet(descriptorSet());
+
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(&first->prototype("acme.users.User"),
+            &second->prototype("acme.users.User"));
+}
+
+TEST(DescriptorCacheTest, ThrowsOnInvalidDescriptorSet) {
+  DescriptorCache cache;
+  EXPECT_THROW_WITH_MESSAGE(cache.descriptorSet("garbage"), EnvoyException,
+                            "unable to parse the protobuf descriptor set");
+}
+
+} // namespace ProtobufBody
+} // namespace Transformer
+} // namespace Extensions
+} // namespace Envoy